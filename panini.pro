@@ -40,6 +40,38 @@ SOURCES += src/pvQtView.cpp \
     src/GLwindow.cpp
 HEADERS += src/pvQt_QTVR.h
 SOURCES += src/pvQt_QTVR.cpp
+HEADERS += src/pvQtPyramid.h
+SOURCES += src/pvQtPyramid.cpp
+HEADERS += src/pvQtAnimation.h \
+    src/pvQtMovie.h
+SOURCES += src/pvQtAnimation.cpp \
+    src/pvQtMovie.cpp
+HEADERS += src/pvQtEncoder.h
+SOURCES += src/pvQtEncoder.cpp
+HEADERS += src/pvQtSession.h
+SOURCES += src/pvQtSession.cpp
+HEADERS += src/pvQtProject.h
+SOURCES += src/pvQtProject.cpp
+HEADERS += src/pvQtCubeMap.h
+SOURCES += src/pvQtCubeMap.cpp
+HEADERS += src/pvQtSlideshow.h
+SOURCES += src/pvQtSlideshow.cpp
+HEADERS += src/pvQtRenderThread.h
+SOURCES += src/pvQtRenderThread.cpp
+HEADERS += src/pvQtTexLoader.h
+SOURCES += src/pvQtTexLoader.cpp
+HEADERS += src/pvQtCamera.h
+SOURCES += src/pvQtCamera.cpp
+HEADERS += src/pvQtBackend.h
+SOURCES += src/pvQtBackend.cpp
+HEADERS += src/pvQtColorLUT.h
+SOURCES += src/pvQtColorLUT.cpp
+HEADERS += src/pvQtImagePool.h
+SOURCES += src/pvQtImagePool.cpp
+HEADERS += src/pvQtResampler.h
+SOURCES += src/pvQtResampler.cpp
+HEADERS += src/pvQtFaceStream.h
+SOURCES += src/pvQtFaceStream.cpp
 FORMS += ui/picTypeDialog.ui
 HEADERS += src/picTypeDialog.h
 SOURCES += src/picTypeDialog.cpp \
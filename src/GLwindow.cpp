@@ -30,9 +30,18 @@
 
 #include <QtCore>
 #include <QFileDialog>
+#include <QInputDialog>
+#include <QProgressDialog>
 #include "GLwindow.h"
 #include "pvQtView.h"
 #include "pvQt_QTVR.h"
+#include "pvQtPyramid.h"
+#include "pvQtMovie.h"
+#include "pvQtSession.h"
+#include "pvQtProject.h"
+#include "pvQtCubeMap.h"
+#include "pvQtSlideshow.h"
+#include "pvQtImagePool.h"
 #include "MainWindow.h"
 
 GLwindow::GLwindow (QWidget * parent )
@@ -40,6 +49,7 @@ GLwindow::GLwindow (QWidget * parent )
 {
     glview = new pvQtView(this);
     pvpic = new pvQtPic();
+    sparePic = new pvQtPic();
     aboutbox = new pvQtAbout( parent );
     ipt = -1;
     for(int i = 0; i < NpictureTypes; i++ ){
@@ -48,7 +58,17 @@ GLwindow::GLwindow (QWidget * parent )
         lastFOV[i] = pictypes.maxFov( i );
     }
 
-    ovlyImg = 0;
+    ovlyVisible = true;
+    cubeConvert = false;
+    qtvrLoader = 0;
+    qtvrSerial = 0;
+    pyramid = 0;
+    slides = new pvQtSlideshow( this );
+    slideFade = false;
+    fadeLayer = 0;
+    fadeAlpha = 0;
+    fadeTimer = new QTimer( this );
+    comparePic = 0;
 
     ok = (glview != 0 && pvpic != 0 );
 
@@ -122,14 +142,42 @@ GLwindow::GLwindow (QWidget * parent )
         ok = connect( glview, &pvQtView::reportFov, this, &GLwindow::showFov);
     if(ok)
         ok = connect( (MainWindow*)parent, &MainWindow::overlayCtl, this, &GLwindow::overlayCtl);
+    if(ok)
+        ok = connect( (MainWindow*)parent, &MainWindow::animationCtl, this, &GLwindow::animationCtl);
+    if(ok)
+        ok = connect( (MainWindow*)parent, &MainWindow::sessionCtl, this, &GLwindow::sessionCtl);
+    if(ok)
+        ok = connect( this, &GLwindow::showRecenter, (MainWindow*)parent, &MainWindow::showRecenter);
+    if(ok)
+        ok = connect( glview, &pvQtView::saveProgress, this, &GLwindow::saveProgress);
+    if(ok)
+        ok = connect( glview, &pvQtView::saveDone, this, &GLwindow::saveDone);
+    if(ok)
+        ok = connect( this, &GLwindow::showStatus, (MainWindow*)parent, &MainWindow::showStatus);
     if(ok)
         ok = connect( (MainWindow*)parent, &MainWindow::recenterMode, glview, &pvQtView::recenterMode);
     if(ok)
         ok = connect( glview, &pvQtView::reportRecenter, (MainWindow*)parent, &MainWindow::showRecenter);
+    if(ok)
+        ok = connect( (MainWindow*)parent, &MainWindow::fastPreview, glview, &pvQtView::setFastPreview);
+    if(ok)
+        ok = connect( (MainWindow*)parent, &MainWindow::glBackend, glview, &pvQtView::setBackend);
+    if(ok)
+        ok = connect( glview, &pvQtView::reportBackend, (MainWindow*)parent, &MainWindow::showBackend);
+    if(ok)
+        ok = connect( (MainWindow*)parent, &MainWindow::cubeConvert, this, &GLwindow::setCubeConvert);
     if(ok)
         ok = connect( (MainWindow*)parent, &MainWindow::step_eyex, glview, &pvQtView::step_eyex);
     if(ok)
         ok = connect( (MainWindow*)parent, &MainWindow::step_eyey, glview, &pvQtView::step_eyey);
+    if(ok)
+        ok = connect( (MainWindow*)parent, &MainWindow::slideCtl, this, &GLwindow::slideCtl);
+    if(ok)
+        ok = connect( (MainWindow*)parent, &MainWindow::paneCtl, this, &GLwindow::paneCtl);
+    if(ok)
+        ok = connect( slides, &pvQtSlideshow::ready, this, &GLwindow::slideReady);
+    if(ok)
+        ok = connect( fadeTimer, &QTimer::timeout, this, &GLwindow::fadeStep);
 
     if(!ok) {
         qFatal("GLwindow setup failed");
@@ -161,12 +209,13 @@ void GLwindow::dropEvent(QDropEvent *event)
     n = paths.count();
     if( n > 0 ) {
         bool ok;
-        if( pvpic->Type() == pvQtPic::cub ) {
+        if( pvpic->Type() == pvQtPic::cub && !pyramid ) {
             if( n > 1 ){
                 ok = loadTypedFiles( "cube", paths );
             } else { // add or replace one cube face
                 QPoint pnt = event->pos();
                 pvQtPic::PicFace pf = glview->pickFace( pnt );
+                stopQTVR();
                 ok = pvpic->setFaceImage( pf, paths[0] );
                 if( ok ){
                     glview->newFace( pf );
@@ -226,6 +275,11 @@ void GLwindow::setCubeLimit( int lim ){
     reportPic();  // refresh size display
 }
 
+// ICC profile of the display, "" for sRGB
+void GLwindow::setDisplayProfile( QString path ){
+    glview->setDisplayProfile( path );
+}
+
 /*
  * Record turn angle changes
  */
@@ -248,6 +302,9 @@ void GLwindow::about_pvQt(){
     msg += tr("Vendor: ") + glview->OpenGLVendor() + QString("\n");
     msg += tr("Video: ") + glview->OpenGLHardware() + QString("\n");
     msg += tr("Limits: ") + glview->OpenGLLimits() + QString("\n");
+    pvQtImagePool::Stats ps = pvQtImagePool::faces()->stats();
+    msg += tr("\nFace memory: %1 MB peak, %2 MB allocated for %3 MB of faces\n")
+            .arg( ps.peak >> 20 ).arg( ps.allocated >> 20 ).arg( ps.served >> 20 );
     aboutbox->setInfo( msg );
     aboutbox->show();
 }
@@ -264,6 +321,8 @@ void GLwindow::newPicture( const char * type ){
     ipt = pictypes.picTypeIndex( type );
     if( ipt >= 0 ) choosePictureFiles( type );
     else {
+        stopQTVR();
+        closePyramid();
         pvpic->setType( pvQtPic::nil );
         glview->showPic( 0 );
     }
@@ -285,8 +344,12 @@ void GLwindow::newPicture( const char * type ){
 
     06 Jan 09: select panocylinder for non cubic sources
 */
-bool GLwindow::loadTypedFiles( const char * tnm, QStringList fnm ){
+bool GLwindow::loadTypedFiles( const char * tnm, QStringList fnm, bool sort ){
     errmsg = tr("(no image file)");
+    stopQTVR();
+    closePyramid();
+    freshPic();
+    srcFile = QString();
     ipt = pictypes.picTypeIndex( tnm );
 
     if( ipt < 0 ) {
@@ -299,12 +362,21 @@ bool GLwindow::loadTypedFiles( const char * tnm, QStringList fnm ){
     bool ok = false, loaded = false;
 
     if( !strcmp( tnm, "proj" )) {
-        qCritical("%s -- to be implemented", tnm );
+        if( c > 0 ) {
+            ok = loaded = project_file( fnm[0] );
+            if(!ok) {
+                errmsg = tr("project load failed");
+            } else {
+                srcFile = fnm[0];
+            }
+        }
     } else if( !strcmp( tnm, "qtvr" )){
         if( c > 0 ) {
             ok = loaded = QTVR_file( fnm[0] );
             if(!ok) {
                 errmsg = tr("QTVR load failed");
+            } else {
+                srcFile = fnm[0];
             }
         }
     } else {
@@ -319,13 +391,19 @@ bool GLwindow::loadTypedFiles( const char * tnm, QStringList fnm ){
                 lastFOV[ipt] = picFov;
             }
 
-            if( c > 1 ) {
+            if( c > 1 && sort ) {
                 fnm.sort();
             }
 
             for(int i = 0; i < c; i++ ){
                 pvpic->setFaceImage( pvQtPic::PicFace(i), fnm[i] );
             }
+
+            // else the 2D picture stands
+            if( c == 1 && cubeConvert && pvQtCubeMap::canConvert( picType )
+                && cube_convert( fnm[0] ) ) {
+                srcFile = fnm[0];
+            }
         }
 
         // select appropriate default panosurface
@@ -378,36 +456,247 @@ void GLwindow::reportPic( bool ok, int c, QStringList fnm ) {
  *  Load a QTVR file
  */
 bool GLwindow::QTVR_file( QString name ){
-    QTVRDecoder dec;
-    bool ok = dec.parseHeaders( name.toUtf8().data() );
+    QTVRDecoder * dec = new QTVRDecoder;
+    bool ok = dec->parseHeaders( name.toUtf8().data() );
 
     if( !ok ){
-        qCritical("QTVR parse: %s", dec.getError() );
+        qCritical("QTVR parse: %s", dec->getError() );
+        delete dec;
         return false;
     }
-    if( dec.getType() == PANO_CUBIC ){
+    // show the lowest resolution level now
+    dec->selectLevel( 0 );
+    if( dec->getType() == PANO_CUBIC ){
         pvpic->setType( pvQtPic::cub );
         picFov = QSizeF( 90, 90 );
         pvpic->setImageFOV( picFov );
+        // all 6 faces are decoded at once, on all cores
+        QImage pims[6];
+        if( dec->getImages( pims ) != 6 ){
+            qCritical("QTVR decode: %s", dec->getError() );
+            delete dec;
+            return false;
+        }
         for( int i = 0; ok && i < 6; i++ ){
-            QImage * pim = dec.getImage( i );
-            ok = pvpic->setFaceImage( pvQtPic::PicFace(i), pim );
+            ok = pvpic->setFaceImage( pvQtPic::PicFace(i), pims[i] );
         }
-    } else if( dec.getType() == PANO_CYLINDRICAL ){
+    } else if( dec->getType() == PANO_CYLINDRICAL ){
         pvpic->setType( pvQtPic::cyl );
-        QImage * pim = dec.getImage( 0 );
+        QImage pim = dec->getImage( 0 );
+        if( pim.isNull() ){
+            qCritical("QTVR decode: %s", dec->getError() );
+            delete dec;
+            return false;
+        }
 
         // compute vFov assuming hFov = 360
-        picFov = pvpic->adjustFov(  pvQtPic::cyl, QSizeF( 360 , 0 ), pim->size() );
+        picFov = pvpic->adjustFov(  pvQtPic::cyl, QSizeF( 360 , 0 ), pim.size() );
         pvpic->setImageFOV( picFov );
         ok = pvpic->setFaceImage( pvQtPic::PicFace(0), pim );
     } else {
         ok = false;
     }
 
+    // stream the higher levels in the background
+    if( ok && dec->levelCount() > 1 ){
+        qtvrLoader = new QTVRLoader( dec, 1, ++qtvrSerial, this );
+        connect( qtvrLoader, &QTVRLoader::levelReady, this, &GLwindow::QTVR_level );
+        qtvrLoader->start( QThread::LowPriority );
+    } else {
+        delete dec;
+    }
+
+    return ok;
+}
+
+/*
+ *  Load a PanoTools stitcher project
+    Shows the stitched output if it is there, else remaps
+    the source images onto cube faces.
+ */
+bool GLwindow::project_file( QString name ){
+    pvQtProject prj;
+    if( !prj.read( name ) ){
+        qCritical("project: %s", prj.errMsg() );
+        return false;
+    }
+
+    QString out = prj.stitchedFile();
+    if( !out.isEmpty() ){
+        picType = pictypes.PicType( pictypes.picTypeIndex( prj.picTypeName() ) );
+        if( !pvpic->setType( picType ) ) {
+            return false;
+        }
+        // the crop's FOV, then the other axis from its shape
+        int xp, yp;
+        pvpic->getxyproj( picType, xp, yp );
+        double hfov = pvpic->scalefov( xp, prj.outputFov(),
+                                       prj.outputSize().width(),
+                                       prj.outputCrop().width() );
+        picFov = pvpic->adjustFov( picType, QSizeF( hfov, 0 ),
+                                   QImageReader( out ).size() );
+        pvpic->setImageFOV( picFov );
+        return pvpic->setFaceImage( pvQtPic::front, out );
+    }
+
+    emit showStatus( tr("Remapping %1 images of %2")
+                     .arg( prj.images().count() )
+                     .arg( QFileInfo( name ).fileName() ) );
+    QImage pims[6];
+    if( !prj.remapToCube( prj.cubeFaceSize( 4096 ), pims ) ){
+        qCritical("project: %s", prj.errMsg() );
+        return false;
+    }
+    emit showStatus( QString() );
+    picType = pvQtPic::cub;
+    pvpic->setType( picType );
+    picFov = QSizeF( 90, 90 );
+    pvpic->setImageFOV( picFov );
+    bool ok = true;
+    for( int i = 0; ok && i < 6; i++ ){
+        ok = pvpic->setFaceImage( pvQtPic::PicFace(i), pims[i] );
+    }
+    return ok;
+}
+
+/*
+ *  Show the current cylindrical, equirectangular or mercator
+    picture as cube faces, resampled from its file or taken
+    from the cube map cache.
+ */
+bool GLwindow::cube_convert( QString name ){
+    QSizeF fovs = pvpic->ImageFOV();
+    int size = pvQtCubeMap::faceSize( QImageReader( name ).size(), fovs,
+                                      glview->maxCubeDims().width() );
+    if( size <= 0 ) {
+        return false;
+    }
+
+    emit showStatus( tr("Converting %1 to cube faces").arg( QFileInfo( name ).fileName() ) );
+    pvQtCubeMap cm;
+    cm.setCacheDir( pvQtCubeMap::defaultCacheDir() );
+    QImage pims[6];
+    if( !cm.convertFile( picType, fovs, name, size, pims ) ){
+        qWarning("cube conversion: %s", cm.errMsg() );
+        return false;
+    }
+
+    pvpic->setType( pvQtPic::cub );
+    pvpic->setImageFOV( QSizeF( 90, 90 ) );
+    bool ok = true;
+    for( int i = 0; ok && i < 6; i++ ){
+        ok = pvpic->setFaceImage( pvQtPic::PicFace(i), pims[i] );
+    }
+    emit showStatus( QString() );
     return ok;
 }
 
+// applies to pictures loaded from now on
+void GLwindow::setCubeConvert( bool on ){
+    cubeConvert = on;
+}
+
+/*
+ * A higher resolution level of the current QTVR is ready:
+   swap it in without disturbing the view.
+*/
+void GLwindow::QTVR_level( int serial, int level, QList<QImage> imgs ){
+    if( !qtvrLoader || serial != qtvrSerial ) return;	// stale
+
+    if( pvpic->Type() == pvQtPic::cub && imgs.count() == 6 ){
+        for( int i = 0; i < 6; i++ ){
+            pvpic->setFaceImage( pvQtPic::PicFace(i), imgs[i] );
+        }
+        glview->newFace( pvQtPic::any );
+    } else if( pvpic->Type() == pvQtPic::cyl && imgs.count() == 1 ){
+        // a 2D picture has to be emptied before it can be refilled
+        pvpic->setFaceImage( pvQtPic::PicFace(0), QImage() );
+        pvpic->setFaceImage( pvQtPic::PicFace(0), imgs[0] );
+        glview->newImages();
+    } else {
+        return;
+    }
+    reportPic();
+}
+
+// stop loading QTVR levels for the previous picture
+void GLwindow::stopQTVR(){
+    if( qtvrLoader ){
+        delete qtvrLoader;	// waits for it
+        qtvrLoader = 0;
+        ++qtvrSerial;	// levels already queued are stale
+    }
+}
+
+/*
+ *  Load a tiled multiresolution pyramid
+    The base level is shown now; pvQtView gets finer
+    tiles from the pyramid as the view requires them.
+*/
+bool GLwindow::pyramid_file( QString name ){
+    errmsg = tr("(no image file)");
+    stopQTVR();
+    closePyramid();
+    freshPic();
+    srcFile = QString();
+
+    pvQtPyramid * pyr = new pvQtPyramid( this );
+    if( !pyr->open( name ) ){
+        qCritical("pyramid: %s", pyr->errMsg() );
+        delete pyr;
+        errmsg = tr("pyramid load failed");
+        reportPic( false );
+        return false;
+    }
+
+    ipt = pictypes.picTypeIndex( pyr->isCube() ? "cube" : "equi" );
+    picType = pictypes.PicType( ipt );
+    picFov = pictypes.maxFov( ipt );
+    bool ok = pvpic->setType( picType ) && pvpic->setImageFOV( picFov );
+    for( int i = 0; ok && i < pyr->faceCount(); i++ ){
+        ok = pvpic->setFaceImage( pvQtPic::PicFace(i), pyr );
+    }
+    if( !ok ){
+        pvpic->setType( pvQtPic::nil );
+        delete pyr;
+        errmsg = tr("pyramid load failed");
+        reportPic( false );
+        return false;
+    }
+    pyramid = pyr;
+    srcFile = name;
+    lastFOV[ipt] = picFov;
+
+    glview->showPic( pvpic );
+    ok = glview->picOK( errmsg );
+    glview->setTurn( lastTurn[ipt], lastRoll[ipt], lastPitch[ipt], lastYaw[ipt] );
+
+    reportPic( ok, 1, QStringList( name ) );
+    return ok;
+}
+
+/* The view goes on drawing the picture it shows until the next one
+   has loaded, so a new picture must not be made in that pvQtPic:
+   make it in the spare one instead.
+*/
+void GLwindow::freshPic(){
+    if( glview->shownPic() != pvpic ) return;
+    pvQtPic * p = sparePic;
+    sparePic = pvpic;
+    pvpic = p;
+    pvpic->setSurface( sparePic->Surface() );
+}
+
+// release the tiled source of the previous picture
+void GLwindow::closePyramid(){
+    if( pyramid ){
+        glview->setPyramid( 0 );
+        pvpic->setType( pvQtPic::nil );	// forget its faces
+        delete pyramid;	// waits for tile readers
+        pyramid = 0;
+    }
+}
+
 /*
  * ask user for the picture type and/or angular size
     of one or more image files.
@@ -655,9 +944,17 @@ bool GLwindow::loadPictureFiles( QStringList names ){
         return loadTypedFiles( "qtvr", names );
     }
 
-    if( ext == "pts" || ext == "pto" || ext == "pro" ){
-        qCritical("PTscript -- to be implemented");
-        return false;  // project_file( name );
+    // tiled pyramid directory, descriptor or archive
+    if( pvQtPyramid::isPyramid( names[0] ) ) {
+        return pyramid_file( names[0] );
+    }
+
+    if( pvQtSession::isSession( names[0] ) ) {
+        return openSession( names[0] );
+    }
+
+    if( pvQtProject::isProject( names[0] ) ){
+        return loadTypedFiles( "proj", names );
     }
 
     // if more than one file, assume cube faces
@@ -715,7 +1012,7 @@ bool GLwindow::choosePictureFiles( const char * ptnm ){
     // contruct file extension filter
     QString filter(tr("All files (*.*)") );
     if( !strcmp( ptnm, "proj" ) ){
-        filter = tr("Stitcher scripts (*.pts, *.pto)");
+        filter = tr("Stitcher scripts (*.pts *.pto)");
     } else if( !strcmp( ptnm, "qtvr" ) ){
         filter = tr("Quicktime panoramas (*.mov)");
     } else {
@@ -725,11 +1022,19 @@ bool GLwindow::choosePictureFiles( const char * ptnm ){
             filter += " *." + fmt;
         }
         filter += ")";
+        if( !strcmp( ptnm, "cube" ) || !strcmp( ptnm, "equi" ) ){
+            filter += ";;" + tr("Tiled pyramids (pyramid.ini *.rcc)");
+        }
     }
 
     // use native Win or Mac file selectors, Qfd on Linux...
     files = QFileDialog::getOpenFileNames( this, title, loaddir, filter );
 
+    // a tiled pyramid knows its own type
+    if( files.count() == 1 && pvQtPyramid::isPyramid( files[0] ) ) {
+        return pyramid_file( files[0] );
+    }
+
     // if there are files
     if( files.count() > 0 ){
         if( it < 0 ){
@@ -766,7 +1071,7 @@ void GLwindow::save_as() {
     // dialog title
     QString title = tr(" Panini -- Save View As");
     // file extension filter
-    QString filter(tr("Jpeg files (*.jpg *.jpeg)") );
+    QString filter(tr("Jpeg files (*.jpg *.jpeg);;PNG files (*.png);;TIFF files (*.tif *.tiff)") );
 
     // default directory
     if( savedir.isEmpty() ) {
@@ -781,16 +1086,68 @@ void GLwindow::save_as() {
         // save directory...
         savedir = QFileInfo( fnm ).absolutePath();
         // add .jpg suffix if seems missing (Q&D)
-        if( fi.suffix().length() != 3  ) {
+        if( fi.suffix().length() < 3  ) {
             fnm += ".jpg";
         }
-        // save file
+        // encoder options for this type
+        if( !saveOptions( fnm ) ) return;
+        // save file, written in the background
         if( !glview->saveView( fnm, fac )){
             qCritical("saveView() failed");
         }
     }
 }
 
+/*
+ * ask for the encoder options that apply to a file type;
+ * false if canceled
+ */
+bool GLwindow::saveOptions( QString fnm ){
+    QString title = tr("Panini -- Save Options");
+    QString sfx = QFileInfo( fnm ).suffix().toLower();
+    pvQtEncoder::Options opt = glview->saveOptions();
+    bool ok = true;
+    QStringList items;
+    if( sfx == "jpg" || sfx == "jpeg" ){
+        opt.quality = QInputDialog::getInt( this, title, tr("JPEG quality"),
+                                            opt.quality, 1, 100, 1, &ok );
+        if( !ok ) return false;
+        items << "4:2:0" << "4:2:2" << "4:4:4";
+        int i = opt.subsample == 444 ? 2 : opt.subsample == 422 ? 1 : 0;
+        QString s = QInputDialog::getItem( this, title, tr("Chroma subsampling"),
+                                           items, i, false, &ok );
+        if( !ok ) return false;
+        opt.subsample = s.remove(':').toInt();
+    } else if( sfx == "png" || sfx == "tif" || sfx == "tiff" ){
+        items << "8" << "16";
+        QString s = QInputDialog::getItem( this, title, tr("Bits per sample"),
+                                           items, opt.depth > 8 ? 1 : 0, false, &ok );
+        if( !ok ) return false;
+        opt.depth = s.toInt();
+        opt.compression = QInputDialog::getInt( this, title,
+                                                tr("Compression level (0 = none)"),
+                                                opt.compression, 0, 9, 1, &ok );
+        if( !ok ) return false;
+    }
+    glview->setSaveOptions( opt );
+    return true;
+}
+
+/*
+ * report views being saved
+ */
+void GLwindow::saveProgress( QString name, int percent ){
+    emit showStatus( tr("Saving %1  %2%").arg( QFileInfo( name ).fileName() ).arg( percent ) );
+}
+
+void GLwindow::saveDone( QString name, bool ok ){
+    if( ok ) {
+        emit showStatus( tr("Saved %1").arg( QFileInfo( name ).fileName() ) );
+    } else {
+        qCritical("Can't write %s", (const char *)name.toUtf8() );
+    }
+}
+
 /*
  * handle set surface requests
  */
@@ -802,59 +1159,63 @@ void GLwindow::set_surface( int surf ){
 
 /*
  * Overlay image control
+ * Loading adds a layer on top of any others; remove and fade act
+ * on the top layer, show/hide on all of them.
+ * Fade steps are applied by glview when it draws the overlay,
+ * dice widths are for a 640 pixel high image.
 */
-void GLwindow::overlayCtl( int c ){
-    const int nfades = 6;
-    static double alphas[nfades] = {
-        1, 0.7, 0.5, 0.3, 1, 0.7
-    };
-    static int deltas[nfades] = {
-        0, 0, 0, 0, 30, 30
-    };
+static const int nfades = 6;
+static const double fadeAlphas[nfades] = {
+    1, 0.7, 0.5, 0.3, 1, 0.7
+};
+static const int fadeDeltas[nfades] = {
+    0, 0, 0, 0, 30, 30
+};
 
+void GLwindow::overlayCtl( int c ){
     switch( c ){
     default:
     case 0:
-        glview->showOverlay( 0 );
-        if( ovlyImg ) {
-            delete ovlyImg;
+        if( !overlays.isEmpty() ) {
+            glview->removeLayer( overlays.takeLast().id );
         }
-        ovlyImg = 0;
-        ovlyVisible = false;
         break;
     //load image
-    case 1:
-        // delete any existing overlay
-        if( ovlyImg ) {
-            delete ovlyImg;
+    case 1: {
+        QString fnm = chooseOverlayFile();
+        if( fnm.isEmpty() || !addOverlay( fnm, 2 ) ) {
+            break;
         }
-        ovlyImg = 0;
-
-        // maybe load a new one
-        ovlyVisible = loadOverlayImage();
-        ovlyFade = 2;
-        setImgAlpha( ovlyImg, 1 - 0.25 * ovlyFade );
-        glview->showOverlay( ovlyImg );
-        break;
+        // show them all
+        ovlyVisible = true;
+        foreach( overlay o, overlays ) {
+            glview->setLayerVisible( o.id, true );
+        }
+        } break;
     // show/hide
     case 2:
         ovlyVisible = !ovlyVisible;
-        glview->showOverlay( ovlyVisible ? ovlyImg : 0 );
+        foreach( overlay ov, overlays ) {
+            glview->setLayerVisible( ov.id, ovlyVisible );
+        }
         break;
     //fade
     case 3:
-        if(++ovlyFade >=nfades) {
-            ovlyFade = 0;
+        if( !overlays.isEmpty() ) {
+            overlay & ov = overlays.last();
+            if(++ov.fade >=nfades) {
+                ov.fade = 0;
+            }
+            glview->setLayerOpacity( ov.id, fadeAlphas[ov.fade],
+                                     fadeDeltas[ov.fade] * ov.height / 640 );
         }
-        diceImgAlpha( ovlyImg, alphas[ovlyFade], deltas[ovlyFade] );
-        glview->showOverlay( ovlyVisible ? ovlyImg : 0 );
         break;
     }
 }
 
-bool GLwindow::loadOverlayImage()
+// file type filter for the image formats Qt reads
+QString GLwindow::imageFileFilter()
 {
-    // file type filter
     QString filter = tr("Image files") + " (";
     QList<QByteArray> fmts(QImageReader::supportedImageFormats());
 
@@ -862,70 +1223,446 @@ bool GLwindow::loadOverlayImage()
         filter += " *." + fmt;
     }
     filter += ")";
+    return filter;
+}
 
+QString GLwindow::chooseOverlayFile()
+{
     // file selector dialog
-    QString fnm = QFileDialog::getOpenFileName( this, tr("Panini - Overlay Image"), loaddir, filter );
+    return QFileDialog::getOpenFileName( this, tr("Panini - Overlay Image"), loaddir,
+                                         imageFileFilter() );
+}
 
-    /* if name is valid, load and prepare image
-    convert format to ARGB if necessary, and scale
-    height to a fraction of max screen height.
-    */
+/*
+ * load an image at full size as a new top layer
+*/
+bool GLwindow::addOverlay( QString fnm, int fade ){
+    QImageReader ird( fnm );
+    QImage img = ird.read();
+    if( img.isNull() ) {
+        qCritical("Can't read overlay: %s", (const char *)fnm.toUtf8() );
+        return false;
+    }
+    overlay ov;
+    ov.id = glview->addLayer( img );
+    if( ov.id == 0 ) {
+        return false;
+    }
+    ov.fade = fade >= 0 && fade < nfades ? fade : 2;
+    ov.height = img.height();
+    ov.file = fnm;
+    overlays.append( ov );
+    glview->setLayerOpacity( ov.id, fadeAlphas[ov.fade],
+                             fadeDeltas[ov.fade] * ov.height / 640 );
+    glview->setLayerVisible( ov.id, ovlyVisible );
+    return true;
+}
+
+/*
+ * Animation control
+ * 0: clear keyframes, 1: add current view, 2: remove last,
+ * 3: export
+*/
+void GLwindow::animationCtl( int c ){
+    switch( c ){
+    default:
+    case 0:
+        anim.clear();
+        break;
+    case 1:
+        anim.addKey( glview->getView() );
+        break;
+    case 2:
+        anim.removeLastKey();
+        break;
+    case 3:
+        exportAnimation();
+        break;
+    }
+    emit showTitle( QString("  Panini  ") + loadname
+                    + QString("  %1 keyframes").arg( anim.keyCount() ) );
+}
+
+/* render the keyframed path at window size to an image sequence
+   or a Y4M video stream
+*/
+void GLwindow::exportAnimation(){
+    QString title = tr("Panini -- Export Animation");
+    if( anim.keyCount() < 2 ){
+        qCritical("Animation needs at least 2 keyframes");
+        return;
+    }
+    if( savedir.isEmpty() ) {
+        savedir = loaddir;
+    }
+    QString fnm = QFileDialog::getSaveFileName( this, title, savedir,
+                      tr("Image sequence (*.jpg *.png *.tif);;Y4M video stream (*.y4m)") );
     if( fnm.isEmpty() ) {
+        return;
+    }
+    savedir = QFileInfo( fnm ).absolutePath();
+
+    bool ok;
+    double secs = QInputDialog::getDouble( this, title, tr("Duration, seconds"),
+                                           2 * ( anim.keyCount() - 1 ), 0.1, 3600, 1, &ok );
+    if( !ok ) return;
+    int fps = QInputDialog::getInt( this, title, tr("Frames per second"),
+                                    25, 1, 120, 1, &ok );
+    if( !ok ) return;
+    int frames = qMax( 2, int( secs * fps + 0.5 ) );
+
+    // even dimensions suit video encoders
+    QSize size = glview->screenSize();
+    size = QSize( size.width() & ~1, size.height() & ~1 );
+
+    pvQtMovie movie;
+    if( !movie.open( fnm, size, fps ) ){
+        qCritical("Export animation: %s", movie.errMsg() );
+        return;
+    }
+
+    QProgressDialog pd( tr("Rendering animation..."), tr("Cancel"), 0, frames, this );
+    pd.setWindowModality( Qt::WindowModal );
+    pd.setMinimumDuration( 0 );
+    connect( glview, &pvQtView::frameRendered, &pd, &QProgressDialog::setValue );
+    connect( &pd, &QProgressDialog::canceled, glview, &pvQtView::cancelRender );
+    ok = glview->renderAnimation( anim, frames, size, &movie );
+    disconnect( glview, &pvQtView::frameRendered, &pd, &QProgressDialog::setValue );
+    pd.setLabelText( tr("Finishing...") );
+    if( !movie.finish() ){
+        qCritical("Export animation: %s", movie.errMsg() );
+    } else if( !ok && !pd.wasCanceled() ){
+        qCritical("Export animation: rendering failed");
+    }
+}
+
+/*
+ * Session files
+ * 0: open, 1: save
+*/
+void GLwindow::sessionCtl( int c ){
+    QString filter = tr("Panini sessions (*.pvs)");
+    QString fnm;
+    if( c == 0 ){
+        fnm = QFileDialog::getOpenFileName( this, tr("Panini -- Open Session"),
+                                            loaddir, filter );
+        if( !fnm.isEmpty() ) {
+            openSession( fnm );
+        }
+    } else {
+        if( savedir.isEmpty() ) {
+            savedir = loaddir;
+        }
+        fnm = QFileDialog::getSaveFileName( this, tr("Panini -- Save Session"),
+                                            savedir, filter );
+        if( fnm.isEmpty() ) {
+            return;
+        }
+        savedir = QFileInfo( fnm ).absolutePath();
+        if( !pvQtSession::isSession( fnm ) ) {
+            fnm += ".pvs";
+        }
+        saveSession( fnm );
+    }
+}
+
+/*
+ * restore a saved session
+  The picture is loaded through the session's texture cache,
+  where its face images are usually waiting ready made.  The
+  current picture is dropped first, so setting the panosurface
+  costs nothing.
+*/
+bool GLwindow::openSession( QString name ){
+    pvQtSession ss;
+    if( !ss.read( name ) ){
+        qCritical("%s: %s", (const char *)name.toUtf8(), ss.errMsg() );
+        return false;
+    }
+    QByteArray type = ss.type.toLatin1();
+    if( pictypes.picTypeIndex( type.constData() ) < 0 ){
+        qCritical("%s: unknown picture type", (const char *)name.toUtf8() );
         return false;
     }
 
-    QImage * pt, * ps;
-    QImageReader ird( fnm );
+    stopQTVR();
+    closePyramid();
+    pvpic->setType( pvQtPic::nil );
+    glview->showPic( 0 );
+    set_surface( ss.surface );
+
+    bool ok;
+    if( !ss.files.isEmpty() && pvQtPyramid::isPyramid( ss.files[0] ) ) {
+        ok = pyramid_file( ss.files[0] );
+    } else {
+        picFov = ss.fov;
+        pvpic->setCacheDir( pvQtSession::cacheDir( name ) );
+        ok = loadTypedFiles( type.constData(), ss.files, false );	// face order
+        pvpic->setCacheDir( QString() );
+    }
+    if( !ok ) {
+        return false;
+    }
+
+    pvpic->setLens( ss.lens );	// if its type takes one
+    glview->recenterMode( ss.recenter );
+    emit showRecenter( ss.recenter );
+    glview->setView( ss.view );
+
+    while( !overlays.isEmpty() ) {
+        glview->removeLayer( overlays.takeLast().id );
+    }
+    ovlyVisible = ss.overlaysVisible;
+    foreach( pvQtSession::Overlay ov, ss.overlays ) {
+        addOverlay( ov.file, ov.fade );
+    }
 
-    pt = new QImage( ird.read() );
-    if( !pt->isNull() ){
-        ps = new QImage( pt->scaledToHeight(640) );
-        delete pt;
-        if( ps->format() != QImage::Format_ARGB32 ){
-            pt = new QImage( ps->convertToFormat(QImage::Format_ARGB32));
-            delete ps;
-            ps = pt;
+    anim.clear();
+    foreach( pvQtView::ViewParams vp, ss.keys ) {
+        anim.addKey( vp );
+    }
+
+    emit showStatus( tr("Opened session %1").arg( QFileInfo( name ).fileName() ) );
+    return true;
+}
+
+/*
+ * save the session, then the face images of a picture made
+ * from image files into its texture cache
+*/
+bool GLwindow::saveSession( QString name ){
+    if( pvpic->Type() == pvQtPic::nil || ipt < 0 ){
+        qCritical("No picture to save in a session");
+        return false;
+    }
+    pvQtSession ss;
+    ss.type = pictypes.picTypeName( ipt );
+    if( !srcFile.isEmpty() ) {
+        ss.files << srcFile;
+    } else {
+        for( int i = 0; i < pvpic->NumFaces(); i++ ) {
+            ss.files << pvpic->FaceFile( pvQtPic::PicFace(i) );
+        }
+        while( !ss.files.isEmpty() && ss.files.last().isEmpty() ) {
+            ss.files.removeLast();
         }
-        ovlyImg = ps;
+    }
+    // a converted picture keeps the source's fov
+    ss.fov = pvpic->Type() == pictypes.PicType( ipt ) ? pvpic->ImageFOV() : lastFOV[ipt];
+    ss.surface = pvpic->Surface();
+    ss.recenter = glview->recentering();
+    ss.lens = pvpic->Lens();
+    ss.view = glview->getView();
+    foreach( overlay o, overlays ) {
+        pvQtSession::Overlay ov;
+        ov.file = o.file;
+        ov.fade = o.fade;
+        ss.overlays.append( ov );
+    }
+    ss.overlaysVisible = ovlyVisible;
+    for( int i = 0; i < anim.keyCount(); i++ ) {
+        ss.keys.append( anim.key( i ) );
     }
 
+    if( !ss.write( name ) ){
+        qCritical("%s: %s", (const char *)name.toUtf8(), ss.errMsg() );
+        return false;
+    }
+    if( srcFile.isEmpty() && !ss.files.isEmpty() ){
+        emit showStatus( tr("Caching textures for %1").arg( QFileInfo( name ).fileName() ) );
+        if( !pvpic->cacheFaces( pvQtSession::cacheDir( name ) ) ) {
+            qWarning("can't write texture cache for %s", (const char *)name.toUtf8() );
+        }
+    }
+    emit showStatus( tr("Saved session %1").arg( QFileInfo( name ).fileName() ) );
     return true;
 }
 
-void GLwindow::setImgAlpha( QImage * pim, double alpha ){
-    if( pim == 0 || pim->isNull() || pim->format() != QImage::Format_ARGB32 ) {
-        return;
+/*
+ * Slideshow
+ * 0: next picture, 1: previous, 2: cross-fade on, 3: off
+*/
+void GLwindow::slideCtl( int c ){
+    switch( c ){
+    default:
+    case 0:
+        showSlide( 1 );
+        break;
+    case 1:
+        showSlide( -1 );
+        break;
+    case 2:
+        slideFade = true;
+        break;
+    case 3:
+        slideFade = false;
+        endFade();
+        break;
+    }
+}
+
+/*
+ * Show the file step places from the current one in its folder,
+   as the same picture type and FOV, keeping the view.  Faces the
+   slideshow has prepared are used instead of reading the file.
+*/
+bool GLwindow::showSlide( int step ){
+    // only single image files
+    if( ipt < 0 || pyramid || qtvrLoader || pictypes.picTypeCount( ipt ) != 1
+        || !strcmp( pictypes.picTypeName( ipt ), "proj" )
+        || !strcmp( pictypes.picTypeName( ipt ), "qtvr" ) ) {
+        return false;
+    }
+    QString cur = srcFile.isEmpty() ? pvpic->FaceFile( pvQtPic::front ) : srcFile;
+    if( cur.isEmpty() || !slides->setFile( cur ) || slides->count() < 2 ) {
+        return false;
+    }
+    QString fnm = slides->advance( step );
+
+    pvQtView::ViewParams vp = glview->getView();
+    if( slideFade ){
+        endFade();
+        fadeLayer = glview->addLayer( glview->grabFrame() );
+        if( fadeLayer ){
+            glview->stackLayer( fadeLayer, 0 );
+            fadeAlpha = 1;
+        }
     }
 
-    qint32 * pw = (qint32 *) pim->bits();
-    qint32 m = (int( 255 * alpha ) & 255 ) << 24;
+    QString key;
+    QImage img;
+    freshPic();	// the prepared face goes with the new picture
+    if( slides->take( fnm, key, img ) ) {
+        pvpic->setPrepared( key, img );
+    }
+    picFov = lastFOV[ipt];
+    bool ok = loadTypedFiles( pictypes.picTypeName( ipt ), QStringList( fnm ) );
+    pvpic->clearPrepared();
+    if( ok ) {
+        glview->setView( vp );
+    }
 
-    for( int i = pim->width() * pim->height(); i > 0; i-- ){
-        register qint32 t = *pw & 0x00ffffff;
-        *pw++ = t + m;
+    // prepare the neighbours of a picture shown as loaded
+    if( ok && srcFile.isEmpty() ) {
+        slides->prefetch( pvpic->FaceClip(), pvpic->FaceSize() );
     }
+    if( fadeLayer ) {
+        fadeTimer->start( 40 );
+    }
+    return ok;
 }
 
-void GLwindow::diceImgAlpha( QImage * pim, double alpha, int dw ){
-    if( pim == 0 || pim->isNull() || pim->format() != QImage::Format_ARGB32 ) {
+/*
+ * A neighbour's face is ready: if it is next in the direction
+   of travel, upload it ahead of time.
+*/
+void GLwindow::slideReady( QString path ){
+    if( path != slides->neighbour( slides->direction() ) ) {
         return;
     }
+    QString key;
+    QImage img;
+    if( pvpic->Type() != pvQtPic::cub && slides->peek( path, key, img ) ) {
+        glview->preloadTexture( key, img );
+    }
+}
 
-    qint32 * pw = (qint32 *) pim->bits();
-    qint32 m = (int( 255 * alpha ) & 255 ) << 24;
-    int r = 0, c = 0, w = pim->width();
+void GLwindow::fadeStep(){
+    fadeAlpha -= 0.125;
+    if( fadeAlpha <= 0 ) {
+        endFade();
+    } else {
+        glview->setLayerOpacity( fadeLayer, fadeAlpha );
+    }
+}
 
-    for( int i = w * pim->height(); i > 0; i-- ){
-        register qint32 t = *pw & 0x00ffffff;
-        register int d = 1;
-        if( dw ){  // dice...
-            d = ((r + c) / dw) ^ ((r + w - c) / dw);
+void GLwindow::endFade(){
+    fadeTimer->stop();
+    if( fadeLayer ) {
+        glview->removeLayer( fadeLayer );
+    }
+    fadeLayer = 0;
+}
+
+/*
+ * Split screen
+ * 0: one view, 1: two, 2: four, 3: lock views, 4: unlock,
+   5: compare with another picture, 6: stop comparing
+*/
+void GLwindow::paneCtl( int c ){
+    switch( c ){
+    default:
+    case 0:
+        glview->setPanes( 1 );
+        break;
+    case 1:
+        glview->setPanes( 2 );
+        break;
+    case 2:
+        glview->setPanes( 4 );
+        break;
+    case 3:
+        glview->setPaneLock( true );
+        break;
+    case 4:
+        glview->setPaneLock( false );
+        break;
+    case 5: {
+        QStringList fnm = QFileDialog::getOpenFileNames( this, tr("Panini - Compare With"),
+                                                         loaddir, imageFileFilter() );
+        if( !fnm.isEmpty() ) {
+            compareWith( fnm );
         }
-        if( d & 1 ) t += m;
-        *pw++ = t;
-        if(++c >= w ){
-            ++r;
-            c = 0;
+        } break;
+    case 6:
+        if( glview->paneCount() > 1 ) {
+            glview->setPanePic( 1, 0 );
         }
+        break;
     }
 }
+
+/*
+ * Show image files in the second pane as a picture of the same
+   type and FOV as the current one
+*/
+bool GLwindow::compareWith( QStringList fnm ){
+    // the current picture must be plain image files
+    if( ipt < 0 || pvpic->Type() == pvQtPic::nil || !srcFile.isEmpty() || pyramid ){
+        emit showStatus( tr("Load a picture from image files to compare with first") );
+        return false;
+    }
+    int n = pictypes.picTypeCount( ipt );
+    if( fnm.count() != n ){
+        emit showStatus( tr("Select %1 image files to compare").arg( n ) );
+        return false;
+    }
+    fnm.sort();
+
+    if( !comparePic ) {
+        comparePic = new pvQtPic();
+    }
+    if( glview->paneCount() > 1 ) {
+        glview->setPanePic( 1, 0 );	// let go of the old one
+    }
+    bool ok = comparePic->setType( pvpic->Type() );
+    if( ok ){
+        comparePic->setImageFOV( pvpic->ImageFOV() );
+        for( int i = 0; ok && i < n; i++ ) {
+            ok = comparePic->setFaceImage( pvQtPic::PicFace(i), fnm[i] );
+        }
+    }
+    if( ok ){
+        if( glview->paneCount() < 2 ) {
+            glview->setPanes( 2 );
+        }
+        ok = glview->setPanePic( 1, comparePic );
+    }
+    QString name = QFileInfo( fnm[0] ).fileName();
+    if( ok ) {
+        emit showStatus( tr("Comparing with %1").arg( name ) );
+    } else {
+        emit showStatus( tr("Can't compare with %1").arg( name ) );
+    }
+    return ok;
+}
@@ -25,9 +25,14 @@
 #include "picTypeDialog.h"
 #include "About.h"
 #include "TurnDialog.h"
+#include "pvQtAnimation.h"
 
 class pvQtView;
 class pvQtPic;
+class QTVRLoader;
+class pvQtPyramid;
+class pvQtSlideshow;
+class QTimer;
 
 class GLwindow : public QWidget {
     Q_OBJECT
@@ -40,6 +45,8 @@ signals:
     void showProj( QString name );
     void showFov( QSizeF fovs );
     void showSurface( int surf );
+    void showStatus( QString msg );
+    void showRecenter( bool on );
 
 public slots:
     // from mainwindow
@@ -49,6 +56,8 @@ public slots:
     void set_surface( int surf );
     void turn90( int t );
     void setCubeLimit( int );
+    void setDisplayProfile( QString path );
+    void setCubeConvert( bool on );
     // from picType dialog...
     void picTypeChanged( int t );
     void hFovChanged( double h );
@@ -58,18 +67,36 @@ public slots:
     void reportTurn( int turn, double roll, double pitch, double yaw );
     void reset_turn();
     void overlayCtl( int c );
+    void animationCtl( int c );
+    void sessionCtl( int c );
+    void slideCtl( int c );
+    void paneCtl( int c );
+    void saveProgress( QString name, int percent );
+    void saveDone( QString name, bool ok );
+    // from QTVRLoader
+    void QTVR_level( int serial, int level, QList<QImage> images );
+    // from pvQtSlideshow
+    void slideReady( QString path );
+    void fadeStep();
 
 protected:
     void resizeEvent( QResizeEvent * ev );
 
 private:
     bool QTVR_file( QString name );
+    void stopQTVR();
+    bool pyramid_file( QString name );
+    bool project_file( QString name );
+    bool cube_convert( QString name );
+    void closePyramid();
+    void freshPic();
     bool choosePictureFiles( const char * picTypeName = 0 );
     bool loadPictureFiles( QStringList names );
     const QStringList picTypeDescrs();
     const char * askPicType( QStringList files,
                              const char * ptyp = 0 );
-    bool loadTypedFiles( const char * type, QStringList files );
+    bool loadTypedFiles( const char * type, QStringList files,
+                         bool sort = true );
     void reportPic( bool ok = true, int c = -1, QStringList files = QStringList() );
     void dragEnterEvent(QDragEnterEvent * event);
     void dropEvent(QDropEvent * event);
@@ -81,6 +108,13 @@ private:
     pvQtView * glview;
     // picture maker
     pvQtPic * pvpic;
+    // the picture still on view while pvpic loads (see freshPic)
+    pvQtPic * sparePic;
+    // streams higher QTVR resolution levels
+    QTVRLoader * qtvrLoader;
+    int qtvrSerial;	// of the current loader's levels
+    // tiled source of the current picture, if any
+    pvQtPyramid * pyramid;
     // true if created w/o error
     bool ok;
     pictureTypes pictypes;
@@ -107,10 +141,42 @@ private:
 
     // V0.7 support for overlay image
     QSize screenSize;
-    QImage * ovlyImg;
+    // overlay layers in glview, bottom to top
+    typedef struct {
+        int id;
+        int fade;	// overlayCtl fade step
+        int height;	// image height
+        QString file;
+    } overlay;
+    QList<overlay> overlays;
+    // show cyl, eqr and mrc pictures as cube maps
+    bool cubeConvert;
     bool ovlyVisible;
-    int ovlyFade;
-    bool loadOverlayImage();
-    void setImgAlpha( QImage * pim, double alpha );
-    void diceImgAlpha( QImage * pim, double alpha, int dw );
+    QString imageFileFilter();
+    QString chooseOverlayFile();
+    bool addOverlay( QString fnm, int fade );
+
+    // view animation keyframes
+    pvQtAnimation anim;
+    void exportAnimation();
+    // encoder options dialog for save_as
+    bool saveOptions( QString fnm );
+
+    // session files
+    QString srcFile;	// QTVR, pyramid, project or converted source, if any
+    bool openSession( QString name );
+    bool saveSession( QString name );
+
+    // next/previous picture in the folder
+    pvQtSlideshow * slides;
+    bool slideFade;	// cross-fade between pictures
+    int fadeLayer;	// glview layer holding the last frame, or 0
+    double fadeAlpha;
+    QTimer * fadeTimer;
+    bool showSlide( int step );
+    void endFade();
+
+    // picture shown in the second pane for A/B comparison
+    pvQtPic * comparePic;
+    bool compareWith( QStringList fnm );
 };
@@ -20,8 +20,10 @@
 #include <QtGui>
 #include <QSettings>
 #include <QMessageBox>
+#include <QFileDialog>
 #include "MainWindow.h"
 #include "GLwindow.h"
+#include "pvQtBackend.h"
 #include "CubeLimit_dialog.h"
 
 /*
@@ -146,6 +148,7 @@ MainWindow::MainWindow( QWidget * parent)
     int cubelim = pqs->value("Mac/cube_limit", 1536 ).toInt();
     pcld = new CubeLimit_dialog( cubelim, this );
     glwindow->setCubeLimit( cubelim );
+    glwindow->setDisplayProfile( pqs->value("color/display_profile").toString() );
 
 #ifdef __APPLE__
     actionCube_limit->setEnabled( true );
@@ -409,10 +412,106 @@ void MainWindow::on_actionRecenter_mode_triggered( bool ckd ){
     emit recenterMode( ckd );
 }
 
+void MainWindow::on_actionClear_keyframes_triggered(){
+    emit animationCtl( 0 );
+}
+
+void MainWindow::on_actionAdd_keyframe_triggered(){
+    emit animationCtl( 1 );
+}
+
+void MainWindow::on_actionRemove_keyframe_triggered(){
+    emit animationCtl( 2 );
+}
+
+void MainWindow::on_actionExport_animation_triggered(){
+    emit animationCtl( 3 );
+}
+
+void MainWindow::on_actionOpen_session_triggered(){
+    emit sessionCtl( 0 );
+}
+
+void MainWindow::on_actionSave_session_triggered(){
+    emit sessionCtl( 1 );
+}
+
+void MainWindow::on_actionFast_preview_triggered( bool ckd ){
+    emit fastPreview( ckd );
+}
+
+void MainWindow::on_actionShader_renderer_triggered( bool ckd ){
+    emit glBackend( ckd ? pvQtBackend::coreGL33 : pvQtBackend::legacyGL );
+}
+
+/* choose the display's ICC profile; cancelling offers to go back
+   to sRGB
+*/
+void MainWindow::on_actionDisplay_profile_triggered(){
+    QString was = pqs->value("color/display_profile").toString();
+    QString fnm = QFileDialog::getOpenFileName( this, tr("Panini - Display Color Profile"),
+                                                QFileInfo( was ).absolutePath(),
+                                                tr("ICC profiles (*.icc *.icm)") );
+    if( fnm.isEmpty() ){
+        if( was.isEmpty()
+            || QMessageBox::question( this, tr("Panini"),
+                                      tr("Use the sRGB display profile?"),
+                                      QMessageBox::Yes | QMessageBox::No )
+               != QMessageBox::Yes ) return;
+    }
+    glwindow->setDisplayProfile( fnm );
+    pqs->setValue("color/display_profile", fnm );
+    pqs->sync();
+}
+
+void MainWindow::on_actionCube_convert_triggered( bool ckd ){
+    emit cubeConvert( ckd );
+}
+
+void MainWindow::on_actionNext_picture_triggered(){
+    emit slideCtl( 0 );
+}
+
+void MainWindow::on_actionPrevious_picture_triggered(){
+    emit slideCtl( 1 );
+}
+
+void MainWindow::on_actionCross_fade_triggered( bool ckd ){
+    emit slideCtl( ckd ? 2 : 3 );
+}
+
+void MainWindow::on_actionSingle_view_triggered(){
+    emit paneCtl( 0 );
+}
+
+void MainWindow::on_actionTwo_views_triggered(){
+    emit paneCtl( 1 );
+}
+
+void MainWindow::on_actionFour_views_triggered(){
+    emit paneCtl( 2 );
+}
+
+void MainWindow::on_actionLock_views_triggered( bool ckd ){
+    emit paneCtl( ckd ? 3 : 4 );
+}
+
+void MainWindow::on_actionCompare_with_triggered(){
+    emit paneCtl( 5 );
+}
+
+void MainWindow::on_actionStop_comparing_triggered(){
+    emit paneCtl( 6 );
+}
+
 void MainWindow::showRecenter( bool ckd ){
     actionRecenter_mode->setChecked( ckd );
 }
 
+void MainWindow::showBackend( int kind ){
+    actionShader_renderer->setChecked( kind == pvQtBackend::coreGL33 );
+}
+
 void MainWindow::on_actionEye_right_triggered(){
     emit step_eyex( 1 );
 }
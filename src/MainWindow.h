@@ -53,6 +53,7 @@ public slots:
     void showFov( QSizeF fovs );
     void showSurface( int surf );
     void showRecenter( bool );
+    void showBackend( int kind );
 signals:
     void step_pan( int d );
     void step_tilt( int d );
@@ -79,6 +80,13 @@ signals:
     void about_pvQt();
     void overlayCtl( int c );
     void recenterMode( bool ckd );
+    void fastPreview( bool ckd );
+    void glBackend( int kind );
+    void cubeConvert( bool ckd );
+    void animationCtl( int c );
+    void sessionCtl( int c );
+    void slideCtl( int c );
+    void paneCtl( int c );
 
 protected:
     virtual void resizeEvent( QResizeEvent * ev );
@@ -146,6 +154,28 @@ private slots:
     void on_actionFade_triggered();
 
     void on_actionRecenter_mode_triggered( bool checked );
+    void on_actionFast_preview_triggered( bool checked );
+    void on_actionShader_renderer_triggered( bool checked );
+    void on_actionDisplay_profile_triggered();
+    void on_actionCube_convert_triggered( bool checked );
+    void on_actionNext_picture_triggered();
+    void on_actionPrevious_picture_triggered();
+    void on_actionCross_fade_triggered( bool checked );
+// split screen
+    void on_actionSingle_view_triggered();
+    void on_actionTwo_views_triggered();
+    void on_actionFour_views_triggered();
+    void on_actionLock_views_triggered( bool checked );
+    void on_actionCompare_with_triggered();
+    void on_actionStop_comparing_triggered();
+// animation menu
+    void on_actionAdd_keyframe_triggered();
+    void on_actionRemove_keyframe_triggered();
+    void on_actionClear_keyframes_triggered();
+    void on_actionExport_animation_triggered();
+// session files
+    void on_actionOpen_session_triggered();
+    void on_actionSave_session_triggered();
     void on_actionEye_right_triggered();
     void on_actionEye_left_triggered();
     void on_actionEye_up_triggered();
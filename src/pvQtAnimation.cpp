@@ -0,0 +1,121 @@
+/*
+ * pvQtAnimation.cpp  for Panini
+ *
+ * This file is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this file; if not, write to Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+
+  See pvQtAnimation.h
+*/
+
+#include "pvQtAnimation.h"
+#include <cmath>
+
+/* view parameters as a vector of reals; the turn is
+   kept as one angle, 90 * turn + roll
+*/
+#define NPARAMS	16
+enum { P_PAN, P_TILT, P_SPIN, P_VFOV, P_DIST, P_EYEX, P_EYEY,
+       P_EYEH, P_EYEV, P_FRAMEX, P_FRAMEY, P_XMAG, P_YMAG,
+       P_TURN, P_PITCH, P_YAW };
+// the ones that wrap around
+static const int wrapped[] = { P_PAN, P_SPIN, P_EYEH, P_TURN, P_YAW };
+
+static void toVector( const pvQtView::ViewParams & vp, double * v )
+{
+    v[P_PAN] = vp.pan;
+    v[P_TILT] = vp.tilt;
+    v[P_SPIN] = vp.spin;
+    v[P_VFOV] = vp.vfov;
+    v[P_DIST] = vp.dist;
+    v[P_EYEX] = vp.eyex;
+    v[P_EYEY] = vp.eyey;
+    v[P_EYEH] = vp.eyeh;
+    v[P_EYEV] = vp.eyev;
+    v[P_FRAMEX] = vp.framex;
+    v[P_FRAMEY] = vp.framey;
+    v[P_XMAG] = vp.xmag;
+    v[P_YMAG] = vp.ymag;
+    v[P_TURN] = 90 * vp.turn + vp.roll;
+    v[P_PITCH] = vp.pitch;
+    v[P_YAW] = vp.yaw;
+}
+
+// reduce an angle to (-180:180]
+static double principal( double a )
+{
+    a = fmod( a, 360.0 );
+    if( a <= -180 ) a += 360;
+    else if( a > 180 ) a -= 360;
+    return a;
+}
+
+static pvQtView::ViewParams fromVector( const double * v )
+{
+    pvQtView::ViewParams vp;
+    vp.pan = principal( v[P_PAN] );
+    vp.tilt = v[P_TILT];
+    vp.spin = principal( v[P_SPIN] );
+    vp.vfov = v[P_VFOV];
+    vp.dist = v[P_DIST];
+    vp.eyex = v[P_EYEX];
+    vp.eyey = v[P_EYEY];
+    vp.eyeh = principal( v[P_EYEH] );
+    vp.eyev = v[P_EYEV];
+    vp.framex = v[P_FRAMEX];
+    vp.framey = v[P_FRAMEY];
+    vp.xmag = v[P_XMAG];
+    vp.ymag = v[P_YMAG];
+    // nearest 90 degree step, remainder is roll
+    double q = floor( v[P_TURN] / 90 + 0.5 );
+    vp.roll = v[P_TURN] - 90 * q;
+    vp.turn = ( int( fmod( q, 4.0 ) ) + 4 ) & 3;
+    vp.pitch = v[P_PITCH];
+    vp.yaw = principal( v[P_YAW] );
+    return vp;
+}
+
+pvQtView::ViewParams pvQtAnimation::at( double u ) const
+{
+    int n = keys.count();
+    if( n == 1 || u <= 0 ) return keys.first();
+    if( u >= n - 1 ) return keys.last();
+
+    // the 4 keys around the segment, ends repeated
+    int i = int( u );
+    double t = u - i;
+    double p[4][NPARAMS];
+    for( int j = 0; j < 4; j++ ){
+        int k = i - 1 + j;
+        toVector( keys[ k < 0 ? 0 : k >= n ? n - 1 : k ], p[j] );
+    }
+    // unwrap angles relative to the previous key
+    for( unsigned int w = 0; w < sizeof(wrapped) / sizeof(wrapped[0]); w++ ){
+        int a = wrapped[w];
+        for( int j = 1; j < 4; j++ ){
+            p[j][a] = p[j-1][a] + principal( p[j][a] - p[j-1][a] );
+        }
+    }
+
+    // Catmull-Rom
+    double t2 = t * t, t3 = t2 * t;
+    double v[NPARAMS];
+    for( int a = 0; a < NPARAMS; a++ ){
+        v[a] = 0.5 * ( 2 * p[1][a]
+                       + ( p[2][a] - p[0][a] ) * t
+                       + ( 2 * p[0][a] - 5 * p[1][a] + 4 * p[2][a] - p[3][a] ) * t2
+                       + ( 3 * p[1][a] - p[0][a] - 3 * p[2][a] + p[3][a] ) * t3 );
+    }
+    return fromVector( v );
+}
@@ -0,0 +1,52 @@
+/*
+ * pvQtAnimation.h  for Panini
+ *
+ * This file is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this file; if not, write to Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+
+  A pvQtAnimation is a path through view space, given by a list of
+  keyframes, each a full set of pvQtView parameters.  at() gives
+  the view at any point along the path by Catmull-Rom spline
+  interpolation of every parameter, so the path passes through
+  each key and is smooth at them.
+
+  Path position u runs from 0 at the first key to keyCount() - 1
+  at the last, so keys are equally spaced in time.  Angles that
+  wrap around (pan, spin, yaw, recenter eye azimuth and the total
+  picture turn) take the shorter way from one key to the next.
+*/
+
+#ifndef PVQTANIMATION_H
+#define PVQTANIMATION_H
+
+#include <QList>
+#include "pvQtView.h"
+
+class pvQtAnimation
+{
+public:
+    void addKey( const pvQtView::ViewParams & vp ){ keys.append( vp ); }
+    void removeLastKey(){ if( !keys.isEmpty() ) keys.removeLast(); }
+    void clear(){ keys.clear(); }
+    int keyCount() const { return keys.count(); }
+    pvQtView::ViewParams key( int i ) const { return keys[i]; }
+    // interpolated view, u in [0, keyCount() - 1]
+    pvQtView::ViewParams at( double u ) const;
+
+private:
+    QList<pvQtView::ViewParams> keys;
+};
+
+#endif //ndef PVQTANIMATION_H
@@ -0,0 +1,435 @@
+/*
+ * pvQtBackend.cpp  for Panini
+ *
+ * This file is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this file; if not, write to Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+
+  See pvQtBackend.h
+*/
+
+#include "pvQtBackend.h"
+#include "pvQtCamera.h"
+#include "panosurface.h"
+#include <QGLShaderProgram>
+#include <QOpenGLContext>
+#include <QOpenGLExtraFunctions>
+#include <QHash>
+#include <QVector>
+#include <cstring>
+#ifdef __APPLE__
+#include "glext.h"
+#else
+#include <GL/glext.h>
+#endif
+
+/**  Fixed-function backend  **/
+
+class pvQtLegacyBackend : public pvQtBackend
+{
+public:
+    ~pvQtLegacyBackend();
+    Kind kind(){ return legacyGL; }
+    const char * name(){ return "OpenGL fixed function"; }
+    unsigned int newScreen();
+    void deleteScreen( unsigned int id );
+    void setScreen( unsigned int id, panosurface * ps,
+                    pvQtPic::PicType pt, bool textured );
+    void drawScreen( unsigned int id, const pvQtCamera & cam,
+                     GLenum target, GLuint tex );
+    bool setColorLUT( GLuint lut ){ return lut == 0; }
+private:
+    QList<unsigned int> lists;
+};
+
+pvQtLegacyBackend::~pvQtLegacyBackend()
+{
+    foreach( unsigned int l, lists ) glDeleteLists( l, 1 );
+}
+
+unsigned int pvQtLegacyBackend::newScreen()
+{
+    unsigned int l = glGenLists( 1 );
+    if( l ) lists.append( l );
+    return l;
+}
+
+void pvQtLegacyBackend::deleteScreen( unsigned int id )
+{
+    if( lists.removeAll( id ) ) glDeleteLists( id, 1 );
+}
+
+/* the arrays are read as the list is compiled, so the ones
+   wanted must be enabled now
+*/
+void pvQtLegacyBackend::setScreen( unsigned int id, panosurface * ps,
+                                   pvQtPic::PicType pt, bool textured )
+{
+    glPushClientAttrib( GL_CLIENT_VERTEX_ARRAY_BIT );
+    glEnableClientState( GL_VERTEX_ARRAY );
+    glVertexPointer( 3, GL_FLOAT, 0, ps->vertices() );
+    glNewList( id, GL_COMPILE );
+    if( textured ){
+        glEnableClientState( GL_NORMAL_ARRAY );
+        glEnableClientState( GL_TEXTURE_COORD_ARRAY );
+        // the normals are the vertices
+        glNormalPointer( GL_FLOAT, 0, ps->vertices() );
+        glTexCoordPointer( 2, GL_FLOAT, 0, ps->texCoords( pt ) );
+        glDrawElements( GL_QUADS, ps->quadIndexCount(), GL_UNSIGNED_INT,
+                        ps->quadIndices() );
+    } else {
+        glDisableClientState( GL_NORMAL_ARRAY );
+        glDisableClientState( GL_TEXTURE_COORD_ARRAY );
+        glDrawElements( GL_LINES, ps->lineIndexCount(), GL_UNSIGNED_INT,
+                        ps->lineIndices() );
+    }
+    glEndList();
+    glPopClientAttrib();
+}
+
+void pvQtLegacyBackend::drawScreen( unsigned int id, const pvQtCamera & cam,
+                                    GLenum target, GLuint tex )
+{
+    glDisable( GL_TEXTURE_2D );
+    glDisable( GL_TEXTURE_CUBE_MAP );
+    if( target ){
+        glBindTexture( target, tex );
+        glEnable( target );
+    }
+    // for cube map, generate texture coords from normals
+    if( target == GL_TEXTURE_CUBE_MAP ){
+        glTexGenf( GL_S, GL_TEXTURE_GEN_MODE, GL_REFLECTION_MAP );
+        glTexGenf( GL_T, GL_TEXTURE_GEN_MODE, GL_REFLECTION_MAP );
+        glTexGenf( GL_R, GL_TEXTURE_GEN_MODE, GL_REFLECTION_MAP );
+        glEnable( GL_TEXTURE_GEN_S );
+        glEnable( GL_TEXTURE_GEN_T );
+        glEnable( GL_TEXTURE_GEN_R );
+    } else {
+        glDisable( GL_TEXTURE_GEN_S );
+        glDisable( GL_TEXTURE_GEN_T );
+        glDisable( GL_TEXTURE_GEN_R );
+    }
+    glFrontFace( cam.flipY ? GL_CW : GL_CCW );
+
+    glMatrixMode( GL_TEXTURE );
+    glLoadMatrixf( cam.texture().constData() );
+    glMatrixMode( GL_PROJECTION );
+    glLoadMatrixf( cam.projection().constData() );
+    glMatrixMode( GL_MODELVIEW );
+    glLoadMatrixf( cam.modelView().constData() );
+
+    glCallList( id );
+}
+
+/**  OpenGL 3.3 core profile backend
+
+    The matrices go to the shaders in a uniform block, one buffer
+    for all screens.  There is a program for each kind of screen:
+    wireframe, 2D and cube textured.  The cube program reflects the
+    eye ray in the normal as GL_REFLECTION_MAP does (the normals,
+    like the legacy ones, are the unnormalized vertices), and the
+    picture is combined with white as GL_DECAL does, so the frames
+    match the fixed-function ones, down to pickFace's coded faces.
+    2D pictures are sampled through the camera's lens correction,
+    which is an identity for an ideal lens.
+    The quads are drawn as triangle pairs.  The textured programs
+    come in two versions, without and with a color lookup table,
+    which is sampled on texture unit 1 at the texel centers of its
+    outer entries.
+
+**/
+
+static const char coreView[] =
+    "layout(std140) uniform View {\n"
+    "    mat4 proj;\n"
+    "    mat4 mv;\n"
+    "    mat4 tex;\n"
+    "    vec4 lensFrame;\n"
+    "    vec4 lensRadial;\n"
+    "    vec4 lensVignet;\n"
+    "};\n";
+
+static const char coreVsrc[] =
+    "layout(location = 0) in vec3 pos;\n"
+    "layout(location = 1) in vec2 tc;\n"
+    "out vec3 dir;\n"
+    "out vec2 st;\n"
+    "void main(){\n"
+    "    vec4 ep = mv * vec4( pos, 1.0 );\n"
+    "    gl_Position = proj * ep;\n"
+    "    vec3 r = reflect( normalize( ep.xyz ), mat3( mv ) * pos );\n"
+    "    dir = ( tex * vec4( r, 1.0 ) ).xyz;\n"
+    "    st = ( tex * vec4( tc, 0.0, 1.0 ) ).xy;\n"
+    "}\n";
+
+static const char coreFsrc[] =
+    "in vec3 dir;\n"
+    "in vec2 st;\n"
+    "out vec4 color;\n"
+    "#if MODE == 2\n"
+    "uniform samplerCube pic;\n"
+    "#elif MODE == 1\n"
+    "uniform sampler2D pic;\n"
+    "#endif\n"
+    "#ifdef LUT\n"
+    "uniform sampler3D lut;\n"
+    "#endif\n"
+    "void main(){\n"
+    "#if MODE == 0\n"
+    "    color = vec4( 1.0 );\n"
+    "#else\n"
+    "#if MODE == 2\n"
+    "    vec4 t = texture( pic, dir );\n"
+    "#else\n"
+    "    // lens correction: radius in lens units, ideal to source\n"
+    "    vec2 p = ( st - lensFrame.xy ) / lensFrame.zw;\n"
+    "    float r = length( p );\n"
+    "    p *= ( ( lensRadial.x * r + lensRadial.y ) * r + lensRadial.z ) * r + lensRadial.w;\n"
+    "    vec4 t = texture( pic, lensFrame.xy + p * lensFrame.zw );\n"
+    "    float r2 = dot( p, p );\n"
+    "    t.rgb /= 1.0 + r2 * ( lensVignet.x + r2 * ( lensVignet.y + r2 * lensVignet.z ) );\n"
+    "#endif\n"
+    "#ifdef LUT\n"
+    "    float n = float( textureSize( lut, 0 ).x );\n"
+    "    t.rgb = texture( lut, t.rgb * ( ( n - 1.0 ) / n ) + 0.5 / n ).rgb;\n"
+    "#endif\n"
+    "    color = vec4( mix( vec3( 1.0 ), t.rgb, t.a ), 1.0 );\n"
+    "#endif\n"
+    "}\n";
+
+class pvQtCoreBackend : public pvQtBackend
+{
+public:
+    pvQtCoreBackend();
+    ~pvQtCoreBackend();
+    bool isOK(){ return ok; }
+    Kind kind(){ return coreGL33; }
+    const char * name(){ return "OpenGL 3.3 core"; }
+    unsigned int newScreen();
+    void deleteScreen( unsigned int id );
+    void setScreen( unsigned int id, panosurface * ps,
+                    pvQtPic::PicType pt, bool textured );
+    void drawScreen( unsigned int id, const pvQtCamera & cam,
+                     GLenum target, GLuint tex );
+    bool setColorLUT( GLuint lut ){ lutTex = lut; return true; }
+private:
+    typedef struct {
+        GLuint vao, vbo, ibo;
+        GLenum mode;	// GL_TRIANGLES or GL_LINES
+        GLsizei count;
+    } mesh;
+    // std140 layout of the View block
+    typedef struct {
+        GLfloat proj[16], mv[16], tex[16];
+        GLfloat lens[12];	// frame, radial, vignet
+    } viewBlock;
+    bool ok;
+    QOpenGLExtraFunctions * xf;
+    // wireframe, 2D, cube, then 2D and cube with color table
+    QGLShaderProgram * progs[5];
+    GLuint ubo;
+    GLuint lutTex;
+    QHash<unsigned int, mesh> meshes;
+    unsigned int lastId;
+    QGLShaderProgram * makeProgram( int mode, bool lut );
+    void freeMesh( mesh & m );
+};
+
+pvQtCoreBackend::pvQtCoreBackend()
+{
+    xf = QOpenGLContext::currentContext()->extraFunctions();
+    lastId = 0;
+    ubo = 0;
+    lutTex = 0;
+    ok = true;
+    for( int i = 0; i < 5; i++ ){
+        progs[i] = makeProgram( i < 3 ? i : i - 2, i >= 3 );
+        if( !progs[i] ) ok = false;
+    }
+    if( !ok ) return;
+    xf->glGenBuffers( 1, &ubo );
+    xf->glBindBuffer( GL_UNIFORM_BUFFER, ubo );
+    xf->glBufferData( GL_UNIFORM_BUFFER, sizeof(viewBlock), 0, GL_DYNAMIC_DRAW );
+    xf->glBindBuffer( GL_UNIFORM_BUFFER, 0 );
+    ok = glGetError() == GL_NO_ERROR;
+}
+
+pvQtCoreBackend::~pvQtCoreBackend()
+{
+    QList<mesh> ms = meshes.values();
+    for( int i = 0; i < ms.count(); i++ ) freeMesh( ms[i] );
+    if( ubo ) xf->glDeleteBuffers( 1, &ubo );
+    for( int i = 0; i < 5; i++ ) delete progs[i];
+}
+
+QGLShaderProgram * pvQtCoreBackend::makeProgram( int mode, bool lut )
+{
+    QByteArray head = "#version 330 core\n#define MODE " + QByteArray::number( mode ) + "\n";
+    if( lut ) head += "#define LUT\n";
+    QGLShaderProgram * p = new QGLShaderProgram( QGLContext::currentContext() );
+    head += coreView;
+    if( !p->addShaderFromSourceCode( QGLShader::Vertex, head + coreVsrc )
+        || !p->addShaderFromSourceCode( QGLShader::Fragment, head + coreFsrc )
+        || !p->link() ){
+        qWarning("core shader: %s", (const char *)p->log().toLocal8Bit() );
+        delete p;
+        return 0;
+    }
+    GLuint id = p->programId();
+    xf->glUniformBlockBinding( id, xf->glGetUniformBlockIndex( id, "View" ), 0 );
+    if( mode > 0 ){
+        p->bind();
+        p->setUniformValue( "pic", 0 );
+        if( lut ) p->setUniformValue( "lut", 1 );
+        p->release();
+    }
+    return p;
+}
+
+unsigned int pvQtCoreBackend::newScreen()
+{
+    mesh m;
+    xf->glGenVertexArrays( 1, &m.vao );
+    xf->glGenBuffers( 1, &m.vbo );
+    xf->glGenBuffers( 1, &m.ibo );
+    m.mode = GL_LINES;
+    m.count = 0;
+    meshes.insert( ++lastId, m );
+    return lastId;
+}
+
+void pvQtCoreBackend::freeMesh( mesh & m )
+{
+    xf->glDeleteVertexArrays( 1, &m.vao );
+    xf->glDeleteBuffers( 1, &m.vbo );
+    xf->glDeleteBuffers( 1, &m.ibo );
+}
+
+void pvQtCoreBackend::deleteScreen( unsigned int id )
+{
+    if( !meshes.contains( id ) ) return;
+    freeMesh( meshes[id] );
+    meshes.remove( id );
+}
+
+void pvQtCoreBackend::setScreen( unsigned int id, panosurface * ps,
+                                 pvQtPic::PicType pt, bool textured )
+{
+    if( !meshes.contains( id ) ) return;
+    mesh & m = meshes[id];
+
+    // vertices, then texture coordinates
+    GLsizeiptr vb = ps->vertexBytes(),
+               tb = textured ? ps->texCoordSize() : 0;
+    QVector<GLuint> idx;
+    if( textured ){
+        const unsigned int * q = ps->quadIndices();
+        unsigned int n = ps->quadIndexCount();
+        idx.reserve( 6 * n / 4 );
+        for( unsigned int i = 0; i + 3 < n; i += 4 ){
+            idx << q[i] << q[i + 1] << q[i + 2]
+                << q[i] << q[i + 2] << q[i + 3];
+        }
+        m.mode = GL_TRIANGLES;
+    } else {
+        const unsigned int * l = ps->lineIndices();
+        for( unsigned int i = 0; i < ps->lineIndexCount(); i++ ) idx << l[i];
+        m.mode = GL_LINES;
+    }
+    m.count = idx.count();
+
+    xf->glBindVertexArray( m.vao );
+    xf->glBindBuffer( GL_ARRAY_BUFFER, m.vbo );
+    xf->glBufferData( GL_ARRAY_BUFFER, vb + tb, 0, GL_STATIC_DRAW );
+    xf->glBufferSubData( GL_ARRAY_BUFFER, 0, vb, ps->vertices() );
+    xf->glEnableVertexAttribArray( 0 );
+    xf->glVertexAttribPointer( 0, 3, GL_FLOAT, GL_FALSE, 0, 0 );
+    if( textured ){
+        xf->glBufferSubData( GL_ARRAY_BUFFER, vb, tb, ps->texCoords( pt ) );
+        xf->glEnableVertexAttribArray( 1 );
+        xf->glVertexAttribPointer( 1, 2, GL_FLOAT, GL_FALSE, 0, (const void *)vb );
+    } else {
+        xf->glDisableVertexAttribArray( 1 );
+    }
+    xf->glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, m.ibo );
+    xf->glBufferData( GL_ELEMENT_ARRAY_BUFFER, idx.count() * sizeof(GLuint),
+                      idx.constData(), GL_STATIC_DRAW );
+    xf->glBindVertexArray( 0 );
+    xf->glBindBuffer( GL_ARRAY_BUFFER, 0 );
+}
+
+void pvQtCoreBackend::drawScreen( unsigned int id, const pvQtCamera & cam,
+                                  GLenum target, GLuint tex )
+{
+    if( !meshes.contains( id ) ) return;
+    const mesh & m = meshes[id];
+
+    viewBlock vb;
+    memcpy( vb.proj, cam.projection().constData(), sizeof(vb.proj) );
+    memcpy( vb.mv, cam.modelView().constData(), sizeof(vb.mv) );
+    memcpy( vb.tex, cam.texture().constData(), sizeof(vb.tex) );
+    const QVector4D lens[3] = { cam.lensFrame, cam.lensRadial, cam.lensVignet };
+    for( int i = 0; i < 3; i++ ){
+        for( int j = 0; j < 4; j++ ) vb.lens[4 * i + j] = lens[i][j];
+    }
+    xf->glBindBuffer( GL_UNIFORM_BUFFER, ubo );
+    xf->glBufferSubData( GL_UNIFORM_BUFFER, 0, sizeof(vb), &vb );
+    xf->glBindBuffer( GL_UNIFORM_BUFFER, 0 );
+    xf->glBindBufferBase( GL_UNIFORM_BUFFER, 0, ubo );
+
+    int mode = 0;
+    if( m.mode == GL_TRIANGLES && target ) {
+        mode = target == GL_TEXTURE_CUBE_MAP ? 2 : 1;
+    }
+    bool lut = mode && lutTex;
+    if( lut ){
+        xf->glActiveTexture( GL_TEXTURE1 );
+        glBindTexture( GL_TEXTURE_3D, lutTex );
+    }
+    xf->glActiveTexture( GL_TEXTURE0 );
+    if( mode ) glBindTexture( target, tex );
+    glFrontFace( cam.flipY ? GL_CW : GL_CCW );
+
+    QGLShaderProgram * p = progs[ lut ? mode + 2 : mode ];
+    p->bind();
+    xf->glBindVertexArray( m.vao );
+    glDrawElements( m.mode, m.count, GL_UNSIGNED_INT, 0 );
+    xf->glBindVertexArray( 0 );
+    p->release();
+    if( lut ){
+        xf->glActiveTexture( GL_TEXTURE1 );
+        glBindTexture( GL_TEXTURE_3D, 0 );
+        xf->glActiveTexture( GL_TEXTURE0 );
+    }
+    xf->glBindBufferBase( GL_UNIFORM_BUFFER, 0, 0 );
+}
+
+/**  Factory  **/
+
+pvQtBackend * pvQtBackend::create( Kind k )
+{
+    QOpenGLContext * ctx = QOpenGLContext::currentContext();
+    if( !ctx ) return 0;
+    if( k == legacyGL ) return new pvQtLegacyBackend;
+
+    if( ctx->isOpenGLES() || ctx->format().version() < qMakePair( 3, 3 ) ) {
+        return 0;
+    }
+    pvQtCoreBackend * b = new pvQtCoreBackend;
+    if( !b->isOK() ){
+        delete b;
+        return 0;
+    }
+    return b;
+}
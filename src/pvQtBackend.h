@@ -0,0 +1,80 @@
+/*
+ * pvQtBackend.h  for Panini
+ *
+ * This file is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this file; if not, write to Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+
+  pvQtBackend draws pvQtView's panosurface screens.  A screen is a
+  panosurface mesh loaded into OpenGL, textured for a picture type
+  or as a wireframe; drawScreen() draws one as a pvQtCamera sees it,
+  with the picture's texture.  The caller owns the viewport, the
+  framebuffer and the texture objects and their parameters.
+
+  There are two implementations, chosen by create():
+    legacyGL  display lists, the GL matrix stacks and glTexGen
+              reflection maps for cube textures; any OpenGL.
+    coreGL33  vertex array and buffer objects, a uniform block for
+              the matrices and GLSL 3.30 shaders, using only calls
+              in the OpenGL 3.3 core profile.  Needs OpenGL 3.3.
+  Both draw the same pixels, so they can be swapped at any time
+  (e.g. to compare frame times).  All calls need the context
+  current.
+
+  A color lookup table (see pvQtColorLUT), set by setColorLUT(),
+  converts the picture's colors as it is drawn, and the camera's
+  lens correction is applied to 2D pictures as they are sampled.
+  Only the coreGL33 backend does these; legacyGL draws the picture
+  as it is.
+*/
+
+#ifndef PVQTBACKEND_H
+#define PVQTBACKEND_H
+
+#include <QtOpenGL/qgl.h>
+#include "pvQtPic.h"
+
+class pvQtCamera;
+class panosurface;
+
+class pvQtBackend
+{
+public:
+    enum Kind { legacyGL, coreGL33 };
+    // 0 if the current context can't run that kind
+    static pvQtBackend * create( Kind k );
+    virtual ~pvQtBackend(){}	// deletes its screens
+    virtual Kind kind() = 0;
+    virtual const char * name() = 0;
+
+    // screens, by nonzero id
+    virtual unsigned int newScreen() = 0;
+    virtual void deleteScreen( unsigned int id ) = 0;
+    /* load the mesh of ps into a screen, with the texture
+       coordinates of pt if textured, else as lines
+    */
+    virtual void setScreen( unsigned int id, panosurface * ps,
+                            pvQtPic::PicType pt, bool textured ) = 0;
+    /* draw a screen, textured with tex (GL_TEXTURE_2D or
+       GL_TEXTURE_CUBE_MAP) unless target is 0
+    */
+    virtual void drawScreen( unsigned int id, const pvQtCamera & cam,
+                             GLenum target, GLuint tex ) = 0;
+    /* GL_TEXTURE_3D color table for the textured screens drawn
+       next, 0 for none.  Returns false if it can't be applied.
+    */
+    virtual bool setColorLUT( GLuint lut ) = 0;
+};
+
+#endif //ndef PVQTBACKEND_H
@@ -0,0 +1,99 @@
+/*
+ * pvQtCamera.cpp  for Panini
+ *
+ * This file is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this file; if not, write to Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+
+  See pvQtCamera.h
+*/
+
+#include "pvQtCamera.h"
+#include <cmath>
+
+#ifndef Pi
+#define Pi 3.141592654
+#define RAD(d) ( Pi * (d) / 180.0 )
+#endif
+
+pvQtCamera::pvQtCamera()
+{
+    wfov = 90;
+    aspect = 1;
+    znear = 0.07; zfar = 30;
+    framex = framey = 0;
+    flipY = false;
+    recenter = false;
+    pan = tilt = spin = 0;
+    eyex = eyey = eyez = 0;
+    cube = false;
+    turn = pitch = yaw = 0;
+    xmag = ymag = 1;
+    lensFrame = QVector4D( 0.5, 0.5, 1, 1 );
+    lensRadial = QVector4D( 0, 0, 0, 1 );
+    lensVignet = QVector4D( 0, 0, 0, 0 );
+}
+
+QMatrix4x4 pvQtCamera::projection() const
+{
+    QMatrix4x4 m;
+    // upside down for readback, which reverses the winding
+    if( flipY ) m.scale( 1, -1, 1 );
+    /* initial viewing volume, wfov sets zoom, includes
+       framing and eye shift compensating translations
+       of the viewport
+    */
+    double  hhnear = znear * tan( 0.5 * RAD(wfov) ),
+            hwnear = hhnear * aspect,
+            dxnear = 2 * hwnear * framex,
+            dynear = 2 * hhnear * framey;
+    m.frustum( -(hwnear + dxnear), hwnear - dxnear,
+               -(hhnear + dynear), hhnear - dynear,
+               znear, zfar );
+    // OGL default view is along -Z, we want +Z
+    m.rotate( 180, 0, 1, 0 );
+    // eye rotates around panocenter, or panosurface around eye
+    if( !recenter ) m.translate( eyex, eyey, eyez );
+    m.rotate( -spin, 0, 0, 1 );
+    m.rotate( tilt, 1, 0, 0 );
+    m.rotate( pan, 0, 1, 0 );
+    return m;
+}
+
+QMatrix4x4 pvQtCamera::modelView() const
+{
+    QMatrix4x4 m;
+    if( recenter ) m.translate( eyex, eyey, eyez );
+    return m;
+}
+
+QMatrix4x4 pvQtCamera::texture() const
+{
+    QMatrix4x4 m;
+    if( cube ){
+        // cube texture rotates around origin
+        m.rotate( 180, 0, 1, 0 );
+        m.rotate( 180, 0, 0, 1 );
+        m.rotate( -yaw, 0, 1, 0 );
+        m.rotate( -pitch, 1, 0, 0 );
+        m.rotate( -turn, 0, 0, 1 );
+    } else {
+        // 2D textures rotate and scale around pic center
+        m.translate( 0.5, 0.5, 0 );
+        m.rotate( -turn, 0, 0, 1 );
+        m.scale( xmag, ymag, 1.0 );
+        m.translate( -0.5, -0.5, 0 );
+    }
+    return m;
+}
@@ -0,0 +1,73 @@
+/*
+ * pvQtCamera.h  for Panini
+ *
+ * This file is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this file; if not, write to Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+
+  pvQtCamera is the viewing geometry of one frame, worked out on
+  the CPU: the projection and modelview matrices that place the eye
+  relative to the panosurface, and the texture matrix that turns and
+  scales the picture on it.  pvQtView fills one in from its view
+  parameters; the rendering backends (pvQtBackend) and the tile
+  picker use the matrices, so no GL matrix stack is involved.
+
+  The matrices are the ones the fixed-function code built with
+  glFrustum, glRotated etc.: the projection holds the view rotation
+  (and the eye shift, except in recenter mode, where the eye shift
+  is the modelview).  Texture coordinates are panosurface (s,t) for
+  2D pictures, and for cube maps the reflection of the eye ray in
+  the surface normal, as GL_REFLECTION_MAP texgen makes.
+
+  A 2D picture may also carry a lens correction (see pvQtPic::
+  LensParams), restated in its face texture coordinates for the
+  backend to apply as it samples; the defaults are an ideal lens.
+*/
+
+#ifndef PVQTCAMERA_H
+#define PVQTCAMERA_H
+
+#include <QMatrix4x4>
+#include <QVector4D>
+
+class pvQtCamera
+{
+public:
+    pvQtCamera();
+
+    // projection
+    double wfov;	// vertical angle at the eye, degrees
+    double aspect;	// viewport width / height
+    double znear, zfar;	// clipping plane distances from eye
+    double framex, framey;	// total framing shifts, viewport halfwidths
+    bool flipY;	// upside down, for readback
+    // eye
+    bool recenter;	// panosurface turns around the eye
+    double pan, tilt, spin;	// degrees
+    double eyex, eyey, eyez;	// sphere radii
+    // picture on the panosurface
+    bool cube;	// cube map, else 2D texture
+    double turn, pitch, yaw;	// degrees
+    double xmag, ymag;	// 2D texture magnification
+    // lens correction, in face texture coordinates
+    QVector4D lensFrame;	// lens center s,t; unit radius in s,t
+    QVector4D lensRadial;	// a, b, c, 1 - a - b - c
+    QVector4D lensVignet;	// vb, vc, vd, 0
+
+    QMatrix4x4 projection() const;
+    QMatrix4x4 modelView() const;
+    QMatrix4x4 texture() const;
+};
+
+#endif //ndef PVQTCAMERA_H
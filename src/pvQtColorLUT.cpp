@@ -0,0 +1,108 @@
+/*
+ * pvQtColorLUT.cpp  for Panini
+ *
+ * This file is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this file; if not, write to Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+
+  See pvQtColorLUT.h
+*/
+
+#include "pvQtColorLUT.h"
+#include <QtGlobal>
+
+#if QT_VERSION >= QT_VERSION_CHECK(5, 14, 0)
+#define HAVE_COLORSPACE
+#include <QColorSpace>
+#include <QColorTransform>
+
+static QColorSpace colorSpace( const QByteArray & prof )
+{
+    if( prof.isEmpty() ) return QColorSpace( QColorSpace::SRgb );
+    return QColorSpace::fromIccProfile( prof );
+}
+#endif
+
+bool pvQtColorLUT::available()
+{
+#ifdef HAVE_COLORSPACE
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool pvQtColorLUT::isValid( const QByteArray & prof )
+{
+#ifdef HAVE_COLORSPACE
+    return colorSpace( prof ).isValid();
+#else
+    return prof.isEmpty();
+#endif
+}
+
+QVector<quint16> pvQtColorLUT::table( const QByteArray & src,
+                                      const QByteArray & dst, int size )
+{
+    QVector<quint16> t;
+#ifdef HAVE_COLORSPACE
+    if( size < 2 || src == dst ) return t;
+    QColorSpace s = colorSpace( src ), d = colorSpace( dst );
+    if( !s.isValid() || !d.isValid() || s == d ) return t;
+    QColorTransform xf = s.transformationToColorSpace( d );
+
+    t.resize( 4 * size * size * size );
+    quint16 * p = t.data();
+    for( int b = 0; b < size; b++ ){
+        for( int g = 0; g < size; g++ ){
+            for( int r = 0; r < size; r++ ){
+                QRgba64 c = xf.map( QRgba64::fromRgba64(
+                                        quint16( 65535 * r / ( size - 1 ) ),
+                                        quint16( 65535 * g / ( size - 1 ) ),
+                                        quint16( 65535 * b / ( size - 1 ) ),
+                                        65535 ) );
+                *p++ = c.red();
+                *p++ = c.green();
+                *p++ = c.blue();
+                *p++ = 65535;
+            }
+        }
+    }
+#else
+    Q_UNUSED(src);
+    Q_UNUSED(dst);
+    Q_UNUSED(size);
+#endif
+    return t;
+}
+
+QByteArray pvQtColorLUT::profileOf( const QImage & img )
+{
+#ifdef HAVE_COLORSPACE
+    if( img.colorSpace().isValid() ) return img.colorSpace().iccProfile();
+#else
+    Q_UNUSED(img);
+#endif
+    return QByteArray();
+}
+
+void pvQtColorLUT::setProfile( QImage & img, const QByteArray & prof )
+{
+#ifdef HAVE_COLORSPACE
+    if( !prof.isEmpty() ) img.setColorSpace( QColorSpace::fromIccProfile( prof ) );
+#else
+    Q_UNUSED(img);
+    Q_UNUSED(prof);
+#endif
+}
@@ -0,0 +1,60 @@
+/*
+ * pvQtColorLUT.h  for Panini
+ *
+ * This file is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this file; if not, write to Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+
+  pvQtColorLUT builds the color lookup tables that color-manage
+  the display.  A table is a size x size x size grid of RGB colors
+  that the fragment shader samples with the picture's color, so a
+  picture is converted from its ICC profile to the display's (or to
+  sRGB for saved views) on the GPU, and its pixels are never touched
+  on the CPU.
+
+  Profiles are ICC profile data, as embedded in image files; an
+  empty one means sRGB.  The conversions are Qt's (QColorSpace,
+  Qt 5.14 and later), which handles RGB matrix/TRC profiles.  With
+  an older Qt, or a profile Qt can't use, there is no table and the
+  picture is shown unconverted, as it always was.
+*/
+
+#ifndef PVQTCOLORLUT_H
+#define PVQTCOLORLUT_H
+
+#include <QByteArray>
+#include <QVector>
+#include <QImage>
+
+class pvQtColorLUT
+{
+public:
+    // true if profiles can be read and converted
+    static bool available();
+    // true if prof is "" or a profile that can be used
+    static bool isValid( const QByteArray & prof );
+    /* the table converting colors in profile src to profile dst:
+       size^3 RGBA entries of 16 bit channels, red varying fastest
+       and blue slowest.  Empty if src and dst are the same, or
+       either can't be used.
+    */
+    static QVector<quint16> table( const QByteArray & src,
+                                   const QByteArray & dst, int size = 33 );
+    // the profile an image was tagged with, "" if none
+    static QByteArray profileOf( const QImage & img );
+    // tag an image with a profile
+    static void setProfile( QImage & img, const QByteArray & prof );
+};
+
+#endif //ndef PVQTCOLORLUT_H
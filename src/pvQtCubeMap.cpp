@@ -0,0 +1,382 @@
+/*
+ * pvQtCubeMap.cpp  for Panini
+ *
+ * This file is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this file; if not, write to Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+
+  See pvQtCubeMap.h
+*/
+
+#include "pvQtCubeMap.h"
+#include <QFile>
+#include <QFileInfo>
+#include <QDir>
+#include <QDataStream>
+#include <QDateTime>
+#include <QCryptographicHash>
+#include <QStandardPaths>
+#include <QImageReader>
+#include <QRunnable>
+#include <QVector>
+#include <cmath>
+
+// face rows per job
+#define BAND_ROWS 32
+
+/* makes one band of rows of one face
+*/
+class pvQtCubeJob : public QRunnable
+{
+public:
+    pvQtCubeJob( pvQtCubeMap * cm, int face, int y0, int y1 )
+        : m_cm( cm ), m_face( face ), m_y0( y0 ), m_y1( y1 ) {}
+    void run(){
+        m_cm->convertBand( m_face, m_y0, m_y1 );
+    }
+private:
+    pvQtCubeMap * m_cm;
+    int m_face, m_y0, m_y1;
+};
+
+/* face pixel (u,v), both -1:1 with v down, is direction
+   origin + u * U + v * V;  x right, y up, z front
+*/
+static const float faceAxes[6][3][3] = {
+    { {  0,  0,  1 }, {  1, 0,  0 }, { 0, -1,  0 } },	// front
+    { {  1,  0,  0 }, {  0, 0, -1 }, { 0, -1,  0 } },	// right
+    { {  0,  0, -1 }, { -1, 0,  0 }, { 0, -1,  0 } },	// back
+    { { -1,  0,  0 }, {  0, 0,  1 }, { 0, -1,  0 } },	// left
+    { {  0,  1,  0 }, {  1, 0,  0 }, { 0,  0,  1 } },	// top
+    { {  0, -1,  0 }, {  1, 0,  0 }, { 0,  0, -1 } }	// bottom
+};
+
+/* atan2 to about 2e-6 radian, without branches so loops
+   that call it can be vectorized
+*/
+static inline float fastAtan2( float y, float x )
+{
+    float ax = fabsf( x ), ay = fabsf( y );
+    float mx = ax > ay ? ax : ay;
+    float mn = ax > ay ? ay : ax;
+    float a = mn / ( mx + 1e-30f );
+    float s = a * a;
+    float r = a * ( 0.99997726f + s * ( -0.33262347f + s * ( 0.19354346f
+              + s * ( -0.11643287f + s * ( 0.05265332f - s * 0.01172120f ) ) ) ) );
+    r = ay > ax ? 1.57079637f - r : r;
+    r = x < 0 ? 3.14159274f - r : r;
+    return y < 0 ? -r : r;
+}
+
+/* mix two pixels, t = 0:256, two channels per multiply
+*/
+static inline QRgb mixPixels( QRgb a, QRgb b, uint t )
+{
+    uint u = 256 - t;
+    uint rb = ( ( ( a & 0xff00ff ) * u + ( b & 0xff00ff ) * t ) >> 8 ) & 0xff00ff;
+    uint ag = ( ( ( a >> 8 ) & 0xff00ff ) * u + ( ( b >> 8 ) & 0xff00ff ) * t ) & 0xff00ff00;
+    return rb | ag;
+}
+
+pvQtCubeMap::pvQtCubeMap()
+{
+    m_error = 0;
+    m_budget = 0;
+    m_src = 0;
+    m_size = 0;
+    m_yproj = 1;
+    m_kx = m_ky = 1;
+    m_wrap = false;
+}
+
+bool pvQtCubeMap::canConvert( pvQtPic::PicType t )
+{
+    return t == pvQtPic::cyl || t == pvQtPic::eqr || t == pvQtPic::mrc;
+}
+
+QString pvQtCubeMap::defaultCacheDir()
+{
+    return QStandardPaths::writableLocation( QStandardPaths::CacheLocation )
+            + "/cubemaps";
+}
+
+int pvQtCubeMap::faceSize( QSize dims, QSizeF fovs, int limit )
+{
+    if( dims.isEmpty() || fovs.width() <= 0 ) {
+        return 0;
+    }
+    // a face has size/2 pixels per radian at its center
+    double ppr = dims.width() / ( fovs.width() * M_PI / 180 );
+    int size = ( int( 2 * ppr + 0.5 ) + 15 ) & ~15;
+    if( size > limit ) {
+        size = limit & ~1;
+    }
+    return size;
+}
+
+void pvQtCubeMap::setCacheDir( QString dir, int budget )
+{
+    m_cachedir = dir;
+    m_budget = qint64( budget ) << 20;
+}
+
+/**  Conversion  **/
+
+void pvQtCubeMap::convertBand( int face, int y0, int y1 )
+{
+    const int n = m_size;
+    const float step = 2.0f / n;
+    const float (*ax)[3] = faceAxes[face];
+    const int w = m_src->width(), h = m_src->height();
+    const float cx = 0.5f * w, cy = 0.5f * h;
+    const float kx = m_kx, ky = m_ky;
+    const int bpl = m_src->bytesPerLine();
+    const uchar * bits = m_src->constBits();
+    QVector<float> sxv( n ), syv( n );
+    float * sx = sxv.data(), * sy = syv.data();
+
+    for( int y = y0; y < y1; y++ ){
+        // direction at u = -1, and its step along the row
+        float v = ( y + 0.5f ) * step - 1;
+        float u0 = 0.5f * step - 1;
+        float bx = ax[0][0] + u0 * ax[1][0] + v * ax[2][0];
+        float by = ax[0][1] + u0 * ax[1][1] + v * ax[2][1];
+        float bz = ax[0][2] + u0 * ax[1][2] + v * ax[2][2];
+        float ux = step * ax[1][0], uy = step * ax[1][1], uz = step * ax[1][2];
+
+        // source coordinates for the whole row
+        switch( m_yproj ){
+        case 0:		// cylindrical
+            for( int x = 0; x < n; x++ ){
+                float dx = bx + x * ux, dy = by + x * uy, dz = bz + x * uz;
+                float hz = sqrtf( dx * dx + dz * dz );
+                sx[x] = cx + kx * fastAtan2( dx, dz );
+                sy[x] = cy - ky * dy / hz;
+            }
+            break;
+        case 1:		// equirectangular
+            for( int x = 0; x < n; x++ ){
+                float dx = bx + x * ux, dy = by + x * uy, dz = bz + x * uz;
+                float hz = sqrtf( dx * dx + dz * dz );
+                sx[x] = cx + kx * fastAtan2( dx, dz );
+                sy[x] = cy - ky * fastAtan2( dy, hz );
+            }
+            break;
+        default:	// mercator
+            for( int x = 0; x < n; x++ ){
+                float dx = bx + x * ux, dy = by + x * uy, dz = bz + x * uz;
+                float hz = sqrtf( dx * dx + dz * dz );
+                sx[x] = cx + kx * fastAtan2( dx, dz );
+                sy[x] = cy - ky * asinhf( dy / hz );
+            }
+            break;
+        }
+
+        // bilinear samples
+        QRgb * out = (QRgb *)m_faces[face].scanLine( y );
+        for( int x = 0; x < n; x++ ){
+            float fx = sx[x], fy = sy[x];
+            if( fy < 0 || fy > h || !( m_wrap || ( fx >= 0 && fx <= w ) ) ){
+                out[x] = qRgb( 0, 0, 0 );
+                continue;
+            }
+            fx -= 0.5f;
+            fy -= 0.5f;
+            int ix = int( floorf( fx ) ), iy = int( floorf( fy ) );
+            uint tx = uint( ( fx - ix ) * 256 ), ty = uint( ( fy - iy ) * 256 );
+            int x0, x1;
+            if( m_wrap ){
+                x0 = ( ix % w + w ) % w;
+                x1 = x0 + 1 < w ? x0 + 1 : 0;
+            } else {
+                x0 = qBound( 0, ix, w - 1 );
+                x1 = qBound( 0, ix + 1, w - 1 );
+            }
+            int r0 = qBound( 0, iy, h - 1 ), r1 = qBound( 0, iy + 1, h - 1 );
+            const QRgb * p0 = (const QRgb *)( bits + r0 * bpl );
+            const QRgb * p1 = (const QRgb *)( bits + r1 * bpl );
+            out[x] = mixPixels( mixPixels( p0[x0], p0[x1], tx ),
+                                mixPixels( p1[x0], p1[x1], tx ), ty );
+        }
+    }
+}
+
+bool pvQtCubeMap::convert( pvQtPic::PicType t, QSizeF fovs, const QImage & src,
+                           int size, QImage faces[6] )
+{
+    for( int i = 0; i < 6; i++ ) {
+        faces[i] = QImage();
+    }
+    int xproj, yproj;
+    if( !canConvert( t ) || !pvQtPic::getxyproj( t, xproj, yproj ) ){
+        m_error = "can't convert this picture type";
+        return false;
+    }
+    double xr = pvQtPic::fov2rad( xproj, fovs.width() );
+    double yr = pvQtPic::fov2rad( yproj, fovs.height() );
+    if( src.isNull() || size <= 0 || xr <= 0 || yr <= 0 ){
+        m_error = "nothing to convert";
+        return false;
+    }
+
+    QImage img = src.convertToFormat( QImage::Format_RGB32 );
+    m_src = &img;
+    m_size = size;
+    m_yproj = yproj;
+    m_kx = float( 0.5 * img.width() / xr );
+    m_ky = float( 0.5 * img.height() / yr );
+    m_wrap = fovs.width() >= 359.5;
+    for( int i = 0; i < 6; i++ ){
+        m_faces[i] = QImage( size, size, PVQT_PIC_FACE_FORMAT );
+        if( m_faces[i].isNull() ){
+            for( int j = 0; j < i; j++ ) {
+                m_faces[j] = QImage();
+            }
+            m_src = 0;
+            m_error = "not enough memory for cube faces";
+            return false;
+        }
+    }
+
+    for( int f = 0; f < 6; f++ ){
+        for( int y = 0; y < size; y += BAND_ROWS ){
+            m_pool.start( new pvQtCubeJob( this, f, y, qMin( y + BAND_ROWS, size ) ) );
+        }
+    }
+    m_pool.waitForDone();
+
+    for( int i = 0; i < 6; i++ ){
+        faces[i] = m_faces[i];
+        m_faces[i] = QImage();
+    }
+    m_src = 0;
+    m_error = 0;
+    return true;
+}
+
+bool pvQtCubeMap::convertFile( pvQtPic::PicType t, QSizeF fovs, QString path,
+                               int size, QImage faces[6] )
+{
+    QString name;
+    if( !m_cachedir.isEmpty() ){
+        name = cacheName( t, fovs, path, size );
+        if( readCache( name, size, faces ) ){
+            m_error = 0;
+            return true;
+        }
+    }
+
+    QImage src = QImageReader( path ).read();
+    if( src.isNull() ){
+        for( int i = 0; i < 6; i++ ) {
+            faces[i] = QImage();
+        }
+        m_error = "can't read image file";
+        return false;
+    }
+    if( !convert( t, fovs, src, size, faces ) ) {
+        return false;
+    }
+    if( !name.isEmpty() ) {
+        writeCache( name, faces );
+    }
+    return true;
+}
+
+/**  Disk cache  **/
+
+static const char cacheMagic[] = "pvQtCub1";
+
+QString pvQtCubeMap::cacheName( pvQtPic::PicType t, QSizeF fovs,
+                                QString path, int size )
+{
+    QFileInfo fi( path );
+    QString key = QString("%1 %2 %3 %4 %5 %6 %7")
+            .arg( fi.absoluteFilePath() )
+            .arg( fi.size() )
+            .arg( fi.lastModified().toMSecsSinceEpoch() )
+            .arg( int(t) )
+            .arg( fovs.width(), 0, 'f', 4 )
+            .arg( fovs.height(), 0, 'f', 4 )
+            .arg( size );
+    return m_cachedir + "/"
+            + QString( QCryptographicHash::hash( key.toUtf8(),
+                                                 QCryptographicHash::Md5 ).toHex() )
+            + ".cube";
+}
+
+bool pvQtCubeMap::readCache( QString name, int size, QImage faces[6] )
+{
+    for( int i = 0; i < 6; i++ ) {
+        faces[i] = QImage();
+    }
+    QFile f( name );
+    if( !f.open( QIODevice::ReadOnly ) ) {
+        return false;
+    }
+    QDataStream ds( &f );
+    QByteArray magic;
+    qint32 s, fmt;
+    ds >> magic >> s >> fmt;
+    if( ds.status() != QDataStream::Ok || magic != cacheMagic
+        || s != size || fmt != int(PVQT_PIC_FACE_FORMAT) ) {
+        return false;
+    }
+    for( int i = 0; i < 6; i++ ){
+        faces[i] = QImage( size, size, PVQT_PIC_FACE_FORMAT );
+        int n = faces[i].bytesPerLine() * size;
+        if( faces[i].isNull()
+            || ds.readRawData( (char *)faces[i].bits(), n ) != n ){
+            for( int j = 0; j <= i; j++ ) {
+                faces[j] = QImage();
+            }
+            return false;
+        }
+    }
+    return true;
+}
+
+void pvQtCubeMap::writeCache( QString name, const QImage faces[6] )
+{
+    QDir dir( m_cachedir );
+    if( !dir.mkpath( "." ) ) {
+        return;
+    }
+    QFile f( name );
+    if( !f.open( QIODevice::WriteOnly ) ) {
+        return;
+    }
+    QDataStream ds( &f );
+    ds << QByteArray( cacheMagic ) << qint32( faces[0].width() )
+       << qint32( faces[0].format() );
+    for( int i = 0; i < 6; i++ ){
+        int n = faces[i].bytesPerLine() * faces[i].height();
+        if( ds.writeRawData( (const char *)faces[i].constBits(), n ) != n ){
+            f.close();
+            f.remove();
+            return;
+        }
+    }
+    f.close();
+
+    // trim to the budget, newest first
+    qint64 total = 0;
+    foreach( QFileInfo e, dir.entryInfoList( QStringList("*.cube"),
+                                             QDir::Files, QDir::Time ) ){
+        total += e.size();
+        if( total > m_budget && e.absoluteFilePath() != QFileInfo( name ).absoluteFilePath() ) {
+            QFile::remove( e.absoluteFilePath() );
+        }
+    }
+}
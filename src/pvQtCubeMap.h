@@ -0,0 +1,93 @@
+/*
+ * pvQtCubeMap.h  for Panini
+ *
+ * This file is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this file; if not, write to Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+
+  pvQtCubeMap resamples a cylindrical, equirectangular or mercator
+  panorama onto six cube faces, so it can be shown through the cube
+  texture path.  A 2:1 equirect texture is limited by the largest
+  2D texture width and wastes most of its texels near the poles;
+  cube faces spend the same video memory more evenly, and each can
+  be as big as the largest cube texture.
+
+  Faces are made in bands of rows by a pool of worker threads.  Each
+  band first computes source coordinates for a whole face row, in
+  loops simple enough for the compiler to vectorize, then samples
+  the source bilinearly with packed integer arithmetic.  Directions
+  outside a partial panorama come out black.
+
+  convertFile() keeps the faces in a disk cache, keyed by the source
+  file, its date, the picture type and FOV and the face size.  The
+  cache is trimmed to a size budget, oldest entries first.
+*/
+
+#ifndef PVQTCUBEMAP_H
+#define PVQTCUBEMAP_H
+
+#include <QString>
+#include <QSize>
+#include <QSizeF>
+#include <QImage>
+#include <QThreadPool>
+#include "pvQtPic.h"
+
+class pvQtCubeJob;
+
+class pvQtCubeMap
+{
+public:
+    pvQtCubeMap();
+    // true for the picture types we convert
+    static bool canConvert( pvQtPic::PicType t );
+    // per user cache directory
+    static QString defaultCacheDir();
+    // face size that keeps the source's equator resolution, <= limit
+    static int faceSize( QSize dims, QSizeF fovs, int limit );
+
+    // "" for no disk cache; budget in megabytes
+    void setCacheDir( QString dir, int budget = 1024 );
+    /* resample src, of type t and angular size fovs, onto faces[6]
+       of the given size in pvQtPic face order.  false on error,
+       with faces[] all null.
+    */
+    bool convert( pvQtPic::PicType t, QSizeF fovs, const QImage & src,
+                  int size, QImage faces[6] );
+    // the same for an image file, through the cache
+    bool convertFile( pvQtPic::PicType t, QSizeF fovs, QString path,
+                      int size, QImage faces[6] );
+    const char * errMsg(){ return m_error; }
+
+private:
+    friend class pvQtCubeJob;
+    void convertBand( int face, int y0, int y1 );
+    QString cacheName( pvQtPic::PicType t, QSizeF fovs, QString path, int size );
+    bool readCache( QString name, int size, QImage faces[6] );
+    void writeCache( QString name, const QImage faces[6] );
+
+    const char * m_error;
+    QString m_cachedir;
+    qint64 m_budget;	// bytes
+    // conversion in progress
+    const QImage * m_src;
+    int m_size;
+    QImage m_faces[6];
+    int m_yproj;		// source y axis projection
+    float m_kx, m_ky;	// source pixels per unit
+    bool m_wrap;		// source is a full circle
+    QThreadPool m_pool;
+};
+
+#endif //ndef PVQTCUBEMAP_H
@@ -0,0 +1,780 @@
+/*
+ * pvQtEncoder.cpp  for Panini
+ *
+ * This file is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this file; if not, write to Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+
+  See pvQtEncoder.h
+
+  The JPEG coder is baseline sequential, 8 bit YCbCr (JFIF) with
+  the example quantization and Huffman tables of the standard,
+  so it needs no optimization pass over the image.  16 bit PNG
+  and TIFF samples are the 8 bit values scaled up exactly.
+*/
+
+#include "pvQtEncoder.h"
+#include <QFile>
+#include <QFileInfo>
+#include <QThread>
+#include <zlib.h>
+#include <cmath>
+#include <cstring>
+
+// target size of an uncompressed strip
+#define STRIP_BYTES	(1 << 20)
+
+/* encodes one strip
+*/
+class pvQtStripJob : public QRunnable
+{
+public:
+    pvQtStripJob( pvQtEncoder * enc, int i ) : m_enc( enc ), m_i( i ) {}
+    void run(){
+        m_enc->encodeStrip( m_i );
+    }
+private:
+    pvQtEncoder * m_enc;
+    int m_i;
+};
+
+/**  JPEG tables  **/
+
+static const uchar zigzag[64] = {
+     0,  1,  8, 16,  9,  2,  3, 10, 17, 24, 32, 25, 18, 11,  4,  5,
+    12, 19, 26, 33, 40, 48, 41, 34, 27, 20, 13,  6,  7, 14, 21, 28,
+    35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23, 30, 37, 44, 51,
+    58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63
+};
+
+static const uchar lumQ[64] = {
+    16, 11, 10, 16,  24,  40,  51,  61,
+    12, 12, 14, 19,  26,  58,  60,  55,
+    14, 13, 16, 24,  40,  57,  69,  56,
+    14, 17, 22, 29,  51,  87,  80,  62,
+    18, 22, 37, 56,  68, 109, 103,  77,
+    24, 35, 55, 64,  81, 104, 113,  92,
+    49, 64, 78, 87, 103, 121, 120, 101,
+    72, 92, 95, 98, 112, 100, 103,  99
+};
+
+static const uchar chrQ[64] = {
+    17, 18, 24, 47, 99, 99, 99, 99,
+    18, 21, 26, 66, 99, 99, 99, 99,
+    24, 26, 56, 99, 99, 99, 99, 99,
+    47, 66, 99, 99, 99, 99, 99, 99,
+    99, 99, 99, 99, 99, 99, 99, 99,
+    99, 99, 99, 99, 99, 99, 99, 99,
+    99, 99, 99, 99, 99, 99, 99, 99,
+    99, 99, 99, 99, 99, 99, 99, 99
+};
+
+// Huffman tables: code counts by length 1:16, then symbols
+static const uchar dcLumBits[16] = { 0,1,5,1,1,1,1,1,1,0,0,0,0,0,0,0 };
+static const uchar dcChrBits[16] = { 0,3,1,1,1,1,1,1,1,1,1,0,0,0,0,0 };
+static const uchar dcVals[12] = { 0,1,2,3,4,5,6,7,8,9,10,11 };
+
+static const uchar acLumBits[16] = { 0,2,1,3,3,2,4,3,5,5,4,4,0,0,1,0x7d };
+static const uchar acLumVals[162] = {
+    0x01,0x02,0x03,0x00,0x04,0x11,0x05,0x12,0x21,0x31,0x41,0x06,0x13,0x51,0x61,0x07,
+    0x22,0x71,0x14,0x32,0x81,0x91,0xa1,0x08,0x23,0x42,0xb1,0xc1,0x15,0x52,0xd1,0xf0,
+    0x24,0x33,0x62,0x72,0x82,0x09,0x0a,0x16,0x17,0x18,0x19,0x1a,0x25,0x26,0x27,0x28,
+    0x29,0x2a,0x34,0x35,0x36,0x37,0x38,0x39,0x3a,0x43,0x44,0x45,0x46,0x47,0x48,0x49,
+    0x4a,0x53,0x54,0x55,0x56,0x57,0x58,0x59,0x5a,0x63,0x64,0x65,0x66,0x67,0x68,0x69,
+    0x6a,0x73,0x74,0x75,0x76,0x77,0x78,0x79,0x7a,0x83,0x84,0x85,0x86,0x87,0x88,0x89,
+    0x8a,0x92,0x93,0x94,0x95,0x96,0x97,0x98,0x99,0x9a,0xa2,0xa3,0xa4,0xa5,0xa6,0xa7,
+    0xa8,0xa9,0xaa,0xb2,0xb3,0xb4,0xb5,0xb6,0xb7,0xb8,0xb9,0xba,0xc2,0xc3,0xc4,0xc5,
+    0xc6,0xc7,0xc8,0xc9,0xca,0xd2,0xd3,0xd4,0xd5,0xd6,0xd7,0xd8,0xd9,0xda,0xe1,0xe2,
+    0xe3,0xe4,0xe5,0xe6,0xe7,0xe8,0xe9,0xea,0xf1,0xf2,0xf3,0xf4,0xf5,0xf6,0xf7,0xf8,
+    0xf9,0xfa
+};
+
+static const uchar acChrBits[16] = { 0,2,1,2,4,4,3,4,7,5,4,4,0,1,2,0x77 };
+static const uchar acChrVals[162] = {
+    0x00,0x01,0x02,0x03,0x11,0x04,0x05,0x21,0x31,0x06,0x12,0x41,0x51,0x07,0x61,0x71,
+    0x13,0x22,0x32,0x81,0x08,0x14,0x42,0x91,0xa1,0xb1,0xc1,0x09,0x23,0x33,0x52,0xf0,
+    0x15,0x62,0x72,0xd1,0x0a,0x16,0x24,0x34,0xe1,0x25,0xf1,0x17,0x18,0x19,0x1a,0x26,
+    0x27,0x28,0x29,0x2a,0x35,0x36,0x37,0x38,0x39,0x3a,0x43,0x44,0x45,0x46,0x47,0x48,
+    0x49,0x4a,0x53,0x54,0x55,0x56,0x57,0x58,0x59,0x5a,0x63,0x64,0x65,0x66,0x67,0x68,
+    0x69,0x6a,0x73,0x74,0x75,0x76,0x77,0x78,0x79,0x7a,0x82,0x83,0x84,0x85,0x86,0x87,
+    0x88,0x89,0x8a,0x92,0x93,0x94,0x95,0x96,0x97,0x98,0x99,0x9a,0xa2,0xa3,0xa4,0xa5,
+    0xa6,0xa7,0xa8,0xa9,0xaa,0xb2,0xb3,0xb4,0xb5,0xb6,0xb7,0xb8,0xb9,0xba,0xc2,0xc3,
+    0xc4,0xc5,0xc6,0xc7,0xc8,0xc9,0xca,0xd2,0xd3,0xd4,0xd5,0xd6,0xd7,0xd8,0xd9,0xda,
+    0xe2,0xe3,0xe4,0xe5,0xe6,0xe7,0xe8,0xe9,0xea,0xf2,0xf3,0xf4,0xf5,0xf6,0xf7,0xf8,
+    0xf9,0xfa
+};
+
+/* code words for the 4 Huffman tables (DC luma, AC luma,
+   DC chroma, AC chroma) and the DCT basis, built on first use
+*/
+struct jpegCodes {
+    quint16 code[4][256];
+    uchar size[4][256];
+    float basis[8][8];	// basis[u][x]
+
+    jpegCodes(){
+        memset( size, 0, sizeof(size) );
+        make( 0, dcLumBits, dcVals );
+        make( 1, acLumBits, acLumVals );
+        make( 2, dcChrBits, dcVals );
+        make( 3, acChrBits, acChrVals );
+        for( int u = 0; u < 8; u++ ){
+            double cu = u ? 0.5 : 0.5 / sqrt( 2.0 );
+            for( int x = 0; x < 8; x++ ){
+                basis[u][x] = float( cu * cos( (2 * x + 1) * u * 3.14159265358979 / 16 ) );
+            }
+        }
+    }
+    void make( int t, const uchar * bits, const uchar * vals ){
+        int k = 0, c = 0;
+        for( int l = 1; l <= 16; l++ ){
+            for( int i = 0; i < bits[l - 1]; i++, k++ ){
+                code[t][vals[k]] = quint16( c++ );
+                size[t][vals[k]] = uchar( l );
+            }
+            c <<= 1;
+        }
+    }
+};
+
+static const jpegCodes & codes()
+{
+    static const jpegCodes c;
+    return c;
+}
+
+/* entropy coded output of one strip, with 0xFF bytes stuffed
+*/
+struct jpegBits {
+    QByteArray out;
+    quint32 acc;
+    int n;
+
+    jpegBits() : acc( 0 ), n( 0 ) {}
+    void put( int bits, int len ){
+        acc = ( acc << len ) | ( quint32( bits ) & ( ( 1u << len ) - 1 ) );
+        n += len;
+        while( n >= 8 ){
+            char b = char( ( acc >> ( n - 8 ) ) & 0xFF );
+            out.append( b );
+            if( b == char(0xFF) ) out.append( char(0) );
+            n -= 8;
+        }
+    }
+    // pad the last byte with 1 bits
+    void flush(){
+        if( n > 0 ) put( 0x7F, 8 - n );
+    }
+};
+
+static int nbits( int v )
+{
+    if( v < 0 ) v = -v;
+    int n = 0;
+    while( v ){
+        ++n;
+        v >>= 1;
+    }
+    return n;
+}
+
+static void fdct( const float * in, float * out )
+{
+    const jpegCodes & c = codes();
+    float t[64];
+    for( int y = 0; y < 8; y++ ){
+        const float * r = in + 8 * y;
+        for( int u = 0; u < 8; u++ ){
+            const float * b = c.basis[u];
+            t[8 * y + u] = b[0] * r[0] + b[1] * r[1] + b[2] * r[2] + b[3] * r[3]
+                         + b[4] * r[4] + b[5] * r[5] + b[6] * r[6] + b[7] * r[7];
+        }
+    }
+    for( int u = 0; u < 8; u++ ){
+        for( int v = 0; v < 8; v++ ){
+            const float * b = c.basis[v];
+            float s = 0;
+            for( int y = 0; y < 8; y++ ) s += b[y] * t[8 * y + u];
+            out[8 * v + u] = s;
+        }
+    }
+}
+
+/* code one 8x8 block of level shifted samples
+   t is 0 for luma, 1 for chroma
+*/
+static void codeBlock( jpegBits & bits, const float * blk, const float * qdiv,
+                       int & dcpred, int t )
+{
+    const jpegCodes & c = codes();
+    const int dc = 2 * t, ac = 2 * t + 1;
+    float F[64];
+    fdct( blk, F );
+
+    int z[64];
+    for( int k = 0; k < 64; k++ ){
+        int i = zigzag[k];
+        z[k] = int( lround( F[i] * qdiv[i] ) );
+        if( z[k] > 1023 ) z[k] = 1023;
+        else if( z[k] < -1023 ) z[k] = -1023;
+    }
+
+    int diff = z[0] - dcpred;
+    dcpred = z[0];
+    int n = nbits( diff );
+    bits.put( c.code[dc][n], c.size[dc][n] );
+    if( n ) bits.put( diff < 0 ? diff - 1 : diff, n );
+
+    int run = 0;
+    for( int k = 1; k < 64; k++ ){
+        if( z[k] == 0 ){
+            ++run;
+            continue;
+        }
+        while( run > 15 ){
+            bits.put( c.code[ac][0xF0], c.size[ac][0xF0] );
+            run -= 16;
+        }
+        n = nbits( z[k] );
+        int s = ( run << 4 ) | n;
+        bits.put( c.code[ac][s], c.size[ac][s] );
+        bits.put( z[k] < 0 ? z[k] - 1 : z[k], n );
+        run = 0;
+    }
+    if( run ) bits.put( c.code[ac][0], c.size[ac][0] );
+}
+
+/**  byte order helpers  **/
+
+static void be16( QByteArray & b, int v )
+{
+    b.append( char( v >> 8 ) );
+    b.append( char( v ) );
+}
+
+static void be32( QByteArray & b, quint32 v )
+{
+    be16( b, int( v >> 16 ) );
+    be16( b, int( v & 0xFFFF ) );
+}
+
+static void le16( QByteArray & b, int v )
+{
+    b.append( char( v ) );
+    b.append( char( v >> 8 ) );
+}
+
+static void le32( QByteArray & b, quint32 v )
+{
+    le16( b, int( v & 0xFFFF ) );
+    le16( b, int( v >> 16 ) );
+}
+
+/**  encoder  **/
+
+pvQtEncoder::pvQtEncoder()
+{
+    m_error = 0;
+    m_opt = defaults();
+    m_format = fmtJPEG;
+    m_rows = m_strips = m_rowBytes = 0;
+    m_hs = m_vs = 1;
+    m_adlerAll = 0;
+    m_pool.setMaxThreadCount( QThread::idealThreadCount() );
+}
+
+pvQtEncoder::~pvQtEncoder()
+{
+    m_pool.waitForDone();
+}
+
+pvQtEncoder::Options pvQtEncoder::defaults()
+{
+    Options o;
+    o.quality = 90;
+    o.subsample = 420;
+    o.depth = 8;
+    o.compression = 6;
+    return o;
+}
+
+bool pvQtEncoder::canEncode( QString name )
+{
+    QString sfx = QFileInfo( name ).suffix().toLower();
+    return sfx == "jpg" || sfx == "jpeg" || sfx == "png"
+        || sfx == "tif" || sfx == "tiff";
+}
+
+void pvQtEncoder::setOptions( const Options & opt )
+{
+    m_opt = opt;
+    m_opt.quality = qBound( 1, opt.quality, 100 );
+    if( opt.subsample != 444 && opt.subsample != 422 ) m_opt.subsample = 420;
+    m_opt.depth = opt.depth > 8 ? 16 : 8;
+    m_opt.compression = qBound( 0, opt.compression, 9 );
+}
+
+void pvQtEncoder::setThreads( int n )
+{
+    m_pool.setMaxThreadCount( n > 0 ? n : QThread::idealThreadCount() );
+}
+
+bool pvQtEncoder::save( const QImage & img, QString name )
+{
+    QString sfx = QFileInfo( name ).suffix().toLower();
+    if( sfx == "jpg" || sfx == "jpeg" ) m_format = fmtJPEG;
+    else if( sfx == "png" ) m_format = fmtPNG;
+    else if( sfx == "tif" || sfx == "tiff" ) m_format = fmtTIFF;
+    else {
+        m_error = "unsupported file type";
+        return false;
+    }
+    if( img.isNull() ){
+        m_error = "no image";
+        return false;
+    }
+    m_img = img;
+    if( img.format() != QImage::Format_RGB32 && img.format() != QImage::Format_ARGB32 ){
+        m_img = img.convertToFormat( QImage::Format_RGB32 );
+    }
+
+    int W = m_img.width(), H = m_img.height();
+    int threads = m_pool.maxThreadCount();
+    // strips of about STRIP_BYTES, at least 2 per thread
+    int rows = qBound( 1, STRIP_BYTES / (3 * W), H );
+    rows = qMax( 1, qMin( rows, ( H + 2 * threads - 1 ) / (2 * threads) ) );
+
+    if( m_format == fmtJPEG ){
+        if( W > 65535 || H > 65535 ){
+            m_error = "image too big for JPEG";
+            return false;
+        }
+        m_hs = m_opt.subsample == 444 ? 1 : 2;
+        m_vs = m_opt.subsample == 420 ? 2 : 1;
+        // strips are whole MCU rows, with at most 65535 MCUs
+        int mh = 8 * m_vs, mcols = ( W + 8 * m_hs - 1 ) / (8 * m_hs);
+        int mrows = qMin( ( rows + mh - 1 ) / mh, 65535 / mcols );
+        rows = mh * qMax( 1, mrows );
+
+        int s = m_opt.quality < 50 ? 5000 / m_opt.quality : 200 - 2 * m_opt.quality;
+        for( int k = 0; k < 64; k++ ){
+            m_qt[0][k] = uchar( qBound( 1, ( lumQ[k] * s + 50 ) / 100, 255 ) );
+            m_qt[1][k] = uchar( qBound( 1, ( chrQ[k] * s + 50 ) / 100, 255 ) );
+            m_qdiv[0][k] = 1.0f / m_qt[0][k];
+            m_qdiv[1][k] = 1.0f / m_qt[1][k];
+        }
+    } else {
+        m_rowBytes = 3 * W * m_opt.depth / 8;
+    }
+    m_rows = rows;
+    m_strips = ( H + rows - 1 ) / rows;
+    m_adler.fill( 0, m_strips );
+    m_offsets.fill( 0, m_strips );
+    m_counts.fill( 0, m_strips );
+
+    QFile f( name );
+    if( !f.open( QIODevice::WriteOnly ) ){
+        m_error = "can't create file";
+        m_img = QImage();
+        return false;
+    }
+    m_error = "can't write file";
+    bool ok;
+    switch( m_format ){
+    case fmtJPEG:
+        ok = jpegHeader( f ) && writeStrips( f );
+        if( ok ) ok = f.write( "\xFF\xD9", 2 ) == 2;
+        break;
+    case fmtPNG:
+        ok = pngHeader( f ) && writeStrips( f );
+        if( ok ) ok = f.write( QByteArray::fromRawData(
+                "\0\0\0\0IEND\xAE\x42\x60\x82", 12 ) ) == 12;
+        break;
+    default:
+        ok = tiffHeader( f ) && writeStrips( f ) && tiffTrailer( f );
+        break;
+    }
+    f.close();
+    if( ok && f.error() != QFile::NoError ) ok = false;
+    if( ok ) m_error = 0;
+    else f.remove();
+    m_img = QImage();
+    return ok;
+}
+
+/* run the strip jobs, writing each strip as soon as it and
+   all before it are done.  At most 2 per thread are in hand.
+*/
+bool pvQtEncoder::writeStrips( QIODevice & out )
+{
+    int window = 2 * m_pool.maxThreadCount();
+    int started = 0;
+    bool ok = true;
+    for( int next = 0; ok && next < m_strips; next++ ){
+        while( started < m_strips && started < next + window ){
+            m_pool.start( new pvQtStripJob( this, started++ ) );
+        }
+        m_lock.lock();
+        while( !m_done.contains( next ) ) m_ready.wait( &m_lock );
+        QByteArray data = m_done.take( next );
+        m_lock.unlock();
+        if( data.isEmpty() ){
+            m_error = "can't encode image";
+            ok = false;
+        } else ok = writeStrip( out, next, data );
+    }
+    if( !ok ){
+        m_pool.waitForDone();
+        m_done.clear();
+    }
+    return ok;
+}
+
+void pvQtEncoder::encodeStrip( int i )
+{
+    int y0 = i * m_rows, y1 = qMin( y0 + m_rows, m_img.height() );
+    QByteArray data;
+    if( m_format == fmtJPEG ) data = jpegStrip( y0, y1 );
+    else data = deflateStrip( y0, y1, m_format == fmtPNG, i );
+    m_lock.lock();
+    m_done.insert( i, data );
+    m_ready.wakeAll();
+    m_lock.unlock();
+}
+
+bool pvQtEncoder::writeStrip( QIODevice & out, int i, const QByteArray & data )
+{
+    bool last = i == m_strips - 1;
+    if( m_format == fmtJPEG ){
+        if( out.write( data ) != data.size() ) return false;
+        if( last ) return true;
+        char rst[2] = { char(0xFF), char( 0xD0 + (i & 7) ) };
+        return out.write( rst, 2 ) == 2;
+    }
+    if( m_format == fmtTIFF ){
+        if( out.pos() + data.size() > qint64(0xFFFFFFF0) ){
+            m_error = "image too big for TIFF";
+            return false;
+        }
+        m_offsets[i] = quint32( out.pos() );
+        m_counts[i] = quint32( data.size() );
+        return out.write( data ) == data.size();
+    }
+
+    // PNG: the strip goes in one IDAT chunk, the first starts
+    // the zlib stream and the last ends it
+    int y0 = i * m_rows, n = qMin( m_rows, m_img.height() - y0 );
+    quint32 len = quint32( n ) * quint32( m_rowBytes + 1 );
+    m_adlerAll = i ? quint32( adler32_combine( m_adlerAll, m_adler[i], len ) ) : m_adler[i];
+
+    QByteArray chunk;
+    chunk.reserve( data.size() + 18 );
+    chunk.append( "IDAT" );
+    if( i == 0 ){
+        static const char flevel[10] = { 0x01, 0x01, 0x5E, 0x5E, 0x5E, 0x5E,
+                                         char(0x9C), char(0xDA), char(0xDA), char(0xDA) };
+        chunk.append( char(0x78) );
+        chunk.append( flevel[m_opt.compression] );
+    }
+    chunk.append( data );
+    if( last ) be32( chunk, m_adlerAll );
+    QByteArray head;
+    be32( head, quint32( chunk.size() - 4 ) );
+    be32( chunk, quint32( crc32( 0, (const Bytef *)chunk.constData(), chunk.size() ) ) );
+    return out.write( head ) == 4 && out.write( chunk ) == chunk.size();
+}
+
+/* one output row, packed RGB samples; 16 bit samples
+   are v * 257, the same in either byte order
+*/
+void pvQtEncoder::packRow( int y, uchar * dst )
+{
+    const QRgb * s = (const QRgb *)m_img.constScanLine( y );
+    int W = m_img.width();
+    if( m_opt.depth == 16 ){
+        for( int x = 0; x < W; x++, dst += 6 ){
+            dst[0] = dst[1] = uchar( qRed( s[x] ) );
+            dst[2] = dst[3] = uchar( qGreen( s[x] ) );
+            dst[4] = dst[5] = uchar( qBlue( s[x] ) );
+        }
+    } else {
+        for( int x = 0; x < W; x++, dst += 3 ){
+            dst[0] = uchar( qRed( s[x] ) );
+            dst[1] = uchar( qGreen( s[x] ) );
+            dst[2] = uchar( qBlue( s[x] ) );
+        }
+    }
+}
+
+/* rows y0 <= y < y1 packed and deflated
+   PNG (filter true): each row gets the Sub filter, and the data
+   is raw deflate, ended by a full flush (or finished, for the
+   last strip) so the strips simply join up.  Its checksum goes
+   in m_adler[i].
+   TIFF: a complete zlib stream, or stored if compression is 0.
+   Returns an empty array on error.
+*/
+QByteArray pvQtEncoder::deflateStrip( int y0, int y1, bool filter, int i )
+{
+    int rb = m_rowBytes + ( filter ? 1 : 0 );
+    QByteArray raw( ( y1 - y0 ) * rb, 0 );
+    uchar * r = (uchar *)raw.data();
+    if( filter ){
+        int bpp = 3 * m_opt.depth / 8;
+        QByteArray row( m_rowBytes, 0 );
+        uchar * p = (uchar *)row.data();
+        for( int y = y0; y < y1; y++, r += rb ){
+            packRow( y, p );
+            r[0] = 1;
+            for( int k = 0; k < bpp; k++ ) r[1 + k] = p[k];
+            for( int k = bpp; k < m_rowBytes; k++ ) r[1 + k] = uchar( p[k] - p[k - bpp] );
+        }
+    } else {
+        for( int y = y0; y < y1; y++, r += rb ) packRow( y, r );
+    }
+
+    if( !filter ){
+        if( m_opt.compression == 0 ) return raw;
+        uLongf len = compressBound( uLong( raw.size() ) );
+        QByteArray z( int( len ), 0 );
+        if( compress2( (Bytef *)z.data(), &len, (const Bytef *)raw.constData(),
+                       uLong( raw.size() ), m_opt.compression ) != Z_OK ){
+            return QByteArray();
+        }
+        z.resize( int( len ) );
+        return z;
+    }
+
+    m_adler[i] = quint32( adler32( adler32( 0, 0, 0 ),
+                                   (const Bytef *)raw.constData(), uInt( raw.size() ) ) );
+    z_stream zs;
+    memset( &zs, 0, sizeof(zs) );
+    if( deflateInit2( &zs, m_opt.compression, Z_DEFLATED, -15, 8,
+                      Z_DEFAULT_STRATEGY ) != Z_OK ){
+        return QByteArray();
+    }
+    QByteArray z( int( deflateBound( &zs, uLong( raw.size() ) ) ) + 64, 0 );
+    zs.next_in = (Bytef *)raw.data();
+    zs.avail_in = uInt( raw.size() );
+    int flush = i == m_strips - 1 ? Z_FINISH : Z_FULL_FLUSH;
+    int got = 0;
+    for(;;){
+        zs.next_out = (Bytef *)z.data() + got;
+        zs.avail_out = uInt( z.size() - got );
+        int ret = deflate( &zs, flush );
+        got = z.size() - int( zs.avail_out );
+        if( ret == Z_STREAM_ERROR ){
+            got = 0;
+            break;
+        }
+        if( ret == Z_STREAM_END || ( flush == Z_FULL_FLUSH && zs.avail_out > 0 ) ) break;
+        z.resize( 2 * z.size() );
+    }
+    deflateEnd( &zs );
+    z.resize( got );
+    return z;
+}
+
+/* rows y0 <= y < y1 as one restart interval; y0 is at the top
+   of an MCU row.  Edge MCUs are filled out by repeating the
+   last column and row.
+*/
+QByteArray pvQtEncoder::jpegStrip( int y0, int y1 )
+{
+    const int W = m_img.width(), H = m_img.height();
+    const int mw = 8 * m_hs, mh = 8 * m_vs;
+    const int mcols = ( W + mw - 1 ) / mw;
+    float Y[256], Cb[256], Cr[256], blk[64];
+    int pred[3] = { 0, 0, 0 };
+    jpegBits bits;
+    bits.out.reserve( 3 * W * ( y1 - y0 ) / 8 );
+
+    for( int my = y0; my < y1; my += mh ){
+        for( int mx = 0; mx < mcols; mx++ ){
+            // convert the MCU to centered YCbCr
+            for( int y = 0; y < mh; y++ ){
+                const QRgb * s = (const QRgb *)m_img.constScanLine( qMin( my + y, H - 1 ) );
+                for( int x = 0; x < mw; x++ ){
+                    QRgb p = s[ qMin( mx * mw + x, W - 1 ) ];
+                    float r = qRed( p ), g = qGreen( p ), b = qBlue( p );
+                    int k = y * mw + x;
+                    Y[k]  =  0.299f * r + 0.587f * g + 0.114f * b - 128;
+                    Cb[k] = -0.168736f * r - 0.331264f * g + 0.5f * b;
+                    Cr[k] =  0.5f * r - 0.418688f * g - 0.081312f * b;
+                }
+            }
+            // luma blocks
+            for( int by = 0; by < m_vs; by++ ){
+                for( int bx = 0; bx < m_hs; bx++ ){
+                    for( int v = 0; v < 8; v++ ){
+                        for( int u = 0; u < 8; u++ ){
+                            blk[8 * v + u] = Y[ ( 8 * by + v ) * mw + 8 * bx + u ];
+                        }
+                    }
+                    codeBlock( bits, blk, m_qdiv[0], pred[0], 0 );
+                }
+            }
+            // chroma blocks, averaged down
+            float norm = 1.0f / ( m_hs * m_vs );
+            for( int c = 0; c < 2; c++ ){
+                const float * C = c ? Cr : Cb;
+                for( int v = 0; v < 8; v++ ){
+                    for( int u = 0; u < 8; u++ ){
+                        float s = 0;
+                        for( int j = 0; j < m_vs; j++ ){
+                            for( int i = 0; i < m_hs; i++ ){
+                                s += C[ ( m_vs * v + j ) * mw + m_hs * u + i ];
+                            }
+                        }
+                        blk[8 * v + u] = s * norm;
+                    }
+                }
+                codeBlock( bits, blk, m_qdiv[1], pred[1 + c], 1 );
+            }
+        }
+    }
+    bits.flush();
+    return bits.out;
+}
+
+/**  headers  **/
+
+bool pvQtEncoder::jpegHeader( QIODevice & out )
+{
+    QByteArray h;
+    // SOI, JFIF APP0
+    h.append( "\xFF\xD8\xFF\xE0", 4 );
+    be16( h, 16 );
+    h.append( "JFIF\0\x01\x01\0", 8 );
+    be16( h, 1 );
+    be16( h, 1 );
+    h.append( "\0\0", 2 );
+    // quantization tables, zigzag order
+    h.append( "\xFF\xDB", 2 );
+    be16( h, 2 + 2 * 65 );
+    for( int t = 0; t < 2; t++ ){
+        h.append( char( t ) );
+        for( int k = 0; k < 64; k++ ) h.append( char( m_qt[t][ zigzag[k] ] ) );
+    }
+    // frame
+    h.append( "\xFF\xC0", 2 );
+    be16( h, 17 );
+    h.append( char(8) );
+    be16( h, m_img.height() );
+    be16( h, m_img.width() );
+    h.append( char(3) );
+    h.append( char(1) );
+    h.append( char( ( m_hs << 4 ) | m_vs ) );
+    h.append( char(0) );
+    h.append( "\x02\x11\x01\x03\x11\x01", 6 );
+    // Huffman tables
+    const uchar * bits[4] = { dcLumBits, acLumBits, dcChrBits, acChrBits };
+    const uchar * vals[4] = { dcVals, acLumVals, dcVals, acChrVals };
+    const char id[4] = { 0x00, 0x10, 0x01, 0x11 };
+    int len = 2;
+    for( int t = 0; t < 4; t++ ) len += 17 + ( t & 1 ? 162 : 12 );
+    h.append( "\xFF\xC4", 2 );
+    be16( h, len );
+    for( int t = 0; t < 4; t++ ){
+        h.append( id[t] );
+        h.append( (const char *)bits[t], 16 );
+        h.append( (const char *)vals[t], t & 1 ? 162 : 12 );
+    }
+    // restart interval: one strip
+    int mcols = ( m_img.width() + 8 * m_hs - 1 ) / (8 * m_hs);
+    h.append( "\xFF\xDD", 2 );
+    be16( h, 4 );
+    be16( h, mcols * m_rows / (8 * m_vs) );
+    // scan
+    h.append( "\xFF\xDA", 2 );
+    be16( h, 12 );
+    h.append( "\x03\x01\x00\x02\x11\x03\x11\x00\x3F\x00", 10 );
+    return out.write( h ) == h.size();
+}
+
+bool pvQtEncoder::pngHeader( QIODevice & out )
+{
+    QByteArray h( "\x89PNG\r\n\x1A\n" );
+    QByteArray c( "IHDR" );
+    be32( c, quint32( m_img.width() ) );
+    be32( c, quint32( m_img.height() ) );
+    c.append( char( m_opt.depth ) );
+    c.append( "\x02\0\0\0", 4 );	// RGB, deflate, adaptive, not interlaced
+    be32( h, 13 );
+    h.append( c );
+    be32( h, quint32( crc32( 0, (const Bytef *)c.constData(), c.size() ) ) );
+    return out.write( h ) == h.size();
+}
+
+// byte order, magic and room for the directory offset
+bool pvQtEncoder::tiffHeader( QIODevice & out )
+{
+    return out.write( "II\x2A\0\0\0\0\0", 8 ) == 8;
+}
+
+/* the image file directory and its out-of-line values go after
+   the strips; then the header is pointed at it
+*/
+bool pvQtEncoder::tiffTrailer( QIODevice & out )
+{
+    QByteArray t;
+    if( out.pos() & 1 ) t.append( char(0) );
+    quint32 base = quint32( out.pos() + t.size() );
+    quint32 bpsAt = base, resAt = base + 6,
+            offAt = resAt + 8, cntAt = offAt + 4 * m_strips,
+            ifdAt = cntAt + 4 * m_strips;
+
+    for( int i = 0; i < 3; i++ ) le16( t, m_opt.depth );
+    le32( t, 72 );
+    le32( t, 1 );
+    for( int i = 0; i < m_strips; i++ ) le32( t, m_offsets[i] );
+    for( int i = 0; i < m_strips; i++ ) le32( t, m_counts[i] );
+
+    struct { int tag, type; quint32 count, value; } ifd[] = {
+        { 256, 4, 1, quint32( m_img.width() ) },
+        { 257, 4, 1, quint32( m_img.height() ) },
+        { 258, 3, 3, bpsAt },
+        { 259, 3, 1, quint32( m_opt.compression ? 8 : 1 ) },	// Adobe deflate
+        { 262, 3, 1, 2 },		// RGB
+        { 273, 4, quint32( m_strips ), m_strips > 1 ? offAt : m_offsets[0] },
+        { 277, 3, 1, 3 },
+        { 278, 4, 1, quint32( m_rows ) },
+        { 279, 4, quint32( m_strips ), m_strips > 1 ? cntAt : m_counts[0] },
+        { 282, 5, 1, resAt },	// 72 dpi
+        { 283, 5, 1, resAt },
+        { 284, 3, 1, 1 },		// chunky
+        { 296, 3, 1, 2 }		// inches
+    };
+    int n = int( sizeof(ifd) / sizeof(ifd[0]) );
+    le16( t, n );
+    for( int i = 0; i < n; i++ ){
+        le16( t, ifd[i].tag );
+        le16( t, ifd[i].type );
+        le32( t, ifd[i].count );
+        if( ifd[i].type == 3 && ifd[i].count == 1 ){
+            le16( t, int( ifd[i].value ) );
+            le16( t, 0 );
+        } else le32( t, ifd[i].value );
+    }
+    le32( t, 0 );
+
+    if( qint64( ifdAt ) + t.size() > qint64(0xFFFFFFFF) ){
+        m_error = "image too big for TIFF";
+        return false;
+    }
+    if( out.write( t ) != t.size() ) return false;
+    QByteArray p;
+    le32( p, ifdAt );
+    return out.seek( 4 ) && out.write( p ) == 4;
+}
@@ -0,0 +1,121 @@
+/*
+ * pvQtEncoder.h  for Panini
+ *
+ * This file is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this file; if not, write to Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+
+  pvQtEncoder writes big RGB images as JPEG, PNG or TIFF files,
+  using all cores.  The image is cut into horizontal strips that
+  can be compressed independently:
+    JPEG  restart intervals: each strip is a run of MCU rows coded
+          with the DC predictions reset, ending in an RSTn marker
+    PNG   runs of rows deflated separately, flushed to a byte
+          boundary, so they join into one zlib stream
+    TIFF  ordinary strips, uncompressed or deflated
+  Strips are encoded by a pool of worker threads and written to
+  the file in order as soon as each is ready, a few cores' worth
+  ahead at most.  So only a few encoded strips are ever held in
+  memory besides the image itself.
+
+  Options:
+    quality      JPEG quality 1:100, as the IJG scale
+    subsample    JPEG chroma sampling: 444, 422 or 420
+    depth        PNG and TIFF bits per sample: 8 or 16
+    compression  PNG and TIFF zlib level 0:9; level 0 TIFF
+                 strips are stored uncompressed
+  The alpha channel, if any, is not written.
+*/
+
+#ifndef PVQTENCODER_H
+#define PVQTENCODER_H
+
+#include <QImage>
+#include <QString>
+#include <QByteArray>
+#include <QVector>
+#include <QMap>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QThreadPool>
+
+class QIODevice;
+class pvQtStripJob;
+
+class pvQtEncoder
+{
+public:
+    typedef struct {
+        int quality;
+        int subsample;
+        int depth;
+        int compression;
+    } Options;
+
+    pvQtEncoder();
+    ~pvQtEncoder();
+    static Options defaults();
+    // true if the file suffix is a type we encode
+    static bool canEncode( QString name );
+    void setOptions( const Options & opt );
+    Options options(){ return m_opt; }
+    // worker threads, default all cores
+    void setThreads( int n );
+    /* write img to a file of the type given by its suffix
+       false on error, see errMsg()
+    */
+    bool save( const QImage & img, QString name );
+    const char * errMsg(){ return m_error; }
+
+private:
+    friend class pvQtStripJob;
+    enum { fmtJPEG, fmtPNG, fmtTIFF };
+    // worker side
+    void encodeStrip( int i );
+    QByteArray jpegStrip( int y0, int y1 );
+    QByteArray deflateStrip( int y0, int y1, bool filter, int i );
+    // writer side
+    bool writeStrips( QIODevice & out );
+    bool writeStrip( QIODevice & out, int i, const QByteArray & data );
+    bool jpegHeader( QIODevice & out );
+    bool pngHeader( QIODevice & out );
+    bool tiffHeader( QIODevice & out );
+    bool tiffTrailer( QIODevice & out );
+    void packRow( int y, uchar * dst );
+
+    const char * m_error;
+    Options m_opt;
+    int m_format;
+    QImage m_img;		// being written
+    int m_rows;			// image rows per strip
+    int m_strips;
+    int m_rowBytes;		// packed output row
+
+    // JPEG tables
+    int m_hs, m_vs;		// luma samples per chroma sample
+    uchar m_qt[2][64];	// quantizers, natural order
+    float m_qdiv[2][64];	// and their scaled reciprocals
+    // PNG and TIFF strip bookkeeping
+    QVector<quint32> m_adler;	// checksums of filtered rows
+    QVector<quint32> m_offsets;
+    QVector<quint32> m_counts;
+    quint32 m_adlerAll;
+
+    QThreadPool m_pool;
+    QMutex m_lock;		// guards the members below
+    QWaitCondition m_ready;
+    QMap<int, QByteArray> m_done;	// encoded, not yet written
+};
+
+#endif //ndef PVQTENCODER_H
@@ -0,0 +1,264 @@
+/*
+ * pvQtFaceStream.cpp  for Panini
+ *
+ * This file is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this file; if not, write to Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+
+  See pvQtFaceStream.h
+*/
+
+#include "pvQtFaceStream.h"
+#include "pvQtResampler.h"
+#include "pvQtColorLUT.h"
+#include <QImageReader>
+#include <cstring>
+
+// largest reduction the JPEG decoder makes by itself
+#define MAX_REDUCE	8
+// largest clip decoded in one read from a file that can be clipped
+#define SOURCE_PIXELS	(64 << 20)
+// above that, the least pixels in a band, and the most bands
+#define BAND_PIXELS	(16 << 20)
+#define MAX_BANDS	8
+
+pvQtFaceStream::pvQtFaceStream( QString path, QRect clip, QSize dims )
+    : path( path ), clip( clip ), dims( dims )
+{
+    rs = 0;
+    nextSrc = row = 0;
+    reduce = 1;
+    bandTop = bandRows = 0;
+    banded = false;
+    opened = failed = false;
+}
+
+pvQtFaceStream::pvQtFaceStream( const QImage & face )
+    : dims( face.size() ), face( face )
+{
+    rs = 0;
+    nextSrc = row = 0;
+    reduce = 1;
+    bandTop = bandRows = 0;
+    banded = false;
+    opened = true;
+    failed = false;
+    prof = pvQtColorLUT::profileOf( face );
+}
+
+pvQtFaceStream::~pvQtFaceStream()
+{
+    close();
+}
+
+/* set a reader up for the file, reduced as chosen by open().
+   The size is rounded up as libjpeg does, so the decoder scales
+   by itself and can still clip.
+*/
+bool pvQtFaceStream::startReader( QImageReader & ir )
+{
+    ir.setFileName( path );
+    if( !ir.canRead() ) return false;
+    if( reduce > 1 ) {
+        QSize full = ir.size();
+        ir.setScaledSize( QSize( ( full.width() + reduce - 1 ) / reduce,
+                                 ( full.height() + reduce - 1 ) / reduce ) );
+    }
+    return true;
+}
+
+bool pvQtFaceStream::open()
+{
+    opened = true;
+    QImageReader ir;
+    if( !startReader( ir ) ) {
+        failed = true;
+        return false;
+    }
+
+    /* let a JPEG decoder reduce by the largest power of 2 that
+       still leaves at least a face's worth of pixels in the clip
+    */
+    QSize full = ir.size();
+    if( full.isValid() && ( ir.format() == "jpeg" || ir.format() == "jpg" )
+        && ir.supportsOption( QImageIOHandler::ScaledSize ) ) {
+        while( 2 * reduce <= MAX_REDUCE
+               && clip.width() / ( 2 * reduce ) >= dims.width()
+               && clip.height() / ( 2 * reduce ) >= dims.height() ) {
+            reduce *= 2;
+        }
+    }
+
+    /* a decoder that can clip (JPEG's can) is asked for the clip a
+       band of rows at a time; anything else is decoded whole
+    */
+    banded = full.isValid()
+            && ir.supportsOption( reduce > 1 ? QImageIOHandler::ScaledClipRect
+                                             : QImageIOHandler::ClipRect );
+    if( reduce > 1 ) {
+        ir.setScaledSize( QSize( ( full.width() + reduce - 1 ) / reduce,
+                                 ( full.height() + reduce - 1 ) / reduce ) );
+    }
+
+    QSize decoded;
+    if( banded ) {
+        decoded = reduce > 1 ? ir.scaledSize() : full;
+    } else {
+        src = ir.read();
+        if( src.isNull() ) {
+            qWarning("face stream: can't read %s: %s", qPrintable( path ),
+                     qPrintable( ir.errorString() ) );
+            failed = true;
+            return false;
+        }
+        prof = pvQtColorLUT::profileOf( src );
+        decoded = src.size();
+        if( !full.isValid() ) full = decoded;
+    }
+
+    // the clip, in the image as decoded
+    double kx = double( decoded.width() ) / full.width(),
+           ky = double( decoded.height() ) / full.height();
+    srcClip = QRect( int( clip.x() * kx ), int( clip.y() * ky ),
+                     qMax( 1, int( clip.width() * kx + 0.5 ) ),
+                     qMax( 1, int( clip.height() * ky + 0.5 ) ) )
+            & QRect( QPoint( 0, 0 ), decoded );
+    if( srcClip.isEmpty() || dims.isEmpty() ) {
+        close();
+        failed = true;
+        return false;
+    }
+
+    /* each band is a fresh read that decodes and skips the rows
+       above it, so a clip is banded only if it is too big to decode
+       at once, and then in few bands: the work stays linear
+    */
+    if( banded ) {
+        int w = srcClip.width(), h = srcClip.height();
+        if( qint64( w ) * h <= SOURCE_PIXELS ) {
+            bandRows = h;
+        } else {
+            bandRows = qMax( qMax( 1, BAND_PIXELS / w ),
+                             ( h + MAX_BANDS - 1 ) / MAX_BANDS );
+        }
+    }
+
+    if( srcClip.size() != dims ) {
+        rs = new pvQtResampler( srcClip.size(), dims );
+    }
+    return true;
+}
+
+/* decode the band of clip rows starting at y
+*/
+bool pvQtFaceStream::readBand( int y )
+{
+    band = QImage();
+    QImageReader ir;
+    if( !startReader( ir ) ) return false;
+    int h = qMin( bandRows, srcClip.height() - y );
+    QRect r( srcClip.x(), srcClip.y() + y, srcClip.width(), h );
+    if( reduce > 1 ) ir.setScaledClipRect( r );
+    else ir.setClipRect( r );
+    band = ir.read();
+    if( band.isNull() || band.height() < h ) {
+        qWarning("face stream: can't read %s: %s", qPrintable( path ),
+                 qPrintable( ir.errorString() ) );
+        band = QImage();
+        return false;
+    }
+    if( y == 0 ) prof = pvQtColorLUT::profileOf( band );
+    bandTop = y;
+    return true;
+}
+
+void pvQtFaceStream::close()
+{
+    delete rs;
+    rs = 0;
+    src = QImage();
+    band = QImage();
+    face = QImage();
+    line.clear();
+}
+
+/* row y of the clip, in ARGB32 or RGB32; other formats are
+   converted a row at a time.  0 if the file can't be read.
+*/
+const QRgb * pvQtFaceStream::srcRow( int y )
+{
+    const QImage * img = &src;
+    int x0 = srcClip.x(), sy = srcClip.y() + y;
+    if( banded ) {
+        if( band.isNull() || y < bandTop || y >= bandTop + band.height() ) {
+            if( !readBand( y ) ) return 0;
+        }
+        img = &band;
+        x0 = 0;
+        sy = y - bandTop;
+    }
+
+    QImage::Format fmt = img->format();
+    if( fmt == QImage::Format_RGB32 || fmt == QImage::Format_ARGB32 ) {
+        return (const QRgb *)img->constScanLine( sy ) + x0;
+    }
+    QImage rgb = QImage( img->constScanLine( sy ), img->width(), 1,
+                         img->bytesPerLine(), fmt );
+    if( fmt == QImage::Format_Indexed8 || fmt == QImage::Format_Mono
+        || fmt == QImage::Format_MonoLSB ) rgb.setColorTable( img->colorTable() );
+    rgb = rgb.convertToFormat( QImage::Format_ARGB32 );
+    line.resize( srcClip.width() );
+    memcpy( line.data(), (const QRgb *)rgb.constScanLine( 0 ) + x0,
+            4 * srcClip.width() );
+    return line.constData();
+}
+
+bool pvQtFaceStream::readRows( uchar * bits, int bpl, int count )
+{
+    count = qMin( count, dims.height() - row );
+    if( count <= 0 ) return true;
+    if( failed || ( !opened && !open() ) ) return false;
+
+    if( !face.isNull() ){
+        int n = qMin( bpl, face.bytesPerLine() );
+        for( int y = 0; y < count; y++ ){
+            memcpy( bits + y * bpl, face.constScanLine( row + y ), n );
+        }
+    } else if( rs ){
+        rs->setBand( bits, bpl, row, count );
+        while( rs->wantsRows() ){
+            const QRgb * s = srcRow( nextSrc++ );
+            if( !s ) return fail();
+            rs->addRow( s );
+        }
+    } else {
+        for( int y = 0; y < count; y++ ){
+            const QRgb * s = srcRow( row + y );
+            if( !s ) return fail();
+            memcpy( bits + y * bpl, s, 4 * dims.width() );
+        }
+    }
+    row += count;
+
+    // done with the source
+    if( row >= dims.height() ) close();
+    return true;
+}
+
+bool pvQtFaceStream::fail()
+{
+    close();
+    failed = true;
+    return false;
+}
@@ -0,0 +1,100 @@
+/*
+ * pvQtFaceStream.h  for Panini
+ *
+ * This file is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this file; if not, write to Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+
+  pvQtFaceStream delivers a face image a band of rows at a time,
+  top to bottom, into memory the caller provides: a mapped pixel
+  buffer, or a small band image.  So a face goes to its texture
+  without ever being held whole.
+
+  A stream made from an image file reads it when the first rows
+  are asked for -- on whatever thread reads them -- and resamples
+  the clip rectangle into each band as it goes (see pvQtResampler).
+  JPEG files are decoded at a reduced size where that still covers
+  the face, by the decoder's own scaling.  Where the decoder can
+  clip (JPEG's can), a clip of up to 64M pixels is decoded in one
+  read; a bigger one in at most 8 bands, so the source held is
+  a fraction of the file's size.  Each band is a fresh read that
+  decodes and skips the rows above it, so the bands are few to
+  keep that work in proportion to the file.  Other formats (TIFF, PNG) are decoded
+  whole and held until the last row is out, as an image of their
+  own format; rows are converted to ARGB32 one at a time.  Faces
+  of other sources are streamed from a face image made already (see
+  pvQtPic::FaceImage()).
+
+  A stream holds no reference to the pvQtPic that made it, so it
+  can be read on the texture loader's thread.
+*/
+
+#ifndef PVQTFACESTREAM_H
+#define PVQTFACESTREAM_H
+
+#include <QImage>
+#include <QVector>
+
+class pvQtResampler;
+class QImageReader;
+
+class pvQtFaceStream
+{
+public:
+    // the clip rectangle of an image file, resampled to dims
+    pvQtFaceStream( QString path, QRect clip, QSize dims );
+    // a face image made already
+    pvQtFaceStream( const QImage & face );
+    ~pvQtFaceStream();
+
+    // of the face
+    QSize size(){ return dims; }
+    /* write the next count rows, Format_ARGB32, bpl bytes apart
+       at bits; false if the source can't be read
+    */
+    bool readRows( uchar * bits, int bpl, int count );
+    // rows written so far
+    int rowsDone(){ return row; }
+    // ICC profile of the source, once rows have been read; "" is sRGB
+    QByteArray profile(){ return prof; }
+
+private:
+    Q_DISABLE_COPY( pvQtFaceStream )
+    bool open();	// look at the file, decode it if it can't clip
+    bool startReader( QImageReader & ir );
+    bool readBand( int y );	// clip rows from y
+    void close();	// free the source
+    bool fail();
+    const QRgb * srcRow( int y );	// in the clip
+
+    QString path;
+    QRect clip;	// in the file's image
+    QSize dims;
+    QImage face;	// made already, or null
+    int reduce;	// JPEG scale down factor
+    bool banded;	// decoded a band at a time
+    QImage src;	// decoded whole, perhaps reduced, if not banded
+    QImage band;	// clip rows from bandTop, if banded
+    int bandTop;
+    int bandRows;	// clip rows in a band
+    QRect srcClip;	// clip in the decoded image
+    QVector<QRgb> line;	// a converted row
+    pvQtResampler * rs;	// 0 if srcClip is the face size
+    int nextSrc;	// src row for the resampler
+    int row;	// face row
+    bool opened, failed;
+    QByteArray prof;
+};
+
+#endif //ndef PVQTFACESTREAM_H
@@ -0,0 +1,136 @@
+/*
+ * pvQtImagePool.cpp  for Panini
+ *
+ * This file is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this file; if not, write to Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+
+  See pvQtImagePool.h
+*/
+
+#include "pvQtImagePool.h"
+#include <QMutexLocker>
+
+// buffer alignment, also the size of the header before the pixels
+#define POOL_ALIGN	64
+// default idle buffer limit, megabytes
+#define DEFAULT_IDLE	256
+
+/* a buffer's header; the pixels follow it, at the next
+   POOL_ALIGN boundary
+*/
+struct pvQtImagePool::Buffer {
+    pvQtImagePool * pool;
+    qint64 bytes;	// of pixels
+    uchar * pixels(){ return (uchar *)this + POOL_ALIGN; }
+};
+
+pvQtImagePool * pvQtImagePool::faces()
+{
+    // never deleted, as images may outlive static destructors
+    static pvQtImagePool * p = new pvQtImagePool( qint64( DEFAULT_IDLE ) << 20 );
+    return p;
+}
+
+pvQtImagePool::pvQtImagePool( qint64 idleLimit )
+{
+    m_limit = idleLimit;
+    m_stats.inUse = m_stats.idle = m_stats.peak = 0;
+    m_stats.allocated = m_stats.served = 0;
+}
+
+pvQtImagePool::~pvQtImagePool()
+{
+    trim();
+}
+
+QImage pvQtImagePool::image( QSize dims, QImage::Format fmt )
+{
+    int depth = QImage( 1, 1, fmt ).depth();
+    int w = dims.width(), h = dims.height();
+    if( w <= 0 || h <= 0 || depth <= 0 ) return QImage();
+    int bpl = ( ( w * depth + 31 ) / 32 ) * 4;	// packed, as QImage needs
+    qint64 bytes = qint64( bpl ) * h;
+
+    Buffer * b = 0;
+    {
+        QMutexLocker lk( &m_mutex );
+        for( int i = m_idle.count() - 1; i >= 0; i-- ){
+            if( m_idle[i]->bytes == bytes ){
+                b = m_idle.takeAt( i );
+                m_stats.idle -= bytes;
+                break;
+            }
+        }
+        if( !b ){
+            // make room first
+            freeIdle( m_limit - bytes );
+            b = (Buffer *)qMallocAligned( size_t( POOL_ALIGN + bytes ), POOL_ALIGN );
+            if( !b ){
+                qWarning("image pool: can't allocate %lld bytes", bytes );
+                return QImage();
+            }
+            b->pool = this;
+            b->bytes = bytes;
+            m_stats.allocated += bytes;
+        }
+        m_stats.inUse += bytes;
+        m_stats.served += bytes;
+        m_stats.peak = qMax( m_stats.peak, m_stats.inUse + m_stats.idle );
+    }
+    return QImage( b->pixels(), w, h, bpl, fmt, release, b );
+}
+
+void pvQtImagePool::release( void * info )
+{
+    Buffer * b = (Buffer *)info;
+    b->pool->recycle( b );
+}
+
+void pvQtImagePool::recycle( Buffer * b )
+{
+    QMutexLocker lk( &m_mutex );
+    m_stats.inUse -= b->bytes;
+    m_idle.append( b );
+    m_stats.idle += b->bytes;
+    freeIdle( m_limit );
+}
+
+void pvQtImagePool::freeIdle( qint64 keep )
+{
+    while( !m_idle.isEmpty() && m_stats.idle > qMax( keep, qint64( 0 ) ) ){
+        Buffer * b = m_idle.takeFirst();
+        m_stats.idle -= b->bytes;
+        qFreeAligned( b );
+    }
+}
+
+void pvQtImagePool::setIdleLimit( qint64 bytes )
+{
+    QMutexLocker lk( &m_mutex );
+    m_limit = bytes;
+    freeIdle( m_limit );
+}
+
+void pvQtImagePool::trim()
+{
+    QMutexLocker lk( &m_mutex );
+    freeIdle( 0 );
+}
+
+pvQtImagePool::Stats pvQtImagePool::stats()
+{
+    QMutexLocker lk( &m_mutex );
+    return m_stats;
+}
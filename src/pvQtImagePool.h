@@ -0,0 +1,80 @@
+/*
+ * pvQtImagePool.h  for Panini
+ *
+ * This file is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this file; if not, write to Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+
+  pvQtImagePool recycles the pixel buffers of face images.  Faces
+  are big (up to the largest texture OpenGL takes) and come in sets
+  of the same size, picture after picture, so rather than allocate
+  and free one for every face of every load, image() hands out a
+  QImage on a pooled buffer.  When the last copy of that QImage is
+  gone the buffer goes back to the pool, to be handed out again for
+  the next image of the same size.  Idle buffers beyond a limit are
+  freed, least recently used first.
+
+  Buffers are 64-byte aligned, and rows are packed (bytesPerLine is
+  width * 4 for the 32 bit formats), so a face uploads to OpenGL
+  with the default unpack state.  Images are released from any
+  thread (e.g. the texture loader's); the pool is thread safe.
+
+  stats() measures the memory: bytes in use and idle now, the peak
+  of the two together, and the totals allocated and handed out, so
+  the reuse rate is served / allocated.
+*/
+
+#ifndef PVQTIMAGEPOOL_H
+#define PVQTIMAGEPOOL_H
+
+#include <QImage>
+#include <QMutex>
+#include <QList>
+
+class pvQtImagePool
+{
+public:
+    // the one used for face images
+    static pvQtImagePool * faces();
+
+    pvQtImagePool( qint64 idleLimit );
+    ~pvQtImagePool();	// images must be released first
+    // an uninitialized image on a pooled buffer, null on failure
+    QImage image( QSize dims, QImage::Format fmt );
+    // bytes of idle buffers to keep
+    void setIdleLimit( qint64 bytes );
+    // free all idle buffers
+    void trim();
+
+    typedef struct {
+        qint64 inUse;	// bytes held by images
+        qint64 idle;	// bytes kept for reuse
+        qint64 peak;	// most inUse + idle at any time
+        qint64 allocated;	// total bytes allocated
+        qint64 served;	// total bytes of images handed out
+    } Stats;
+    Stats stats();
+
+private:
+    struct Buffer;
+    static void release( void * info );	// QImageCleanupFunction
+    void recycle( Buffer * b );
+    void freeIdle( qint64 keep );	// call locked
+    QMutex m_mutex;
+    QList<Buffer *> m_idle;	// most recently used last
+    qint64 m_limit;
+    Stats m_stats;
+};
+
+#endif //ndef PVQTIMAGEPOOL_H
@@ -0,0 +1,188 @@
+/*
+ * pvQtMovie.cpp  for Panini
+ *
+ * This file is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this file; if not, write to Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+
+  See pvQtMovie.h
+*/
+
+#include "pvQtMovie.h"
+#include <QFileInfo>
+#include <QThread>
+#include <cstdio>
+
+/* encodes one frame
+*/
+class pvQtFrameJob : public QRunnable
+{
+public:
+    pvQtFrameJob( pvQtMovie * mov, int n, const QImage & img, bool bottomUp )
+        : m_mov( mov ), m_n( n ), m_img( img ), m_bottomUp( bottomUp ) {}
+    void run(){
+        if( !m_mov->encode( m_n, m_img, m_bottomUp ) ) m_mov->m_failed.ref();
+        m_mov->m_slots.release();
+    }
+private:
+    pvQtMovie * m_mov;
+    int m_n;
+    QImage m_img;
+    bool m_bottomUp;
+};
+
+pvQtMovie::pvQtMovie()
+{
+    m_error = 0;
+    m_stream = false;
+    m_frames = 0;
+    m_next = 0;
+    int n = QThread::idealThreadCount();
+    m_pool.setMaxThreadCount( n );
+    m_slots.release( 2 * n );
+}
+
+pvQtMovie::~pvQtMovie()
+{
+    finish();
+}
+
+bool pvQtMovie::isStream( QString name )
+{
+    return name == "-" || QFileInfo( name ).suffix().toLower() == "y4m";
+}
+
+bool pvQtMovie::open( QString name, QSize size, int fps )
+{
+    m_size = size;
+    m_frames = m_next = 0;
+    m_stream = isStream( name );
+    if( size.isEmpty() || fps < 1 ){
+        m_error = "bad frame size or rate";
+        return false;
+    }
+    if( !m_stream ){
+        QFileInfo fi( name );
+        m_name = fi.path() + "/" + fi.completeBaseName() + "_";
+        m_suffix = fi.suffix().isEmpty() ? QString("jpg") : fi.suffix();
+        m_error = 0;
+        return true;
+    }
+
+    if( ( size.width() & 1 ) || ( size.height() & 1 ) ){
+        m_error = "stream frame size must be even";
+        return false;
+    }
+    bool ok;
+    if( name == "-" ){
+        ok = m_file.open( stdout, QIODevice::WriteOnly );
+    } else {
+        m_file.setFileName( name );
+        ok = m_file.open( QIODevice::WriteOnly | QIODevice::Truncate );
+    }
+    if( !ok ){
+        m_error = "can't open output file";
+        return false;
+    }
+    QByteArray hdr = QString("YUV4MPEG2 W%1 H%2 F%3:1 Ip A1:1 C420jpeg\n")
+                     .arg( size.width() ).arg( size.height() ).arg( fps ).toLatin1();
+    if( m_file.write( hdr ) != hdr.size() ){
+        m_error = "can't write output file";
+        return false;
+    }
+    m_error = 0;
+    return true;
+}
+
+void pvQtMovie::addFrame( const QImage & img, bool bottomUp )
+{
+    m_slots.acquire();
+    m_pool.start( new pvQtFrameJob( this, m_frames++, img, bottomUp ) );
+}
+
+bool pvQtMovie::finish()
+{
+    m_pool.waitForDone();
+    if( m_file.isOpen() ){
+        m_file.flush();
+        m_file.close();
+    }
+    if( m_failed.load() && !m_error ) m_error = "frame encoding failed";
+    return m_failed.load() == 0;
+}
+
+/* worker: save an image file, or convert to YUV 4:2:0 and
+   pass to writeFrame()
+*/
+bool pvQtMovie::encode( int n, QImage img, bool bottomUp )
+{
+    if( !m_stream ){
+        if( img.size() != m_size ) return false;
+        if( bottomUp ) img = img.mirrored();
+        QString name = m_name + QString("%1.").arg( n + 1, 5, 10, QChar('0') ) + m_suffix;
+        return img.save( name );
+    }
+
+    if( img.size() == m_size && bottomUp ) img = img.mirrored();
+    if( img.format() != QImage::Format_RGB32
+        && img.format() != QImage::Format_ARGB32 ){
+        img = img.convertToFormat( QImage::Format_RGB32 );
+    }
+    if( img.size() != m_size ){
+        // let the frames after it be written
+        writeFrame( n, QByteArray() );
+        return false;
+    }
+    int w = m_size.width(), h = m_size.height();
+    QByteArray yuv( w * h * 3 / 2, 0 );
+    uchar * py = (uchar *)yuv.data(),
+          * pu = py + w * h,
+          * pv = pu + w * h / 4;
+    for( int y = 0; y < h; y += 2 ){
+        const QRgb * r0 = (const QRgb *)img.constScanLine( y );
+        const QRgb * r1 = (const QRgb *)img.constScanLine( y + 1 );
+        uchar * y0 = py + y * w, * y1 = y0 + w;
+        for( int x = 0; x < w; x += 2 ){
+            QRgb p[4] = { r0[x], r0[x+1], r1[x], r1[x+1] };
+            int rs = 0, gs = 0, bs = 0;
+            for( int i = 0; i < 4; i++ ){
+                int r = qRed( p[i] ), g = qGreen( p[i] ), b = qBlue( p[i] );
+                uchar lum = uchar( 16 + ( ( 66 * r + 129 * g + 25 * b + 128 ) >> 8 ) );
+                if( i < 2 ) y0[x + i] = lum;
+                else y1[x + i - 2] = lum;
+                rs += r; gs += g; bs += b;
+            }
+            rs = ( rs + 2 ) >> 2; gs = ( gs + 2 ) >> 2; bs = ( bs + 2 ) >> 2;
+            *pu++ = uchar( 128 + ( ( -38 * rs - 74 * gs + 112 * bs + 128 ) >> 8 ) );
+            *pv++ = uchar( 128 + ( ( 112 * rs - 94 * gs - 18 * bs + 128 ) >> 8 ) );
+        }
+    }
+    writeFrame( n, yuv );
+    return true;
+}
+
+// write converted frames in order; an empty one failed, and is skipped
+void pvQtMovie::writeFrame( int n, const QByteArray & yuv )
+{
+    QMutexLocker lock( &m_lock );
+    m_pending.insert( n, yuv );
+    while( m_pending.contains( m_next ) ){
+        QByteArray f = m_pending.take( m_next++ );
+        if( f.isEmpty() ) continue;
+        if( m_file.write( "FRAME\n", 6 ) != 6
+            || m_file.write( f ) != f.size() ){
+            m_failed.ref();
+        }
+    }
+}
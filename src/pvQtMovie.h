@@ -0,0 +1,92 @@
+/*
+ * pvQtMovie.h  for Panini
+ *
+ * This file is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this file; if not, write to Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+
+  pvQtMovie writes a series of rendered frames, encoding them on
+  a pool of worker threads while the caller goes on rendering.
+
+  The output is either
+    an image sequence: name.jpg gives name_00001.jpg, name_00002.jpg
+      ... in any format QImageWriter supports, or
+    a YUV4MPEG2 stream (name ends in .y4m, or is "-" for standard
+      output): 4:2:0 8 bit video, BT.601 studio range, that video
+      encoders such as ffmpeg and x264 read directly.  A named
+      pipe works too.
+  Stream frames are converted in parallel but written in order.
+
+  addFrame() blocks while too many frames are waiting, so memory
+  use stays bounded however fast frames are rendered.
+*/
+
+#ifndef PVQTMOVIE_H
+#define PVQTMOVIE_H
+
+#include <QImage>
+#include <QString>
+#include <QFile>
+#include <QMap>
+#include <QMutex>
+#include <QSemaphore>
+#include <QThreadPool>
+#include <QAtomicInt>
+
+class pvQtFrameJob;
+
+class pvQtMovie
+{
+public:
+    pvQtMovie();
+    ~pvQtMovie();
+    // true if name selects the stream format
+    static bool isStream( QString name );
+    /* start writing; stream dimensions must be even
+       false on error, see errMsg()
+    */
+    bool open( QString name, QSize size, int fps = 25 );
+    /* queue a frame for encoding; bottomUp if its rows are in
+       OpenGL order.  Frames must all be the open() size.
+    */
+    void addFrame( const QImage & img, bool bottomUp = false );
+    // wait for all frames to be written and close
+    bool finish();
+    int frameCount(){ return m_frames; }
+    // a frame has failed to encode or write; see finish()
+    bool failed(){ return m_failed.load() != 0; }
+    const char * errMsg(){ return m_error; }
+
+private:
+    friend class pvQtFrameJob;
+    // worker side
+    bool encode( int n, QImage img, bool bottomUp );
+    void writeFrame( int n, const QByteArray & yuv );
+
+    const char * m_error;
+    bool m_stream;
+    QString m_name;		// sequence: path/base_
+    QString m_suffix;	// and file type
+    QSize m_size;
+    int m_frames;		// frames added
+    QFile m_file;		// stream output
+    QThreadPool m_pool;
+    QSemaphore m_slots;	// frames that may be waiting
+    QMutex m_lock;		// guards the members below
+    QMap<int, QByteArray> m_pending;	// converted, not yet written
+    int m_next;			// next frame to write
+    QAtomicInt m_failed;
+};
+
+#endif //ndef PVQTMOVIE_H
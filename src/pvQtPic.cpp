@@ -81,6 +81,11 @@
  */
 
 #include "pvQtPic.h"
+#include "pvQtPyramid.h"
+#include "pvQtColorLUT.h"
+#include "pvQtImagePool.h"
+#include "pvQtResampler.h"
+#include "pvQtFaceStream.h"
 #include <cmath>
 
 #ifndef Pi
@@ -95,7 +100,8 @@ enum{
     QIMAGE_KIND,
     RASTER_KIND,
     FILE_KIND,
-    URL_KIND
+    URL_KIND,
+    PYRAMID_KIND
 };
 
 #define kcode(bpc,cpp,isfp,pack,align) \
@@ -228,7 +234,7 @@ double pvQtPic::scalefov( int proj, double fov,
     if( pix == 0 ) {
         return 0;
     }
-    double r = topix / pix;
+    double r = double(topix) / pix;
 
     return rad2fov( proj, r * fov2rad( proj, fov ) );
 }
@@ -346,6 +352,7 @@ pvQtPic::pvQtPic( pvQtPic::PicType t )
     // zero the cached image pointers so
     // we won't try to delete them
     for(int i = 0; i < 6; i++ ) addrs[i] = 0;
+    generation = 0;
     // set up for the given pic type, or none
     picTypes = new pictureTypes();
     if( !setType( t ) ) setType( nil );
@@ -364,6 +371,7 @@ bool pvQtPic::setType( pvQtPic::PicType t )
 */
 
     type = nil; // disable API
+    lens = idealLens();
 
     // pixel format for face images
     faceformat = PVQT_PIC_FACE_FORMAT;
@@ -420,7 +428,7 @@ bool pvQtPic::setType( pvQtPic::PicType t )
 }
 
 // Clear a face image info entry
-// after deleting any associated QImage
+// after releasing any associated QImage
 // note raster images are not deleted
 // note preserves label, border and fill
 void pvQtPic::removeImg( int i ){
@@ -428,15 +436,15 @@ void pvQtPic::removeImg( int i ){
         return;
     }
 
-    if(	kinds[i] == QIMAGE_KIND && addrs[i] != 0 ) {
-        delete (QImage *)addrs[i];
-    }
+    imgs[i] = QImage();
+    ++generation;	// every change of source passes here
 
     accept[i] = false;
     kinds[i] = 0; // coded source type
     idims[i] = QSize(0,0); // source dimensions
     names[i]  = QString(); // path or url
     formats[i] = 0; // pixel format
+    iccs[i] = QByteArray(); // color profile
 }
 
 /*
@@ -654,6 +662,7 @@ bool pvQtPic::setLabel( pvQtPic::PicFace face, QString label )
             labels[i] = label;
         }
     }
+    ++generation;
     return true;
 }
 
@@ -677,6 +686,7 @@ bool pvQtPic::setBorder( pvQtPic::PicFace face, QColor color )
         }
     }
 
+    ++generation;
     return true;
 }
 
@@ -699,6 +709,7 @@ bool pvQtPic::setFill( pvQtPic::PicFace face, QColor color )
         fills[i] = color;
     }
 
+    ++generation;
     return true;
 }
 
@@ -712,14 +723,14 @@ bool pvQtPic::setFill( pvQtPic::PicFace face, QColor color )
  *
  * It is an error to assign to a face that already has an image,
  * however you can remove any assigned image by passing a null
- * pointer to the 'QImage *' version of setFaceImage.
+ * QImage to setFaceImage.
  *
  * All source images for a cubic picture must	be the same size,
  * and square, and will be adjusted to the same display size.
  * It is not required to assign a full set of these images as
  * there is a default "empty" image for every face.
 */
-bool pvQtPic::setFaceImage( pvQtPic::PicFace face, QImage * img )
+bool pvQtPic::setFaceImage( pvQtPic::PicFace face, const QImage & img )
 {
     if( type == nil ) {
         return false;
@@ -730,7 +741,7 @@ bool pvQtPic::setFaceImage( pvQtPic::PicFace face, QImage * img )
 
     int i = int(face);
 
-    if( img == 0 ){	// remove any assigned image
+    if( img.isNull() ){	// remove any assigned image
         if( kinds[i] && numimgs > 0 ) {
             --numimgs;
         }
@@ -745,10 +756,10 @@ bool pvQtPic::setFaceImage( pvQtPic::PicFace face, QImage * img )
 
     removeImg( i );
     kinds[i] = QIMAGE_KIND;
-    addrs[i] = img;
-    formats[i] = img->format();
+    imgs[i] = img;
+    formats[i] = img.format();
 
-    return addimgsize( i, img->size() );
+    return addimgsize( i, img.size() );
 }
 
 bool pvQtPic::setFaceImage( pvQtPic::PicFace face,
@@ -837,6 +848,211 @@ bool pvQtPic::setFaceImage( pvQtPic::PicFace face, QUrl url )
     return false;
 }
 
+/*
+ * A tiled pyramid supplies its base level for every face;
+ * it is not owned or deleted by the pic.
+*/
+bool pvQtPic::setFaceImage( pvQtPic::PicFace face, pvQtPyramid * pyr )
+{
+    if( type == nil || pyr == 0 ) {
+        return false;
+    }
+    if( face < front || face >= PicFace(maxfaces) ) {
+        return false;
+    }
+    if( pyr->isCube() != (type == cub) || face >= PicFace(pyr->faceCount()) ) {
+        return false;
+    }
+    int i = int(face);
+    if( type != cub && kinds[i] != 0 ) {
+        return false;
+    }
+
+    removeImg( i );
+    kinds[i] = PYRAMID_KIND;
+    addrs[i] = pyr;
+
+    return addimgsize( i, pyr->levelSize( pyr->baseLevel() ) );
+}
+
+pvQtPyramid * pvQtPic::Pyramid()
+{
+    for( int i = 0; i < maxfaces; i++ ){
+        if( kinds[i] == PYRAMID_KIND ) {
+            return (pvQtPyramid *)(addrs[i]);
+        }
+    }
+    return 0;
+}
+
+QString pvQtPic::FaceFile( PicFace face )
+{
+    int i = int(face);
+    if( i < 0 || i >= maxfaces || kinds[i] != FILE_KIND ) {
+        return QString();
+    }
+    return names[i];
+}
+
+/*
+ * Lens correction
+ */
+pvQtPic::LensParams pvQtPic::idealLens()
+{
+    LensParams lp;
+    lp.a = lp.b = lp.c = 0;
+    lp.d = lp.e = 0;
+    lp.vb = lp.vc = lp.vd = 0;
+    return lp;
+}
+
+bool pvQtPic::setLens( LensParams lp )
+{
+    if( type != rec && type != eqs && type != eqa ) {
+        return false;
+    }
+    lens = lp;
+    return true;
+}
+
+bool pvQtPic::hasLens()
+{
+    return lens.a != 0 || lens.b != 0 || lens.c != 0
+           || lens.d != 0 || lens.e != 0
+           || lens.vb != 0 || lens.vc != 0 || lens.vd != 0;
+}
+
+QByteArray pvQtPic::ColorProfile()
+{
+    for( int i = 0; i < maxfaces; i++ ){
+        if( !iccs[i].isEmpty() ) {
+            return iccs[i];
+        }
+    }
+    return QByteArray();
+}
+
+/*
+ * Texture cache
+  Each entry is one face image, stored raw so it loads with a
+  single read.  Its file name is a digest of everything that
+  went into making it: the source file path, size and date, the
+  clip rectangle and the face size and format.  The source's color
+  profile follows the header, so cached faces stay color managed.
+*/
+static const char cacheMagic[] = "pvQtTex2";
+
+QString pvQtPic::faceKey( QString path, QRect clip, QSize dims,
+                          QImage::Format fmt )
+{
+    QFileInfo fi( path );
+    QString key = QString("%1 %2 %3 %4 %5 %6 %7 %8 %9 %10")
+            .arg( fi.absoluteFilePath() )
+            .arg( fi.size() )
+            .arg( fi.lastModified().toMSecsSinceEpoch() )
+            .arg( clip.x() ).arg( clip.y() )
+            .arg( clip.width() ).arg( clip.height() )
+            .arg( dims.width() ).arg( dims.height() )
+            .arg( int(fmt) );
+    return QString( QCryptographicHash::hash( key.toUtf8(),
+                                              QCryptographicHash::Md5 ).toHex() );
+}
+
+QString pvQtPic::cacheName( int i )
+{
+    return faceKey( names[i], imageclip, facedims, faceformat ) + ".tex";
+}
+
+// the source clip rectangle of face i, as FaceImage() sets it
+QRect pvQtPic::faceClip( int i )
+{
+    int dx = idims[i].width(),
+            dy = idims[i].height();
+    return QRect(
+                int( dx * cliprect.x()),
+                int( dy * cliprect.y()),
+                int( dx * cliprect.width()),
+                int( dy * cliprect.height())
+                );
+}
+
+QString pvQtPic::FaceKey( PicFace face )
+{
+    int i = int(face);
+    if( type == nil || i < 0 || i >= maxfaces || kinds[i] != FILE_KIND ) {
+        return QString();
+    }
+    return faceKey( names[i], faceClip( i ), facedims, faceformat );
+}
+
+// the cached face image, or a null one if there is none
+QImage pvQtPic::readCache( int i )
+{
+    if( cachedir.isEmpty() ) {
+        return QImage();
+    }
+    QFile f( cachedir + "/" + cacheName( i ) );
+    if( !f.open( QIODevice::ReadOnly ) ) {
+        return QImage();
+    }
+    QDataStream ds( &f );
+    QByteArray magic, icc;
+    qint32 w, h, fmt;
+    ds >> magic >> w >> h >> fmt >> icc;
+    if( ds.status() != QDataStream::Ok || magic != cacheMagic
+        || QSize( w, h ) != facedims || fmt != int(faceformat) ) {
+        return QImage();
+    }
+    QImage img = pvQtImagePool::faces()->image( facedims, faceformat );
+    int n = img.bytesPerLine() * h;
+    if( img.isNull() || ds.readRawData( (char *)img.bits(), n ) != n ) {
+        return QImage();
+    }
+    pvQtColorLUT::setProfile( img, icc );
+    return img;
+}
+
+bool pvQtPic::cacheFaces( QString dir )
+{
+    if( type == nil || !QDir().mkpath( dir ) ) {
+        return false;
+    }
+    QString was = cachedir;
+    cachedir = QString();	// make them afresh
+    QStringList keep;
+    bool ok = true;
+
+    for( int i = 0; ok && i < maxfaces; i++ ){
+        if( kinds[i] != FILE_KIND || !QFileInfo( names[i] ).exists() ) {
+            continue;
+        }
+        const QImage img = FaceImage( PicFace(i) );	// sets imageclip
+        QString name = cacheName( i );
+        QFile f( dir + "/" + name );
+        ok = !img.isNull() && f.open( QIODevice::WriteOnly );
+        if( ok ){
+            QDataStream ds( &f );
+            ds << QByteArray( cacheMagic ) << qint32( img.width() )
+               << qint32( img.height() ) << qint32( img.format() )
+               << pvQtColorLUT::profileOf( img );
+            int n = img.bytesPerLine() * img.height();
+            ok = ds.writeRawData( (const char *)img.constBits(), n ) == n
+                 && ds.status() == QDataStream::Ok;
+            keep << name;
+        }
+    }
+    cachedir = was;
+
+    // drop entries for other pictures and sizes
+    QDir d( dir );
+    foreach( QString e, d.entryList( QStringList("*.tex"), QDir::Files ) ){
+        if( !keep.contains( e ) ) {
+            d.remove( e );
+        }
+    }
+    return ok;
+}
+
 /*
  * common final stage of assigning an image to a face.
  * called by all setFaceImage() overloads.
@@ -950,70 +1166,103 @@ QColor	pvQtPic::getFill( PicFace face )
 
   FaceImage() delivers a displayable image, which it gets
   by calling a reader for the appropriate source.  Readers
-  return new images of size facedims in the native pixel
-  format of the source; FaceImage converts pixel format if
-  necessary.
+  return images of size facedims, normally in faceformat on
+  a pooled buffer (see pvQtImagePool), made by resampling the
+  source rows in place (see pvQtResampler), so there are no
+  clipped, scaled or converted copies of the source.  The
+  face goes back to the pool when the caller's last copy of
+  the QImage is gone.  FaceImage converts pixel format if a
+  reader could not.
 **/
 
-QImage * pvQtPic::FaceImage( PicFace face ){
+QImage pvQtPic::FaceImage( PicFace face ){
     if( type == nil ) {
-        return 0;
+        return QImage();
     }
     if( face < front || face >= PicFace(maxfaces) ) {
-        return 0;
+        return QImage();
     }
 
-    QImage * pim = 0;
+    QImage img;
     int i = int(face);
 
     if( !idims[i].isNull() ){
         // set clipping rectangle for this face's image (allows mixed-size cube faces
-        int dx = idims[i].width(),
-                dy = idims[i].height();
-        imageclip = QRect(
-                    int( dx * cliprect.x()),
-                    int( dy * cliprect.y()),
-                    int( dx * cliprect.width()),
-                    int( dy * cliprect.height())
-                    );
+        imageclip = faceClip( i );
 
         switch( kinds[i] ){
         case QIMAGE_KIND:
-            pim = loadQImage( i );
+            img = loadQImage( i );
             break;
         case RASTER_KIND:
-            pim = loadRaster( i );
+            img = loadRaster( i );
             break;
         case FILE_KIND:
-            pim = loadFile( i );
+            img = loadFile( i );
             break;
         case URL_KIND:
-            pim =  loadURL( QUrl( names[i] ) );
+            img = loadURL( QUrl( names[i] ) );
+            break;
+        case PYRAMID_KIND:
+            img = loadPyramid( i );
             break;
         }
     }
     // if no image, return the empty face
-    if( pim == 0 ) {
+    if( img.isNull() ) {
+        iccs[i] = QByteArray();
         return loadEmpty( i );
     }
+    // note its color profile, for the display
+    iccs[i] = pvQtColorLUT::profileOf( img );
 
     // convert pixel format if necessary
-    if( pim->format() != faceformat ) {
-        QImage *oim = new QImage( pim->convertToFormat(faceformat) );
-        delete pim;
-        pim = oim;
+    if( img.format() != faceformat ) {
+        img = img.convertToFormat( faceformat );
+    }
+
+    return img;
+}
+
+/* A file face that was not made ahead of time or cached is
+   streamed from the file itself, so it is decoded and resampled
+   band by band where the rows are wanted.  Any other face is made
+   now and streamed from the image.
+*/
+pvQtFaceStream * pvQtPic::FaceStream( PicFace face )
+{
+    int i = int(face);
+    if( type != nil && face >= front && face < PicFace(maxfaces)
+        && kinds[i] == FILE_KIND && !idims[i].isNull() ){
+        imageclip = faceClip( i );
+        bool prepared = !prepkey.isEmpty()
+                && prepkey == faceKey( names[i], imageclip, facedims, faceformat );
+        bool cached = !cachedir.isEmpty()
+                && QFile::exists( cachedir + "/" + cacheName( i ) );
+        if( !prepared && !cached ) {
+            return new pvQtFaceStream( names[i], imageclip, facedims );
+        }
     }
+    return new pvQtFaceStream( FaceImage( face ) );
+}
 
-    return pim;
+void pvQtPic::setColorProfile( PicFace face, QByteArray icc )
+{
+    if( face >= front && face < PicFace(maxfaces) ) {
+        iccs[int(face)] = icc;
+    }
 }
 
-QImage * pvQtPic::loadEmpty( int i )
+QImage pvQtPic::loadEmpty( int i )
 {
     // make the empty image for face i
-    QImage * pim = new QImage( facedims, faceformat );
-    QPainter qp( pim );
+    QImage img = pvQtImagePool::faces()->image( facedims, faceformat );
+    if( img.isNull() ) {
+        return img;
+    }
+    QPainter qp( &img );
     // fill
-    QRect box( pim->rect() );
+    QRect box( img.rect() );
     QBrush brush( fills[i] );
     qp.fillRect( box, brush );
     // draw border
@@ -1025,63 +1274,59 @@ QImage * pvQtPic::loadEmpty( int i )
     // draw label
     pen.setColor( fills[i].value() < 100 ? Qt::white : Qt::black );
     qp.setPen( pen );
-    int pts = (32 * pim->height()) / 512 ;
+    int pts = (32 * img.height()) / 512 ;
     qp.setFont(QFont("Arial", pts));
     qp.drawText( box, Qt::AlignCenter, labels[i] );
 
-    return pim;
+    return img;
 }
 
-QImage * pvQtPic::loadFile( int face )
+QImage pvQtPic::loadFile( int face )
 {
+    if( !prepkey.isEmpty()
+        && prepkey == faceKey( names[face], imageclip, facedims, faceformat ) ){
+        QImage img = prepimg;
+        clearPrepared();
+        return img;
+    }
+
+    QImage img = readCache( face );
+    if( !img.isNull() ) {
+        return img;
+    }
+
     QImageReader ir( names[face] );
     if( !ir.canRead() ) {
-        return 0;
+        return QImage();
     }
-    QImage * pim;
 
     /*
      * TODO:
      * to avoid a bug in Qt4.4 jpeg reader:
-     * read at full size, reduce using QImage ops
+     * read at full size, reduce as the face is made
      */
 #if 1
-    pim = new QImage(
-                ir.read().copy(
-                    imageclip
-                    ).scaled(
-                    facedims,
-                    Qt::IgnoreAspectRatio,
-                    Qt::SmoothTransformation
-                    )
-                );
-
+    return pvQtResampler::resample( ir.read(), imageclip, facedims );
 #else	// can use this if bug gets fixed:
     ir.setClipRect( imageclip );
     ir.setScaledSize( facedims );
-    pim = new QImage( ir.read() );
+    return ir.read();
 #endif
-
-    return pim;
 }
 
-QImage * pvQtPic::loadQImage( int face )
+QImage pvQtPic::loadQImage( int face )
 {
-    QImage * iim = (QImage *)(addrs[face]);
-    QImage * pim = new QImage(
-                iim->copy(
-                    imageclip
-                    ).scaled(
-                    facedims,
-                    Qt::IgnoreAspectRatio,
-                    Qt::SmoothTransformation
-                    )
-                );
+    return pvQtResampler::resample( imgs[face], imageclip, facedims );
+}
 
-    return pim;
+QImage pvQtPic::loadPyramid( int face )
+{
+    pvQtPyramid * pyr = (pvQtPyramid *)(addrs[face]);
+    return pvQtResampler::resample( pyr->levelImage( pyr->baseLevel(), face ),
+                                    imageclip, facedims );
 }
 
-QImage * pvQtPic::loadRaster( int face )
+QImage pvQtPic::loadRaster( int face )
 {
-    return 0;
+    return QImage();
 }
@@ -66,9 +66,13 @@
 
   For cubic pictures only, you can call setFaceImage() even
   after the picture is displayed, to add, replace or delete
-  face images.   To delete a face, pass a null QImage *.
+  face images.   To delete a face, pass a null QImage.
   To add or replace one, call any of the overloads.  The
   new images will be shown at the existing face dimensions.
+
+  A tiled pvQtPyramid can be the source for a cubic or equi-
+  rectangular picture: assign it to every face.  The pic shows
+  its base level; pvQtView gets the finer levels from Pyramid().
 */
 
 #ifndef __PVQTPIC_H__
@@ -79,6 +83,8 @@
 #define PVQT_PIC_FACE_FORMAT  QImage::Format_ARGB32
 
 class pictureTypes;
+class pvQtPyramid;
+class pvQtFaceStream;
 
 class pvQtPic : public QObject
 {	Q_OBJECT
@@ -164,6 +170,13 @@ fov in degrees, rad in radians
 
     // size of texture image(s)
     QSize   FaceSize(){ return facedims; }
+    // fraction of the source image they show
+    QRectF  FaceClip(){ return cliprect; }
+    /* changes whenever the face images would come out different
+       at the same face size and clip: new type, face image or
+       empty frame style
+    */
+    int Generation(){ return generation; }
     QSizeF  FaceFOV(){ return facefovs; }
     // size of source image
     QSize   ImageSize(){ return imagedims; }
@@ -187,8 +200,17 @@ fov in degrees, rad in radians
     bool fitFaceToImage( QSize maxdims, bool pwr2 = false );
     // texcoord scale factors to give correct displayed FOV
     QSizeF  getTexScale(){ return texscale; }
-    // get a displayable image
-    QImage * FaceImage( PicFace face = front ); // get face image
+    /* get a displayable image, null on error.  It is on a pooled
+       buffer (see pvQtImagePool); drop it promptly once used.
+    */
+    QImage FaceImage( PicFace face = front ); // get face image
+    /* the same, a band of rows at a time (see pvQtFaceStream);
+       faces from files are decoded as the rows are read.  The
+       caller deletes it.
+    */
+    pvQtFaceStream * FaceStream( PicFace face = front );
+    // the color profile a stream found, for ColorProfile()
+    void setColorProfile( PicFace face, QByteArray icc );
     // Apparent FOV for arbitrary projection and texcoord scale
     QSizeF  texScale2Fov( QSizeF scl, PicType t );
 
@@ -212,7 +234,8 @@ fov in degrees, rad in radians
     bool setType( PicType pt ); // clears, sets all defaults
     bool setSurface( int s );
     bool setImageFOV( QSizeF angles );
-    bool setFaceImage( PicFace face, QImage * img );
+    // keeps a shared copy of img; no pixels are copied
+    bool setFaceImage( PicFace face, const QImage & img );
     bool setFaceImage( PicFace face, int width, int height, void * addr,
                        int bitsPerColor, int colorsPerPixel,
                        bool floatValues = false,
@@ -220,8 +243,62 @@ fov in degrees, rad in radians
                        int alignBytes = 0 );
     bool setFaceImage( PicFace face, QString path );
     bool setFaceImage( PicFace face, QUrl url );
+    bool setFaceImage( PicFace face, pvQtPyramid * pyr );
+    // the tiled source, if any (caller keeps ownership)
+    pvQtPyramid * Pyramid();
+    // source file of a face, empty if it is not from a file
+    QString FaceFile( PicFace face = front );
+    /* ICC profile embedded in the source images, as FaceImage()
+       found it (the first face that had one); "" means sRGB
+    */
+    QByteArray ColorProfile();
+
+/*
+Texture cache
+A face image made from a file can be saved in a cache directory
+as it stands, ready to load without decoding or resampling.  An
+entry is used only if the source file and the face size and clip
+are just as they were when it was written.
+*/
+    // write the current face images; stale entries are removed
+    bool cacheFaces( QString dir );
+    // look here first when loading face images ("" for none)
+    void setCacheDir( QString dir ){ cachedir = dir; }
+    // the digest that names a face image made from a file
+    static QString faceKey( QString path, QRect clip, QSize dims,
+                            QImage::Format fmt );
+    // the same for a face of this pic, "" if it is not from a file
+    QString FaceKey( PicFace face = front );
+    /* a face image made ahead of time, e.g. by a prefetcher; it is
+       used, once, by the face whose FaceKey() is key
+    */
+    void setPrepared( QString key, QImage img ){ prepkey = key; prepimg = img; }
+    void clearPrepared(){ prepkey = QString(); prepimg = QImage(); }
 
 /*
+Lens correction
+A rect or fish picture can be corrected for the lens that took it,
+with PanoTools parameters: radial distortion a, b, c (the source
+radius is r * (a r^3 + b r^2 + c r + 1 - a - b - c)), the lens
+center's shift d, e from the source image center, in pixels (x
+right, y down), and vignetting vb, vc, vd (brightness falls off as
+1 + vb r^2 + vc r^4 + vd r^6).  r is the radius in units of half the
+smaller source dimension.  pvQtView applies the correction as it
+samples the face images, which are not changed.
+NOTE setType() restores the ideal lens
+*/
+    typedef struct {
+        double a, b, c;	// radial distortion
+        double d, e;	// lens center shift
+        double vb, vc, vd;	// vignetting
+    } LensParams;
+    static LensParams idealLens();
+    // false if the type can't take a lens
+    bool setLens( LensParams lp );
+    LensParams Lens(){ return lens; }
+    // true if Lens() is not ideal
+    bool hasLens();
+/*
 Set empty frame styles
 face = any sets all faces; label = "*" uses face names
 label color is black or white according to fill color
@@ -238,6 +315,7 @@ private:
     int ipt; // pictureTypes index of type
     int maxfaces; // 0 to 6
     int numimgs; // no. of faces with source images
+    int generation; // see Generation()
     // display image and face properties
     QImage::Format faceformat; // pixel format
     /* dimensions and assigned FOVs of source image never modified here */
@@ -260,10 +338,13 @@ private:
     int formats[6];	// QImage::Format, or a kcode
     QSize idims[6];	// source dimensions
     void * addrs[6]; // address if in core
+    QImage imgs[6]; // the image if a QImage
     QString names[6]; // path or url
     QString labels[6]; // for empty images...
     QColor borders[6];
     QColor fills[6];
+    QByteArray iccs[6]; // embedded color profiles
+    LensParams lens;
     // common logic for assigning an image to a face
     bool addimgsize( int iface, QSize dims );
     // pixels <=> fov angle
@@ -273,10 +354,18 @@ private:
     // used to remove cached source images
     void removeImg( int i );
     // load local images for a face
-    QImage * loadEmpty( int face );
-    QImage * loadFile( int face );
-    QImage * loadQImage( int face );
-    QImage * loadRaster( int face );
+    QImage loadEmpty( int face );
+    QImage loadFile( int face );
+    QImage loadQImage( int face );
+    QImage loadRaster( int face );
+    QImage loadPyramid( int face );
+    // texture cache
+    QString cachedir;
+    QString cacheName( int face );
+    QImage readCache( int face );
+    QRect faceClip( int face );
+    QString prepkey;
+    QImage prepimg;
 
 /*
       virtual functions for remote images --
@@ -285,16 +374,17 @@ private:
       It must return true for a (probably) loadable image, else
       false.  If possible it should put image dimensions in dims,
       however that can be deferred until the image is loaded.
-      loadURL is called when it is time to fetch the image.
+      loadURL is called when it is time to fetch the image; a
+      null QImage means it could not be had.
 */
     virtual bool gotURL( QUrl url, QSize & dims ){
         Q_UNUSED(url);
         Q_UNUSED(dims);
         return false;
     }
-    virtual QImage * loadURL( QUrl url ){
+    virtual QImage loadURL( QUrl url ){
         Q_UNUSED(url);
-        return 0;
+        return QImage();
     }
 };
 
@@ -0,0 +1,631 @@
+/*
+ * pvQtProject.cpp  for Panini
+ *
+ * This file is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this file; if not, write to Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+
+  See pvQtProject.h
+*/
+
+#include "pvQtProject.h"
+#include <QFile>
+#include <QFileInfo>
+#include <QDir>
+#include <QTextStream>
+#include <QImageReader>
+#include <QRunnable>
+#include <math.h>
+
+#ifndef Pi
+#define Pi 3.141592653589793
+#endif
+#define DEG2RAD( x ) ((x) * Pi / 180.0)
+
+// face rows per remap job
+#define BAND_ROWS 32
+
+/* remaps one band of face rows from one source image
+*/
+class pvQtRemapJob : public QRunnable
+{
+public:
+    pvQtRemapJob( pvQtProject * prj, const pvQtProject::Source * src,
+                  int face, int y0, int y1 )
+        : m_prj( prj ), m_src( src ), m_face( face ), m_y0( y0 ), m_y1( y1 ) {}
+    void run(){
+        m_prj->remapBand( *m_src, m_face, m_y0, m_y1 );
+    }
+private:
+    pvQtProject * m_prj;
+    const pvQtProject::Source * m_src;
+    int m_face, m_y0, m_y1;
+};
+
+pvQtProject::pvQtProject()
+{
+    m_error = 0;
+    m_proj = -1;
+    m_hfov = 0;
+    m_faceSize = 0;
+}
+
+bool pvQtProject::isProject( QString name )
+{
+    QString ext = QFileInfo( name ).suffix().toLower();
+    return ext == "pto" || ext == "pts" || ext == "pro";
+}
+
+/**  Script parsing  **/
+
+/* split a script line into parameter names and values.
+   A name is a run of letters, the value runs to the next
+   blank, or is a quoted string.
+*/
+bool pvQtProject::parseLine( const QString & line, QStringList & keys,
+                             QStringList & vals )
+{
+    int n = line.length();
+    int i = 1;	// skip the line type
+    while( i < n ){
+        if( line[i].isSpace() ){
+            ++i;
+            continue;
+        }
+        int k = i;
+        while( i < n && line[i].isLetter() ) ++i;
+        if( i == k ) {
+            return false;
+        }
+        QString key = line.mid( k, i - k );
+        QString val;
+        if( i < n && line[i] == '"' ){
+            int q = line.indexOf( '"', i + 1 );
+            if( q < 0 ) {
+                return false;
+            }
+            val = line.mid( i + 1, q - i - 1 );
+            i = q + 1;
+        } else {
+            k = i;
+            while( i < n && !line[i].isSpace() ) ++i;
+            val = line.mid( k, i - k );
+        }
+        keys << key;
+        vals << val;
+    }
+    return true;
+}
+
+/* the value of a parameter of image i, following "=n"
+   references to earlier images.  Empty if not given.
+*/
+QString pvQtProject::lookup( int i, const QString & key )
+{
+    for( int hops = 0; i >= 0 && i < m_keys.count() && hops < 16; hops++ ){
+        int k = m_keys[i].indexOf( key );
+        if( k < 0 ) {
+            return QString();
+        }
+        QString v = m_vals[i][k];
+        if( !v.startsWith( '=' ) ) {
+            return v;
+        }
+        i = v.mid( 1 ).toInt();
+    }
+    return QString();
+}
+
+double pvQtProject::number( int i, const QString & key, double dflt )
+{
+    bool ok;
+    double v = lookup( i, key ).toDouble( &ok );
+    return ok ? v : dflt;
+}
+
+// a crop value "left,right,top,bottom"
+static QRect cropRect( const QString & s )
+{
+    QStringList c = s.split( ',' );
+    if( c.count() != 4 ) {
+        return QRect();
+    }
+    int l = c[0].toInt(), r = c[1].toInt(), t = c[2].toInt(), b = c[3].toInt();
+    if( r <= l || b <= t ) {
+        return QRect();
+    }
+    return QRect( l, t, r - l, b - t );
+}
+
+bool pvQtProject::read( QString name )
+{
+    QFile f( name );
+    if( !f.open( QIODevice::ReadOnly | QIODevice::Text ) ){
+        m_error = "can't read project file";
+        return false;
+    }
+    m_name = QFileInfo( name ).absoluteFilePath();
+    QDir dir = QFileInfo( name ).absoluteDir();
+    m_proj = -1;
+    m_size = QSize();
+    m_hfov = 0;
+    m_crop = QRect();
+    m_images.clear();
+    m_keys.clear();
+    m_vals.clear();
+
+    QList<QStringList> ikeys, ivals, okeys, ovals;
+    QStringList imgfiles;
+    QList<QSize> imgsizes;
+    QTextStream ts( &f );
+    bool first = true;
+    while( !ts.atEnd() ){
+        QString line = ts.readLine().trimmed();
+        if( line.isEmpty() ) {
+            continue;
+        }
+        if( first && line.startsWith( '{' ) ){
+            m_error = "unsupported project format (export a .pts script)";
+            return false;
+        }
+        first = false;
+        if( line.startsWith( "#-imgfile" ) ){
+            // PTGui: #-imgfile w h "name"
+            QStringList t = line.mid( 9 ).trimmed().split( ' ', QString::SkipEmptyParts );
+            int q = line.indexOf( '"' );
+            if( t.count() >= 3 && q > 0 ){
+                imgsizes << QSize( t[0].toInt(), t[1].toInt() );
+                imgfiles << line.mid( q + 1, line.lastIndexOf( '"' ) - q - 1 );
+            }
+            continue;
+        }
+        QChar c = line[0];
+        if( line.length() > 1 && !line[1].isSpace() ) {
+            continue;	// not a script line
+        }
+        QStringList keys, vals;
+        if( c != 'p' && c != 'i' && c != 'o' ) {
+            continue;
+        }
+        if( !parseLine( line, keys, vals ) ){
+            m_error = "bad project script line";
+            return false;
+        }
+        if( c == 'p' ){
+            int k;
+            if( (k = keys.indexOf("f")) >= 0 ) m_proj = vals[k].toInt();
+            int w = 0, h = 0;
+            if( (k = keys.indexOf("w")) >= 0 ) w = vals[k].toInt();
+            if( (k = keys.indexOf("h")) >= 0 ) h = vals[k].toInt();
+            m_size = QSize( w, h );
+            if( (k = keys.indexOf("v")) >= 0 ) m_hfov = vals[k].toDouble();
+            if( (k = keys.indexOf("S")) >= 0 ) m_crop = cropRect( vals[k] );
+        } else if( c == 'i' ){
+            ikeys << keys;
+            ivals << vals;
+        } else {
+            okeys << keys;
+            ovals << vals;
+        }
+    }
+    if( m_size.isEmpty() || m_hfov <= 0 ){
+        m_error = "project has no valid p line";
+        return false;
+    }
+    if( m_crop.isNull() || !QRect( QPoint(0,0), m_size ).contains( m_crop ) ) {
+        m_crop = QRect( QPoint(0,0), m_size );
+    }
+
+    // PTStitcher scripts put the image parameters on o lines
+    if( okeys.count() > 0 ){
+        m_keys = okeys;
+        m_vals = ovals;
+    } else {
+        m_keys = ikeys;
+        m_vals = ivals;
+    }
+
+    for( int i = 0; i < m_keys.count(); i++ ){
+        Image im;
+        im.file = lookup( i, "n" );
+        im.width = int( number( i, "w", 0 ) );
+        im.height = int( number( i, "h", 0 ) );
+        if( im.file.isEmpty() && i < imgfiles.count() ){
+            im.file = imgfiles[i];
+            if( im.width <= 0 ){
+                im.width = imgsizes[i].width();
+                im.height = imgsizes[i].height();
+            }
+        }
+        if( im.file.isEmpty() ){
+            m_error = "project image has no file name";
+            return false;
+        }
+        im.file = QDir::cleanPath( dir.absoluteFilePath( im.file ) );
+        if( im.width <= 0 || im.height <= 0 ){
+            QSize s = QImageReader( im.file ).size();
+            im.width = s.width();
+            im.height = s.height();
+        }
+        im.lens = int( number( i, "f", 0 ) );
+        im.hfov = number( i, "v", 0 );
+        im.yaw = number( i, "y", 0 );
+        im.pitch = number( i, "p", 0 );
+        im.roll = number( i, "r", 0 );
+        im.a = number( i, "a", 0 );
+        im.b = number( i, "b", 0 );
+        im.c = number( i, "c", 0 );
+        im.d = number( i, "d", 0 );
+        im.e = number( i, "e", 0 );
+        im.crop = cropRect( lookup( i, "S" ) );
+        if( im.crop.isNull() ) {
+            im.crop = cropRect( lookup( i, "C" ) );
+        }
+        m_images.append( im );
+    }
+
+    m_error = 0;
+    return true;
+}
+
+/**  Stitched output  **/
+
+const char * pvQtProject::picTypeName()
+{
+    switch( m_proj ){
+    case 0:  return "rect";
+    case 1:  return "cyli";
+    case 2:  return "equi";
+    case 3:  return "sphr";
+    case 4:  return "ster";
+    case 5:  return "merc";
+    case 15: return "fish";
+    }
+    return 0;
+}
+
+/* look for the output next to the project: Hugin names it
+   after the project by default.  It must have the size of the
+   crop or full p line size, or at least the same shape.
+*/
+QString pvQtProject::stitchedFile()
+{
+    if( !picTypeName() ) {
+        return QString();
+    }
+    static const char * tails[] = {
+        ".tif", ".tiff", ".jpg", ".jpeg", ".png",
+        "_fused.tif", "_blended_fused.tif", 0
+    };
+    QFileInfo fi( m_name );
+    QString base = fi.absolutePath() + "/" + fi.completeBaseName();
+    double aspect = double( m_crop.width() ) / m_crop.height();
+    for( int i = 0; tails[i]; i++ ){
+        QString name = base + tails[i];
+        if( !QFileInfo( name ).isReadable() ) {
+            continue;
+        }
+        QImageReader ir( name );
+        QSize s = ir.size();
+        if( !ir.canRead() || s.isEmpty() ) {
+            continue;
+        }
+        if( s == m_crop.size()
+            || fabs( double( s.width() ) / s.height() - aspect ) < 0.01 * aspect ) {
+            return name;
+        }
+    }
+    return QString();
+}
+
+/**  Remapping  **/
+
+int pvQtProject::cubeFaceSize( int limit )
+{
+    // a 90 degree face has size/2 pixels per radian at its center
+    double F = 0;
+    foreach( Image im, m_images ){
+        if( im.width <= 0 || im.hfov <= 0 ) {
+            continue;
+        }
+        double f = im.width / DEG2RAD( im.hfov );
+        if( im.lens == 0 && im.hfov < 180 ) {
+            f = 0.5 * im.width / tan( DEG2RAD( 0.5 * im.hfov ) );
+        }
+        if( f > F ) {
+            F = f;
+        }
+    }
+    int size = 2 * int( F + 0.5 );
+    size = ( size + 15 ) & ~15;
+    if( size > limit ) {
+        size = limit & ~1;
+    }
+    if( size < 64 ) {
+        size = 64;
+    }
+    return size;
+}
+
+/* fill a Source from the script parameters of one image
+*/
+bool pvQtProject::setupSource( const Image & im, const QImage * img,
+                               Source & s )
+{
+    s.img = img;
+    s.lens = im.lens;
+    double w = img->width(), h = img->height();
+    double hw = 0.5 * w;
+    double half = DEG2RAD( 0.5 * im.hfov );
+    if( half <= 0 ) {
+        return false;
+    }
+    switch( im.lens ){
+    case 0:		// rectilinear
+        if( half >= 0.5 * Pi ) return false;
+        s.F = hw / tan( half );
+        break;
+    case 1:		// cylindrical
+    case 2:		// circular fisheye
+    case 3:		// full frame fisheye
+    case 4:		// equirectangular
+        s.F = hw / half;
+        break;
+    case 8:		// orthographic
+        s.F = hw / sin( qMin( half, 0.5 * Pi ) );
+        break;
+    case 10:	// stereographic
+        s.F = hw / ( 2 * tan( 0.5 * half ) );
+        break;
+    case 20:	// Thoby
+        s.F = hw / ( 1.47 * sin( 0.713 * half ) );
+        break;
+    case 21:	// equisolid
+        s.F = hw / ( 2 * sin( 0.5 * half ) );
+        break;
+    default:
+        return false;
+    }
+
+    s.cx = hw + im.d;
+    s.cy = 0.5 * h + im.e;
+    s.R0 = 0.5 * qMin( w, h );
+    s.a = im.a; s.b = im.b; s.c = im.c;
+    s.dd = 1 - im.a - im.b - im.c;
+
+    QRect all( 0, 0, img->width(), img->height() );
+    s.valid = im.crop.isNull() ? QRectF( all ) : QRectF( im.crop & all );
+    s.circle = im.lens == 2 && !im.crop.isNull();
+    s.feather = 0.5 * qMin( s.valid.width(), s.valid.height() );
+
+    // pano to camera rotation: undo yaw, then pitch, then roll
+    double cy = cos( DEG2RAD( im.yaw ) ), sy = sin( DEG2RAD( im.yaw ) );
+    double cp = cos( DEG2RAD( im.pitch ) ), sp = sin( DEG2RAD( im.pitch ) );
+    double cr = cos( DEG2RAD( im.roll ) ), sr = sin( DEG2RAD( im.roll ) );
+    double Ry[3][3] = { { cy, 0, -sy }, { 0, 1, 0 }, { sy, 0, cy } };
+    double Rp[3][3] = { { 1, 0, 0 }, { 0, cp, -sp }, { 0, sp, cp } };
+    double Rr[3][3] = { { cr, -sr, 0 }, { sr, cr, 0 }, { 0, 0, 1 } };
+    double t[3][3];
+    for( int i = 0; i < 3; i++ ) for( int j = 0; j < 3; j++ ){
+        t[i][j] = 0;
+        for( int k = 0; k < 3; k++ ) t[i][j] += Rp[i][k] * Ry[k][j];
+    }
+    for( int i = 0; i < 3; i++ ) for( int j = 0; j < 3; j++ ){
+        s.m[i][j] = 0;
+        for( int k = 0; k < 3; k++ ) s.m[i][j] += Rr[i][k] * t[k][j];
+    }
+
+    // cull directions well off the image
+    double rx = qMax( fabs( s.valid.left() - s.cx ), fabs( s.valid.right() - s.cx ) );
+    double ry = qMax( fabs( s.valid.top() - s.cy ), fabs( s.valid.bottom() - s.cy ) );
+    double r = sqrt( rx * rx + ry * ry ) / s.F;
+    double th;
+    switch( im.lens ){
+    case 0:  th = atan( r ); break;
+    case 8:  th = asin( qMin( r, 1.0 ) ); break;
+    case 10: th = 2 * atan( 0.5 * r ); break;
+    case 20: th = asin( qMin( r / 1.47, 1.0 ) ) / 0.713; break;
+    case 21: th = 2 * asin( qMin( 0.5 * r, 1.0 ) ); break;
+    case 2:
+    case 3:  th = r; break;
+    default: th = Pi; break;	// cylindrical and equirect wrap
+    }
+    th = 1.1 * th + 0.05;	// slack for lens distortion
+    s.cosMax = th >= Pi ? -2 : cos( th );
+    return true;
+}
+
+/* remap face rows y0 to y1-1 from a source image, blending
+   into what the earlier images put there
+*/
+void pvQtProject::remapBand( const Source & s, int face, int y0, int y1 )
+{
+    const int size = m_faceSize;
+    const double step = 2.0 / size;
+    const QImage & img = *s.img;
+    const int iw = img.width(), ih = img.height();
+    const int bpl = img.bytesPerLine();
+    const uchar * bits = img.constBits();
+    const double rx = 0.5 * s.valid.width(), ry = 0.5 * s.valid.height();
+    const double ex = s.valid.center().x(), ey = s.valid.center().y();
+
+    for( int y = y0; y < y1; y++ ){
+        QRgb * out = (QRgb *)m_faces[face].scanLine( y );
+        float * wt = m_weight.data() + ( face * size + y ) * size;
+        double v = ( y + 0.5 ) * step - 1;
+        for( int x = 0; x < size; x++ ){
+            double u = ( x + 0.5 ) * step - 1;
+            // direction in the pano: x right, y up, z front
+            double d[3];
+            switch( face ){
+            case 0: d[0] = u;  d[1] = -v; d[2] = 1;  break;	// front
+            case 1: d[0] = 1;  d[1] = -v; d[2] = -u; break;	// right
+            case 2: d[0] = -u; d[1] = -v; d[2] = -1; break;	// back
+            case 3: d[0] = -1; d[1] = -v; d[2] = u;  break;	// left
+            case 4: d[0] = u;  d[1] = 1;  d[2] = v;  break;	// top
+            default: d[0] = u; d[1] = -1; d[2] = -v; break;	// bottom
+            }
+            double c[3];
+            for( int i = 0; i < 3; i++ ) {
+                c[i] = s.m[i][0] * d[0] + s.m[i][1] * d[1] + s.m[i][2] * d[2];
+            }
+            double len = sqrt( c[0] * c[0] + c[1] * c[1] + c[2] * c[2] );
+            if( c[2] < s.cosMax * len ) {
+                continue;
+            }
+
+            // ideal image position, x right, y up
+            double px, py;
+            double rxy = sqrt( c[0] * c[0] + c[1] * c[1] );
+            if( s.lens == 0 ){
+                if( c[2] <= 0 ) continue;
+                px = s.F * c[0] / c[2];
+                py = s.F * c[1] / c[2];
+            } else if( s.lens == 1 ){
+                double hz = sqrt( c[0] * c[0] + c[2] * c[2] );
+                if( hz <= 0 ) continue;
+                px = s.F * atan2( c[0], c[2] );
+                py = s.F * c[1] / hz;
+            } else if( s.lens == 4 ){
+                px = s.F * atan2( c[0], c[2] );
+                py = s.F * atan2( c[1], sqrt( c[0] * c[0] + c[2] * c[2] ) );
+            } else {
+                double th = atan2( rxy, c[2] );
+                double rho;
+                switch( s.lens ){
+                case 8:
+                    if( c[2] < 0 ) continue;
+                    rho = sin( th );
+                    break;
+                case 10: rho = 2 * tan( 0.5 * th ); break;
+                case 20: rho = 1.47 * sin( 0.713 * th ); break;
+                case 21: rho = 2 * sin( 0.5 * th ); break;
+                default: rho = th; break;
+                }
+                double k = rxy > 0 ? s.F * rho / rxy : 0;
+                px = k * c[0];
+                py = k * c[1];
+            }
+
+            // lens distortion
+            double rn = sqrt( px * px + py * py ) / s.R0;
+            double k = ( ( s.a * rn + s.b ) * rn + s.c ) * rn + s.dd;
+            double sx = s.cx + k * px, sy = s.cy - k * py;
+
+            // inside the valid area?  weight by distance to its edge
+            double dist;
+            if( s.circle ){
+                double ux = ( sx - ex ) / rx, uy = ( sy - ey ) / ry;
+                double q = sqrt( ux * ux + uy * uy );
+                if( q >= 1 ) continue;
+                dist = ( 1 - q ) * qMin( rx, ry );
+            } else {
+                dist = qMin( qMin( sx - s.valid.left(), s.valid.right() - sx ),
+                             qMin( sy - s.valid.top(), s.valid.bottom() - sy ) );
+                if( dist <= 0 ) continue;
+            }
+            float w = float( dist / s.feather );
+            w *= w;
+
+            // bilinear sample
+            double fx = qBound( 0.0, sx - 0.5, iw - 1.0 );
+            double fy = qBound( 0.0, sy - 0.5, ih - 1.0 );
+            int x0 = int( fx ), yy0 = int( fy );
+            int x1 = qMin( x0 + 1, iw - 1 ), yy1 = qMin( yy0 + 1, ih - 1 );
+            double ax = fx - x0, ay = fy - yy0;
+            const QRgb * r0 = (const QRgb *)( bits + yy0 * bpl );
+            const QRgb * r1 = (const QRgb *)( bits + yy1 * bpl );
+            double w00 = ( 1 - ax ) * ( 1 - ay ), w10 = ax * ( 1 - ay );
+            double w01 = ( 1 - ax ) * ay, w11 = ax * ay;
+            double cr = w00 * qRed( r0[x0] ) + w10 * qRed( r0[x1] )
+                      + w01 * qRed( r1[x0] ) + w11 * qRed( r1[x1] );
+            double cg = w00 * qGreen( r0[x0] ) + w10 * qGreen( r0[x1] )
+                      + w01 * qGreen( r1[x0] ) + w11 * qGreen( r1[x1] );
+            double cb = w00 * qBlue( r0[x0] ) + w10 * qBlue( r0[x1] )
+                      + w01 * qBlue( r1[x0] ) + w11 * qBlue( r1[x1] );
+
+            // running weighted mean
+            float W = wt[x] + w;
+            double t = w / W;
+            QRgb o = out[x];
+            out[x] = qRgb( int( qRed( o ) + t * ( cr - qRed( o ) ) + 0.5 ),
+                           int( qGreen( o ) + t * ( cg - qGreen( o ) ) + 0.5 ),
+                           int( qBlue( o ) + t * ( cb - qBlue( o ) ) + 0.5 ) );
+            wt[x] = W;
+        }
+    }
+}
+
+bool pvQtProject::remapToCube( int size, QImage faces[6] )
+{
+    for( int i = 0; i < 6; i++ ) {
+        faces[i] = QImage();
+    }
+    if( size <= 0 || m_images.isEmpty() ){
+        m_error = "nothing to remap";
+        return false;
+    }
+    m_faceSize = size;
+    for( int i = 0; i < 6; i++ ){
+        m_faces[i] = QImage( size, size, QImage::Format_ARGB32 );
+        if( m_faces[i].isNull() ){
+            for( int j = 0; j < i; j++ ) {
+                m_faces[j] = QImage();
+            }
+            m_error = "not enough memory for cube faces";
+            return false;
+        }
+        m_faces[i].fill( qRgb( 0, 0, 0 ) );
+    }
+    m_weight.fill( 0, 6 * size * size );
+
+    // one source image at a time, all cores on its bands
+    int used = 0;
+    foreach( Image im, m_images ){
+        QImageReader ir( im.file );
+        QImage img = ir.read();
+        if( img.isNull() ){
+            qWarning("project: can't read %s", (const char *)im.file.toUtf8() );
+            continue;
+        }
+        img = img.convertToFormat( QImage::Format_RGB32 );
+        Source src;
+        if( !setupSource( im, &img, src ) ){
+            qWarning("project: unsupported lens for %s", (const char *)im.file.toUtf8() );
+            continue;
+        }
+        for( int f = 0; f < 6; f++ ){
+            for( int y = 0; y < size; y += BAND_ROWS ){
+                m_pool.start( new pvQtRemapJob( this, &src, f, y, qMin( y + BAND_ROWS, size ) ) );
+            }
+        }
+        m_pool.waitForDone();
+        ++used;
+    }
+    m_weight.clear();
+
+    if( used == 0 ){
+        for( int i = 0; i < 6; i++ ) {
+            m_faces[i] = QImage();
+        }
+        m_error = "can't read any project images";
+        return false;
+    }
+    for( int i = 0; i < 6; i++ ){
+        faces[i] = m_faces[i];
+        m_faces[i] = QImage();
+    }
+    m_error = 0;
+    return true;
+}
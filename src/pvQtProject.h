@@ -0,0 +1,143 @@
+/*
+ * pvQtProject.h  for Panini
+ *
+ * This file is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this file; if not, write to Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+
+  pvQtProject reads a PanoTools stitcher script: a Hugin project
+  (.pto) or a PTStitcher/PTGui script (.pts), and makes a picture
+  from it in one of two ways.
+
+  If the stitched panorama is found next to the project, named
+  like it (proj.tif, proj.jpg, proj.png, proj_fused.tif ...), and
+  its size fits the p line, it is shown as a picture of the output
+  projection.  The p line gives the projection (f), full size (w,h),
+  horizontal FOV (v) and crop (S left,right,top,bottom); a crop is
+  shown centered.
+
+  Otherwise the source images are remapped straight onto six cube
+  faces.  The images are read one at a time; each is spread over
+  the faces by a pool of worker threads, each doing a band of face
+  rows, so only one source image is in memory besides the faces.
+  Per image the i lines (or o lines, in a PTStitcher script) give
+    w,h       size, read from the file if missing
+    f         lens: 0 rectilinear, 1 cylindrical, 2,3 fisheye,
+              4 equirectangular, 8 orthographic, 10 stereographic,
+              20 Thoby fisheye, 21 equisolid
+    v         horizontal FOV
+    y,p,r     yaw, pitch and roll
+    a,b,c     radial distortion polynomial
+    d,e       lens center shift
+    S         crop rectangle (the image circle for f2)
+    n         file name, relative to the project
+  A parameter given as "v=0" is taken from image 0.  PTGui keeps
+  the file names on "#-imgfile w h "name"" comment lines instead.
+  Overlaps are feathered; photometric parameters are ignored, so
+  this is a preview, not a finished stitch.
+*/
+
+#ifndef PVQTPROJECT_H
+#define PVQTPROJECT_H
+
+#include <QString>
+#include <QStringList>
+#include <QList>
+#include <QRect>
+#include <QSize>
+#include <QImage>
+#include <QVector>
+#include <QThreadPool>
+
+class pvQtRemapJob;
+
+class pvQtProject
+{
+public:
+    typedef struct {
+        QString file;
+        int width, height;
+        int lens;		// PanoTools lens type
+        double hfov;		// degrees
+        double yaw, pitch, roll;	// degrees
+        double a, b, c;		// radial distortion
+        double d, e;		// center shift, pixels
+        QRect crop;		// null if none
+    } Image;
+
+    pvQtProject();
+    // true if name has a stitcher script suffix
+    static bool isProject( QString name );
+    // false on error, see errMsg()
+    bool read( QString name );
+    const char * errMsg(){ return m_error; }
+
+    // output panorama, from the p line
+    int projection(){ return m_proj; }	// PanoTools format code
+    QSize outputSize(){ return m_size; }
+    double outputFov(){ return m_hfov; }
+    QRect outputCrop(){ return m_crop; }	// whole if no crop
+    // Panini picture type name of the output, 0 if none fits
+    const char * picTypeName();
+    // the stitched output, empty if not found
+    QString stitchedFile();
+
+    QList<Image> images(){ return m_images; }
+    // face size that keeps the sources' resolution, <= limit
+    int cubeFaceSize( int limit );
+    /* remap the source images onto faces[6] of the given size,
+       in pvQtPic face order.  false on error, with faces[] all
+       null.
+    */
+    bool remapToCube( int size, QImage faces[6] );
+
+private:
+    friend class pvQtRemapJob;
+    // a source image, ready to sample
+    typedef struct {
+        const QImage * img;
+        double m[3][3];		// pano to camera rotation
+        int lens;
+        double F;		// pixels per radian, sort of
+        double cx, cy;		// optical center, pixels
+        double R0;		// distortion radius unit
+        double a, b, c, dd;	// dd = 1 - a - b - c
+        double cosMax;		// cull beyond this
+        QRectF valid;		// sampled area
+        bool circle;		// valid is an ellipse
+        double feather;		// blend width, pixels
+    } Source;
+    bool parseLine( const QString & line, QStringList & keys,
+                    QStringList & vals );
+    QString lookup( int i, const QString & key );
+    double number( int i, const QString & key, double dflt );
+    bool setupSource( const Image & im, const QImage * img, Source & s );
+    void remapBand( const Source & s, int face, int y0, int y1 );
+
+    const char * m_error;
+    QString m_name;
+    int m_proj;
+    QSize m_size;
+    double m_hfov;
+    QRect m_crop;
+    QList<Image> m_images;
+    QList<QStringList> m_keys, m_vals;	// raw image lines
+    // remapping state
+    int m_faceSize;
+    QImage m_faces[6];
+    QVector<float> m_weight;	// feather weights so far, per face pixel
+    QThreadPool m_pool;
+};
+
+#endif //ndef PVQTPROJECT_H
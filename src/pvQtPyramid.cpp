@@ -0,0 +1,338 @@
+/*
+ * pvQtPyramid.cpp  for Panini
+ *
+ * This file is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this file; if not, write to Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+
+  See pvQtPyramid.h for the pyramid layout.
+
+  Background tile loading: requestTiles() replaces a queue of
+  wanted tiles and starts up to one worker per core.  Each worker
+  takes tiles from the front of the queue until it is empty, so
+  the most recently wanted tiles are always read first and tiles
+  nobody wants any more are simply dropped.  Finished tiles go
+  back to the owning thread through a queued signal, so none can
+  arrive after the pyramid has been deleted.
+*/
+
+#include "pvQtPyramid.h"
+#include <QFileInfo>
+#include <QThread>
+#include <QFile>
+#include <QResource>
+#include <QSettings>
+#include <QImageReader>
+#include <QPainter>
+#include <cmath>
+
+#ifndef Pi
+#define Pi 3.141592654
+#endif
+
+// widest base level (shown as the texture image)
+#define PYRAMID_BASE_CUBE	1024
+#define PYRAMID_BASE_EQUI	2048
+// hard limits
+#define PYRAMID_MAX_LEVELS	24
+#define PYRAMID_MIN_TILE	16
+
+static const char descName[] = "pyramid.ini";
+
+/* reads tiles from the request queue until it is empty
+*/
+class pvQtTileJob : public QRunnable
+{
+public:
+    pvQtTileJob( pvQtPyramid * pyr ) : m_pyr( pyr ) {}
+    void run(){
+        quint64 key;
+        while( m_pyr->nextTile( key ) ){
+            QImage img = m_pyr->loadTile( key );
+            emit m_pyr->tileLoaded( key, img );
+        }
+    }
+private:
+    pvQtPyramid * m_pyr;
+};
+
+pvQtPyramid::pvQtPyramid( QObject * parent )
+    : QObject( parent )
+{
+    m_error = 0;
+    m_cube = false;
+    m_tilesize = 0;
+    m_levels = 0;
+    m_baselevel = 0;
+    m_workers = 0;
+    m_pool.setMaxThreadCount( QThread::idealThreadCount() );
+
+    connect( this, &pvQtPyramid::tileLoaded, this, &pvQtPyramid::deliverTile,
+             Qt::QueuedConnection );
+}
+
+pvQtPyramid::~pvQtPyramid()
+{
+    cancelTiles();
+    if( !m_resource.isEmpty() ){
+        QResource::unregisterResource( m_resource, m_root );
+    }
+}
+
+bool pvQtPyramid::isPyramid( QString path )
+{
+    QFileInfo fi( path );
+    if( fi.isDir() ){
+        return QFile::exists( fi.absoluteFilePath() + "/" + descName );
+    }
+    return fi.fileName() == descName
+        || fi.suffix().toLower() == "rcc";
+}
+
+/* find and read the descriptor
+   path may be the pyramid directory, its pyramid.ini or
+   a .rcc archive made from the directory.
+*/
+bool pvQtPyramid::open( QString path )
+{
+    QFileInfo fi( path );
+    if( fi.suffix().toLower() == "rcc" ){
+        static int narchives = 0;
+        m_root = QString("/pyramid%1").arg( ++narchives );
+        m_resource = fi.absoluteFilePath();
+        if( !QResource::registerResource( m_resource, m_root ) ){
+            m_resource = QString();
+            m_error = "can't open pyramid archive";
+            return false;
+        }
+        m_base = QString(":") + m_root;
+    } else if( fi.isDir() ){
+        m_base = fi.absoluteFilePath();
+    } else {
+        m_base = fi.absolutePath();
+    }
+
+    QString desc = m_base + "/" + descName;
+    if( !QFile::exists( desc ) ){
+        m_error = "no pyramid.ini";
+        return false;
+    }
+
+    QSettings s( desc, QSettings::IniFormat );
+    s.beginGroup("pyramid");
+    QString type = s.value("type").toString();
+    m_format = s.value("format", "jpg").toString();
+    m_tilesize = s.value("tilesize", 0).toInt();
+    m_levels = s.value("levels", 0).toInt();
+    m_dims = QSize( s.value("width", 0).toInt(),
+                    s.value("height", 0).toInt() );
+    s.endGroup();
+
+    if( type == "cube" ) m_cube = true;
+    else if( type == "equi" ) m_cube = false;
+    else {
+        m_error = "unknown pyramid type";
+        return false;
+    }
+    if( m_tilesize < PYRAMID_MIN_TILE
+        || m_levels < 1 || m_levels > PYRAMID_MAX_LEVELS
+        || m_dims.isEmpty()
+        || ( m_cube && m_dims.width() != m_dims.height() ) ){
+        m_error = "bad pyramid dimensions";
+        return false;
+    }
+
+    // base level: the largest one that makes a modest texture
+    int maxw = m_cube ? PYRAMID_BASE_CUBE : PYRAMID_BASE_EQUI;
+    m_baselevel = 0;
+    for( int l = 1; l < m_levels; l++ ){
+        if( levelSize( l ).width() > maxw ) break;
+        m_baselevel = l;
+    }
+
+    m_error = 0;
+    return true;
+}
+
+/* set up the layout of a new pyramid
+   Levels are added until the coarsest fits in one tile.
+*/
+bool pvQtPyramid::setup( bool cube, QSize dims, int tilesize, QString format )
+{
+    if( tilesize < PYRAMID_MIN_TILE || dims.isEmpty()
+        || ( cube && dims.width() != dims.height() ) ){
+        m_error = "bad pyramid dimensions";
+        return false;
+    }
+    m_cube = cube;
+    m_dims = dims;
+    m_tilesize = tilesize;
+    m_format = format;
+
+    m_levels = 1;
+    int w = dims.width(), h = dims.height();
+    while( ( w > tilesize || h > tilesize ) && m_levels < PYRAMID_MAX_LEVELS ){
+        w = (w + 1) / 2;
+        h = (h + 1) / 2;
+        ++m_levels;
+    }
+    m_baselevel = 0;
+    m_error = 0;
+    return true;
+}
+
+bool pvQtPyramid::writeDescriptor( QString dir )
+{
+    QSettings s( dir + "/" + descName, QSettings::IniFormat );
+    s.beginGroup("pyramid");
+    s.setValue("type", m_cube ? "cube" : "equi");
+    s.setValue("format", m_format );
+    s.setValue("tilesize", m_tilesize );
+    s.setValue("levels", m_levels );
+    s.setValue("width", m_dims.width() );
+    s.setValue("height", m_dims.height() );
+    s.endGroup();
+    s.sync();
+    if( s.status() != QSettings::NoError ){
+        m_error = "can't write pyramid.ini";
+        return false;
+    }
+    return true;
+}
+
+/* face dimensions at a level:
+   full size divided by a power of 2, rounded up
+*/
+QSize pvQtPyramid::levelSize( int level )
+{
+    if( level < 0 || level >= m_levels ) return QSize(0,0);
+    int k = m_levels - 1 - level;
+    return QSize( ( m_dims.width() + (1 << k) - 1 ) >> k,
+                  ( m_dims.height() + (1 << k) - 1 ) >> k );
+}
+
+int pvQtPyramid::tileCols( int level )
+{
+    return ( levelSize( level ).width() + m_tilesize - 1 ) / m_tilesize;
+}
+
+int pvQtPyramid::tileRows( int level )
+{
+    return ( levelSize( level ).height() + m_tilesize - 1 ) / m_tilesize;
+}
+
+QRect pvQtPyramid::tileRect( int level, int row, int col )
+{
+    QRect r( col * m_tilesize, row * m_tilesize, m_tilesize, m_tilesize );
+    return r.intersected( QRect( QPoint(0,0), levelSize( level ) ) );
+}
+
+double pvQtPyramid::pixelAngle( int level )
+{
+    int w = levelSize( level ).width();
+    if( w < 1 ) return 0;
+    return ( m_cube ? 0.5 * Pi : 2 * Pi ) / w;
+}
+
+QString pvQtPyramid::tileName( int level, int face, int row, int col,
+                               QString format )
+{
+    return QString("%1/%2/%3_%4.%5")
+            .arg( level ).arg( face ).arg( row ).arg( col ).arg( format );
+}
+
+QImage pvQtPyramid::loadTile( quint64 key )
+{
+    QImageReader ir( m_base + "/"
+                     + tileName( keyLevel( key ), keyFace( key ),
+                                 keyRow( key ), keyCol( key ), m_format ) );
+    QImage img = ir.read();
+    if( !img.isNull()
+        && img.format() != QImage::Format_RGB32
+        && img.format() != QImage::Format_ARGB32 ){
+        img = img.convertToFormat( QImage::Format_ARGB32 );
+    }
+    return img;
+}
+
+/* a whole face at one level, black where tiles are missing
+*/
+QImage pvQtPyramid::levelImage( int level, int face )
+{
+    QImage img( levelSize( level ), QImage::Format_RGB32 );
+    if( img.isNull() ) return img;
+    img.fill( Qt::black );
+
+    QPainter qp( &img );
+    int rows = tileRows( level ), cols = tileCols( level );
+    for( int r = 0; r < rows; r++ ){
+        for( int c = 0; c < cols; c++ ){
+            QImage t = loadTile( tileKey( level, face, r, c ) );
+            if( !t.isNull() ){
+                qp.drawImage( tileRect( level, r, c ).topLeft(), t );
+            }
+        }
+    }
+    return img;
+}
+
+void pvQtPyramid::requestTiles( const QList<quint64> & keys )
+{
+    QMutexLocker lock( &m_lock );
+    m_queue.clear();
+    foreach( quint64 k, keys ){
+        if( !m_busy.contains( k ) && !m_missing.contains( k ) ){
+            m_queue.append( k );
+        }
+    }
+    int n = qMin( m_queue.count(), m_pool.maxThreadCount() ) - m_workers;
+    while( n-- > 0 ){
+        ++m_workers;
+        m_pool.start( new pvQtTileJob( this ) );
+    }
+}
+
+void pvQtPyramid::cancelTiles()
+{
+    m_lock.lock();
+    m_queue.clear();
+    m_lock.unlock();
+    m_pool.waitForDone();
+}
+
+// worker: claim the next wanted tile, or retire
+bool pvQtPyramid::nextTile( quint64 & key )
+{
+    QMutexLocker lock( &m_lock );
+    if( m_queue.isEmpty() ){
+        --m_workers;
+        return false;
+    }
+    key = m_queue.takeFirst();
+    m_busy.insert( key );
+    return true;
+}
+
+/* a tile has been read; it stays "busy" until it gets here
+   so it can't be requested twice while in transit.  Tiles
+   that could not be read are not requested again.
+*/
+void pvQtPyramid::deliverTile( quint64 key, QImage img )
+{
+    m_lock.lock();
+    m_busy.remove( key );
+    if( img.isNull() ) m_missing.insert( key );
+    m_lock.unlock();
+    if( !img.isNull() ) emit tileReady( key, img );
+}
@@ -0,0 +1,160 @@
+/*
+ * pvQtPyramid.h  for Panini
+ *
+ * This file is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this file; if not, write to Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+
+  A pvQtPyramid is a tiled, multi-resolution picture source for
+  panoramas too big to fit in one texture.  It holds either 6 cube
+  faces or one equirectangular image, each stored at a series of
+  resolution levels cut into square tiles.
+
+  Level 0 is the coarsest; each level has twice the dimensions of
+  the one before (rounded up), the last one is full resolution.
+  All levels use the same tile size, so tile (row, col) of level L
+  covers the same part of the picture as tiles (2 row, 2 col) to
+  (2 row + 1, 2 col + 1) of level L + 1.
+
+  On disk a pyramid is a directory holding a descriptor file,
+  pyramid.ini, plus one image file per tile, at
+      <level>/<face>/<row>_<col>.<format>
+  with face 0 for equirectangular pyramids and the pvQtPic face
+  order (front right back left top bottom) for cubes.  The same
+  tree can be packed into a binary Qt resource archive (.rcc) and
+  opened from that.
+
+  The descriptor (QSettings ini format) has one group:
+      [pyramid]
+      type=cube         ; or equi
+      format=jpg        ; tile image file type
+      tilesize=512      ; tile width and height in pixels
+      levels=5          ; number of resolution levels
+      width=8192        ; full resolution face dimensions
+      height=8192
+
+  pvQtPic shows one "base" level as an ordinary texture image;
+  pvQtView draws finer tiles over it as the view requires.  Tiles
+  are read by a pool of worker threads, in the order requested by
+  the latest call to requestTiles(), and delivered by the
+  tileReady() signal in the thread that owns the pyramid.
+
+  A pyramid can also be set up with setup() and written out with
+  writeDescriptor(), which is how the panini-pyramid tool builds
+  them.
+*/
+
+#ifndef PVQTPYRAMID_H
+#define PVQTPYRAMID_H
+
+#include <QObject>
+#include <QImage>
+#include <QList>
+#include <QSet>
+#include <QMutex>
+#include <QThreadPool>
+
+class pvQtTileJob;
+
+class pvQtPyramid : public QObject
+{	Q_OBJECT
+public:
+    pvQtPyramid( QObject * parent = 0 );
+    ~pvQtPyramid();
+
+    // true if path names a pyramid directory, descriptor or archive
+    static bool isPyramid( QString path );
+    // read the descriptor; false on error, see errMsg()
+    bool open( QString path );
+    // set up a new pyramid (for building one)
+    bool setup( bool cube, QSize dims, int tilesize,
+                QString format = QString("jpg") );
+    // write pyramid.ini into a directory
+    bool writeDescriptor( QString dir );
+    const char * errMsg(){ return m_error; }
+
+    /* layout */
+    bool isCube(){ return m_cube; }
+    int  faceCount(){ return m_cube ? 6 : 1; }
+    int  levelCount(){ return m_levels; }
+    int  tileSize(){ return m_tilesize; }
+    QString format(){ return m_format; }
+    QSize levelSize( int level );		// face dimensions
+    int  tileCols( int level );
+    int  tileRows( int level );
+    QRect tileRect( int level, int row, int col );	// in level pixels
+    // level shown as the texture image, finer ones are tiled
+    int  baseLevel(){ return m_baselevel; }
+    // radians per pixel at the center of a face
+    double pixelAngle( int level );
+
+    // relative path of a tile file
+    static QString tileName( int level, int face, int row, int col,
+                             QString format );
+    // packed tile id
+    static quint64 tileKey( int level, int face, int row, int col ){
+        return (quint64(level) << 56) | (quint64(face) << 48)
+             | (quint64(row) << 24) | quint64(col);
+    }
+    static int keyLevel( quint64 k ){ return int(k >> 56); }
+    static int keyFace( quint64 k ){ return int((k >> 48) & 0xFF); }
+    static int keyRow( quint64 k ){ return int((k >> 24) & 0xFFFFFF); }
+    static int keyCol( quint64 k ){ return int(k & 0xFFFFFF); }
+
+    /* tile images */
+    // read one tile now (any thread); null image on error
+    QImage loadTile( quint64 key );
+    // read and assemble a whole face at one level
+    QImage levelImage( int level, int face );
+    /* queue tiles to be loaded in the background, most wanted
+       first. Replaces whatever is still waiting from the last
+       call; tiles already being read are not requested again.
+    */
+    void requestTiles( const QList<quint64> & keys );
+    // drop all waiting requests and wait for the workers
+    void cancelTiles();
+
+signals:
+    void tileReady( quint64 key, QImage img );
+    // internal: from worker threads
+    void tileLoaded( quint64 key, QImage img );
+
+private slots:
+    void deliverTile( quint64 key, QImage img );
+
+private:
+    friend class pvQtTileJob;
+    // worker side of the request queue
+    bool nextTile( quint64 & key );
+
+    const char * m_error;
+    QString m_base;		// directory holding pyramid.ini
+    QString m_resource;	// registered archive, if any
+    QString m_root;		// and its resource root
+    bool m_cube;
+    QString m_format;
+    int m_tilesize;
+    int m_levels;
+    int m_baselevel;
+    QSize m_dims;		// full resolution face size
+
+    QThreadPool m_pool;
+    QMutex m_lock;		// guards the members below
+    QList<quint64> m_queue;
+    QSet<quint64> m_busy;
+    QSet<quint64> m_missing;
+    int m_workers;
+};
+
+#endif //ndef PVQTPYRAMID_H
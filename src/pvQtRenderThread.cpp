@@ -0,0 +1,182 @@
+/*
+ * pvQtRenderThread.cpp  for Panini
+ *
+ * This file is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this file; if not, write to Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+
+  See pvQtRenderThread.h
+*/
+
+#include "pvQtRenderThread.h"
+#include <QAbstractEventDispatcher>
+#include <QElapsedTimer>
+#include <climits>
+
+pvQtRenderThread::pvQtRenderThread( pvQtView * view )
+    : QThread()
+{
+    m_view = view;
+    m_gui = QThread::currentThread();
+    m_quit = m_frame = m_hasNext = m_painting = m_painted = false;
+    m_errAt = 0;
+    m_err = GL_NO_ERROR;
+    // the GUI thread starts with the context
+    m_lent = true;
+    m_lendLevel = INT_MAX;
+    m_lendWanted = false;
+    m_frameMs = 0;
+
+    QAbstractEventDispatcher * ed = QAbstractEventDispatcher::instance();
+    connect( ed, &QAbstractEventDispatcher::aboutToBlock, this,
+             &pvQtRenderThread::guiIdle, Qt::DirectConnection );
+}
+
+pvQtRenderThread::~pvQtRenderThread()
+{
+    stop();
+}
+
+void pvQtRenderThread::stop()
+{
+    m_mutex.lock();
+    m_quit = true;
+    m_cond.wakeAll();
+    m_mutex.unlock();
+    wait();
+}
+
+void pvQtRenderThread::requestFrame()
+{
+    QMutexLocker lk( &m_mutex );
+    m_frame = true;
+}
+
+double pvQtRenderThread::frameTime()
+{
+    QMutexLocker lk( &m_mutex );
+    return m_frameMs;
+}
+
+void pvQtRenderThread::borrowContext()
+{
+    QMutexLocker lk( &m_mutex );
+    while( m_painting ) {
+        m_cond.wait( &m_mutex );
+    }
+    // a frame not yet drawn may name GL objects about to change
+    if( m_hasNext ){
+        m_hasNext = false;
+        m_next = pvQtView::Frame();
+        m_frame = true;
+    }
+    int level = qMax( 1, m_gui->loopLevel() );
+    if( m_lent ){
+        m_lendLevel = qMin( m_lendLevel, level );
+        return;
+    }
+    m_lendWanted = true;
+    m_cond.wakeAll();
+    while( !m_lent ) {
+        m_cond.wait( &m_mutex );
+    }
+    m_lendWanted = false;
+    m_lendLevel = level;
+}
+
+/* GUI thread is idle: read a frame if one was asked for, and give
+   back the context unless a GL sequence below this event loop
+   still holds it
+*/
+void pvQtRenderThread::guiIdle()
+{
+    QMutexLocker lk( &m_mutex );
+    if( m_lent && m_gui->loopLevel() > m_lendLevel ) return;
+    if( m_frame && isRunning() ){
+        m_frame = false;
+        m_hasNext = false;
+        lk.unlock();	// preparing may borrow the context
+        pvQtView::Frame f;
+        m_view->prepareFrame( f, QRect( 0, 0, m_view->Width, m_view->Height ) );
+        lk.relock();
+        m_next = f;
+        m_hasNext = true;
+    }
+
+    // report the frames drawn since last time
+    bool painted = m_painted;
+    const char * errAt = m_errAt;
+    GLenum err = m_err;
+    m_painted = false;
+    m_errAt = 0;
+
+    if( m_lent && isRunning() ){
+        m_view->doneCurrent();
+        m_view->context()->moveToThread( this );
+        m_lent = false;
+        m_lendLevel = INT_MAX;
+    }
+    m_cond.wakeAll();
+    lk.unlock();
+
+    if( painted ) m_view->paintok = errAt == 0;
+    if( errAt ) m_view->noteOGLerror( errAt, err );
+}
+
+void pvQtRenderThread::run()
+{
+    QElapsedTimer ft;
+    QMutexLocker lk( &m_mutex );
+    for(;;){
+        while( !m_quit && !m_lendWanted && !( m_hasNext && !m_lent ) ) {
+            m_cond.wait( &m_mutex );
+        }
+        if( m_quit || m_lendWanted ){
+            if( !m_lent ){
+                m_view->doneCurrent();
+                m_view->context()->moveToThread( m_gui );
+                m_lent = true;
+            }
+            m_cond.wakeAll();
+            if( m_quit ) break;
+            continue;
+        }
+
+        // draw the GUI thread's copy of the view
+        pvQtView::Frame f = m_next;
+        m_next = pvQtView::Frame();
+        m_hasNext = false;
+        m_painting = true;
+        lk.unlock();
+        ft.start();
+        m_view->QGLWidget::makeCurrent();
+        m_view->paintFrame( f );
+        glFlush();
+        double ms = 1e-6 * ft.nsecsElapsed();
+        lk.relock();
+        m_painting = false;
+        m_painted = true;
+        if( f.errAt && !m_errAt ){
+            m_errAt = f.errAt;
+            m_err = f.err;
+        }
+        m_frameMs = ms;
+        m_cond.wakeAll();
+
+        // swap while the GUI thread runs
+        lk.unlock();
+        m_view->swapBuffers();
+        lk.relock();
+    }
+}
@@ -0,0 +1,90 @@
+/*
+ * pvQtRenderThread.h  for Panini
+ *
+ * This file is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this file; if not, write to Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+
+  pvQtRenderThread draws and swaps pvQtView's frames on a thread of
+  its own, which owns the view's OpenGL context.  The GUI thread only
+  asks for frames, so waiting for the GPU and for the display's
+  refresh no longer holds up menus and input.
+
+  The view's state belongs to the GUI thread.  When it goes idle
+  (the event dispatcher's aboutToBlock()) and a frame has been
+  asked for, it reads the view into a pvQtView::Frame, and the
+  render thread draws that copy while the GUI thread goes on
+  handling events; the GUI thread never waits for a frame.
+
+  GL work the GUI thread does itself (readback, picking, screens,
+  color tables) takes the context with pvQtView::useContext(),
+  which calls borrowContext(): that waits for the frame being
+  drawn, if any, and drops one not yet started, since the GL
+  objects it names may change.  The context stays with the GUI
+  thread until it is idle again at the event loop level it was
+  first taken at, so a dialog or progress loop opened in the middle
+  of a GL sequence can't hand it back early.
+*/
+
+#ifndef PVQTRENDERTHREAD_H
+#define PVQTRENDERTHREAD_H
+
+#include <QThread>
+#include <QMutex>
+#include <QWaitCondition>
+#include "pvQtView.h"
+
+class pvQtRenderThread : public QThread
+{
+    Q_OBJECT
+public:
+    pvQtRenderThread( pvQtView * view );
+    ~pvQtRenderThread();	// stops
+    // finish, leaving the context with the GUI thread
+    void stop();
+    // draw a frame soon; requests made before it starts make one
+    void requestFrame();
+    /* GUI thread: take the context, waiting for any frame being
+       drawn, until idle at the current event loop level
+    */
+    void borrowContext();
+    // msec to draw the last frame, not counting the swap
+    double frameTime();
+
+protected:
+    void run();
+
+private slots:
+    void guiIdle();
+
+private:
+    pvQtView * m_view;
+    QThread * m_gui;
+    QMutex m_mutex;
+    QWaitCondition m_cond;
+    bool m_quit;
+    bool m_frame;	// requested
+    pvQtView::Frame m_next;	// prepared, to be drawn
+    bool m_hasNext;
+    bool m_painting;	// drawing a frame
+    bool m_painted;	// since the GUI thread last looked
+    const char * m_errAt;	// OGL error of the last frame, or 0
+    GLenum m_err;
+    bool m_lent;	// context is with the GUI thread
+    int m_lendLevel;	// event loop level it was taken at
+    bool m_lendWanted;
+    double m_frameMs;
+};
+
+#endif //ndef PVQTRENDERTHREAD_H
@@ -0,0 +1,176 @@
+/*
+ * pvQtResampler.cpp  for Panini
+ *
+ * This file is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this file; if not, write to Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+
+  See pvQtResampler.h
+*/
+
+#include "pvQtResampler.h"
+#include "pvQtImagePool.h"
+#include "pvQtColorLUT.h"
+#include <cmath>
+#include <cstring>
+
+pvQtResampler::pvQtResampler( QSize src, QSize dst )
+{
+    sw = src.width(); sh = src.height();
+    dw = dst.width(); dh = dst.height();
+    band = 0;
+    bandBpl = bandFirst = bandEnd = 0;
+
+    // horizontal taps, normalized
+    double sx = double( sw ) / dw, rx = qMax( 1.0, sx );
+    xstart.resize( dw );
+    xcount.resize( dw );
+    xoff.resize( dw );
+    for( int x = 0; x < dw; x++ ){
+        double c = ( x + 0.5 ) * sx - 0.5;
+        int i0 = qMax( 0, int( floor( c - rx ) ) + 1 ),
+            i1 = qMin( sw - 1, int( ceil( c + rx ) ) - 1 );
+        if( i1 < i0 ) i0 = i1 = qBound( 0, int( floor( c + 0.5 ) ), sw - 1 );
+        xstart[x] = i0;
+        xcount[x] = i1 - i0 + 1;
+        xoff[x] = xwts.count();
+        double sum = 0;
+        for( int i = i0; i <= i1; i++ ){
+            double w = qMax( 0.0, 1 - fabs( i - c ) / rx );
+            xwts.append( float( w ) );
+            sum += w;
+        }
+        for( int k = 0; k < xcount[x]; k++ ){
+            xwts[xoff[x] + k] = sum > 0 ? float( xwts[xoff[x] + k] / sum )
+                                        : 1.0f / xcount[x];
+        }
+    }
+
+    // vertical accumulators, enough for every row one source row touches
+    sy = double( sh ) / dh;
+    ry = qMax( 1.0, sy );
+    nring = int( 2 * ry / sy ) + 3;
+    nextIn = nextOut = 0;
+    lastOpen = -1;
+    hrow.resize( 4 * dw );
+    acc.resize( nring * 4 * dw );
+    wsum.resize( nring );
+}
+
+void pvQtResampler::addRow( const QRgb * row )
+{
+    if( nextIn >= sh ) return;
+    int y = nextIn++;
+
+    // across
+    float * h = hrow.data();
+    for( int x = 0; x < dw; x++ ){
+        const QRgb * p = row + xstart[x];
+        const float * w = xwts.constData() + xoff[x];
+        float b = 0, g = 0, r = 0, a = 0;
+        for( int k = 0; k < xcount[x]; k++ ){
+            b += w[k] * qBlue( p[k] );
+            g += w[k] * qGreen( p[k] );
+            r += w[k] * qRed( p[k] );
+            a += w[k] * qAlpha( p[k] );
+        }
+        *h++ = b; *h++ = g; *h++ = r; *h++ = a;
+    }
+
+    // down: add to the output rows this one falls in
+    int jlo = qMax( nextOut, int( ceil( ( y - ry + 0.5 ) / sy - 0.5 ) ) ),
+        jhi = qMin( dh - 1, int( floor( ( y + ry + 0.5 ) / sy - 0.5 ) ) );
+    for( int j = jlo; j <= jhi; j++ ){
+        float w = float( 1 - fabs( y - center( j ) ) / ry );
+        if( w <= 0 ) continue;
+        while( lastOpen < j ){
+            ++lastOpen;
+            int s = lastOpen % nring;
+            memset( acc.data() + s * 4 * dw, 0, 4 * dw * sizeof(float) );
+            wsum[s] = 0;
+        }
+        int s = j % nring;
+        float * a = acc.data() + s * 4 * dw;
+        for( int i = 0; i < 4 * dw; i++ ) a[i] += w * hrow[i];
+        wsum[s] += w;
+    }
+
+    emitDone();
+}
+
+// write the rows no later source row reaches, as far as the band goes
+void pvQtResampler::emitDone()
+{
+    while( nextOut < dh && nextOut < bandEnd
+           && ( center( nextOut ) + ry <= nextIn || nextIn == sh ) ){
+        emitRow( nextOut++ );
+    }
+}
+
+void pvQtResampler::setBand( uchar * bits, int bpl, int first, int count )
+{
+    band = bits;
+    bandBpl = bpl;
+    bandFirst = first;
+    bandEnd = qMin( dh, first + count );
+    emitDone();
+}
+
+void pvQtResampler::emitRow( int j )
+{
+    int s = j % nring;
+    if( j > lastOpen ){	// nothing fell in it
+        memset( acc.data() + s * 4 * dw, 0, 4 * dw * sizeof(float) );
+        wsum[s] = 0;
+        lastOpen = j;
+    }
+    float k = wsum[s] > 0 ? 1 / wsum[s] : 0;
+    const float * a = acc.constData() + s * 4 * dw;
+    QRgb * d = (QRgb *)( band + ( j - bandFirst ) * bandBpl );
+    for( int x = 0; x < dw; x++, a += 4 ){
+        d[x] = qRgba( qBound( 0, int( a[2] * k + 0.5f ), 255 ),
+                      qBound( 0, int( a[1] * k + 0.5f ), 255 ),
+                      qBound( 0, int( a[0] * k + 0.5f ), 255 ),
+                      qBound( 0, int( a[3] * k + 0.5f ), 255 ) );
+    }
+}
+
+QImage pvQtResampler::resample( const QImage & src, QRect clip, QSize dims )
+{
+    clip &= src.rect();
+    if( src.isNull() || clip.isEmpty() || dims.isEmpty() ) return QImage();
+    // rows are read in place; only unusual formats are converted
+    QImage img = src;
+    if( img.format() != QImage::Format_RGB32 && img.format() != QImage::Format_ARGB32 ) {
+        img = img.convertToFormat( QImage::Format_ARGB32 );
+    }
+
+    QImage dst = pvQtImagePool::faces()->image( dims, QImage::Format_ARGB32 );
+    if( dst.isNull() ) return dst;
+    pvQtColorLUT::setProfile( dst, pvQtColorLUT::profileOf( src ) );
+
+    if( clip.size() == dims ){
+        for( int y = 0; y < dims.height(); y++ ){
+            memcpy( dst.scanLine( y ), img.constScanLine( clip.y() + y ) + 4 * clip.x(),
+                    4 * dims.width() );
+        }
+    } else {
+        pvQtResampler rs( clip.size(), dims );
+        rs.setBand( dst );
+        for( int y = 0; y < clip.height(); y++ ){
+            rs.addRow( (const QRgb *)img.constScanLine( clip.y() + y ) + clip.x() );
+        }
+    }
+    return dst;
+}
@@ -0,0 +1,90 @@
+/*
+ * pvQtResampler.h  for Panini
+ *
+ * This file is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this file; if not, write to Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+
+  pvQtResampler resizes an image a row at a time, straight into its
+  destination, so making a face image needs no clipped, scaled or
+  converted copies of the source.  Source rows go in top to bottom
+  with addRow(); each output row is written to the destination as
+  soon as the last source row it needs has gone in.  Only a few
+  rows of accumulators are held.
+
+  The destination is a band of output rows, set by setBand(): a
+  whole image, or a few rows at a time of some other buffer (e.g.
+  a mapped pixel buffer).  Rows finished beyond the band wait until
+  the next band is set; wantsRows() says when the band needs more
+  source rows.
+
+  The filter is separable and triangular, as wide as the larger of
+  a source and a destination pixel: bilinear when enlarging, and an
+  area weighted average (no aliasing) when reducing.  Source rows
+  are QImage::Format_RGB32 or Format_ARGB32 pixels; the destination
+  is a Format_ARGB32 image the size given to the constructor.
+*/
+
+#ifndef PVQTRESAMPLER_H
+#define PVQTRESAMPLER_H
+
+#include <QImage>
+#include <QVector>
+
+class pvQtResampler
+{
+public:
+    pvQtResampler( QSize src, QSize dst );
+    // output rows first to first + count - 1, bpl bytes apart at bits
+    void setBand( uchar * bits, int bpl, int first, int count );
+    // the whole of an image of the dst size
+    void setBand( QImage & img ){
+        setBand( img.bits(), img.bytesPerLine(), 0, img.height() );
+    }
+    // true until the band is full or the source used up
+    bool wantsRows(){ return nextOut < bandEnd && nextIn < sh; }
+    // the next source row, src.width() pixels
+    void addRow( const QRgb * row );
+    // output rows written so far
+    int rowsDone(){ return nextOut; }
+
+    /* resample the clip rectangle of src into a new image of size
+       dims on a pooled buffer (see pvQtImagePool), in
+       Format_ARGB32, with src's color profile
+    */
+    static QImage resample( const QImage & src, QRect clip, QSize dims );
+
+private:
+    int sw, sh, dw, dh;
+    uchar * band;	// destination band
+    int bandBpl, bandFirst, bandEnd;
+    // horizontal taps: for dst column x, xcount[x] weights from
+    // source column xstart[x], at xwts[xoff[x]]
+    QVector<int> xstart, xcount, xoff;
+    QVector<float> xwts;
+    // vertical
+    double sy, ry;	// scale, filter radius, in source rows
+    int nextIn;	// source row
+    int nextOut;	// dst row
+    int lastOpen;	// highest dst row with an accumulator
+    int nring;
+    QVector<float> hrow;	// a source row, resampled horizontally
+    QVector<float> acc;	// nring rows of dw * 4 sums
+    QVector<float> wsum;	// their weights
+    double center( int j ){ return ( j + 0.5 ) * sy - 0.5; }
+    void emitRow( int j );
+    void emitDone();	// the finished rows in the band
+};
+
+#endif //ndef PVQTRESAMPLER_H
@@ -0,0 +1,221 @@
+/*
+ * pvQtSession.cpp  for Panini
+ *
+ * This file is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this file; if not, write to Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+
+  See pvQtSession.h
+*/
+
+#include "pvQtSession.h"
+#include <QSettings>
+#include <QFileInfo>
+#include <QDir>
+#include <QFile>
+
+#define SESSION_VERSION 1
+
+pvQtSession::pvQtSession()
+{
+    m_error = 0;
+    surface = 0;
+    recenter = false;
+    overlaysVisible = true;
+    lens = pvQtPic::idealLens();
+    view = pvQtView::ViewParams();
+}
+
+bool pvQtSession::isSession( QString name )
+{
+    return QFileInfo( name ).suffix().toLower() == "pvs";
+}
+
+QString pvQtSession::cacheDir( QString name )
+{
+    QFileInfo fi( name );
+    return fi.absolutePath() + "/" + fi.completeBaseName() + ".cache";
+}
+
+void pvQtSession::writeView( QSettings & s, const pvQtView::ViewParams & vp )
+{
+    s.setValue("pan", vp.pan );
+    s.setValue("tilt", vp.tilt );
+    s.setValue("spin", vp.spin );
+    s.setValue("vfov", vp.vfov );
+    s.setValue("dist", vp.dist );
+    s.setValue("eyex", vp.eyex );
+    s.setValue("eyey", vp.eyey );
+    s.setValue("eyeh", vp.eyeh );
+    s.setValue("eyev", vp.eyev );
+    s.setValue("framex", vp.framex );
+    s.setValue("framey", vp.framey );
+    s.setValue("xmag", vp.xmag );
+    s.setValue("ymag", vp.ymag );
+    s.setValue("turn", vp.turn );
+    s.setValue("roll", vp.roll );
+    s.setValue("pitch", vp.pitch );
+    s.setValue("yaw", vp.yaw );
+}
+
+pvQtView::ViewParams pvQtSession::readView( QSettings & s )
+{
+    pvQtView::ViewParams vp;
+    vp.pan = s.value("pan", 0).toDouble();
+    vp.tilt = s.value("tilt", 0).toDouble();
+    vp.spin = s.value("spin", 0).toDouble();
+    vp.vfov = s.value("vfov", 90).toDouble();
+    vp.dist = s.value("dist", 0).toDouble();
+    vp.eyex = s.value("eyex", 0).toDouble();
+    vp.eyey = s.value("eyey", 0).toDouble();
+    vp.eyeh = s.value("eyeh", 0).toDouble();
+    vp.eyev = s.value("eyev", 0).toDouble();
+    vp.framex = s.value("framex", 0).toDouble();
+    vp.framey = s.value("framey", 0).toDouble();
+    vp.xmag = s.value("xmag", 1).toDouble();
+    vp.ymag = s.value("ymag", 1).toDouble();
+    vp.turn = s.value("turn", 0).toInt();
+    vp.roll = s.value("roll", 0).toDouble();
+    vp.pitch = s.value("pitch", 0).toDouble();
+    vp.yaw = s.value("yaw", 0).toDouble();
+    return vp;
+}
+
+bool pvQtSession::read( QString name )
+{
+    if( !QFileInfo( name ).isReadable() ){
+        m_error = "can't read session file";
+        return false;
+    }
+    QSettings s( name, QSettings::IniFormat );
+    QDir dir = QFileInfo( name ).absoluteDir();
+
+    s.beginGroup("session");
+    int version = s.value("version", 0).toInt();
+    type = s.value("type").toString();
+    files.clear();
+    foreach( QString f, s.value("files").toStringList() ){
+        files << ( f.isEmpty() ? f : QDir::cleanPath( dir.absoluteFilePath( f ) ) );
+    }
+    fov = QSizeF( s.value("hfov", 0).toDouble(), s.value("vfov", 0).toDouble() );
+    surface = s.value("surface", 0).toInt();
+    recenter = s.value("recenter", false).toBool();
+    s.endGroup();
+    if( version < 1 || version > SESSION_VERSION || type.isEmpty() ){
+        m_error = "not a Panini session";
+        return false;
+    }
+
+    s.beginGroup("lens");
+    lens.a = s.value("a", 0).toDouble();
+    lens.b = s.value("b", 0).toDouble();
+    lens.c = s.value("c", 0).toDouble();
+    lens.d = s.value("d", 0).toDouble();
+    lens.e = s.value("e", 0).toDouble();
+    lens.vb = s.value("vb", 0).toDouble();
+    lens.vc = s.value("vc", 0).toDouble();
+    lens.vd = s.value("vd", 0).toDouble();
+    s.endGroup();
+
+    s.beginGroup("view");
+    view = readView( s );
+    s.endGroup();
+
+    s.beginGroup("overlays");
+    overlaysVisible = s.value("visible", true).toBool();
+    s.endGroup();
+    overlays.clear();
+    int n = s.beginReadArray("overlays");
+    for( int i = 0; i < n; i++ ){
+        s.setArrayIndex( i );
+        Overlay ov;
+        ov.file = QDir::cleanPath( dir.absoluteFilePath( s.value("file").toString() ) );
+        ov.fade = s.value("fade", 2).toInt();
+        overlays.append( ov );
+    }
+    s.endArray();
+
+    keys.clear();
+    n = s.beginReadArray("keyframes");
+    for( int i = 0; i < n; i++ ){
+        s.setArrayIndex( i );
+        keys.append( readView( s ) );
+    }
+    s.endArray();
+
+    m_error = 0;
+    return true;
+}
+
+bool pvQtSession::write( QString name )
+{
+    QDir dir = QFileInfo( name ).absoluteDir();
+    QFile::remove( name );	// no leftover keys
+    QSettings s( name, QSettings::IniFormat );
+
+    s.beginGroup("session");
+    s.setValue("version", SESSION_VERSION );
+    s.setValue("type", type );
+    QStringList rel;
+    foreach( QString f, files ){
+        rel << ( f.isEmpty() ? f : dir.relativeFilePath( f ) );
+    }
+    s.setValue("files", rel );
+    s.setValue("hfov", fov.width() );
+    s.setValue("vfov", fov.height() );
+    s.setValue("surface", surface );
+    s.setValue("recenter", recenter );
+    s.endGroup();
+
+    s.beginGroup("lens");
+    s.setValue("a", lens.a );
+    s.setValue("b", lens.b );
+    s.setValue("c", lens.c );
+    s.setValue("d", lens.d );
+    s.setValue("e", lens.e );
+    s.setValue("vb", lens.vb );
+    s.setValue("vc", lens.vc );
+    s.setValue("vd", lens.vd );
+    s.endGroup();
+
+    s.beginGroup("view");
+    writeView( s, view );
+    s.endGroup();
+
+    s.beginGroup("overlays");
+    s.setValue("visible", overlaysVisible );
+    s.endGroup();
+    s.beginWriteArray("overlays", overlays.count() );
+    for( int i = 0; i < overlays.count(); i++ ){
+        s.setArrayIndex( i );
+        s.setValue("file", dir.relativeFilePath( overlays[i].file ) );
+        s.setValue("fade", overlays[i].fade );
+    }
+    s.endArray();
+
+    s.beginWriteArray("keyframes", keys.count() );
+    for( int i = 0; i < keys.count(); i++ ){
+        s.setArrayIndex( i );
+        writeView( s, keys[i] );
+    }
+    s.endArray();
+
+    s.sync();
+    if( s.status() != QSettings::NoError ){
+        m_error = "can't write session file";
+        return false;
+    }
+    m_error = 0;
+    return true;
+}
@@ -0,0 +1,97 @@
+/*
+ * pvQtSession.h  for Panini
+ *
+ * This file is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this file; if not, write to Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+
+  A pvQtSession holds everything needed to put Panini back the way
+  it was: the picture source files, type and angular size, the
+  panosurface, recenter mode, the lens correction, the full view, the overlay stack and
+  the animation keyframes.
+
+  A session file (.pvs) is in QSettings ini format:
+      [session]
+      version=1
+      type=equi         ; picture type name, see pictureTypes
+      files=a.jpg       ; source files, in face order
+      hfov=360
+      vfov=180
+      surface=0
+      recenter=false
+      [lens]
+      a=0               ; pvQtPic::LensParams, rect and fish only
+      [view]
+      pan=...           ; one key per pvQtView::ViewParams field
+      [overlays]
+      visible=true
+      1\file=...        ; bottom to top
+      1\fade=2
+      [keyframes]
+      1\pan=...
+  File names are stored relative to the session file's directory,
+  so a session can be moved along with its sources.
+
+  Next to name.pvs, the directory name.cache holds the picture's
+  texture images (see pvQtPic::cacheFaces), so reopening a session
+  needs no decoding or resampling of the sources.
+*/
+
+#ifndef PVQTSESSION_H
+#define PVQTSESSION_H
+
+#include <QString>
+#include <QStringList>
+#include <QSizeF>
+#include <QList>
+#include "pvQtView.h"
+
+class QSettings;
+
+class pvQtSession
+{
+public:
+    pvQtSession();
+    // true if name has the session file suffix
+    static bool isSession( QString name );
+    // the texture cache directory that goes with a session file
+    static QString cacheDir( QString name );
+    // false on error, see errMsg()
+    bool read( QString name );
+    bool write( QString name );
+    const char * errMsg(){ return m_error; }
+
+    typedef struct {
+        QString file;
+        int fade;	// GLwindow::overlayCtl fade step
+    } Overlay;
+
+    QString type;		// picture type name
+    QStringList files;	// absolute paths, face order
+    QSizeF fov;
+    int surface;
+    bool recenter;
+    pvQtPic::LensParams lens;
+    pvQtView::ViewParams view;
+    QList<Overlay> overlays;
+    bool overlaysVisible;
+    QList<pvQtView::ViewParams> keys;
+
+private:
+    static void writeView( QSettings & s, const pvQtView::ViewParams & vp );
+    static pvQtView::ViewParams readView( QSettings & s );
+    const char * m_error;
+};
+
+#endif //ndef PVQTSESSION_H
@@ -0,0 +1,215 @@
+/*
+ * pvQtSlideshow.cpp  for Panini
+ *
+ * This file is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this file; if not, write to Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+
+  See pvQtSlideshow.h
+*/
+
+#include "pvQtSlideshow.h"
+#include "pvQtPic.h"
+#include "pvQtFaceStream.h"
+#include "pvQtImagePool.h"
+#include "pvQtColorLUT.h"
+#include <QDir>
+#include <QFileInfo>
+#include <QImageReader>
+#include <QRunnable>
+#include <QMetaObject>
+
+// default memory for prepared faces, megabytes
+#define DEFAULT_BUDGET 512
+
+/* streams one file's face, as the view would (see pvQtFaceStream),
+   into a pooled face image, and posts it to the slideshow
+*/
+class pvQtSlideJob : public QRunnable
+{
+public:
+    pvQtSlideJob( pvQtSlideshow * ss, int serial, QString path,
+                  QRectF clip, QSize dims )
+        : m_ss( ss ), m_serial( serial ), m_path( path ),
+          m_clip( clip ), m_dims( dims ) {}
+    void run(){
+        QSize s = QImageReader( m_path ).size();
+        QRect pc( int( s.width() * m_clip.x() ),
+                  int( s.height() * m_clip.y() ),
+                  int( s.width() * m_clip.width() ),
+                  int( s.height() * m_clip.height() ) );
+        QImage img = pvQtImagePool::faces()->image( m_dims, PVQT_PIC_FACE_FORMAT );
+        if( !img.isNull() ){
+            pvQtFaceStream fs( m_path, pc, m_dims );
+            if( fs.readRows( img.bits(), img.bytesPerLine(), m_dims.height() ) ) {
+                pvQtColorLUT::setProfile( img, fs.profile() );
+            } else {
+                img = QImage();
+            }
+        }
+        QString key;
+        if( !img.isNull() ){
+            key = pvQtPic::faceKey( m_path, pc, m_dims, PVQT_PIC_FACE_FORMAT );
+        }
+        QMetaObject::invokeMethod( m_ss, "prepared", Qt::QueuedConnection,
+                                   Q_ARG( int, m_serial ), Q_ARG( QString, m_path ),
+                                   Q_ARG( QString, key ), Q_ARG( QImage, img ) );
+    }
+private:
+    pvQtSlideshow * m_ss;
+    int m_serial;
+    QString m_path;
+    QRectF m_clip;
+    QSize m_dims;
+};
+
+pvQtSlideshow::pvQtSlideshow( QObject * parent )
+    : QObject( parent )
+{
+    cur = -1;
+    lastStep = 1;
+    serial = 0;
+    setBudget( DEFAULT_BUDGET );
+    // leave cores for the viewer
+    pool.setMaxThreadCount( 2 );
+}
+
+pvQtSlideshow::~pvQtSlideshow()
+{
+    pool.clear();
+    pool.waitForDone();
+}
+
+bool pvQtSlideshow::setFile( QString name )
+{
+    QFileInfo fi( name );
+    QDir dir = fi.absoluteDir();
+    QStringList filters;
+    foreach( QByteArray fmt, QImageReader::supportedImageFormats() ){
+        filters << "*." + QString( fmt );
+    }
+    QStringList names = dir.entryList( filters, QDir::Files,
+                                       QDir::Name | QDir::IgnoreCase );
+    QStringList list;
+    foreach( QString n, names ){
+        list << dir.absoluteFilePath( n );
+    }
+    if( list != files ){
+        files = list;
+        faces.clear();
+        wanted.clear();
+        ++serial;
+    }
+    cur = files.indexOf( fi.absoluteFilePath() );
+    return cur >= 0;
+}
+
+QString pvQtSlideshow::current()
+{
+    return cur < 0 ? QString() : files[cur];
+}
+
+QString pvQtSlideshow::neighbour( int step )
+{
+    int n = files.count();
+    if( cur < 0 || n == 0 ) {
+        return QString();
+    }
+    return files[ ( ( cur + step ) % n + n ) % n ];
+}
+
+QString pvQtSlideshow::advance( int step )
+{
+    if( cur < 0 || files.isEmpty() ) {
+        return QString();
+    }
+    if( step != 0 ) {
+        lastStep = step > 0 ? 1 : -1;
+    }
+    cur = ( ( cur + step ) % files.count() + files.count() ) % files.count();
+    return files[cur];
+}
+
+void pvQtSlideshow::prefetch( QRectF clip, QSize dims )
+{
+    if( cur < 0 || dims.isEmpty() ) {
+        return;
+    }
+    if( clip != pclip || dims != pdims ){
+        pclip = clip;
+        pdims = dims;
+        faces.clear();
+        ++serial;
+    }
+
+    // nearest first, leaning ahead: +1 -1 +2 +3 -2 +4 +5 -3 ...
+    qint64 bytes = 4 * qint64( dims.width() ) * dims.height();
+    int n = int( qMin( qint64( files.count() - 1 ), qMax( qint64(1), budget / bytes ) ) );
+    wanted.clear();
+    int ahead = 1, back = 1;
+    while( wanted.count() < n ){
+        QString f = neighbour( lastStep * ahead++ );
+        if( !wanted.contains( f ) && f != current() ) wanted << f;
+        if( wanted.count() < n && ahead % 2 == 0 ){
+            f = neighbour( -lastStep * back++ );
+            if( !wanted.contains( f ) && f != current() ) wanted << f;
+        }
+        if( ahead > files.count() ) break;
+    }
+
+    // drop what is no longer wanted, start what is missing
+    foreach( QString f, faces.keys() ){
+        if( !wanted.contains( f ) ) faces.remove( f );
+    }
+    pool.clear();	// queued for an older position
+    pending.clear();
+    foreach( QString f, wanted ){
+        if( !faces.contains( f ) ){
+            pending.insert( f );
+            pool.start( new pvQtSlideJob( this, serial, f, clip, dims ) );
+        }
+    }
+}
+
+void pvQtSlideshow::prepared( int s, QString path, QString key, QImage img )
+{
+    pending.remove( path );
+    if( s != serial || img.isNull() || !wanted.contains( path ) ) {
+        return;
+    }
+    Face f;
+    f.key = key;
+    f.img = img;
+    faces.insert( path, f );
+    emit ready( path );
+}
+
+bool pvQtSlideshow::peek( QString path, QString & key, QImage & img )
+{
+    if( !faces.contains( path ) ) {
+        return false;
+    }
+    key = faces[path].key;
+    img = faces[path].img;
+    return true;
+}
+
+bool pvQtSlideshow::take( QString path, QString & key, QImage & img )
+{
+    if( !peek( path, key, img ) ) {
+        return false;
+    }
+    faces.remove( path );
+    return true;
+}
@@ -0,0 +1,98 @@
+/*
+ * pvQtSlideshow.h  for Panini
+ *
+ * This file is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this file; if not, write to Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+
+  pvQtSlideshow steps through the image files of a directory, in
+  name order, wrapping around at the ends.
+
+  prefetch() decodes and resamples the files around the current
+  one in the background, nearest first and leaning in the direction
+  of travel, each into the face image pvQtPic would make of it at
+  the current picture's clip and face size.  Each is streamed into
+  a pooled face image as the view would stream it (see
+  pvQtFaceStream), so a big JPEG is never held whole.  As many
+  are kept as fit the memory budget; the rest are dropped.  A file that turns
+  out to need a different clip or size (e.g. it is not the same
+  size as the current one) simply gets no match and is loaded the
+  ordinary way.  ready() is emitted as each face is made.
+*/
+
+#ifndef PVQTSLIDESHOW_H
+#define PVQTSLIDESHOW_H
+
+#include <QObject>
+#include <QStringList>
+#include <QImage>
+#include <QRectF>
+#include <QMap>
+#include <QSet>
+#include <QThreadPool>
+
+class pvQtSlideshow : public QObject
+{
+    Q_OBJECT
+public:
+    pvQtSlideshow( QObject * parent = 0 );
+    ~pvQtSlideshow();	// waits for decoders
+    /* list the image files in the directory of name, which
+       becomes the current file.  false if it is not one of them
+    */
+    bool setFile( QString name );
+    int count(){ return files.count(); }
+    QString current();
+    // the file step places from the current one
+    QString neighbour( int step );
+    // move by step, returning the new current file
+    QString advance( int step );
+    // +1 or -1, the sign of the last step
+    int direction(){ return lastStep; }
+
+    // memory for prepared faces, megabytes
+    void setBudget( int mb ){ budget = qint64( mb ) << 20; }
+    // prepare faces for the current file's neighbours
+    void prefetch( QRectF clip, QSize dims );
+    /* the prepared face of a file and its pvQtPic::faceKey;
+       false if it is not ready.  take() gives it up.
+    */
+    bool peek( QString path, QString & key, QImage & img );
+    bool take( QString path, QString & key, QImage & img );
+
+signals:
+    void ready( QString path );
+
+private slots:
+    void prepared( int serial, QString path, QString key, QImage img );
+
+private:
+    typedef struct {
+        QString key;
+        QImage img;
+    } Face;
+    QStringList files;	// absolute paths
+    int cur;
+    int lastStep;		// direction of travel
+    qint64 budget;	// bytes
+    int serial;		// of the latest prefetch
+    QRectF pclip;
+    QSize pdims;
+    QStringList wanted;	// to prepare, nearest first
+    QMap<QString, Face> faces;	// prepared
+    QSet<QString> pending;	// being prepared
+    QThreadPool pool;
+};
+
+#endif //ndef PVQTSLIDESHOW_H
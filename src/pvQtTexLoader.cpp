@@ -0,0 +1,225 @@
+/*
+ * pvQtTexLoader.cpp  for Panini
+ *
+ * This file is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this file; if not, write to Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+
+  See pvQtTexLoader.h
+*/
+
+#include "pvQtTexLoader.h"
+#include "pvQtView.h"
+#include "pvQtImagePool.h"
+#include <QOpenGLContext>
+#include <QOpenGLBuffer>
+#include <QOpenGLFunctions>
+#include <QOpenGLExtraFunctions>
+#include <QOffscreenSurface>
+#ifdef __APPLE__
+#include "glext.h"
+#else
+#include <GL/glext.h>
+#endif
+
+#include <cmath>
+
+// rows streamed and uploaded at a time, between checks for a newer job
+#define BAND_ROWS	256
+
+pvQtTexLoader::pvQtTexLoader( QOpenGLContext * share, bool fences, bool storage )
+    : QThread()
+{
+    m_fences = fences;
+    m_storage = storage;
+    m_quit = false;
+
+    m_ctx = new QOpenGLContext;
+    m_ctx->setFormat( share->format() );
+    m_ctx->setShareContext( share );
+    m_surface = new QOffscreenSurface;
+    m_surface->setFormat( m_ctx->format() );
+    m_surface->create();
+    m_ok = m_ctx->create() && m_ctx->shareContext() == share
+           && m_surface->isValid();
+    if( m_ok ) {
+        m_ctx->moveToThread( this );
+    }
+}
+
+pvQtTexLoader::~pvQtTexLoader()
+{
+    m_mutex.lock();
+    m_quit = true;
+    m_jobs.clear();
+    m_cond.wakeAll();
+    m_mutex.unlock();
+    wait();
+    delete m_ctx;	// if the thread never ran
+    delete m_surface;
+}
+
+void pvQtTexLoader::load( const Job & job )
+{
+    QMutexLocker lk( &m_mutex );
+    m_jobs.clear();
+    m_jobs.append( job );
+    m_cond.wakeAll();
+}
+
+bool pvQtTexLoader::stale()
+{
+    QMutexLocker lk( &m_mutex );
+    return m_quit || !m_jobs.isEmpty();
+}
+
+void pvQtTexLoader::run()
+{
+    if( !m_ok || !m_ctx->makeCurrent( m_surface ) ) {
+        return;
+    }
+    QOpenGLFunctions * gf = m_ctx->functions();
+    QOpenGLExtraFunctions * xf = m_ctx->extraFunctions();
+
+    // pixel unpack buffers, if OpenGL has them
+    QOpenGLBuffer pbos[2] = { QOpenGLBuffer( QOpenGLBuffer::PixelUnpackBuffer ),
+                              QOpenGLBuffer( QOpenGLBuffer::PixelUnpackBuffer ) };
+    bool usePbos = ( m_ctx->format().version() >= qMakePair( 2, 1 )
+                     || m_ctx->hasExtension("GL_ARB_pixel_buffer_object") )
+                   && pbos[0].create() && pbos[1].create();
+    if( usePbos ) {
+        pbos[0].setUsagePattern( QOpenGLBuffer::StreamDraw );
+        pbos[1].setUsagePattern( QOpenGLBuffer::StreamDraw );
+    }
+
+    for(;;){
+        m_mutex.lock();
+        while( !m_quit && m_jobs.isEmpty() ) {
+            m_cond.wait( &m_mutex );
+        }
+        if( m_quit ){
+            m_mutex.unlock();
+            break;
+        }
+        Job job = m_jobs.takeFirst();
+        m_mutex.unlock();
+        bool mips = job.mips;
+
+        int w = job.dims.width(), h = job.dims.height();
+        int levels = mips ? 1 + int( floor( log2( double( qMax( w, h ) ) ) ) ) : 1;
+        GLuint tex = 0;
+        glGenTextures( 1, &tex );
+        glBindTexture( job.target, tex );
+        pvQtView::setTexParams( job.target, mips );
+        if( m_storage ){
+            xf->glTexStorage2D( job.target, levels, GL_RGBA8, w, h );
+        } else {
+            foreach( GLenum f, job.faces ){
+                glTexImage2D( f, 0, GL_RGBA, w, h, 0,
+                              GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV, 0 );
+            }
+        }
+
+        /* stream the faces in bands, giving up if a newer job comes;
+           rows go straight into a mapped pixel buffer, or else into
+           a band image, and the texture is filled from there
+        */
+        glPixelStorei( GL_UNPACK_ALIGNMENT, 4 );  // QImage row alignment
+        bool abandon = false, failed = false;
+        int k = 0;	// pixel buffer next in turn
+        QImage band;
+        for( int i = 0; !abandon && !failed && i < job.faces.count(); i++ ){
+            QSharedPointer<pvQtFaceStream> fs = job.streams.value( i );
+            if( !fs ){
+                failed = true;
+                break;
+            }
+            int sw = fs->size().width();
+            int fw = qMin( w, sw ), fh = qMin( h, fs->size().height() );
+            int bpl = 4 * sw;
+            glPixelStorei( GL_UNPACK_ROW_LENGTH, sw );
+            for( int y = 0; y < fh; y += BAND_ROWS ){
+                int n = qMin( BAND_ROWS, fh - y );
+                uchar * p = 0;
+                if( usePbos ){
+                    pbos[k].bind();
+                    pbos[k].allocate( BAND_ROWS * bpl );	// orphans its last band
+                    p = (uchar *)pbos[k].map( QOpenGLBuffer::WriteOnly );
+                    if( !p ){
+                        pbos[k].release();
+                        usePbos = false;
+                    }
+                }
+                bool mapped = p != 0;
+                if( !mapped ){
+                    if( band.width() != sw ) {
+                        band = pvQtImagePool::faces()->image( QSize( sw, BAND_ROWS ),
+                                                              PVQT_PIC_FACE_FORMAT );
+                    }
+                    p = band.bits();
+                }
+                bool ok = p != 0 && fs->readRows( p, bpl, n );
+                if( mapped ) {
+                    ok = pbos[k].unmap() && ok;
+                }
+                if( ok ){
+                    glTexSubImage2D( job.faces[i], 0, 0, y, fw, n,
+                                     GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV,
+                                     mapped ? 0 : p );
+                }
+                if( mapped ){
+                    pbos[k].release();
+                    k ^= 1;
+                }
+                if( !ok ){
+                    failed = true;
+                    break;
+                }
+                glFlush();
+                if( stale() ){
+                    abandon = true;
+                    break;
+                }
+            }
+            job.streams[i].clear();	// done with it
+        }
+        band = QImage();
+        glPixelStorei( GL_UNPACK_ROW_LENGTH, 0 );
+        if( !abandon && !failed && mips ) {
+            gf->glGenerateMipmap( job.target );
+        }
+        glBindTexture( job.target, 0 );
+
+        if( abandon || failed || glGetError() != GL_NO_ERROR ){
+            glDeleteTextures( 1, &tex );
+            if( abandon ) continue;
+            tex = 0;
+        }
+
+        void * fence = 0;
+        if( tex && m_fences ){
+            fence = xf->glFenceSync( GL_SYNC_GPU_COMMANDS_COMPLETE, 0 );
+            glFlush();
+        } else {
+            glFinish();
+        }
+        emit loaded( job.serial, tex, fence );
+    }
+
+    pbos[0].destroy();
+    pbos[1].destroy();
+    m_ctx->doneCurrent();
+    delete m_ctx;
+    m_ctx = 0;
+}
@@ -0,0 +1,95 @@
+/*
+ * pvQtTexLoader.h  for Panini
+ *
+ * This file is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this file; if not, write to Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+
+  pvQtTexLoader makes picture textures on a thread of its own, in
+  an OpenGL context that shares objects with pvQtView's, so a big
+  upload doesn't stall the frames of the picture being shown.
+
+  Each job is a set of face streams (see pvQtFaceStream), all the
+  same size.  The loader makes a new texture and fills it a band of
+  rows at a time: each band is decoded and resampled straight into
+  a mapped pixel unpack buffer, two of which take turns, so one can
+  be read by OpenGL while the next is written (where there are no
+  pixel buffers a small band image is used instead).  No face is
+  ever held whole.  Then it builds the mipmap levels if asked, and
+  sets a fence after the commands.  loaded() passes the texture name and the fence
+  (0 if OpenGL has no sync objects, when the loader waits for the
+  upload itself) to the view, which swaps the texture in once the
+  fence has passed.  A job that is replaced while it is loading is
+  abandoned between bands; its texture is deleted.  A face that
+  can't be read fails the job (texture 0).
+*/
+
+#ifndef PVQTTEXLOADER_H
+#define PVQTTEXLOADER_H
+
+#include <QThread>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QImage>
+#include <QList>
+#include <QSharedPointer>
+#include <QtOpenGL/qgl.h>
+#include "pvQtFaceStream.h"
+
+class QOpenGLContext;
+class QOffscreenSurface;
+
+class pvQtTexLoader : public QThread
+{
+    Q_OBJECT
+public:
+    typedef struct {
+        int serial;	// passed back by loaded()
+        GLenum target;	// GL_TEXTURE_2D or GL_TEXTURE_CUBE_MAP
+        QSize dims;	// of every face
+        bool mips;	// make the mipmap levels
+        QList<GLenum> faces;	// upload targets
+        QList<QSharedPointer<pvQtFaceStream> > streams;	// in the same order
+    } Job;
+
+    /* call in the GUI thread; check isOK()
+       fences: OpenGL has sync objects; storage: immutable textures
+    */
+    pvQtTexLoader( QOpenGLContext * share, bool fences, bool storage );
+    ~pvQtTexLoader();	// abandons any job
+    bool isOK(){ return m_ok; }
+    // start loading, in place of any job not finished
+    void load( const Job & job );
+
+signals:
+    // tex is 0 on error; fence is a GLsync
+    void loaded( int serial, uint tex, void * fence );
+
+protected:
+    void run();
+
+private:
+    bool stale();	// a newer job is waiting
+
+    QOpenGLContext * m_ctx;
+    QOffscreenSurface * m_surface;
+    bool m_ok;
+    bool m_fences, m_storage;
+    QMutex m_mutex;
+    QWaitCondition m_cond;
+    QList<Job> m_jobs;	// at most one waiting
+    bool m_quit;
+};
+
+#endif //ndef PVQTTEXLOADER_H
@@ -19,6 +19,16 @@
  */
 
 #include "pvQtView.h"
+#include "pvQtPyramid.h"
+#include "pvQtAnimation.h"
+#include "pvQtMovie.h"
+#include "pvQtRenderThread.h"
+#include "pvQtTexLoader.h"
+#include "pvQtBackend.h"
+#include "pvQtCamera.h"
+#include "pvQtColorLUT.h"
+#include "pvQtFaceStream.h"
+#include "pvQtImagePool.h"
 
 #include <QtOpenGL/QtOpenGL>
 #ifdef __APPLE__
@@ -29,8 +39,14 @@
 #include <GL/glu.h>
 #endif
 #include <QGLFramebufferObject>
+#include <QElapsedTimer>
+#include <QOpenGLBuffer>
+#include <QOpenGLContext>
+#include <QOpenGLFunctions>
+#include <QOpenGLExtraFunctions>
 
 #include <cmath>
+#include <algorithm>
 
 #define max( a, b ) (a > b ? a : b )
 #define min( a, b ) (a > b ? b : a )
@@ -42,74 +58,29 @@
 #define RAD(d) ( Pi * (d) / 180.0 )
 #endif
 
-/*
- * Kludge: despite the fact that glWindowPos is standard from
- * OGL 1.4, my headers don't define it.  This code provides it.
-*/
-#ifndef glWindowPos4f
-
-void glWindowPos4f(float x,float y,float z,float w)
-{
-    //  Integer versions of x and y
-    int ix = (int)x;
-    int iy = (int)y;
-    //  Save transform attributes (Matrix Mode and Viewport)
-    glPushAttrib(GL_TRANSFORM_BIT|GL_VIEWPORT_BIT);
-    //  Save projection matrix and set identity
-    glMatrixMode(GL_PROJECTION);
-    glPushMatrix();
-    glLoadIdentity();
-    //  Save model view matrix and set to indentity
-    glMatrixMode(GL_MODELVIEW);
-    glPushMatrix();
-    glLoadIdentity();
-    //  Set viewport to 2x2 pixels around (x,y)
-    glViewport(ix-1,iy-1,2,2);
-    //  Finally set the raster position
-    glRasterPos4f(x-ix,y-iy,z,w);
-    //  Reset model view matrix
-    glPopMatrix();
-    //  Reset projection matrix
-    glMatrixMode(GL_PROJECTION);
-    glPopMatrix();
-    //  Pop transform attributes (Matrix Mode and Viewport)
-    glPopAttrib();
-}
-
-/*
- * glWindowPos wrappers
- */
-void glWindowPos2s(short  x,short  y)                   {glWindowPos4f(x,y,0,1);}
-void glWindowPos2i(int    x,int    y)                   {glWindowPos4f(x,y,0,1);}
-void glWindowPos2f(float  x,float  y)                   {glWindowPos4f(x,y,0,1);}
-void glWindowPos2d(double x,double y)                   {glWindowPos4f(x,y,0,1);}
-void glWindowPos3s(short  x,short  y,short  z)          {glWindowPos4f(x,y,z,1);}
-void glWindowPos3i(int    x,int    y,int    z)          {glWindowPos4f(x,y,z,1);}
-void glWindowPos3f(float  x,float  y,float  z)          {glWindowPos4f(x,y,z,1);}
-void glWindowPos3d(double x,double y,double z)          {glWindowPos4f(x,y,z,1);}
-void glWindowPos4s(short  x,short  y,short  z,short  w) {glWindowPos4f(x,y,z,w);}
-void glWindowPos4i(int    x,int    y,int    z,int    w) {glWindowPos4f(x,y,z,w);}
-void glWindowPos4d(double x,double y,double z,double w) {glWindowPos4f(x,y,z,w);}
-void glWindowPos2sv(const short  v[2])                  {glWindowPos4f(v[0],v[1],  0 ,  1 );}
-void glWindowPos2iv(const int    v[2])                  {glWindowPos4f(v[0],v[1],  0 ,  1 );}
-void glWindowPos2fv(const float  v[2])                  {glWindowPos4f(v[0],v[1],  0 ,  1 );}
-void glWindowPos2dv(const double v[2])                  {glWindowPos4f(v[0],v[1],  0 ,  1 );}
-void glWindowPos3sv(const short  v[3])                  {glWindowPos4f(v[0],v[1],v[2],  1 );}
-void glWindowPos3iv(const int    v[3])                  {glWindowPos4f(v[0],v[1],v[2],  1 );}
-void glWindowPos3fv(const float  v[3])                  {glWindowPos4f(v[0],v[1],v[2],  1 );}
-void glWindowPos3dv(const double v[3])                  {glWindowPos4f(v[0],v[1],v[2],  1 );}
-void glWindowPos4sv(const short  v[4])                  {glWindowPos4f(v[0],v[1],v[2],v[3]);}
-void glWindowPos4iv(const int    v[4])                  {glWindowPos4f(v[0],v[1],v[2],v[3]);}
-void glWindowPos4fv(const float  v[4])                  {glWindowPos4f(v[0],v[1],v[2],v[3]);}
-void glWindowPos4dv(const double v[4])                  {glWindowPos4f(v[0],v[1],v[2],v[3]);}
-
-#endif  //ndef glWindowPos4f
+// color table grid points per axis
+#define LUT_SIZE	33
+// face rows streamed to a texture at a time
+#define FACE_BAND_ROWS	256
 
 /**** maximum projection angle at eye ****/
 #define MAXPROJFOV  150
 #define MAXDANGLE	88
 #define MAXDIST	tan(RAD(MAXDANGLE))
 
+/**** tiled pyramid display ****/
+#define TILE_CACHE_BYTES  (256 * 1024 * 1024)	// GPU memory for tiles
+#define TILE_SAMPLE	32	// screen sample spacing, pixels
+#define TILE_DIVS	8	// mesh subdivisions per tile side
+#define CYLTAN	3.7320508	// tan(75 deg), panocylinder half height
+
+/**** fast preview while dragging ****/
+#define PREVIEW_BUDGET	30.0	// target frame time, msec
+#define PREVIEW_MIN	0.25	// smallest render scale
+
+/**** animation rendering ****/
+#define READBACK_PBOS	3	// frames in flight, render to readback
+
 /*
  * C'tor for pvQtView
  * specifies a custom OGL context format, not because we need it
@@ -132,14 +103,57 @@ pvQtView::pvQtView(QWidget *parent)
     errmsg = tr("no picture");
     thePic = 0;
     theScreen = 0;
+    backend = 0;
+    wantBackend = pvQtBackend::coreGL33;
     textgt = 0;
     texname = 0;
     textgt = 0;
     MacCubeLimit = 0;
 
-    povly = 0;
+    lastLayer = 0;
+    layerProg = 0;
+
+    fastPreview = true;
+    moving = false;
+    previewScale = 1;
+    previewFbo = 0;
+    renderCancel = false;
+    flipY = false;
+    hasFences = false;
+    hasTexStorage = false;
+    genMips = false;
+    texPic = 0;
+    texGen = 0;
+    saveOpts = pvQtEncoder::defaults();
+    readTimer.setInterval( 5 );
+    connect( &readTimer, &QTimer::timeout, this, &pvQtView::pollSaves );
     recenter = false;
 
+    pyramid = 0;
+    maxTiles = 0;
+    tileFrame = 0;
+
+    renderer = 0;
+
+    loader = 0;
+    loadSerial = 0;
+    loadPic = 0;
+    loadTex = 0;
+    loadFence = 0;
+    viewPending = false;
+    loadTimer.setInterval( 5 );
+    connect( &loadTimer, &QTimer::timeout, this, &pvQtView::pollLoad );
+    for( int i = 0; i < 3; i++ ) {
+        texMipped[i] = false;
+    }
+    lutTex[0] = lutTex[1] = 0;
+    lutMade = true;	// no picture, no tables
+
+    activePane = 0;
+    paneLock = false;
+    altScreen = 0;
+    altKey = -1;
+
     // create the surface tables
     pqs = new panosphere( 50 );
     ppc = new panocylinder( 200 );
@@ -155,8 +169,30 @@ pvQtView::pvQtView(QWidget *parent)
 
 pvQtView::~pvQtView()
 {
-    makeCurrent();
-    glDeleteLists(theScreen, 1);
+    delete renderer;	// stops it, leaving us the context
+    renderer = 0;
+    delete loader;	// abandons any upload
+    loader = 0;
+    useContext();
+    dropLoad();
+    // finish saving views
+    readTimer.stop();
+    foreach( saveJob sj, saves ){
+        fenceDone( sj.fence, true );
+        encodeView( sj.name, mapImage( *sj.pbo, sj.size.width(), sj.size.height() ) );
+        sj.pbo->destroy();
+        delete sj.pbo;
+    }
+    saves.clear();
+    savePool.waitForDone();
+    clearTiles();
+    clearLayers();
+    for( int i = 0; i < panes.count(); i++ ) {
+        dropPanePic( panes[i] );
+    }
+    delete previewFbo;
+    glDeleteTextures( 2, lutTex );
+    delete backend;	// and its screens
 }
 
 /*
@@ -193,6 +229,7 @@ bool pvQtView::OpenGLOK()
                 vertBuf = true;
                 if( vf & QGLFormat::OpenGL_Version_2_0 ) {
                     texPwr2 = false;
+                    OGLv20 = true;
                 }
             }
         }
@@ -216,9 +253,21 @@ bool pvQtView::OpenGLOK()
     glGetIntegerv( GL_MAX_TEXTURE_SIZE, &max2d );
     glGetIntegerv( GL_MAX_CUBE_MAP_TEXTURE_SIZE, &maxcube );
 
+    // sync objects for asynchronous readback
+    QOpenGLContext * ctx = QOpenGLContext::currentContext();
+    hasFences = ctx != 0
+            && ( ctx->format().version() >= qMakePair( 3, 2 )
+                 || ctx->hasExtension("GL_ARB_sync") );
+    // fixed size textures
+    hasTexStorage = ctx != 0
+            && ( ctx->format().version() >= qMakePair( 4, 2 )
+                 || ctx->hasExtension("GL_ARB_texture_storage") );
+    // mipmapped picture textures
+    genMips = ctx != 0
+            && ctx->functions()->hasOpenGLFeature( QOpenGLFunctions::Framebuffers );
+
     // operating controls
     OGLisOK = cubeMap;
-    QS_BUF = vertBuf;
 
 
     ////TODO: check for framebuffer object
@@ -255,6 +304,11 @@ void pvQtView::mouseDoubleClickEvent( QMouseEvent * pme ){
 }
 
 void pvQtView::mousePressEvent( QMouseEvent * pme ){
+    // a click selects the pane to control
+    if( panes.count() > 1 ){
+        int p = paneAt( pme->pos() );
+        if( p != activePane ) setActivePane( p );
+    }
     mx1 = mx0 = pme->x();
     my1 = my0 = pme->y();
     mb = pme->buttons();
@@ -281,6 +335,11 @@ void pvQtView::mouseReleaseEvent( QMouseEvent * pme ){
     mk = pme->modifiers();
     if( mb == 0 ) {
         mTimer.stop();
+        // full quality once motion stops
+        if( moving ){
+            moving = false;
+            updateGL();
+        }
     }
 }
 
@@ -290,10 +349,6 @@ void pvQtView::mTimeout(){
         return;
     }
 
-    // wait til previous draw done?
-    makeCurrent();
-    //glFinish();
-
     int dx = (mx1 - mx0) / 3,
             dy = (my0 - my1) / 3;
     /*  mouse modes
@@ -351,7 +406,18 @@ void pvQtView::mTimeout(){
         }
     }
 
+    // draw, and adjust preview scale to the frame time
+    QElapsedTimer ft;
+    ft.start();
+    moving = true;
     updateGL();
+    if( fastPreview ){
+        // the last frame the render thread drew, or this one
+        double ms = renderer ? renderer->frameTime() : 1e-6 * ft.nsecsElapsed();
+        // pixel count goes as the square of the scale
+        double f = sqrt( PREVIEW_BUDGET / max( 1.0, ms ) );
+        previewScale = KLIP( previewScale * KLIP( f, 0.7, 1.25 ), PREVIEW_MIN, 1.0 );
+    }
     showview();
     mTimer.start();
 }
@@ -766,13 +832,18 @@ void pvQtView::setZoom(int angle)
 bool pvQtView::OGLok( const char * label ){
     GLenum c = glGetError();
     if( c == GL_NO_ERROR ) return true;
+    noteOGLerror( label, c );
+    return false;
+}
+
+// post an OGL error, as OGLok(); for errors found by the render thread
+void pvQtView::noteOGLerror( const char * label, GLenum c ){
     if( picok ){
         picok = false;
         errmsg = QString("%1 OGL error: ").arg(label)
                 + QString( (const char *)gluErrorString( c ) );
         emit OGLerror( errmsg );
     }
-    return false;
 }
 
 /* One-time setup of the OpenGL environment
@@ -798,7 +869,7 @@ void pvQtView::initializeGL()
     glEnable(GL_CULL_FACE);
 
     // create texture objects
-    glGenTextures( 2, texnms );
+    glGenTextures( 3, texnms );
     glBindTexture( GL_TEXTURE_2D, texnms[0] );
     glBindTexture( GL_TEXTURE_CUBE_MAP, texnms[1] );
 
@@ -809,27 +880,66 @@ void pvQtView::initializeGL()
 
     // constant texture mapping parameters...
     glTexEnvf(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_DECAL);
-    // for cube maps...
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    // 2d maps...
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    setTexParams( GL_TEXTURE_CUBE_MAP );
+    glBindTexture( GL_TEXTURE_2D, texnms[2] );
+    setTexParams( GL_TEXTURE_2D );
+    glBindTexture( GL_TEXTURE_2D, texnms[0] );
+    setTexParams( GL_TEXTURE_2D );
 
-    // enable alpha blending for overlay
+    // enable alpha blending for overlays
     glEnable (GL_BLEND);
     glBlendFunc (GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    makeLayerProgram();
 
+    // the preferred rendering backend, else the fixed-function one
+    backend = pvQtBackend::create( pvQtBackend::Kind( wantBackend ) );
+    if( !backend ) backend = pvQtBackend::create( pvQtBackend::legacyGL );
+    emit reportBackend( backend->kind() );
 
-    // create a displaylist
-    theScreen = glGenLists(1);
+    // create a screen
+    theScreen = backend->newScreen();
 
     // make wireframe panosphere
     makeSphere( theScreen );
 
+    // draw from now on in a thread of our own, if we can,
+    // and make new pictures' textures in another
+    if( QOpenGLContext::supportsThreadedOpenGL() ){
+        loader = new pvQtTexLoader( context()->contextHandle(),
+                                    hasFences, hasTexStorage );
+        if( loader->isOK() ){
+            connect( loader, &pvQtTexLoader::loaded, this, &pvQtView::texLoaded );
+            loader->start();
+        } else {
+            delete loader;
+            loader = 0;
+        }
+        setAutoBufferSwap( false );
+        renderer = new pvQtRenderThread( this );
+        renderer->start();
+    }
+
+}
+
+/* sampling parameters of the bound picture texture,
+   trilinear if it has mipmap levels
+*/
+void pvQtView::setTexParams( GLenum target, bool mipped )
+{
+    GLint minf = mipped ? GL_LINEAR_MIPMAP_LINEAR : GL_NEAREST;
+    if( target == GL_TEXTURE_CUBE_MAP ){
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, minf);
+    } else {
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, minf);
+        // black border color for 2D textures
+        float bord[4] = { 0, 0, 0, 1 };
+        glTexParameterfv(GL_TEXTURE_2D, GL_TEXTURE_BORDER_COLOR, bord);
+    }
 }
 
 /* find the largest feasible texture dimensions
@@ -877,41 +987,19 @@ void pvQtView::setPicType( pvQtPic::PicType pt )
     curr_pt = picType;
     curr_ipt = ipicType;
 
-    makeCurrent();	// get OGL's attention
-    if(textgt){
-        glDisable( textgt );
-        texname = 0;
-        textgt = 0;
-    }
-
-    glDisable( GL_TEXTURE_GEN_S );
-    glDisable( GL_TEXTURE_GEN_T );
-    glDisable( GL_TEXTURE_GEN_R );
-
-    glFrontFace( GL_CCW );
-    glEnableClientState(GL_VERTEX_ARRAY);
-    glDisableClientState(GL_TEXTURE_COORD_ARRAY);
-    glDisableClientState(GL_NORMAL_ARRAY);
+    useContext();	// get OGL's attention
+    texname = 0;
+    textgt = 0;
 
+    // the backend sets up texturing for the target
     if( picType == pvQtPic::cub ){
-        /* for cube map, generate texture coords from normals */
+        /* for cube map, texture coords from normals */
         textgt = GL_TEXTURE_CUBE_MAP;
         texname = texnms[1];
-        glEnableClientState(GL_NORMAL_ARRAY);
-        glTexGenf( GL_S, GL_TEXTURE_GEN_MODE, GL_REFLECTION_MAP );
-        glTexGenf( GL_T, GL_TEXTURE_GEN_MODE, GL_REFLECTION_MAP );
-        glTexGenf( GL_R, GL_TEXTURE_GEN_MODE, GL_REFLECTION_MAP );
-        glEnable( GL_TEXTURE_GEN_S );
-        glEnable( GL_TEXTURE_GEN_T );
-        glEnable( GL_TEXTURE_GEN_R );
     } else if( picType != pvQtPic::nil ) {
         /* for 2D maps, use quadsphere texture coordinates */
         textgt = GL_TEXTURE_2D;
         texname = texnms[0];
-        glEnableClientState(GL_TEXTURE_COORD_ARRAY);
-        // black border color for 2D textures
-        float bord[4] = { 0, 0, 0, 1 };
-        glTexParameterfv(GL_TEXTURE_2D, GL_TEXTURE_BORDER_COLOR, bord);
     } else {
         /* no picture, show wireframe */
     }
@@ -945,108 +1033,335 @@ void pvQtView::setTexMag( double magx, double magy ){
 
 /**  Display a Frame  **/
 
+/* While the mouse is dragging the view, and fast preview is on,
+   the picture may be drawn at a reduced scale into an offscreen
+   buffer and stretched to fill the window.  mTimeout() sets the
+   scale from the measured frame time; once the mouse is released
+   a full quality frame is drawn.  Overlay layers are always drawn
+   at full size.
+
+   paintGL() draws a frame here and now, in the current viewport;
+   the render thread calls prepareFrame() and paintFrame() itself.
+*/
 void pvQtView::paintGL()
 {
     // abort if the OpenGL version is insufficient
     if( !OGLisOK ) return;
 
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    GLint vp[4];
+    glGetIntegerv( GL_VIEWPORT, vp );
+    Frame f;
+    prepareFrame( f, QRect( vp[0], vp[1], vp[2], vp[3] ) );
+    paintFrame( f );
+    paintok = f.errAt == 0;
+    if( !paintok ) noteOGLerror( f.errAt, f.err );
+}
+
+/* Threaded drawing: updates and repaints ask the render thread
+   for a frame; GL work done here first takes the context.
+*/
+void pvQtView::updateGL()
+{
+    if( renderer ) renderer->requestFrame();
+    else QGLWidget::updateGL();
+}
+
+void pvQtView::glDraw()
+{
+    if( renderer ) renderer->requestFrame();
+    else QGLWidget::glDraw();
+}
 
-    if( textgt ){	//there is a picture...
-        glBindTexture( textgt, texname );
-        glEnable( textgt );
+void pvQtView::useContext()
+{
+    if( renderer && QThread::currentThread() != renderer ) {
+        renderer->borrowContext();
     }
-    // 2D texture border mode
-    if( textgt ==  GL_TEXTURE_2D ){
-        GLuint sclamp, tclamp;
-        sclamp = tclamp = GL_CLAMP_TO_BORDER;
-        if( curr_fovs.width() >= 360 ) sclamp = GL_CLAMP_TO_EDGE;
-        if( curr_fovs.height() >= 360 ) tclamp = GL_CLAMP_TO_EDGE;
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, sclamp);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, tclamp);
+    if( QGLContext::currentContext() != context() ) {
+        QGLWidget::makeCurrent();
     }
+}
 
-    // set texture rotation and scaling
-    glMatrixMode(GL_TEXTURE);
-    glLoadIdentity();
+void pvQtView::resizeEvent( QResizeEvent * ev )
+{
+    useContext();	// resizeGL runs here
+    QGLWidget::resizeEvent( ev );
+}
+
+QImage pvQtView::grabFrame()
+{
+    useContext();
+    paintGL();	// into the back buffer, not swapped
+    return grabFrameBuffer();
+}
+
+void pvQtView::setFastPreview( bool on )
+{
+    fastPreview = on;
+    if( !on ) previewScale = 1;
+}
+
+/* read the view into f, to be drawn in port; makes what the
+   frame needs that takes GL work first
+*/
+void pvQtView::prepareFrame( Frame & f, QRect port )
+{
+    f.port = port;
+    f.flipY = flipY;
+    f.preview = 1;
+    f.panes.clear();
+    f.active = QRect();
+    f.layers.clear();
+    f.errAt = 0;
+    f.err = GL_NO_ERROR;
+
+    if( !lutMade ){
+        useContext();
+        makeLUTs();
+    }
 
-    double turnAngle = turn90 * 90 + turnRoll;
-    if(picType == pvQtPic::cub){
-        // cube texture rotates around origin
-        glRotated( 180, 0,1,0 );
-        glRotated( 180, 0,0,1 );
-        glRotated( -turnYaw, 0, 1, 0 );
-        glRotated( -turnPitch, 1, 0, 0 );
-        glRotated( -turnAngle, 0, 0, 1 );
+    if( panes.count() > 1 ){
+        // each pane's view, in its part of the port
+        double ar = portAR;
+        ViewParams live = getView();
+        GLuint screen = theScreen, tex = texname;
+        pvQtPyramid * pyr = pyramid;
+        QList<ViewParams> views;
+        for( int i = 0; i < panes.count(); i++ ) {
+            views.append( paneView( i ) );
+        }
+        bool blocked = blockSignals( true );
+        for( int i = 0; i < panes.count(); i++ ){
+            QRect r = paneRect( i, port );
+            portAR = (double)r.width() / (double)r.height();
+            applyView( views[i] );
+            if( i != activePane && panes[i].surface != surface ) {
+                useContext();
+                theScreen = otherScreen();
+            }
+            if( panes[i].tex ){
+                texname = panes[i].tex;
+                pyramid = 0;	// its tiles are the main picture's
+            }
+            framePane p;
+            preparePane( p, r );
+            f.panes.append( p );
+            theScreen = screen;
+            texname = tex;
+            pyramid = pyr;
+        }
+        applyView( live );
+        portAR = ar;
+        blockSignals( blocked );
+        // frame the active pane on screen
+        if( !flipY ) f.active = paneRect( activePane, port );
     } else {
-        // 2D textures rotate and scale around pic center
-        glTranslated( 0.5, 0.5, 0 );
-        ///		glRotated( -turnPitch, 1, 0, 0 );
-        glRotated( -turnAngle, 0, 0, 1 );
-        glScaled( xtexmag, ytexmag, 1.0 );
-        glTranslated( -0.5, -0.5, 0 );
+        QRect r = port;
+        if( moving && fastPreview && previewScale < 1 ){
+            // drawn into the lower left of the preview buffer
+            f.preview = previewScale;
+            r = QRect( 0, 0, max( 1, int( previewScale * port.width() ) ),
+                       max( 1, int( previewScale * port.height() ) ) );
+        }
+        framePane p;
+        preparePane( p, r );
+        f.panes.append( p );
     }
 
-    // Set point of view
-    glMatrixMode(GL_PROJECTION);
-    glLoadIdentity();
-    /* initial viewing volume, vFOV sets zoom, includes
-   framing and eye shift compensating translations
-   of the viewport
+    // overlay layers, loading new images
+    for( int i = 0; i < layers.count(); i++ ){
+        ovlyLayer & ly = layers[i];
+        if( !ly.visible || ly.opacity <= 0 || ly.dims.isEmpty() ) continue;
+        if( !ly.img.isNull() ){
+            useContext();
+            if( !loadLayer( ly ) ) continue;
+        }
+        frameLayer fl;
+        fl.tex = ly.tex;
+        fl.blend = ly.blend;
+        fl.opacity = ly.opacity;
+        fl.dice = ly.dice;
+        fl.dims = ly.dims;
+        fl.pos = ly.pos;
+        fl.scale = ly.scale;
+        fl.rotate = ly.rotate;
+        f.layers.append( fl );
+    }
+}
+
+// the current picture and view, drawn in port
+void pvQtView::preparePane( framePane & p, QRect port )
+{
+    p.port = port;
+    p.cam = camera();
+    p.screen = theScreen;
+    p.target = textgt;
+    p.tex = texname;
+
+    /* color table, converting to the display's profile, or to
+       sRGB for readback (saved views and animations); none for
+       pickFace's coded faces
+    */
+    p.lut = texname ? lutTex[ flipY ? 1 : 0 ] : 0;
+
+    // 2D texture border mode
+    p.wrapS = p.wrapT = GL_CLAMP_TO_BORDER;
+    if( curr_fovs.width() >= 360 ) p.wrapS = GL_CLAMP_TO_EDGE;
+    if( curr_fovs.height() >= 360 ) p.wrapT = GL_CLAMP_TO_EDGE;
+
+    // finer pyramid tiles on top (but not when picking a face)
+    p.tiles.clear();
+    p.tileVerts.clear();
+    if( pyramid && texname != 0 ) prepareTiles( p );
+}
+
+/* draw a prepared frame; notes the first OGL error in f
 */
-    double  hhnear = Znear * tan( 0.5 * RAD(wFOV) ),
-            hwnear = hhnear * portAR,
-            dxnear = 2 * hwnear * (framex + fcompx),
-            dynear = 2 * hhnear * (framey + fcompy);
-    glFrustum( -(hwnear + dxnear), hwnear - dxnear,
-               -(hhnear + dynear), hhnear - dynear,
-               Znear, Zfar
-               );
-    // OGL default view is along -Z, we want +Z
-    glRotated( 180, 0, 1, 0 );
+void pvQtView::paintFrame( Frame & f )
+{
+    if( f.panes.count() > 1 ){
+        glEnable( GL_SCISSOR_TEST );
+        for( int i = 0; i < f.panes.count(); i++ ){
+            const framePane & p = f.panes[i];
+            QRect r = p.port;
+            glViewport( r.x(), r.y(), r.width(), r.height() );
+            glScissor( r.x(), r.y(), r.width(), r.height() );
+            paintScene( f, p );
+            if( f.errAt ) break;
+        }
+        if( !f.active.isEmpty() && !f.errAt ){
+            QRect r = f.active;
+            int b = 2;
+            QRect edges[4] = {
+                QRect( r.x(), r.y(), r.width(), b ),
+                QRect( r.x(), r.bottom() + 1 - b, r.width(), b ),
+                QRect( r.x(), r.y(), b, r.height() ),
+                QRect( r.right() + 1 - b, r.y(), b, r.height() )
+            };
+            glClearColor( 0.5f, 0.5f, 0.5f, 1.0f );
+            for( int k = 0; k < 4; k++ ){
+                glScissor( edges[k].x(), edges[k].y(), edges[k].width(), edges[k].height() );
+                glClear( GL_COLOR_BUFFER_BIT );
+            }
+            glClearColor( 0.0f, 0.0f, 0.0f, 1.0f );
+        }
+        glDisable( GL_SCISSOR_TEST );
+    } else if( !f.panes.isEmpty()
+               && !( f.preview < 1 && paintPreview( f, f.panes[0] ) ) ){
+        glViewport( f.port.x(), f.port.y(), f.port.width(), f.port.height() );
+        paintScene( f, f.panes[0] );
+    }
+    glViewport( f.port.x(), f.port.y(), f.port.width(), f.port.height() );
 
-    if( recenter ){
-        // panosurface rotates around eye
-        glRotated( -spinAngle, 0, 0, 1 );
-        glRotated( tiltAngle, 1, 0, 0 );
-        glRotated( panAngle, 0, 1, 0 );
-        glMatrixMode(GL_MODELVIEW);
-        glLoadIdentity();
-        glTranslated( eyex, eyey, eyez );
-    } else {
-        // eye rotates around panocenter
-        glTranslated( eyex, eyey, eyez );
-        glRotated( -spinAngle, 0, 0, 1 );
-        glRotated( tiltAngle, 1, 0, 0 );
-        glRotated( panAngle, 0, 1, 0 );
-        glMatrixMode(GL_MODELVIEW);
-        glLoadIdentity();
+    // overlay layers on top
+    if( !f.errAt && !f.layers.isEmpty() ){
+        paintLayers( f );
+        frameOk( f, "paint layers" );
     }
+}
 
-    // Display the panosphere
-    if( QS_BUF ) {	// use buffers
-        glCallList(theScreen);				//// TODO: buffers
-    } else glCallList(theScreen); // use display list
+// note the first OGL error of a frame; false if there is one now
+bool pvQtView::frameOk( Frame & f, const char * label )
+{
+    GLenum c = glGetError();
+    if( c == GL_NO_ERROR ) return true;
+    if( !f.errAt ){
+        f.errAt = label;
+        f.err = c;
+    }
+    return false;
+}
 
-    // check for OGL error
-    paintok = OGLok("paintGL");
-
-    /* Display the overlay image
-     Note this code inverts Y, the QImage should not be flipped
-  */
-    if( paintok && povly ){
-        glDisable( textgt );
-        int w = povly->width(), h = povly->height();
-        double scly = double(Height) / double(h);
-        double sclx = scly;
-        glPixelZoom( sclx, -scly );	// overlay fills window
-        glWindowPos2i( 0, Height - 1 );	// align in window
-        glDrawPixels( w, h,
-                      GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV,
-                      povly->bits());
-        paintok = OGLok("paint overlay");
-        glPixelZoom( 1, 1 );		// restore pixel zoom
+/* draw the picture into the lower left part of an offscreen
+   buffer the size of the port, then stretch that over the
+   port.  Returns false if there is no usable buffer.
+*/
+bool pvQtView::paintPreview( Frame & f, const framePane & p )
+{
+    QSize size = f.port.size();
+    if( previewFbo && previewFbo->size() != size ){
+        delete previewFbo;
+        previewFbo = 0;
+    }
+    if( !previewFbo ){
+        if( !QGLFramebufferObject::hasOpenGLFramebufferObjects() ) return false;
+        previewFbo = new QGLFramebufferObject( size );
+    }
+    if( !previewFbo->isValid() || !previewFbo->bind() ) return false;
+    int w = p.port.width(), h = p.port.height();
+    glViewport( 0, 0, w, h );
+    paintScene( f, p );
+    previewFbo->release();
+    glViewport( f.port.x(), f.port.y(), f.port.width(), f.port.height() );
+    if( f.errAt ) return true;
+
+    float s = float( w ) / size.width(), t = float( h ) / size.height();
+    const float verts[8] = { -1, -1,  1, -1,  1, 1,  -1, 1 };
+    const float tcs[8] = { 0, 0,  s, 0,  s, t,  0, t };
+
+    glClear( GL_COLOR_BUFFER_BIT );
+    glPushAttrib( GL_ENABLE_BIT | GL_TEXTURE_BIT );
+    glPushClientAttrib( GL_CLIENT_VERTEX_ARRAY_BIT );
+    glDisable( GL_TEXTURE_CUBE_MAP );
+    glDisable( GL_TEXTURE_GEN_S );
+    glDisable( GL_TEXTURE_GEN_T );
+    glDisable( GL_TEXTURE_GEN_R );
+    glDisable( GL_CULL_FACE );
+    glDisable( GL_BLEND );
+    glEnable( GL_TEXTURE_2D );
+    glBindTexture( GL_TEXTURE_2D, previewFbo->texture() );
+    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR );
+    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR );
+    glTexEnvf( GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_REPLACE );
+    glMatrixMode( GL_TEXTURE );
+    glPushMatrix();
+    glLoadIdentity();
+    glMatrixMode( GL_PROJECTION );
+    glPushMatrix();
+    glLoadIdentity();
+    glMatrixMode( GL_MODELVIEW );
+    glPushMatrix();
+    glLoadIdentity();
+
+    glEnableClientState( GL_VERTEX_ARRAY );
+    glEnableClientState( GL_TEXTURE_COORD_ARRAY );
+    glDisableClientState( GL_NORMAL_ARRAY );
+    glDisableClientState( GL_COLOR_ARRAY );
+    glVertexPointer( 2, GL_FLOAT, 0, verts );
+    glTexCoordPointer( 2, GL_FLOAT, 0, tcs );
+    glDrawArrays( GL_QUADS, 0, 4 );
+
+    glPopMatrix();
+    glMatrixMode( GL_PROJECTION );
+    glPopMatrix();
+    glMatrixMode( GL_TEXTURE );
+    glPopMatrix();
+    glMatrixMode( GL_MODELVIEW );
+    glPopClientAttrib();
+    glPopAttrib();
+    frameOk( f, "paint preview" );
+    return true;
+}
+
+// draw a pane's picture in the current viewport
+void pvQtView::paintScene( Frame & f, const framePane & p )
+{
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+    if( p.target == GL_TEXTURE_2D ){
+        glBindTexture( p.target, p.tex );
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, p.wrapS);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, p.wrapT);
     }
+    backend->setColorLUT( p.lut );
+
+    // Display the panosphere, from the pane's point of view
+    backend->drawScreen( p.screen, p.cam, p.target, p.tex );
+
+    if( !p.tiles.isEmpty() ) paintTiles( f, p );
+
+    // check for OGL error
+    frameOk( f, "paintGL" );
 }
 
 void pvQtView::resizeGL(int width, int height)
@@ -1059,6 +1374,9 @@ void pvQtView::resizeGL(int width, int height)
 
     Width = width; Height = height;
     fwf = 2.0 / width; fhf = 2.0 / height;
+    // preview buffer matches the window
+    delete previewFbo;
+    previewFbo = 0;
     portAR = (double)Width / (double)Height;
 
     updateGL();
@@ -1069,46 +1387,145 @@ void pvQtView::resizeGL(int width, int height)
 void pvQtView::makeSphere( GLuint list )
 {
     // abort if the OpenGL version is insufficient
-    if( !OGLisOK ) return;
-    const float * verts, * TCs;
-    const unsigned int * quads, * lines;
-    unsigned int qcount, lcount;
-    if( surface == 0 ){	// sphere
-        verts = pqs->vertices();
-        TCs = pqs->texCoords( curr_pt );
-        quads = pqs->quadIndices();
-        qcount = pqs->quadIndexCount();
-        lines = pqs->lineIndices();
-        lcount = pqs->lineIndexCount();
-    } else {						// cylinder
-        verts = ppc->vertices();
-        TCs = ppc->texCoords( curr_pt );
-        quads = ppc->quadIndices();
-        qcount = ppc->quadIndexCount();
-        lines = ppc->lineIndices();
-        lcount = ppc->lineIndexCount();
-    }
-
+    if( !OGLisOK || !backend ) return;
+    panosurface * ps = surface == 0 ? (panosurface *)pqs : (panosurface *)ppc;
+    backend->setScreen( list, ps, curr_pt, textgt != 0 );
+    // report the projection used
     if( textgt ){	// there is an image
-        glNewList(list, GL_COMPILE);
-        glVertexPointer( 3, GL_FLOAT, 0, verts );
-        glNormalPointer( GL_FLOAT, 0, verts );
-        glTexCoordPointer( 2, GL_FLOAT, 0, TCs );
-        glDrawElements(GL_QUADS, qcount, GL_UNSIGNED_INT, quads );
-        glEndList();
-        // report the projection used
         emit reportProj(QString( pictypes.picTypeName( curr_pt )));
     } else {
-        glEnableClientState(GL_VERTEX_ARRAY);
-        glNewList(list, GL_COMPILE);
-        glVertexPointer( 3, GL_FLOAT, 0, verts );
-        glDrawElements(GL_LINES, lcount, GL_UNSIGNED_INT, lines );
-        glEndList();
-        // report the projection used
         emit reportProj(QString("none"));
     }
 }
 
+/* the view parameters as a camera model for the backend
+*/
+pvQtCamera pvQtView::camera()
+{
+    pvQtCamera c;
+    c.wfov = wFOV;
+    c.aspect = portAR;
+    c.znear = Znear;
+    c.zfar = Zfar;
+    c.framex = framex + fcompx;
+    c.framey = framey + fcompy;
+    c.flipY = flipY;
+    c.recenter = recenter;
+    c.pan = panAngle;
+    c.tilt = tiltAngle;
+    c.spin = spinAngle;
+    c.eyex = eyex;
+    c.eyey = eyey;
+    c.eyez = eyez;
+    c.cube = picType == pvQtPic::cub;
+    c.turn = turn90 * 90 + turnRoll;
+    c.pitch = turnPitch;
+    c.yaw = turnYaw;
+    c.xmag = xtexmag;
+    c.ymag = ytexmag;
+
+    // lens correction, moved from source pixels to the face clip
+    if( thePic && !c.cube && thePic->hasLens() ){
+        pvQtPic::LensParams lp = thePic->Lens();
+        double w = thePic->ImageSize().width(),
+               h = thePic->ImageSize().height();
+        QRectF fc = thePic->FaceClip();
+        if( w > 0 && h > 0 && !fc.isEmpty() ){
+            double r0 = 0.5 * min( w, h );
+            c.lensFrame = QVector4D( ( ( 0.5 * w + lp.d ) / w - fc.x() ) / fc.width(),
+                                     ( ( 0.5 * h + lp.e ) / h - fc.y() ) / fc.height(),
+                                     r0 / ( w * fc.width() ),
+                                     r0 / ( h * fc.height() ) );
+            c.lensRadial = QVector4D( lp.a, lp.b, lp.c, 1 - lp.a - lp.b - lp.c );
+            c.lensVignet = QVector4D( lp.vb, lp.vc, lp.vd, 0 );
+        }
+    }
+    return c;
+}
+
+/* switch rendering backend, keeping the one in use if the
+   new one can't run here
+*/
+void pvQtView::setBackend( int kind )
+{
+    wantBackend = kind;
+    if( !OGLisOK || !backend || backend->kind() == kind ) return;
+    useContext();
+    pvQtBackend * b = pvQtBackend::create( pvQtBackend::Kind( kind ) );
+    if( !b ){
+        qWarning("rendering backend %d is not supported", kind );
+    } else {
+        delete backend;
+        backend = b;
+        theScreen = backend->newScreen();
+        altScreen = 0;
+        altKey = -1;
+        makeSphere( theScreen );
+        updateGL();
+    }
+    emit reportBackend( backend->kind() );
+}
+
+QString pvQtView::OpenGLBackend()
+{
+    return backend ? QString( backend->name() ) : QString();
+}
+
+/**  Color management  **
+
+  A picture whose source images carry an ICC profile is converted,
+  as it is drawn, to the display's profile, and to sRGB when it is
+  read back to save.  The conversions are 3D color tables, made
+  once per picture profile (and display profile) by pvQtColorLUT
+  and applied by the backend's fragment shader; lutTex[k] is 0 if
+  no conversion is needed.
+**/
+
+void pvQtView::setDisplayProfile( QString path )
+{
+    QByteArray icc;
+    if( !path.isEmpty() ){
+        QFile f( path );
+        if( f.open( QIODevice::ReadOnly ) ) icc = f.readAll();
+        if( icc.isEmpty() || !pvQtColorLUT::isValid( icc ) ){
+            qWarning("unusable display profile %s, using sRGB",
+                     (const char *)path.toLocal8Bit() );
+            icc = QByteArray();
+        }
+    }
+    if( icc == dispICC ) return;
+    dispICC = icc;
+    lutMade = false;
+    if( OGLisOK ) updateGL();
+}
+
+// (re)make the color tables; needs the context current
+void pvQtView::makeLUTs()
+{
+    lutMade = true;
+    QOpenGLExtraFunctions * xf = QOpenGLContext::currentContext()->extraFunctions();
+    const QByteArray dsts[2] = { dispICC, QByteArray() };
+    for( int k = 0; k < 2; k++ ){
+        QVector<quint16> t = pvQtColorLUT::table( lutSrc, dsts[k], LUT_SIZE );
+        if( t.isEmpty() ){
+            glDeleteTextures( 1, &lutTex[k] );
+            lutTex[k] = 0;
+            continue;
+        }
+        if( !lutTex[k] ) glGenTextures( 1, &lutTex[k] );
+        glBindTexture( GL_TEXTURE_3D, lutTex[k] );
+        glTexParameteri( GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR );
+        glTexParameteri( GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR );
+        glTexParameteri( GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE );
+        glTexParameteri( GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE );
+        glTexParameteri( GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE );
+        xf->glTexImage3D( GL_TEXTURE_3D, 0, GL_RGBA16, LUT_SIZE, LUT_SIZE, LUT_SIZE,
+                          0, GL_RGBA, GL_UNSIGNED_SHORT, t.constData() );
+    }
+    glBindTexture( GL_TEXTURE_3D, 0 );
+    OGLok("color tables");
+}
+
 
 /* Load a picture
   pass pic == 0 to just clear all picture state
@@ -1127,7 +1544,7 @@ static GLenum cubefaces[6] = {
 };
 
 
-bool pvQtView::setupPic( pvQtPic * pic )
+bool pvQtView::setupPic( pvQtPic * pic, bool now )
 {
     // abort if the OpenGL version is insufficient
     if( !OGLisOK ){
@@ -1135,12 +1552,26 @@ bool pvQtView::setupPic( pvQtPic * pic )
         return false;
     }
 
+    // a new picture is shown once its textures are made
+    if( !now && loader && startLoad( pic ) ){
+        picok = true;
+        errmsg = tr("no error");
+        return true;
+    }
+    if( loadPic ){
+        useContext();
+        dropLoad();
+    }
+
     /* Reset picture type specific state
 */
     thePic = pic;
     if( pic ) picType = pic->Type();
     else picType = pvQtPic::nil;
 
+    // tiled source, if any
+    setPyramid( pic ? pic->Pyramid() : 0 );
+
     // set up OGL for the picture type
     setPicType( picType );
 
@@ -1151,9 +1582,54 @@ bool pvQtView::setupPic( pvQtPic * pic )
     picok = true;
     errmsg = tr("no error");
 
-    // select a feasible texture size
+    if( !loadTextures() ) return false;
+
+    picShown();
+
+    // check for (?asychronous?) OpenGL error
+    return picok;
+
+}
+
+/* finish showing a new picture, once its textures are loaded
+*/
+void pvQtView::picShown()
+{
+    // color tables for its profile
+    QByteArray icc = thePic ? thePic->ColorProfile() : QByteArray();
+    if( icc != lutSrc ){
+        lutSrc = icc;
+        lutMade = false;
+    }
+
+    // reset the view and display
+    reset_view();
+
+    // other panes keep their views, scaled for this picture
+    for( int i = 0; i < panes.count(); i++ ){
+        if( panes[i].pic && ( !thePic || panes[i].pic->Type() != picType ) ) {
+            dropPanePic( panes[i] );
+        }
+        panes[i].view.xmag = xtexmag;
+        panes[i].view.ymag = ytexmag;
+    }
+
+    // report current panosurface
+    emit reportSurface( surface );
+}
+
+/* largest feasible texture size for the current picture type,
+   or another
+*/
+QSize pvQtView::maxFaceDims()
+{
+    return maxFaceDims( picType );
+}
+
+QSize pvQtView::maxFaceDims( pvQtPic::PicType pt )
+{
     QSize maxdims(0,0);
-    switch( picType ){
+    switch( pt ){
     case pvQtPic::nil:
         break;
     case pvQtPic::rec:
@@ -1168,70 +1644,372 @@ bool pvQtView::setupPic( pvQtPic * pic )
         maxdims = maxTex2Drec;
         break;
     case pvQtPic::cub:
-        maxdims = maxTexCube;
-#ifdef __APPLE__
-        maxdims = QSize(MacCubeLimit, MacCubeLimit);
-#endif
+        maxdims = maxCubeDims();
         break;
     }
+    return maxdims;
+}
 
-    if( !maxdims.isEmpty() ){
+QSize pvQtView::maxCubeDims()
+{
+#ifdef __APPLE__
+    return QSize(MacCubeLimit, MacCubeLimit);
+#else
+    return maxTexCube;
+#endif
+}
 
-        thePic->fitFaceToImage( maxdims, texPwr2 );
+/* Picture textures
+   Texture storage is allocated once for a face size and then
+   refilled in place with glTexSubImage2D.  Where OGL has
+   immutable storage it is used, so the texture object is
+   replaced only when the face size changes.  loadTextures()
+   remembers the picture state it loaded; if the picture, its
+   face size and clip are unchanged (e.g. after an FOV or
+   panosurface change within the texture) nothing is uploaded.
+*/
 
-        makeCurrent();
-        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);  // QImage row alignment
+/* give texture k (0: 2D, 1: cube, 2: spare 2D) storage for dims,
+   binding it.  returns false on OGL error
+*/
+bool pvQtView::allocTexture( int k, QSize dims )
+{
+    GLenum target = k == 1 ? GL_TEXTURE_CUBE_MAP : GL_TEXTURE_2D;
+    if( dims == texDims[k] ){
+        glBindTexture( target, texnms[k] );
+        return true;
+    }
 
-        if( picType == pvQtPic::cub ){
-            for(int i = 0; i < 6; i++){
-                QImage * p = thePic->FaceImage(pvQtPic::PicFace(i));
-                if( p ){
-                    glTexImage2D( cubefaces[i], 0, GL_RGBA,
-                                  p->width(), p->height(), 0,
-                                  GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV,
-                                  p->bits() );
-                    delete p;
-                    if( !OGLok("load cube") ) return false;
-                }
+    if( k == 2 ) spareKey.clear();
+    else texPic = 0;	// contents are gone
+    texMipped[k] = false;
+    if( hasTexStorage ){
+        // immutable storage can't be resized: make a new object
+        GLuint old = texnms[k];
+        glDeleteTextures( 1, &old );
+        glGenTextures( 1, &texnms[k] );
+        if( texname == old ) texname = texnms[k];
+        glBindTexture( target, texnms[k] );
+        setTexParams( target );
+        QOpenGLExtraFunctions * xf = QOpenGLContext::currentContext()->extraFunctions();
+        xf->glTexStorage2D( target, 1, GL_RGBA8, dims.width(), dims.height() );
+    } else {
+        glBindTexture( target, texnms[k] );
+        setTexParams( target );	// no mipmap levels now
+        if( k == 1 ){
+            for( int i = 0; i < 6; i++ ){
+                glTexImage2D( cubefaces[i], 0, GL_RGBA,
+                              dims.width(), dims.height(), 0,
+                              GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV, 0 );
             }
         } else {
-            QImage * p = thePic->FaceImage(pvQtPic::PicFace(0));
-            if( p ){
-                glTexImage2D( textgt, 0, GL_RGBA,
-                              p->width(), p->height(), 0,
-                              GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV,
-                              p->bits() );
-                delete p;
-                if( !OGLok("load 2D") ) return false;
-            }
+            glTexImage2D( GL_TEXTURE_2D, 0, GL_RGBA,
+                          dims.width(), dims.height(), 0,
+                          GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV, 0 );
         }
     }
-
-    // reset the view and display
-    reset_view();
-
-    // report current panosurface
-    emit reportSurface( surface );
-
-    // check for (?asychronous?) OpenGL error
-    return picok;
-
+    if( !OGLok("allocate texture") ){
+        texDims[k] = QSize();
+        return false;
+    }
+    texDims[k] = dims;
+    return true;
 }
 
-void pvQtView::updatePic()
+/* upload one face image of pic into the bound texture's storage,
+   streamed through a band image a few rows deep
+*/
+bool pvQtView::loadFace( pvQtPic * pic, GLenum target, pvQtPic::PicFace face )
 {
-    setupPic( thePic );
+    QScopedPointer<pvQtFaceStream> fs( pic->FaceStream( face ) );
+    QSize fd = pic->FaceSize();
+    int sw = fs->size().width(),
+        w = qMin( sw, fd.width() ),
+        h = qMin( fs->size().height(), fd.height() );
+    if( w <= 0 || h <= 0 ) return true;
+    QImage band = pvQtImagePool::faces()->image( QSize( sw, qMin( h, FACE_BAND_ROWS ) ),
+                                                 PVQT_PIC_FACE_FORMAT );
+    if( band.isNull() ) return false;
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);  // QImage row alignment
+    for( int y = 0; y < h; y += band.height() ){
+        int n = qMin( band.height(), h - y );
+        if( !fs->readRows( band.bits(), band.bytesPerLine(), n ) ){
+            // unreadable file: the empty face
+            const QImage img = pic->FaceImage( face );
+            if( img.isNull() ) return true;
+            glTexSubImage2D( target, 0, 0, 0,
+                             qMin( img.width(), fd.width() ),
+                             qMin( img.height(), fd.height() ),
+                             GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV,
+                             img.constBits() );
+            break;
+        }
+        glTexSubImage2D( target, 0, 0, y, w, n,
+                         GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV,
+                         band.constBits() );
+    }
+    if( fs->rowsDone() > 0 ) {
+        pic->setColorProfile( face, fs->profile() );
+    }
+    return OGLok( target == GL_TEXTURE_2D ? "load 2D" : "load cube" );
 }
 
-/* pick the face that contains a mouse position
+/* fit the face size to the source images and load
+   the texture image(s) of the current picture
 */
-pvQtPic::PicFace pvQtView::pickFace( QPoint pnt )
+bool pvQtView::loadTextures()
 {
-    if( curr_pt != pvQtPic::cub ) return pvQtPic::front;
+    QSize maxdims = maxFaceDims();
+
+    if( !maxdims.isEmpty() ){
+
+        thePic->fitFaceToImage( maxdims, texPwr2 );
+        QSize fd = thePic->FaceSize();
+        int k = picType == pvQtPic::cub ? 1 : 0;
+
+        // the textures already hold this
+        if( thePic == texPic && thePic->Generation() == texGen
+            && fd == texDims[k] && thePic->FaceClip() == texClip ) {
+            return true;
+        }
+
+        useContext();
+
+        // the next picture was preloaded: swap it in
+        if( k == 0 && !spareKey.isEmpty() && fd == texDims[2]
+            && spareKey == thePic->FaceKey( pvQtPic::front ) ) {
+            qSwap( texnms[0], texnms[2] );
+            qSwap( texDims[0], texDims[2] );
+            qSwap( texMipped[0], texMipped[2] );
+            spareKey.clear();
+            texname = texnms[0];
+            glBindTexture( GL_TEXTURE_2D, texname );
+            texPic = thePic;
+            texGen = thePic->Generation();
+            texClip = thePic->FaceClip();
+            return true;
+        }
+
+        if( !allocTexture( k, fd ) ) return false;
+
+        if( picType == pvQtPic::cub ){
+            for(int i = 0; i < 6; i++){
+                if( !loadFace( thePic, cubefaces[i], pvQtPic::PicFace(i) ) ) return false;
+            }
+        } else {
+            if( !loadFace( thePic, GL_TEXTURE_2D, pvQtPic::PicFace(0) ) ) return false;
+        }
+        if( texMipped[k] ) {
+            genMipmaps( k );
+        }
+        texPic = thePic;
+        texGen = thePic->Generation();
+        texClip = thePic->FaceClip();
+    }
+    return true;
+}
+
+void pvQtView::preloadTexture( QString key, const QImage & img )
+{
+    if( !OGLisOK || img.isNull() || key == spareKey ) return;
+    useContext();
+    if( allocTexture( 2, img.size() ) ){
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        glTexSubImage2D( GL_TEXTURE_2D, 0, 0, 0, img.width(), img.height(),
+                         GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV, img.bits() );
+        if( OGLok("preload 2D") ) spareKey = key;
+    }
+    glBindTexture( GL_TEXTURE_2D, texnms[0] );
+    if( textgt ) glBindTexture( textgt, texname );
+}
+
+/* rebuild the mipmap levels of texture k after an upload
+*/
+void pvQtView::genMipmaps( int k )
+{
+    GLenum target = k == 1 ? GL_TEXTURE_CUBE_MAP : GL_TEXTURE_2D;
+    glBindTexture( target, texnms[k] );
+    QOpenGLContext::currentContext()->functions()->glGenerateMipmap( target );
+    OGLok("make mipmaps");
+}
+
+/**  Background Texture Loading
+
+    Where OpenGL can be used from more than one thread, a new
+    picture's faces are streamed by pvQtTexLoader, in a context
+    that shares textures with ours, into a new texture object with
+    all its mipmap levels; faces from files are decoded and
+    resampled there too, a band at a time (see pvQtFaceStream).  Meanwhile the previous
+    picture is still drawn, and can still be panned and zoomed.
+    When the loader is done, texLoaded() gets the texture and a
+    fence; loadTimer polls the fence, and once it has passed the
+    new texture replaces the old one and the picture is shown.
+    setView() calls made in the meantime apply to the new picture.
+
+    Loading again, or showing a picture the usual way, abandons
+    the load.  Pictures whose texture is already loaded or was
+    preloaded, and tiled pictures, are shown at once.
+
+**/
+
+/* pass streams of pic's faces to the loader;
+   false if it should be shown at once instead
+*/
+bool pvQtView::startLoad( pvQtPic * pic )
+{
+    if( !pic || pic->Pyramid() ) return false;
+    pvQtPic::PicType pt = pic->Type();
+    QSize maxdims = maxFaceDims( pt );
+    if( maxdims.isEmpty() ) return false;
+
+    pic->fitFaceToImage( maxdims, texPwr2 );
+    QSize fd = pic->FaceSize();
+    int k = pt == pvQtPic::cub ? 1 : 0;
+    // loaded or preloaded already
+    if( pic == texPic && pic->Generation() == texGen
+        && fd == texDims[k] && pic->FaceClip() == texClip ) {
+        return false;
+    }
+    if( k == 0 && !spareKey.isEmpty() && fd == texDims[2]
+        && spareKey == pic->FaceKey( pvQtPic::front ) ) {
+        return false;
+    }
+
+    if( loadPic ){
+        useContext();
+        dropLoad();
+    }
+    pvQtTexLoader::Job job;
+    job.serial = ++loadSerial;
+    job.target = k == 1 ? GL_TEXTURE_CUBE_MAP : GL_TEXTURE_2D;
+    job.dims = fd;
+    job.mips = genMips;
+    int n = k == 1 ? 6 : 1;
+    for( int i = 0; i < n; i++ ){
+        job.faces << ( k == 1 ? cubefaces[i] : GLenum(GL_TEXTURE_2D) );
+        job.streams << QSharedPointer<pvQtFaceStream>( pic->FaceStream( pvQtPic::PicFace(i) ) );
+    }
+    loadStreams = job.streams;
+    loadPic = pic;
+    loader->load( job );
+    return true;
+}
+
+/* the loader has finished a texture (0 on error)
+*/
+void pvQtView::texLoaded( int serial, uint tex, void * fence )
+{
+    if( serial != loadSerial || !loadPic || loadTex ){
+        // superseded
+        useContext();
+        GLuint t = tex;
+        if( t ) glDeleteTextures( 1, &t );
+        if( fence ) {
+            QOpenGLContext::currentContext()->extraFunctions()->glDeleteSync( (GLsync)fence );
+        }
+        return;
+    }
+    if( tex == 0 ){
+        // load it here, the usual way
+        pvQtPic * pic = loadPic;
+        bool vp = viewPending;
+        ViewParams pv = pendingView;
+        loadPic = 0;
+        loadStreams.clear();
+        viewPending = false;
+        setupPic( pic, true );
+        if( vp ) setView( pv );
+        return;
+    }
+    loadTex = tex;
+    loadFence = fence;
+    loadTimer.start();
+}
+
+// wait for the upload to reach the GPU
+void pvQtView::pollLoad()
+{
+    useContext();
+    if( !fenceDone( loadFence, false ) ) return;
+    loadTimer.stop();
+    finishLoad();
+}
+
+/* swap the loaded texture in and show the new picture
+*/
+void pvQtView::finishLoad()
+{
+    pvQtPic * pic = loadPic;
+    GLuint tex = loadTex;
+    loadPic = 0;
+    loadTex = 0;
+
+    // the color profiles the streams found
+    for( int i = 0; i < loadStreams.count(); i++ ){
+        pic->setColorProfile( pvQtPic::PicFace(i), loadStreams[i]->profile() );
+    }
+    loadStreams.clear();
+
+    thePic = pic;
+    picType = pic->Type();
+    setPyramid( 0 );
+
+    // replace the texture before setPicType selects it
+    int k = picType == pvQtPic::cub ? 1 : 0;
+    useContext();
+    glDeleteTextures( 1, &texnms[k] );
+    texnms[k] = tex;
+    texDims[k] = pic->FaceSize();
+    texMipped[k] = genMips;
+    texPic = pic;
+    texGen = pic->Generation();
+    texClip = pic->FaceClip();
+
+    setPicType( picType );
+    initView();
+    picok = true;
+    errmsg = tr("no error");
+    glBindTexture( textgt, texname );
+    OGLok("swap texture");
+
+    picShown();
+    if( viewPending ){
+        viewPending = false;
+        setView( pendingView );
+    }
+}
+
+/* abandon any load in progress; needs the context
+*/
+void pvQtView::dropLoad()
+{
+    ++loadSerial;
+    loadPic = 0;
+    loadStreams.clear();
+    viewPending = false;
+    loadTimer.stop();
+    if( loadFence ) {
+        QOpenGLContext::currentContext()->extraFunctions()->glDeleteSync( (GLsync)loadFence );
+    }
+    loadFence = 0;
+    if( loadTex ) glDeleteTextures( 1, &loadTex );
+    loadTex = 0;
+}
+
+void pvQtView::updatePic()
+{
+    setupPic( thePic );
+}
+
+/* pick the face that contains a mouse position
+*/
+pvQtPic::PicFace pvQtView::pickFace( QPoint pnt )
+{
+    if( curr_pt != pvQtPic::cub ) return pvQtPic::front;
     // select the default texture object
     GLuint svnm = texname;
     texname = 0;
-    makeCurrent();
+    useContext();
     glBindTexture( textgt, texname );
     // set required texture parameters
     glTexEnvf(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_DECAL);
@@ -1257,10 +2035,22 @@ pvQtPic::PicFace pvQtView::pickFace( QPoint pnt )
                       64, 64, 0, GL_RGBA,
                       GL_UNSIGNED_BYTE, timg );
     }
-    // render to an offscreen buffer
+    // render to an offscreen buffer, in the active pane
     GLenum buf = GL_BACK;
     glDrawBuffer( buf );
-    paintGL();
+    QRect r( 0, 0, Width, Height );
+    if( panes.count() > 1 ){
+        r = paneRect( activePane, r );
+        portAR = (double)r.width() / (double)r.height();
+    }
+    Frame f;
+    f.errAt = 0;
+    framePane p;
+    preparePane( p, r );
+    glViewport( r.x(), r.y(), r.width(), r.height() );
+    paintScene( f, p );
+    glViewport( 0, 0, Width, Height );
+    portAR = (double)Width / (double)Height;
     // read pixel at cursor position
     glReadBuffer( buf );
     GLint x = pnt.x(),
@@ -1277,20 +2067,34 @@ pvQtPic::PicFace pvQtView::pickFace( QPoint pnt )
 }
 
 /* reload a cube face texture image
+   face = any reloads all of them.  If the new image changes
+   the face size (e.g. a higher resolution level arrived) all
+   faces are reloaded at the new size; otherwise only the given
+   face is uploaded, into the existing storage.
 */
 void pvQtView::newFace( pvQtPic::PicFace face )
 {
+    if( loadPic ){	// not shown yet: start again
+        setupPic( loadPic );
+        return;
+    }
     if( curr_pt != pvQtPic::cub ) return;
 
-    makeCurrent();
-    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);  // QImage row alignment
-    QImage * p = thePic->FaceImage( face );
-    if( p ){
-        glTexImage2D( cubefaces[int(face)], 0, GL_RGBA,
-                p->width(), p->height(), 0,
-                GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV,
-                p->bits() );
-        delete p;
+    QSize fd = thePic->FaceSize();
+    thePic->fitFaceToImage( maxFaceDims(), texPwr2 );
+    if( face == pvQtPic::any || thePic->FaceSize() != fd ){
+        newImages();
+        return;
+    }
+
+    // same size: refill just this face in place
+    useContext();
+    if( allocTexture( 1, thePic->FaceSize() )
+        && loadFace( thePic, cubefaces[int(face)], face ) ) {
+        if( texMipped[1] ) {
+            genMipmaps( 1 );
+        }
+        texGen = thePic->Generation();
     }
 
     updateGL();
@@ -1298,58 +2102,213 @@ void pvQtView::newFace( pvQtPic::PicFace face )
 
 }
 
+/* replace the texture image(s) of the current picture,
+   e.g. with a higher resolution version, keeping the view
+*/
+void pvQtView::newImages()
+{
+    if( loadPic ){	// not shown yet: start again
+        setupPic( loadPic );
+        return;
+    }
+    if( !thePic || picType == pvQtPic::nil ) return;
+
+    loadTextures();	// posts any error
+
+    updateGL();
+    showview();
+}
+
+/**  Saving Views
+
+    The view is drawn upside down (by flipping the projection), so
+    the rows read back are already in image order, into a framebuffer
+    object of the requested size if possible, else the back buffer.
+    It is read into a pixel pack buffer and a fence is set after the
+    read; readTimer polls the fence, and once the pixels have arrived
+    they are copied out and encoded by a worker thread.  So saveView()
+    returns as soon as the view is drawn, and the GUI stays live
+    through readback and encoding.  saveProgress() and saveDone()
+    report on each file.
+
+    Without pixel buffers the read is done at once, and without
+    fences the buffer is mapped when first polled; encoding is still
+    in the background.
+
+**/
+
+/* encodes one saved view, on all cores if the file type
+   is one pvQtEncoder writes
+*/
+class pvQtSaveJob : public QRunnable
+{
+public:
+    pvQtSaveJob( pvQtView * view, const QImage & img, QString name,
+                 const pvQtEncoder::Options & opt )
+        : m_view( view ), m_img( img ), m_name( name ), m_opt( opt ) {}
+    void run(){
+        bool ok;
+        if( pvQtEncoder::canEncode( m_name ) ){
+            pvQtEncoder enc;
+            enc.setOptions( m_opt );
+            ok = enc.save( m_img, m_name );
+            if( !ok ) qWarning("%s: %s", (const char *)m_name.toUtf8(), enc.errMsg() );
+        } else {
+            ok = m_img.save( m_name, 0, m_opt.quality );
+        }
+        emit m_view->saveDone( m_name, ok );
+    }
+private:
+    pvQtView * m_view;
+    QImage m_img;
+    QString m_name;
+    pvQtEncoder::Options m_opt;
+};
+
+/* start reading the current read buffer into a pixel pack
+   buffer; returns a fence set after the read, or 0
+*/
+void * pvQtView::readPixels( QOpenGLBuffer & pbo, int W, int H )
+{
+    pbo.bind();
+    glPixelStorei( GL_PACK_ALIGNMENT, 4 );  // QImage row alignment
+    glReadPixels( 0, 0, W, H,
+                  GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV, 0 );
+    pbo.release();
+    if( !hasFences ) return 0;
+    QOpenGLExtraFunctions * xf = QOpenGLContext::currentContext()->extraFunctions();
+    GLsync f = xf->glFenceSync( GL_SYNC_GPU_COMMANDS_COMPLETE, 0 );
+    glFlush();	// so the read gets going
+    return f;
+}
+
+/* check (or wait for) a readback fence; deletes it once passed
+*/
+bool pvQtView::fenceDone( void * & fence, bool wait )
+{
+    if( fence == 0 ) return true;
+    QOpenGLExtraFunctions * xf = QOpenGLContext::currentContext()->extraFunctions();
+    GLsync f = (GLsync)fence;
+    GLenum r = xf->glClientWaitSync( f, wait ? GL_SYNC_FLUSH_COMMANDS_BIT : 0,
+                                     wait ? GLuint64( 1000000000 ) : 0 );
+    if( r == GL_TIMEOUT_EXPIRED ) return false;
+    xf->glDeleteSync( f );
+    fence = 0;
+    return true;
+}
+
+// copy a finished readback out to an image
+QImage pvQtView::mapImage( QOpenGLBuffer & pbo, int W, int H )
+{
+    QImage img;
+    pbo.bind();
+    const uchar * p = (const uchar *)pbo.map( QOpenGLBuffer::ReadOnly );
+    if( p ){
+        img = QImage( W, H, QImage::Format_RGB32 );
+        memcpy( img.bits(), p, 4 * W * H );
+        pbo.unmap();
+    }
+    pbo.release();
+    return img;
+}
+
 /* save current view to a file
   Default size is current viewport size.
-  If a different size is requested, uses an offsscreen framebuffer
-  to render the view if possible.
-  Otherwise, renders to the back screen buffer and dumps that.
+  Renders to an offscreen framebuffer of the requested size if
+  possible, otherwise to the back screen buffer at screen size.
+  Returns false if the view could not be rendered.
 */
 bool pvQtView::saveView( QString name, QSize size )
 {
-    bool done = false;
+    if( !OGLisOK ) return false;
+    moving = false;	// always full quality
     int W = size.width(), H = size.height();
-    if( ( W != Width || H != Height )
-            && QGLFramebufferObject::hasOpenGLFramebufferObjects() ){
-        makeCurrent();
-        // create private frame buffer
-        QGLFramebufferObject fbo( W, H );
-        bool ok = fbo.isValid();
-        // try to render and save
-        if( ok && fbo.bind() ){
-            // temp resize viewport
-            glViewport(0, 0, W, H);
-            portAR = (double)W / (double)H;
-            // render
-            paintGL();
-            if( paintok ){
-                QImage img = fbo.toImage();
-                ok = img.save( name );
-            } else ok = false;
-            fbo.release();
-            // restore screen viewport
-            resizeGL( Width, Height );
+    useContext();
+
+    // create private frame buffer
+    QGLFramebufferObject * fbo = 0;
+    if( QGLFramebufferObject::hasOpenGLFramebufferObjects() ){
+        fbo = new QGLFramebufferObject( W, H );
+        if( !fbo->isValid() || !fbo->bind() ){
+            delete fbo;
+            fbo = 0;
         }
-        done = ok;
     }
     // fallback: use the screen buffer
-    if( !done ){
+    if( !fbo ){
         W = Width; H = Height;
-        makeCurrent();
-        GLenum buf = GL_BACK;	// fb to use
-        glDrawBuffer( buf );	// select it
-        paintGL();				// render
-        // read the famebuffer into a QImage
-        glReadBuffer( buf );
-        QImage::Format image_format = QImage::Format_RGB32;
-        QImage img( W, H, image_format );
-        glPixelStorei(GL_PACK_ALIGNMENT, 4);  // QImage row alignment
-        glReadPixels( 0, 0, W, H,
-                      GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV,
-                      img.bits() );
-        // reverse Y axis and save
-        done = img.mirrored().save( name );
-    }
-    return done;
+        glDrawBuffer( GL_BACK );
+        glReadBuffer( GL_BACK );
+    }
+
+    // render, upside down
+    glViewport( 0, 0, W, H );
+    portAR = (double)W / (double)H;
+    flipY = true;
+    paintGL();
+    flipY = false;
+    bool ok = paintok;
+
+    if( ok ){
+        saveJob sj;
+        sj.name = name;
+        sj.size = QSize( W, H );
+        sj.pbo = new QOpenGLBuffer( QOpenGLBuffer::PixelPackBuffer );
+        sj.pbo->setUsagePattern( QOpenGLBuffer::StreamRead );
+        if( sj.pbo->create() && sj.pbo->bind() ){
+            sj.pbo->allocate( 4 * W * H );
+            sj.pbo->release();
+            sj.fence = readPixels( *sj.pbo, W, H );
+            saves.append( sj );
+            readTimer.start();
+        } else {
+            delete sj.pbo;
+            QImage img( W, H, QImage::Format_RGB32 );
+            glPixelStorei( GL_PACK_ALIGNMENT, 4 );  // QImage row alignment
+            glReadPixels( 0, 0, W, H,
+                          GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV,
+                          img.bits() );
+            encodeView( name, img );
+        }
+        emit saveProgress( name, 25 );
+    }
+
+    if( fbo ){
+        fbo->release();
+        delete fbo;
+    }
+    // restore screen viewport and display
+    resizeGL( Width, Height );
+    return ok;
+}
+
+// collect finished readbacks
+void pvQtView::pollSaves()
+{
+    useContext();
+    for( int i = 0; i < saves.count(); ){
+        saveJob & sj = saves[i];
+        if( !fenceDone( sj.fence, false ) ){
+            ++i;
+            continue;
+        }
+        QImage img = mapImage( *sj.pbo, sj.size.width(), sj.size.height() );
+        sj.pbo->destroy();
+        delete sj.pbo;
+        encodeView( sj.name, img );
+        saves.removeAt( i );
+    }
+    if( saves.isEmpty() ) readTimer.stop();
+}
+
+void pvQtView::encodeView( QString name, const QImage & img )
+{
+    if( img.isNull() ){
+        emit saveDone( name, false );
+        return;
+    }
+    emit saveProgress( name, 50 );
+    savePool.start( new pvQtSaveJob( this, img, name, saveOpts ) );
 }
 
 bool pvQtView::saveView( QString name, double scale ){
@@ -1364,18 +2323,633 @@ void pvQtView::setSurface( int surf ){
     updatePic();
 }
 
-bool pvQtView::showOverlay( QImage * ovl ){
-    if( ovl != 0 ){
-        if( ovl->format() != QImage::Format_ARGB32 ){
-            qCritical("bad overlay format");
-            return false;
+/**  Overlay Layers
+
+    Overlay layers are drawn over the view, bottom to top, each as
+    one textured quad blended into the frame, so any number are
+    composited in the same pass as the picture.  A layer's texture
+    is loaded when it is first drawn after its image was set; the
+    image is then released, so large layers cost GPU memory only.
+
+    Layer geometry is in units of the viewport height, so layers
+    keep their place and shape when the window is resized or a
+    view is saved at a larger size.  The default puts the image's
+    top left corner at the viewport's and fills its height.
+
+    With OpenGL 2.0 a small shader applies opacity and the check
+    ("dice") pattern and premultiplies alpha, so all the blend modes
+    work with one set of blend functions.  Otherwise fixed function
+    texturing scales color and alpha by the opacity, which is
+    exact for opaque images, and dice is not shown.
+
+**/
+
+int pvQtView::addLayer( const QImage & img )
+{
+    ovlyLayer ly;
+    ly.id = ++lastLayer;
+    ly.tex = 0;
+    ly.opacity = 1;
+    ly.dice = 0;
+    ly.blend = blendNormal;
+    ly.pos = QPointF( 0, 0 );
+    ly.scale = 1;
+    ly.rotate = 0;
+    ly.visible = true;
+    if( !putLayerImage( ly, img ) ) return 0;
+    layers.append( ly );
+    update();
+    return ly.id;
+}
+
+bool pvQtView::putLayerImage( ovlyLayer & ly, const QImage & img )
+{
+    if( img.isNull() ) return false;
+    ly.img = img;
+    if( img.format() != QImage::Format_ARGB32 ){
+        ly.img = img.convertToFormat( QImage::Format_ARGB32 );
+    }
+    ly.dims = img.size();
+    return true;
+}
+
+bool pvQtView::setLayerImage( int id, const QImage & img )
+{
+    ovlyLayer * ly = findLayer( id );
+    if( !ly || !putLayerImage( *ly, img ) ) return false;
+    update();
+    return true;
+}
+
+void pvQtView::removeLayer( int id )
+{
+    for( int i = 0; i < layers.count(); i++ ){
+        if( layers[i].id == id ){
+            if( layers[i].tex ){
+                useContext();
+                glDeleteTextures( 1, &layers[i].tex );
+            }
+            layers.removeAt( i );
+            update();
+            return;
         }
     }
-    povly = ovl;
+}
+
+void pvQtView::clearLayers()
+{
+    useContext();
+    foreach( ovlyLayer ly, layers ){
+        if( ly.tex ) glDeleteTextures( 1, &ly.tex );
+    }
+    layers.clear();
+}
+
+void pvQtView::setLayerOpacity( int id, double alpha, int dice )
+{
+    ovlyLayer * ly = findLayer( id );
+    if( !ly ) return;
+    ly->opacity = KLIP( alpha, 0.0, 1.0 );
+    ly->dice = max( 0, dice );
+    update();
+}
+
+void pvQtView::setLayerBlend( int id, LayerBlend blend )
+{
+    ovlyLayer * ly = findLayer( id );
+    if( !ly ) return;
+    ly->blend = blend;
+    update();
+}
+
+void pvQtView::setLayerTransform( int id, QPointF pos, double scale, double rotate )
+{
+    ovlyLayer * ly = findLayer( id );
+    if( !ly ) return;
+    ly->pos = pos;
+    ly->scale = scale;
+    ly->rotate = rotate;
+    update();
+}
+
+void pvQtView::setLayerVisible( int id, bool visible )
+{
+    ovlyLayer * ly = findLayer( id );
+    if( !ly ) return;
+    ly->visible = visible;
+    update();
+}
+
+void pvQtView::stackLayer( int id, int index )
+{
+    for( int i = 0; i < layers.count(); i++ ){
+        if( layers[i].id == id ){
+            layers.move( i, KLIP( index, 0, layers.count() - 1 ) );
+            update();
+            return;
+        }
+    }
+}
+
+pvQtView::ovlyLayer * pvQtView::findLayer( int id )
+{
+    for( int i = 0; i < layers.count(); i++ ){
+        if( layers[i].id == id ) return &layers[i];
+    }
+    return 0;
+}
+
+/* compile the layer shader, if possible
+   Alpha is the image's own alpha times the opacity; where dice > 0
+   the image is cut into diagonal checks dice pixels wide and
+   every other one is left out.
+*/
+void pvQtView::makeLayerProgram()
+{
+    if( !OGLv20 || !QGLShaderProgram::hasOpenGLShaderPrograms( context() ) ) return;
+
+    static const char vsrc[] =
+        "void main(){\n"
+        "    gl_TexCoord[0] = gl_MultiTexCoord0;\n"
+        "    gl_Position = ftransform();\n"
+        "}\n";
+    static const char fsrc[] =
+        "uniform sampler2D image;\n"
+        "uniform float alpha;\n"
+        "uniform float dice;\n"
+        "uniform vec2 size;\n"
+        "void main(){\n"
+        "    vec4 c = texture2D( image, gl_TexCoord[0].st );\n"
+        "    float a = c.a * alpha;\n"
+        "    if( dice > 0.0 ){\n"
+        "        vec2 p = floor( gl_TexCoord[0].st * size );\n"
+        "        float d = floor( (p.y + p.x) / dice )\n"
+        "                + floor( (p.y + size.x - p.x) / dice );\n"
+        "        if( mod( d, 2.0 ) < 0.5 ) a = 0.0;\n"
+        "    }\n"
+        "    gl_FragColor = vec4( c.rgb * a, a );\n"
+        "}\n";
+
+    layerProg = new QGLShaderProgram( context(), this );
+    if( !layerProg->addShaderFromSourceCode( QGLShader::Vertex, vsrc )
+        || !layerProg->addShaderFromSourceCode( QGLShader::Fragment, fsrc )
+        || !layerProg->link() ){
+        qWarning("layer shader: %s", (const char *)layerProg->log().toLocal8Bit() );
+        delete layerProg;
+        layerProg = 0;
+    }
+}
+
+/* load a layer's texture from its image, then drop the image
+   The image is scaled down if too big for a texture, and up
+   to power-of-2 dimensions (within the limit) if OGL requires
+   that.
+*/
+bool pvQtView::loadLayer( ovlyLayer & ly )
+{
+    QImage img = ly.img;
+    ly.img = QImage();
+    if( img.width() > max2d || img.height() > max2d ){
+        img = img.scaled( max2d, max2d, Qt::KeepAspectRatio,
+                          Qt::SmoothTransformation );
+    }
+    if( texPwr2 ){
+        int w = 1, h = 1;
+        while( w < img.width() && w < max2d ) w <<= 1;
+        while( h < img.height() && h < max2d ) h <<= 1;
+        if( w != img.width() || h != img.height() ){
+            img = img.scaled( w, h, Qt::IgnoreAspectRatio,
+                              Qt::SmoothTransformation );
+        }
+    }
+
+    /* a full size reference image is usually minified,
+       so let OGL (1.4 and up) build mipmaps for it
+    */
+    if( ly.tex == 0 ) glGenTextures( 1, &ly.tex );
+    glBindTexture( GL_TEXTURE_2D, ly.tex );
+    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE );
+    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE );
+    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR );
+    glTexParameteri( GL_TEXTURE_2D, GL_GENERATE_MIPMAP, GL_TRUE );
+    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR );
+    glPixelStorei( GL_UNPACK_ALIGNMENT, 4 );  // QImage row alignment
+    glTexImage2D( GL_TEXTURE_2D, 0, GL_RGBA,
+                  img.width(), img.height(), 0,
+                  GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV,
+                  img.constBits() );
+    return OGLok("load layer");
+}
+
+void pvQtView::paintLayers( Frame & f )
+{
+    // premultiplied alpha blend functions, by LayerBlend
+    static const GLenum blendSrc[4] = { GL_ONE, GL_ONE, GL_DST_COLOR, GL_ONE },
+                        blendDst[4] = { GL_ONE_MINUS_SRC_ALPHA, GL_ONE,
+                                        GL_ONE_MINUS_SRC_ALPHA, GL_ONE_MINUS_SRC_COLOR };
+
+    // plain 2D texturing, leaving the picture's state as it was
+    glPushAttrib( GL_ENABLE_BIT | GL_TEXTURE_BIT | GL_CURRENT_BIT
+                  | GL_COLOR_BUFFER_BIT );
+    glPushClientAttrib( GL_CLIENT_VERTEX_ARRAY_BIT );
+    glDisable( GL_TEXTURE_CUBE_MAP );
+    glDisable( GL_TEXTURE_GEN_S );
+    glDisable( GL_TEXTURE_GEN_T );
+    glDisable( GL_TEXTURE_GEN_R );
+    glDisable( GL_CULL_FACE );
+    glDisable( GL_DEPTH_TEST );
+    glEnable( GL_TEXTURE_2D );
+    glEnable( GL_BLEND );
+
+    // pixel coordinates, origin at lower left
+    int W = f.port.width();
+    double H = f.port.height();
+    glMatrixMode( GL_TEXTURE );
+    glPushMatrix();
+    glLoadIdentity();
+    glMatrixMode( GL_PROJECTION );
+    glPushMatrix();
+    glLoadIdentity();
+    if( f.flipY ) glOrtho( 0, W, H, 0, -1, 1 );
+    else glOrtho( 0, W, 0, H, -1, 1 );
+    glMatrixMode( GL_MODELVIEW );
+    glPushMatrix();
+
+    // unit quad, top row of the image at the top
+    static const float verts[8] = { -1, 1,  1, 1,  1, -1,  -1, -1 };
+    static const float tcs[8] = { 0, 0,  1, 0,  1, 1,  0, 1 };
+    glEnableClientState( GL_VERTEX_ARRAY );
+    glEnableClientState( GL_TEXTURE_COORD_ARRAY );
+    glDisableClientState( GL_NORMAL_ARRAY );
+    glDisableClientState( GL_COLOR_ARRAY );
+    glVertexPointer( 2, GL_FLOAT, 0, verts );
+    glTexCoordPointer( 2, GL_FLOAT, 0, tcs );
+
+    if( layerProg ){
+        layerProg->bind();
+        layerProg->setUniformValue( "image", 0 );
+    } else {
+        glTexEnvf( GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE );
+    }
+
+    for( int i = 0; i < f.layers.count(); i++ ){
+        const frameLayer & ly = f.layers[i];
+        glBindTexture( GL_TEXTURE_2D, ly.tex );
+        glBlendFunc( blendSrc[ly.blend], blendDst[ly.blend] );
+        if( layerProg ){
+            layerProg->setUniformValue( "alpha", GLfloat( ly.opacity ) );
+            layerProg->setUniformValue( "dice", GLfloat( ly.dice ) );
+            layerProg->setUniformValue( "size", QSizeF( ly.dims ) );
+        } else {
+            GLfloat a = GLfloat( ly.opacity );
+            glColor4f( a, a, a, a );
+        }
+        // place the layer
+        double hh = 0.5 * ly.scale,
+               hw = hh * ly.dims.width() / ly.dims.height();
+        glLoadIdentity();
+        glTranslated( H * ( ly.pos.x() + hw ), H * ( 1 - ly.pos.y() - hh ), 0 );
+        glRotated( -ly.rotate, 0, 0, 1 );
+        glScaled( H * hw, H * hh, 1 );
+        glDrawArrays( GL_QUADS, 0, 4 );
+    }
+    if( layerProg ) layerProg->release();
+
+    glPopMatrix();
+    glMatrixMode( GL_PROJECTION );
+    glPopMatrix();
+    glMatrixMode( GL_TEXTURE );
+    glPopMatrix();
+    glMatrixMode( GL_MODELVIEW );
+    glPopClientAttrib();
+    glPopAttrib();
+}
+
+/**  View Parameters and Animation  **/
+
+pvQtView::ViewParams pvQtView::getView()
+{
+    ViewParams vp;
+    vp.pan = panAngle;
+    vp.tilt = tiltAngle;
+    vp.spin = spinAngle;
+    vp.vfov = vFOV;
+    vp.dist = eyeDistance;
+    vp.eyex = eyex;
+    vp.eyey = eyey;
+    vp.eyeh = hangle;
+    vp.eyev = vangle;
+    vp.framex = framex;
+    vp.framey = framey;
+    vp.xmag = xtexmag;
+    vp.ymag = ytexmag;
+    vp.turn = turn90;
+    vp.roll = turnRoll;
+    vp.pitch = turnPitch;
+    vp.yaw = turnYaw;
+    return vp;
+}
+
+void pvQtView::setView( const ViewParams & vp )
+{
+    if( loadPic ){	// for the picture being loaded
+        pendingView = vp;
+        viewPending = true;
+        return;
+    }
+    applyView( vp );
+    updateGL();
+    showview();
+    emit reportTurn( turn90, turnRoll, turnPitch, turnYaw );
+}
+
+/* post view parameters, legalized by the usual rules,
+   and keep the GUI angle counters in step
+*/
+void pvQtView::applyView( const ViewParams & vp )
+{
+    panAngle = vp.pan;
+    ipan = iAngle( panAngle );
+    tiltAngle = vp.tilt;
+    itilt = iAngle( tiltAngle );
+    spinAngle = vp.spin;
+    ispin = iAngle( spinAngle );
+    hangle = vp.eyeh;
+    ihangl = iAngle( hangle );
+    vangle = vp.eyev;
+    ivangl = iAngle( vangle );
+    if( !recenter ){
+        eyex = vp.eyex;
+        eyey = vp.eyey;
+    }
+    setDist( vp.dist );	// places the eye, sets FOV limits
+    setFOV( vp.vfov );
+    izoom = iAngle( vFOV );
+    framex = KLIP( vp.framex, -1, 1 );
+    framey = KLIP( vp.framey, -1, 1 );
+    setTexMag( vp.xmag, vp.ymag );
+    turn90 = vp.turn & 3;
+    turnRoll = KLIP( vp.roll, -45, 45 );
+    turnPitch = KLIP( vp.pitch, -90, 90 );
+    turnYaw = KLIP( vp.yaw, -180, 180 );
+}
+
+/**  Split Screen
+
+    Each pane is drawn by posting its view parameters with the
+    signals blocked, setting the viewport (and a scissor box, so
+    the clear stays inside) to its rectangle, and drawing the scene
+    as usual; the active pane's view, which the controls change, is
+    posted back afterwards.  A pane on the other panosurface uses a
+    second screen list; an A/B pane binds its own texture.  Nothing
+    is reloaded, so all panes share the main picture's textures.
+
+**/
+
+void pvQtView::setPanes( int n )
+{
+    n = KLIP( n, 1, 4 );
+    if( n == paneCount() ) return;
+    useContext();
+    if( panes.isEmpty() ){
+        viewPane p;
+        p.surface = surface;
+        p.pic = 0;
+        p.tex = 0;
+        panes.append( p );
+    }
+    if( activePane >= n ) setActivePane( 0 );
+    while( panes.count() > n ){
+        dropPanePic( panes.last() );
+        panes.removeLast();
+    }
+    // new panes start with the active view
+    while( panes.count() < n ){
+        viewPane p;
+        p.view = getView();
+        p.surface = surface;
+        p.pic = 0;
+        p.tex = 0;
+        panes.append( p );
+    }
+    if( n == 1 ){
+        dropPanePic( panes[0] );
+        panes.clear();
+        activePane = 0;
+    }
+    updateGL();
+}
+
+void pvQtView::setPaneLock( bool on )
+{
+    paneLock = on;
+    updateGL();
+}
+
+/* load pic's faces into a texture of pane's own
+*/
+bool pvQtView::setPanePic( int pane, pvQtPic * pic )
+{
+    if( pane < 0 || pane >= panes.count() ) return false;
+    useContext();
+    viewPane & p = panes[pane];
+    dropPanePic( p );
+    if( !pic ){
+        updateGL();
+        return true;
+    }
+    if( !thePic || pic->Type() != picType || !textgt ) return false;
+
+    pic->fitFaceToImage( maxFaceDims(), texPwr2 );
+    QSize fd = pic->FaceSize();
+    glGenTextures( 1, &p.tex );
+    glBindTexture( textgt, p.tex );
+    setTexParams( textgt );
+    bool ok = true;
+    if( textgt == GL_TEXTURE_CUBE_MAP ){
+        for( int i = 0; ok && i < 6; i++ ){
+            glTexImage2D( cubefaces[i], 0, GL_RGBA, fd.width(), fd.height(), 0,
+                          GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV, 0 );
+            ok = loadFace( pic, cubefaces[i], pvQtPic::PicFace(i) );
+        }
+    } else {
+        glTexImage2D( GL_TEXTURE_2D, 0, GL_RGBA, fd.width(), fd.height(), 0,
+                      GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV, 0 );
+        ok = loadFace( pic, GL_TEXTURE_2D, pvQtPic::front );
+    }
+    glBindTexture( textgt, texname );
+    if( !ok ){
+        dropPanePic( p );
+        return false;
+    }
+    p.pic = pic;
     updateGL();
     return true;
 }
 
+void pvQtView::dropPanePic( viewPane & p )
+{
+    if( p.tex ) glDeleteTextures( 1, &p.tex );
+    p.tex = 0;
+    p.pic = 0;
+}
+
+// pane i's rectangle in area, in OGL (lower left origin) coordinates
+QRect pvQtView::paneRect( int i, QRect area )
+{
+    int n = panes.count(),
+        cols = n > 1 ? 2 : 1,
+        rows = n > 2 ? 2 : 1;
+    int w = area.width() / cols, h = area.height() / rows;
+    int c = i % cols, r = i / cols;
+    // GL rows go up, unless rendering upside down for readback
+    int y = flipY ? r : rows - 1 - r;
+    return QRect( area.x() + c * w, area.y() + y * h, w, h );
+}
+
+// the pane under a point in widget coordinates
+int pvQtView::paneAt( QPoint pnt )
+{
+    QPoint p( pnt.x(), Height - 1 - pnt.y() );
+    for( int i = 0; i < panes.count(); i++ ){
+        if( paneRect( i, QRect( 0, 0, Width, Height ) ).contains( p ) ) return i;
+    }
+    return activePane;
+}
+
+// the view to draw pane i with
+pvQtView::ViewParams pvQtView::paneView( int i )
+{
+    ViewParams vp = i == activePane ? getView() : panes[i].view;
+    if( paneLock ){
+        vp.pan = panAngle;
+        vp.tilt = tiltAngle;
+        vp.vfov = vFOV;
+    }
+    return vp;
+}
+
+/* save the live view in the active pane and make pane i's live
+*/
+void pvQtView::setActivePane( int i )
+{
+    if( i < 0 || i >= panes.count() || i == activePane ) return;
+    ViewParams vp = paneView( i );
+    panes[activePane].view = getView();
+    panes[activePane].surface = surface;
+    activePane = i;
+    if( panes[i].surface != surface ){
+        // not setSurface(), that resets the view
+        surface = panes[i].surface;
+        useContext();
+        makeSphere( theScreen );
+        emit reportSurface( surface );
+    }
+    setView( vp );
+}
+
+// a screen list on the panosurface not in use
+GLuint pvQtView::otherScreen()
+{
+    int key = ( int( curr_pt ) << 2 ) | ( surface << 1 ) | ( textgt ? 1 : 0 );
+    if( altScreen == 0 ) altScreen = backend->newScreen();
+    if( key != altKey ){
+        int s = surface;
+        surface = 1 - s;
+        makeSphere( altScreen );
+        surface = s;
+        altKey = key;
+    }
+    return altScreen;
+}
+
+void pvQtView::cancelRender()
+{
+    renderCancel = true;
+}
+
+/* Frames are drawn upside down into a framebuffer object, so rows
+   come back in image order, and read back into a ring of pixel pack
+   buffers, so the GPU can go on to the next frames while a read
+   completes.  Each buffer is collected READBACK_PBOS - 1 frames
+   later, once its fence has passed, copied to an image and handed
+   to the encoder, which works on its own threads.  Without pixel
+   buffers every frame is read back directly.
+*/
+bool pvQtView::renderAnimation( const pvQtAnimation & anim, int frames,
+                                QSize size, pvQtMovie * out )
+{
+    if( !OGLisOK || frames < 1 || anim.keyCount() < 1 || out == 0
+        || !QGLFramebufferObject::hasOpenGLFramebufferObjects() ) return false;
+    int W = size.width(), H = size.height();
+    useContext();
+    QGLFramebufferObject fbo( W, H );
+    if( !fbo.isValid() || !fbo.bind() ) return false;
+
+    QOpenGLBuffer pbo[READBACK_PBOS];
+    void * fence[READBACK_PBOS];
+    bool usePbo = true;
+    for( int i = 0; i < READBACK_PBOS; i++ ){
+        fence[i] = 0;
+        if( !usePbo ) continue;
+        pbo[i] = QOpenGLBuffer( QOpenGLBuffer::PixelPackBuffer );
+        pbo[i].setUsagePattern( QOpenGLBuffer::StreamRead );
+        usePbo = pbo[i].create() && pbo[i].bind();
+        if( usePbo ){
+            pbo[i].allocate( W * H * 4 );
+            pbo[i].release();
+        }
+    }
+    int lag = usePbo ? READBACK_PBOS - 1 : 0;
+
+    ViewParams saved = getView();
+    moving = false;
+    renderCancel = false;
+    flipY = true;
+    bool ok = true;
+    for( int n = 0; ok && n < frames + lag; n++ ){
+        if( n < frames ){
+            double u = frames > 1 ? double( n ) * ( anim.keyCount() - 1 ) / ( frames - 1 ) : 0;
+            applyView( anim.at( u ) );
+            glViewport( 0, 0, W, H );
+            portAR = (double)W / (double)H;
+            paintGL();
+            ok = paintok;
+            if( usePbo ){
+                fence[n % READBACK_PBOS] = readPixels( pbo[n % READBACK_PBOS], W, H );
+            } else {
+                QImage img( W, H, QImage::Format_RGB32 );
+                glPixelStorei( GL_PACK_ALIGNMENT, 4 );  // QImage row alignment
+                glReadPixels( 0, 0, W, H,
+                              GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV,
+                              img.bits() );
+                out->addFrame( img );
+                emit frameRendered( n + 1 );
+            }
+        }
+        int k = n - lag;
+        if( ok && usePbo && k >= 0 ){
+            int i = k % READBACK_PBOS;
+            ok = fenceDone( fence[i], true );
+            QImage img = ok ? mapImage( pbo[i], W, H ) : QImage();
+            if( !img.isNull() ) out->addFrame( img );
+            else ok = false;
+            emit frameRendered( k + 1 );
+        }
+        if( renderCancel || out->failed() ) ok = false;
+    }
+    flipY = false;
+
+    fbo.release();
+    for( int i = 0; i < READBACK_PBOS; i++ ){
+        fenceDone( fence[i], true );
+        if( usePbo ) pbo[i].destroy();
+    }
+    applyView( saved );
+    resizeGL( Width, Height );
+    return ok;
+}
+
 void pvQtView::recenterMode( bool ckd ){
     recenter = ckd;
     hangle = -panAngle;
@@ -1387,3 +2961,407 @@ void pvQtView::recenterMode( bool ckd ){
     updateGL();
     showview();
 }
+
+/**  Tiled Pyramid Display
+
+    The base level of a pyramid is the ordinary texture image.
+    Each frame, prepareTiles() finds the pyramid level that matches
+    the screen resolution at the center of the view, and the tiles
+    of that level seen at a grid of screen points.  It picks those
+    that are in the GPU tile cache, falling back to their nearest
+    cached ancestors, and asks the pyramid for the rest; they are
+    uploaded as they arrive and trigger a repaint.
+
+    A tile is drawn as a small mesh on the panosurface, placed by
+    inverting the texture mapping of the base picture, so it lines
+    up with it under any turn or texture scaling.
+
+**/
+
+void pvQtView::setPyramid( pvQtPyramid * pyr )
+{
+    if( pyr == pyramid ) return;
+
+    if( pyramid ){
+        disconnect( pyramid, 0, this, 0 );
+        pyramid->cancelTiles();
+    }
+    clearTiles();
+
+    pyramid = pyr;
+    if( pyramid ){
+        int ts = pyramid->tileSize();
+        maxTiles = max( 64, TILE_CACHE_BYTES / (4 * ts * ts) );
+        connect( pyramid, &pvQtPyramid::tileReady, this, &pvQtView::tileReady );
+    }
+}
+
+// delete all tile textures
+void pvQtView::clearTiles()
+{
+    if( tileCache.isEmpty() ) return;
+    useContext();
+    foreach( tileTex tt, tileCache ){
+        glDeleteTextures( 1, &tt.tex );
+    }
+    tileCache.clear();
+}
+
+/* a tile has been read: upload it, evicting the least
+   recently drawn tiles if the cache is full
+*/
+void pvQtView::tileReady( quint64 key, QImage img )
+{
+    if( !pyramid || !OGLisOK ) return;
+    if( pvQtPyramid::keyLevel( key ) <= pyramid->baseLevel()
+        || tileCache.contains( key ) ) return;
+
+    if( texPwr2 ){
+        int w = 1, h = 1;
+        while( w < img.width() ) w <<= 1;
+        while( h < img.height() ) h <<= 1;
+        if( w != img.width() || h != img.height() ){
+            img = img.scaled( w, h, Qt::IgnoreAspectRatio,
+                              Qt::SmoothTransformation );
+        }
+    }
+
+    useContext();
+    tileTex tt;
+    tt.used = tileFrame;
+    glGenTextures( 1, &tt.tex );
+    glBindTexture( GL_TEXTURE_2D, tt.tex );
+    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE );
+    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE );
+    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR );
+    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR );
+    glPixelStorei( GL_UNPACK_ALIGNMENT, 4 );  // QImage row alignment
+    glTexImage2D( GL_TEXTURE_2D, 0, GL_RGBA,
+                  img.width(), img.height(), 0,
+                  GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV,
+                  img.bits() );
+    // loadTextures() expects the picture's texture to be bound
+    glBindTexture( GL_TEXTURE_2D, texnms[0] );
+    if( !OGLok("load tile") ){
+        glDeleteTextures( 1, &tt.tex );
+        return;
+    }
+
+    // evict, but never a tile drawn in the latest frame
+    while( tileCache.count() >= maxTiles ){
+        QHash<quint64, tileTex>::iterator it, lru = tileCache.end();
+        for( it = tileCache.begin(); it != tileCache.end(); ++it ){
+            if( lru == tileCache.end() || it->used < lru->used ) lru = it;
+        }
+        if( lru->used >= tileFrame ) break;
+        glDeleteTextures( 1, &lru->tex );
+        tileCache.erase( lru );
+    }
+    tileCache.insert( key, tt );
+
+    update();	// one repaint for any number of tiles
+}
+
+/* finest pyramid level needed to show the center of the
+   view at screen resolution
+*/
+int pvQtView::tileLevel()
+{
+    double d = recenter ? 0 : eyeDistance;
+    // radians on the panosurface per screen pixel
+    double pa = (d + 1) * 2 * tan( 0.5 * RAD(wFOV) ) / tileVP[3];
+    int l = pyramid->baseLevel();
+    while( l < pyramid->levelCount() - 1 && pyramid->pixelAngle( l ) > pa ) ++l;
+    return l;
+}
+
+/* picture coordinates of the panosurface point seen at a
+   window position: face, and u,v in [0:1] on that face.
+   false if the ray misses the surface.
+*/
+bool pvQtView::screenToPano( double x, double y, int & face, double & u, double & v )
+{
+    GLdouble p0[3], p1[3];
+    if( !gluUnProject( x, y, 0, tileMV, tilePJ, tileVP, &p0[0], &p0[1], &p0[2] )
+        || !gluUnProject( x, y, 1, tileMV, tilePJ, tileVP, &p1[0], &p1[1], &p1[2] ) ){
+        return false;
+    }
+    // far intersection of the ray with the sphere or cylinder
+    double d[3] = { p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2] };
+    double ky = surface == 0 ? 1 : 0;
+    double a = d[0] * d[0] + ky * d[1] * d[1] + d[2] * d[2],
+           b = 2 * ( p0[0] * d[0] + ky * p0[1] * d[1] + p0[2] * d[2] ),
+           c = p0[0] * p0[0] + ky * p0[1] * p0[1] + p0[2] * p0[2] - 1;
+    double disc = b * b - 4 * a * c;
+    if( a <= 0 || disc < 0 ) return false;
+    double t = ( sqrt( disc ) - b ) / ( 2 * a );
+    if( t < 0 ) return false;
+    double w[3] = { p0[0] + t * d[0], p0[1] + t * d[1], p0[2] + t * d[2] };
+    if( surface != 0 && fabs( w[1] ) > CYLTAN ) return false;
+    double s = 1.0 / sqrt( w[0] * w[0] + w[1] * w[1] + w[2] * w[2] );
+    w[0] *= s; w[1] *= s; w[2] *= s;
+
+    if( picType == pvQtPic::cub ){
+        // cube map lookup direction (see paintGL), r = -T w
+        double r[3];
+        for( int i = 0; i < 3; i++ ){
+            r[i] = -( tileTM[i] * w[0] + tileTM[4 + i] * w[1] + tileTM[8 + i] * w[2] );
+        }
+        // select face as OpenGL does
+        double ax = fabs( r[0] ), ay = fabs( r[1] ), az = fabs( r[2] );
+        double sc, tc, ma;
+        if( ax >= ay && ax >= az ){
+            ma = ax; tc = -r[1];
+            if( r[0] > 0 ){ face = pvQtPic::right; sc = -r[2]; }
+            else { face = pvQtPic::left; sc = r[2]; }
+        } else if( ay >= az ){
+            ma = ay; sc = r[0];
+            if( r[1] > 0 ){ face = pvQtPic::top; tc = r[2]; }
+            else { face = pvQtPic::bottom; tc = -r[2]; }
+        } else {
+            ma = az; tc = -r[1];
+            if( r[2] > 0 ){ face = pvQtPic::front; sc = r[0]; }
+            else { face = pvQtPic::back; sc = -r[0]; }
+        }
+        u = 0.5 * ( sc / ma + 1 );
+        v = 0.5 * ( tc / ma + 1 );
+    } else {
+        // equirectangular texture coordinates (see panosurface)
+        double es = 0.5 - 0.5 * atan2( w[0], w[2] ) / Pi,
+               et = acos( KLIP( w[1], -1.0, 1.0 ) ) / Pi;
+        face = 0;
+        u = tileTM[0] * es + tileTM[4] * et + tileTM[12];
+        v = tileTM[1] * es + tileTM[5] * et + tileTM[13];
+        u -= floor( u );
+        v = KLIP( v, 0.0, 1.0 );
+    }
+    return true;
+}
+
+/* panosurface point that shows picture point face,u,v
+*/
+void pvQtView::panoToSurface( int face, double u, double v, float * pnt )
+{
+    double w[3];
+    if( picType == pvQtPic::cub ){
+        double sc = 2 * u - 1, tc = 2 * v - 1, r[3];
+        switch( face ){
+        case pvQtPic::front:  r[0] = sc;  r[1] = -tc; r[2] = 1;   break;
+        case pvQtPic::right:  r[0] = 1;   r[1] = -tc; r[2] = -sc; break;
+        case pvQtPic::back:   r[0] = -sc; r[1] = -tc; r[2] = -1;  break;
+        case pvQtPic::left:   r[0] = -1;  r[1] = -tc; r[2] = sc;  break;
+        case pvQtPic::top:    r[0] = sc;  r[1] = 1;   r[2] = tc;  break;
+        default:              r[0] = sc;  r[1] = -1;  r[2] = -tc; break;
+        }
+        // invert r = -T w (T is a rotation)
+        for( int i = 0; i < 3; i++ ){
+            w[i] = -( tileTM[4 * i] * r[0] + tileTM[4 * i + 1] * r[1] + tileTM[4 * i + 2] * r[2] );
+        }
+    } else {
+        // invert the 2D texture matrix
+        double a = tileTM[0], b = tileTM[4], c = tileTM[1], d = tileTM[5];
+        double det = a * d - b * c;
+        if( det == 0 ) det = 1;
+        double du = u - tileTM[12], dv = v - tileTM[13];
+        double es = ( d * du - b * dv ) / det,
+               et = KLIP( ( a * dv - c * du ) / det, 0.0, 1.0 );
+        double xa = ( es - 0.5 ) * 2 * Pi, ya = et * Pi;
+        w[0] = -sin( xa ) * sin( ya );
+        w[1] = cos( ya );
+        w[2] = cos( xa ) * sin( ya );
+    }
+
+    double s;
+    if( surface == 0 ){
+        s = 1.0 / sqrt( w[0] * w[0] + w[1] * w[1] + w[2] * w[2] );
+    } else {
+        // cylinder, clipped at its ends
+        double r = max( sqrt( w[0] * w[0] + w[2] * w[2] ), 1.0e-6 );
+        w[1] = KLIP( w[1], -CYLTAN * r, CYLTAN * r );
+        s = 1.0 / r;
+    }
+    pnt[0] = float( s * w[0] );
+    pnt[1] = float( s * w[1] );
+    pnt[2] = float( s * w[2] );
+}
+
+// panosurface points of a tile's mesh, (N+1)^2 of them
+void pvQtView::tileVerts( quint64 key, float * verts )
+{
+    const int N = TILE_DIVS;
+    int level = pvQtPyramid::keyLevel( key ),
+        face = pvQtPyramid::keyFace( key );
+    QRect r = pyramid->tileRect( level, pvQtPyramid::keyRow( key ),
+                                 pvQtPyramid::keyCol( key ) );
+    QSize ls = pyramid->levelSize( level );
+
+    float * pv = verts;
+    for( int i = 0; i <= N; i++ ){
+        double v = ( r.y() + r.height() * double(i) / N ) / ls.height();
+        for( int j = 0; j <= N; j++ ){
+            double u = ( r.x() + r.width() * double(j) / N ) / ls.width();
+            panoToSurface( face, u, v, pv );
+            pv += 3;
+        }
+    }
+}
+
+/* choose the tiles to draw over a pane, in p.tiles with their
+   meshes, and ask the pyramid for those it lacks
+*/
+void pvQtView::prepareTiles( framePane & p )
+{
+    ++tileFrame;
+    QMatrix4x4 mv = p.cam.modelView(), pj = p.cam.projection(), tm = p.cam.texture();
+    for( int i = 0; i < 16; i++ ){
+        tileMV[i] = p.tileMV[i] = mv.constData()[i];
+        tilePJ[i] = p.tilePJ[i] = pj.constData()[i];
+        tileTM[i] = tm.constData()[i];
+    }
+    tileVP[0] = p.port.x();
+    tileVP[1] = p.port.y();
+    tileVP[2] = p.port.width();
+    tileVP[3] = p.port.height();
+
+    int base = pyramid->baseLevel();
+    int level = tileLevel();
+    if( level <= base ){
+        pyramid->requestTiles( QList<quint64>() );
+        return;
+    }
+
+    // screen sample points, from the center outward
+    int nx = tileVP[2] / TILE_SAMPLE + 1,
+        ny = tileVP[3] / TILE_SAMPLE + 1;
+    QVector<QPoint> pts;
+    for( int j = 0; j <= ny; j++ ){
+        for( int i = 0; i <= nx; i++ ) pts.append( QPoint( 2 * i - nx, 2 * j - ny ) );
+    }
+    std::sort( pts.begin(), pts.end(), []( const QPoint & a, const QPoint & b ){
+        return a.x() * a.x() + a.y() * a.y() < b.x() * b.x() + b.y() * b.y();
+    });
+
+    // the tiles they see at the wanted level
+    QSize ls = pyramid->levelSize( level );
+    int ts = pyramid->tileSize(),
+        cols = pyramid->tileCols( level ),
+        rows = pyramid->tileRows( level );
+    QList<quint64> want;
+    QSet<quint64> seen;
+    foreach( QPoint p, pts ){
+        double x = tileVP[0] + 0.5 * tileVP[2] * double( p.x() + nx ) / nx,
+               y = tileVP[1] + 0.5 * tileVP[3] * double( p.y() + ny ) / ny;
+        int face;
+        double u, v;
+        if( !screenToPano( x, y, face, u, v ) ) continue;
+        int c = int( u * ls.width() ) / ts,
+            r = int( v * ls.height() ) / ts;
+        quint64 k = pvQtPyramid::tileKey( level, face,
+                                          KLIP( r, 0, rows - 1 ),
+                                          KLIP( c, 0, cols - 1 ) );
+        if( !seen.contains( k ) ){
+            seen.insert( k );
+            want.append( k );
+        }
+    }
+
+    // request missing tiles; show their nearest cached ancestors
+    QList<quint64> missing, draw;
+    QSet<quint64> drawing;
+    foreach( quint64 k, want ){
+        if( !tileCache.contains( k ) ) missing.append( k );
+        while( pvQtPyramid::keyLevel( k ) > base ){
+            if( tileCache.contains( k ) ){
+                if( !drawing.contains( k ) ){
+                    drawing.insert( k );
+                    draw.append( k );
+                }
+                break;
+            }
+            k = pvQtPyramid::tileKey( pvQtPyramid::keyLevel( k ) - 1,
+                                      pvQtPyramid::keyFace( k ),
+                                      pvQtPyramid::keyRow( k ) / 2,
+                                      pvQtPyramid::keyCol( k ) / 2 );
+        }
+    }
+    pyramid->requestTiles( missing );
+    if( draw.isEmpty() ) return;
+
+    // coarse to fine: the level is in the high bits of the key
+    std::sort( draw.begin(), draw.end() );
+
+    const int nv = 3 * (TILE_DIVS + 1) * (TILE_DIVS + 1);
+    p.tileVerts.resize( nv * draw.count() );
+    for( int i = 0; i < draw.count(); i++ ){
+        tileTex & tt = tileCache[ draw[i] ];
+        tt.used = tileFrame;
+        p.tiles.append( tt.tex );
+        tileVerts( draw[i], p.tileVerts.data() + i * nv );
+    }
+}
+
+void pvQtView::paintTiles( Frame & f, const framePane & p )
+{
+    const int N = TILE_DIVS;
+    static GLuint quads[4 * N * N];
+    static float tcs[2 * (N + 1) * (N + 1)];
+    static bool haveQuads = false;
+    if( !haveQuads ){
+        GLuint * q = quads;
+        for( int i = 0; i < N; i++ ){
+            for( int j = 0; j < N; j++ ){
+                GLuint k = i * (N + 1) + j;
+                *q++ = k; *q++ = k + 1;
+                *q++ = k + N + 2; *q++ = k + N + 1;
+            }
+        }
+        float * pt = tcs;
+        for( int i = 0; i <= N; i++ ){
+            for( int j = 0; j <= N; j++ ){
+                *pt++ = float(j) / N;
+                *pt++ = float(i) / N;
+            }
+        }
+        haveQuads = true;
+    }
+
+    // plain 2D texturing, leaving the picture's state as it was
+    glPushAttrib( GL_ENABLE_BIT | GL_TEXTURE_BIT );
+    glPushClientAttrib( GL_CLIENT_VERTEX_ARRAY_BIT );
+    glDisable( GL_TEXTURE_CUBE_MAP );
+    glDisable( GL_TEXTURE_GEN_S );
+    glDisable( GL_TEXTURE_GEN_T );
+    glDisable( GL_TEXTURE_GEN_R );
+    glDisable( GL_CULL_FACE );
+    glEnable( GL_TEXTURE_2D );
+    glEnableClientState( GL_VERTEX_ARRAY );
+    glEnableClientState( GL_TEXTURE_COORD_ARRAY );
+    glDisableClientState( GL_NORMAL_ARRAY );
+    glMatrixMode( GL_TEXTURE );
+    glPushMatrix();
+    glLoadIdentity();
+    glMatrixMode( GL_PROJECTION );
+    glPushMatrix();
+    glLoadMatrixd( p.tilePJ );
+    glMatrixMode( GL_MODELVIEW );
+    glPushMatrix();
+    glLoadMatrixd( p.tileMV );
+
+    const int nv = 3 * (N + 1) * (N + 1);
+    glTexCoordPointer( 2, GL_FLOAT, 0, tcs );
+    for( int i = 0; i < p.tiles.count(); i++ ){
+        glBindTexture( GL_TEXTURE_2D, p.tiles[i] );
+        glVertexPointer( 3, GL_FLOAT, 0, p.tileVerts.constData() + i * nv );
+        glDrawElements( GL_QUADS, 4 * N * N, GL_UNSIGNED_INT, quads );
+    }
+
+    glPopMatrix();
+    glMatrixMode( GL_PROJECTION );
+    glPopMatrix();
+    glMatrixMode( GL_TEXTURE );
+    glPopMatrix();
+    glMatrixMode( GL_MODELVIEW );
+    glPopClientAttrib();
+    glPopAttrib();
+    frameOk( f, "paint tiles" );
+}
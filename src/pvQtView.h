@@ -20,7 +20,8 @@
  pvQtView is an OpenGL display widget that shows images projected on
  a 3D spherical or cylindrical screen.
 
- This class is the only one in pvQt that issues OpenGL calls.
+ This class and the helpers it owns (render thread, texture loader,
+ rendering backend) are the only ones in pvQt that issue OpenGL calls.
 
  App should call OpenGLOK() before using this widget, and terminate
  with error if it returns false (as nothing can be displayed).
@@ -31,10 +32,26 @@
 #define PVQTVIEW_H
 
 #include <QtOpenGL/QGLWidget>
+#include <QHash>
+#include <QTimer>
+#include <QThreadPool>
+#include <QSharedPointer>
 #include "pvQtPic.h"
+#include "pvQtCamera.h"
+#include "pvQtEncoder.h"
 #include "panosphere.h"
 #include "panocylinder.h"
 
+class QGLShaderProgram;
+class QGLFramebufferObject;
+class pvQtAnimation;
+class pvQtMovie;
+class QOpenGLBuffer;
+class pvQtRenderThread;
+class pvQtTexLoader;
+class pvQtBackend;
+class pvQtFaceStream;
+
 class pvQtView : public QGLWidget
 {
     Q_OBJECT
@@ -58,27 +75,52 @@ public:
     QString OpenGLHardware(){
         return QString( (const char *)glGetString(GL_RENDERER) );
     }
+    // name of the rendering backend in use
+    QString OpenGLBackend();
     QString OpenGLLimits(){
         return QString("texPwr2 %1, texMax %2, cubeMax %3")
                 .arg(texPwr2).arg(max2d).arg(maxcube);
     }
 
     /*
-    Display an overlay image
-    ovl = 0 stops overlay display
-    Image format should be ARGB.  Size should be moderate.
-    Vertical dimension will fill the viewport.
+    Overlay layers
+    Images shown over the view, each with its own opacity, blend
+    mode, placement and visibility, stacked in the order added.
+    addLayer returns an id for the other calls, 0 on error.
+    The image is copied to a texture and not kept.
+    */
+    enum LayerBlend { blendNormal, blendAdd, blendMultiply, blendScreen };
+    int addLayer( const QImage & img );
+    bool setLayerImage( int id, const QImage & img );
+    void removeLayer( int id );
+    /* opacity 0:1; dice > 0 shows only alternate diagonal checks
+       dice image pixels wide (needs OpenGL 2.0)
     */
-    bool showOverlay( QImage * ovl );
+    void setLayerOpacity( int id, double alpha, int dice = 0 );
+    void setLayerBlend( int id, LayerBlend blend );
+    /* pos is the image's top left corner and scale its height,
+       both in viewport heights from the viewport's top left;
+       rotate is clockwise degrees around the image center.
+       The default, (0,0), 1, 0, fills the viewport height.
+    */
+    void setLayerTransform( int id, QPointF pos, double scale, double rotate = 0 );
+    void setLayerVisible( int id, bool visible );
+    // move a layer to position index in the stack, 0 = bottom
+    void stackLayer( int id, int index );
+    int layerCount(){ return layers.count(); }
 
     /*
     Display a picture
     pic = 0 resets to base screen display.  Otherwise
-    *pic must be valid and undisturbed until showPic is next
-    called (caller can then delete pic if appropriate).
+    *pic must be valid and undisturbed until another picture
+    is shown: the current one stays on view while a new one
+    loads, so make the new one in a different pvQtPic, and
+    check shownPic() before changing or deleting one.
     returns sucess or failure, with errmsg updated.
     */
     bool showPic( pvQtPic * pic );
+    // the picture on view, or 0
+    pvQtPic * shownPic(){ return thePic; }
     /*
     check whether picture displayed OK, get message if not
     The error flag is reset when a new picture is loaded.
@@ -97,20 +139,99 @@ public:
 
     /*
     Save the current view to a file
-    name is full pathname, with extension .jpg or .tif
+    name is full pathname; .jpg, .png and .tif files are written
+    by pvQtEncoder with the options set by setSaveOptions(), other
+    types Qt supports by QImage::save().
     Default size is the current viewport size.  Custom sizes
     need not be the same shape as the viewport (but may
     not be supported on a given system -- if not, viewport
     size is used)
-    Returns true if image was rendered and written OK.
+    Returns true if the image was rendered.  It is read back and
+    written in the background: saveProgress() reports the stages
+    and saveDone() the result.
     */
     bool saveView( QString name, QSize size = QSize());
     // overload to save possibly scaled-up copy of viewport
     // scale is clipped to [1.0:5.0]
     bool saveView( QString name, double scale = 1.0 );
+    // encoder options for views saved from now on
+    void setSaveOptions( const pvQtEncoder::Options & opt ){ saveOpts = opt; }
+    pvQtEncoder::Options saveOptions(){ return saveOpts; }
 
     // get the current screen viewport size in pixels
     QSize screenSize(){ return QSize( Width, Height ); }
+    // true in recenter mode
+    bool recentering(){ return recenter; }
+    // largest cube face texture
+    QSize maxCubeDims();
+    // the current view with its overlay layers, drawn now
+    QImage grabFrame();
+    /*
+    Frames are drawn by a render thread where OpenGL supports it.
+    GL work done elsewhere must call useContext() first, never
+    QGLWidget::makeCurrent(): it takes the context from the render
+    thread between frames, and keeps it until the GUI thread is
+    idle at the event loop level it was taken at.
+    */
+    void useContext();
+    /*
+    Upload the front face of the next 2D picture ahead of time.
+    key is its pvQtPic::FaceKey(); if the picture shown next has
+    that key and size, its texture is swapped in, not reloaded.
+    */
+    void preloadTexture( QString key, const QImage & img );
+
+    /*
+    Select the tiled pyramid whose finer levels are drawn over
+    the picture.  showPic() does this for the pic's pyramid; call
+    setPyramid( 0 ) before deleting the one being shown.
+    */
+    void setPyramid( pvQtPyramid * pyr );
+
+    /*
+    All the view parameters, for saving and animating views.
+    Angles are in degrees; eyeh, eyev are the eye direction in
+    recenter mode, eyex, eyey the eye shifts otherwise.
+    */
+    typedef struct {
+        double pan, tilt, spin;
+        double vfov;
+        double dist;	// eye distance, sphere radii
+        double eyex, eyey;
+        double eyeh, eyev;
+        double framex, framey;	// framing shifts
+        double xmag, ymag;	// texture magnification
+        int turn;	// picture turn, 0:3 = 0,90,180,270 deg
+        double roll, pitch, yaw;
+    } ViewParams;
+    ViewParams getView();
+    void setView( const ViewParams & vp );
+
+    /*
+    Split screen
+    The window can be divided into up to 4 panes, side by side or
+    2 x 2, each with its own view parameters and panosurface, all
+    drawn in one frame from the same textures.  The mouse and the
+    view controls act on the active pane, the one last clicked;
+    the others keep their views, except that with the lock on they
+    follow its pan, tilt and zoom.  A pane can show another picture
+    of the same type and FOV (for A/B comparison): setPanePic()
+    loads its textures; pic must stay valid until it is replaced,
+    setPanes() drops the pane or a different type of picture is
+    shown.  pic = 0 shows the main picture again.
+    */
+    int paneCount(){ return panes.isEmpty() ? 1 : panes.count(); }
+    bool setPanePic( int pane, pvQtPic * pic );
+
+    /*
+    Render an animation offscreen, frames images of the given size
+    evenly spaced from its first to its last key, and pass them to
+    out to be encoded in the background.  Emits frameRendered()
+    after each frame is read back.  The view is restored after.
+    Returns false on error or if cancelRender() was called.
+    */
+    bool renderAnimation( const pvQtAnimation & anim, int frames,
+                          QSize size, pvQtMovie * out );
 
 public slots:
     /*
@@ -140,7 +261,8 @@ public slots:
     void super_fish(); // Ez = 1.07, min zoom
     // update display of current picture
     void picChanged(); // from scratch
-    void newFace( pvQtPic::PicFace face ); // one cube face
+    void newFace( pvQtPic::PicFace face ); // one cube face, or any
+    void newImages(); // new source images, same view
     // select panosurface
     void setSurface( int surf );
     // orient image on panosurface turn(0:3)= 0,90,180,270 deg
@@ -151,6 +273,24 @@ public slots:
     void recenterMode( bool );
     void step_eyex( int );
     void step_eyey( int );
+    // draw reduced size previews while dragging
+    void setFastPreview( bool on );
+    // stop renderAnimation()
+    void cancelRender();
+    // draw a frame, on the render thread if there is one
+    void updateGL();
+    // split screen, see above
+    void setPanes( int n );	// 1:4
+    void setPaneLock( bool on );
+    /* rendering backend, a pvQtBackend::Kind; the default
+       is the OpenGL 3.3 one where OpenGL supports it
+    */
+    void setBackend( int kind );
+    /* ICC profile file of the display, "" for sRGB.  Pictures with
+       embedded profiles are converted to it as they are drawn, and
+       to sRGB in saved views (OpenGL 3.3 renderer only).
+    */
+    void setDisplayProfile( QString path );
 
 
 signals:
@@ -161,10 +301,17 @@ signals:
     void reportProj( QString name );
     void reportSurface( int surf );
     void reportRecenter( bool ); // when recenter changed internally
+    void frameRendered( int n ); // renderAnimation() progress
+    // saveView() progress, percent, and result
+    void saveProgress( QString name, int percent );
+    void saveDone( QString name, bool ok );
+    void reportBackend( int kind );	// the one in use
 protected:
     void initializeGL();
     void paintGL();
     void resizeGL(int width, int height);
+    void glDraw();
+    void resizeEvent( QResizeEvent * ev );
     void mousePressEvent(QMouseEvent *pme );
     void mouseMoveEvent(QMouseEvent *pme );
     void mouseReleaseEvent( QMouseEvent *pme );
@@ -173,6 +320,10 @@ protected:
 
 private slots:
     void mTimeout();
+    void tileReady( quint64 key, QImage img );
+    void pollSaves();
+    void texLoaded( int serial, uint tex, void * fence );
+    void pollLoad();
 private:
     // GUI support
     double normalizeAngle(int &iangle, int istep, double lwr, double upr);
@@ -222,18 +373,43 @@ private:
 
     // display support
     void setPicType( pvQtPic::PicType pt );
-    bool setupPic( pvQtPic * pic );
+    // now: load the textures here, not on the loader thread
+    bool setupPic( pvQtPic * pic, bool now = false );
+    void picShown();
+    QSize maxFaceDims();
+    QSize maxFaceDims( pvQtPic::PicType pt );
+    bool loadTextures();
     void updatePic();
     pvQtPic  * thePic;
     pvQtPic::PicType picType;
     int	ipicType; // index of picType
-    // display lists for screens
+    // screens, drawn by the rendering backend
+    pvQtBackend * backend;
+    int wantBackend;	// Kind chosen
+    pvQtCamera camera();	// of the current view
     void makeSphere( GLuint list );
-    GLuint theScreen; // current screen list
+    GLuint theScreen; // current screen
     // textures
     GLenum textgt; // current target (2D or cube)
     GLuint texname; // current texture object
-    GLuint texnms[2]; // bound textures: 0: 2d, 1: cube
+    GLuint texnms[3]; // bound textures: 0: 2d, 1: cube, 2: next 2d
+    QSize texDims[3]; // their allocated sizes
+    bool texMipped[3]; // have mipmap levels
+    // color management
+    GLuint lutTex[2]; // color tables: 0 to display, 1 to sRGB
+    QByteArray lutSrc; // picture's color profile
+    QByteArray dispICC; // display's color profile
+    bool lutMade; // tables are up to date
+    void makeLUTs();
+    QString spareKey; // face key of the picture in texnms[2]
+    // picture state the textures were loaded from
+    pvQtPic * texPic;
+    int texGen;
+    QRectF texClip;
+    static void setTexParams( GLenum target, bool mipped = false );
+    bool allocTexture( int k, QSize dims );
+    void genMipmaps( int k );
+    bool loadFace( pvQtPic * pic, GLenum target, pvQtPic::PicFace face );
     // OpenGL capabilities
     bool OGLisOK; // is usable
     bool OGLv20; // is version 2.0 or better
@@ -250,10 +426,10 @@ private:
     bool picok; // sticky OGL error flag
     QString errmsg;	// sticky OGL error message
     bool OGLok(const char * label);	// check, post and signal OGL errors
+    void noteOGLerror( const char * label, GLenum code );
     // tabulated sphere points and texture coordinates
     panosphere  * pqs;
     panocylinder * ppc;
-    bool QS_BUF; // put quadsphere data in OGL buffers
     double xtexmag, ytexmag; // tex coord scale factors
 
     pictureTypes pictypes;
@@ -266,12 +442,168 @@ private:
 
     int MacCubeLimit;
 
-    // pointer to overlay image
-    QImage * povly;
+    // tiled pyramid source, not owned
+    pvQtPyramid * pyramid;
+    // GPU tile cache, least recently drawn tile evicted first
+    typedef struct {
+        GLuint tex;
+        unsigned int used; // tileFrame when last drawn
+    } tileTex;
+    QHash<quint64, tileTex> tileCache;
+    int maxTiles;
+    unsigned int tileFrame;
+    // camera matrices and viewport of the frame being drawn
+    GLdouble tileMV[16], tilePJ[16], tileTM[16];
+    GLint tileVP[4];
+    int tileLevel();
+    bool screenToPano( double x, double y, int & face, double & u, double & v );
+    void panoToSurface( int face, double u, double v, float * pnt );
+    void tileVerts( quint64 key, float * verts );
+    void clearTiles();
+
+    // overlay layers, bottom to top
+    typedef struct {
+        int id;
+        QImage img;	// waiting to be loaded
+        GLuint tex;
+        QSize dims;	// image size in pixels
+        double opacity;
+        int dice;	// check width, pixels
+        int blend;	// LayerBlend
+        QPointF pos;	// see setLayerTransform
+        double scale, rotate;
+        bool visible;
+    } ovlyLayer;
+    QList<ovlyLayer> layers;
+    int lastLayer;	// id
+    QGLShaderProgram * layerProg;	// 0 if no shader
+    ovlyLayer * findLayer( int id );
+    bool putLayerImage( ovlyLayer & ly, const QImage & img );
+    void makeLayerProgram();
+    bool loadLayer( ovlyLayer & ly );
+    void clearLayers();
+    // fast preview
+    bool fastPreview;	// enabled
+    bool moving;	// mouse is dragging the view
+    double previewScale;	// of the window, for preview frames
+    QGLFramebufferObject * previewFbo;
+
+    /* A frame is drawn in two steps.  prepareFrame() reads the view
+       state into a Frame, doing first any GL work the frame needs
+       (color tables, layer images, screens); it runs on the GUI
+       thread.  paintFrame() only draws what the Frame says, with
+       GL objects the view made, so the render thread can draw it
+       while the GUI thread goes on changing the view.
+    */
+    typedef struct {
+        QRect port;	// GL viewport
+        pvQtCamera cam;
+        GLuint screen;
+        GLenum target;	// picture texture target, 0 for none
+        GLuint tex;
+        GLuint lut;	// color table, 0 for none
+        GLint wrapS, wrapT;	// 2D texture border modes
+        // pyramid tiles over the picture, coarse to fine
+        QVector<GLuint> tiles;
+        QVector<float> tileVerts;	// panosurface points, per tile
+        GLdouble tileMV[16], tilePJ[16];
+    } framePane;
+    typedef struct {
+        GLuint tex;
+        int blend;
+        double opacity;
+        int dice;
+        QSize dims;
+        QPointF pos;
+        double scale, rotate;
+    } frameLayer;
+    typedef struct {
+        QRect port;	// GL viewport
+        bool flipY;
+        double preview;	// render scale, < 1 for a preview
+        QList<framePane> panes;
+        QRect active;	// pane to frame, if not empty
+        QList<frameLayer> layers;
+        const char * errAt;	// first OGL error, 0 if none
+        GLenum err;
+    } Frame;
+    void prepareFrame( Frame & f, QRect port );
+    void preparePane( framePane & p, QRect port );
+    void prepareTiles( framePane & p );
+    void paintFrame( Frame & f );
+    bool paintPreview( Frame & f, const framePane & p );
+    void paintScene( Frame & f, const framePane & p );
+    void paintTiles( Frame & f, const framePane & p );
+    void paintLayers( Frame & f );
+    bool frameOk( Frame & f, const char * label );
+
+    // asynchronous readback
+    bool flipY;	// render upside down
+    bool hasFences;	// OGL has sync objects
+    bool hasTexStorage;	// OGL has immutable texture storage
+    bool genMips;	// OGL can make mipmap levels
+    void * readPixels( QOpenGLBuffer & pbo, int W, int H );
+    bool fenceDone( void * & fence, bool wait );
+    QImage mapImage( QOpenGLBuffer & pbo, int W, int H );
+    // views being saved
+    typedef struct {
+        QString name;
+        QSize size;
+        QOpenGLBuffer * pbo;
+        void * fence;	// GLsync
+    } saveJob;
+    QList<saveJob> saves;
+    QTimer readTimer;
+    QThreadPool savePool;
+    pvQtEncoder::Options saveOpts;
+    void encodeView( QString name, const QImage & img );
+
+    // split screen panes; the active one's view is the live one
+    typedef struct {
+        ViewParams view;	// when not active
+        int surface;
+        pvQtPic * pic;	// A/B picture, or 0
+        GLuint tex;		// its texture
+    } viewPane;
+    QList<viewPane> panes;	// empty for a single view
+    int activePane;
+    bool paneLock;	// follow the active pane's pan, tilt, zoom
+    GLuint altScreen;	// screen for the other panosurface
+    int altKey;		// what it was made for
+    QRect paneRect( int i, QRect area );
+    int paneAt( QPoint pnt );
+    ViewParams paneView( int i );
+    void setActivePane( int i );
+    void dropPanePic( viewPane & p );
+    GLuint otherScreen();
+
+    // view parameters without redisplay
+    void applyView( const ViewParams & vp );
+    bool renderCancel;
+
     // for recenter mode
     bool recenter;
     void clipEyePosition();
 
+    // threaded rendering
+    friend class pvQtRenderThread;
+    pvQtRenderThread * renderer;	// 0 if drawing on the GUI thread
+    using QGLWidget::makeCurrent;	// see useContext()
+
+    // textures of new pictures made on a loader thread
+    friend class pvQtTexLoader;
+    pvQtTexLoader * loader;	// 0 if loading on the GUI thread
+    int loadSerial;	// of the current load
+    pvQtPic * loadPic;	// being loaded, or 0
+    QList<QSharedPointer<pvQtFaceStream> > loadStreams;	// its faces
+    GLuint loadTex;	// loaded, waiting for its fence
+    void * loadFence;	// GLsync
+    QTimer loadTimer;
+    bool viewPending;	// setView() while loading
+    ViewParams pendingView;
+    bool startLoad( pvQtPic * pic );
+    void finishLoad();
+    void dropLoad();
 };
 
 #endif //ndef PVQTVIEW_H
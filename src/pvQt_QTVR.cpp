@@ -32,7 +32,9 @@
 
 #include <math.h>
 #include <errno.h>
+#include <limits.h>
 #include <vector>
+#include <algorithm>
 #include <zlib.h>
 
 #include <QtCore>
@@ -92,57 +94,19 @@ bool decodeJPEG( QIODevice * dev, QImage * img, bool rot90 )
     return ok;
 }
 
-// source is a buffer
-bool decodeJPEG( char * buffer, size_t buf_len, QImage & image, bool rot90=false)
+// source is a buffer, normally a slice of the mapped .mov file.
+// fromRawData() wraps it without copying; it must stay mapped
+// until the decode returns.
+bool decodeJPEG( const uchar * buffer, size_t buf_len, QImage & image, bool rot90=false)
 {
-    QByteArray qb( buffer, int(buf_len) );
+    QByteArray qb( QByteArray::fromRawData( (const char *)buffer, int(buf_len) ) );
     QBuffer buf(&qb);
+    if( !buf.open( QIODevice::ReadOnly ) ) {
+        return false;
+    }
     return decodeJPEG( &buf, &image, rot90 );
 }
 
-// source is an open file
-bool decodeJPEG( FILE *f, QImage & image, bool rot90=false){
-    QFile qf;
-    qf.open( f, QIODevice::ReadOnly );
-    return decodeJPEG( &qf, &image, rot90 );
-}
-
-struct ChunkOffsetAtom
-{
-    int32 size;
-    int32 type;
-    char version;
-    char flags[3];
-    int32 numEntries;
-    int32 chunkOffsetTable[200];
-};
-
-struct SampleSizeAtom
-{
-    int32 size;
-    int32 type;
-    char version;
-    char flags[3];
-    int32 sampleSize;
-    int32 numEntries;
-    int32 sampleSizeTable[200];
-};
-
-struct PublicHandlerInfo
-{
-    int32 componentType;
-    int32 componentSubType;
-};
-
-struct HandlerAtom
-{
-    int32 size;
-    int32 type;
-    char version;
-    char flags[3];
-    PublicHandlerInfo hInfo;
-};
-
 struct QTVRCubicViewAtom
 {
     float minPan;
@@ -212,80 +176,80 @@ struct QTVRTrackRefEntry
     uint32  trackRefIndex;
 } ;
 
-#define DECOMP_CHUNK 4096
+/* largest expansion deflate can give, and a cap on any movie header */
+#define ZLIB_MAX_RATIO 1032
+#define CMVD_MAX_SIZE (256 << 20)
 
 /*
- * Decompress from file source to file dest until stream ends or EOF.
-   inf() returns Z_OK on success, Z_MEM_ERROR if memory could not be
+ * Inflate a zlib stream held in memory into dest.
+   sizeHint is the uncompressed size recorded in the 'cmvd' atom;
+   dest is grown if that turns out to be too small.
+   Returns Z_OK on success, Z_MEM_ERROR if memory could not be
    allocated for processing, Z_DATA_ERROR if the deflate data is
-   invalid or incomplete, Z_VERSION_ERROR if the version of zlib.height() and
-   the version of the library linked do not match, or Z_ERRNO if there
-   is an error reading or writing the files.
+   invalid or incomplete, Z_VERSION_ERROR if the version of zlib.h and
+   the version of the library linked do not match.
 */
-int decompressZLIBFile(FILE *source, FILE *dest)
+int decompressZLIBBuffer(const uchar *source, size_t sourceLen,
+                         QByteArray &dest, size_t sizeHint)
 {
     int ret;
-    unsigned have;
     z_stream strm;
-    unsigned char in[DECOMP_CHUNK];
-    unsigned char out[DECOMP_CHUNK];
 
     /* allocate inflate state */
     strm.zalloc = Z_NULL;
     strm.zfree = Z_NULL;
     strm.opaque = Z_NULL;
-    strm.avail_in = 0;
-    strm.next_in = Z_NULL;
+    strm.avail_in = (uInt)sourceLen;
+    strm.next_in = (Bytef *)source;
     ret = inflateInit(&strm);
     if (ret != Z_OK) {
         return ret;
     }
 
-    /* decompress until deflate stream ends or end of file */
+    if (sizeHint < 4 * sourceLen) {
+        sizeHint = 4 * sourceLen;
+    }
+    if (sizeHint > INT_MAX / 2) {
+        (void)inflateEnd(&strm);
+        return Z_MEM_ERROR;
+    }
+    dest.resize(int(sizeHint));
+
+    /* inflate straight into dest, growing it until the stream ends */
     do {
-        strm.avail_in = fread(in, 1, DECOMP_CHUNK, source);
-        if (ferror(source)) {
+        strm.next_out = (Bytef *)dest.data() + strm.total_out;
+        strm.avail_out = (uInt)(dest.size() - strm.total_out);
+        ret = inflate(&strm, Z_FINISH);
+
+        switch (ret) {
+        case Z_NEED_DICT:
+            ret = Z_DATA_ERROR; /* and fall through */
+        case Z_DATA_ERROR:
+        case Z_MEM_ERROR:
+        case Z_STREAM_ERROR:
             (void)inflateEnd(&strm);
-            return Z_ERRNO;
-        }
-        if (strm.avail_in == 0)
-            break;
-        strm.next_in = in;
-
-        /* run inflate() on input until output buffer not full */
-        do {
-            strm.avail_out = DECOMP_CHUNK;
-            strm.next_out = out;
-            ret = inflate(&strm, Z_NO_FLUSH);
-
-            ///assert(ret != Z_STREAM_ERROR);  /* state not clobbered */
-            if(ret == Z_STREAM_ERROR){
-                qFatal("pvQt_QTVR::Z_STREAM_ERROR");
-            }
-
-            switch (ret) {
-            case Z_NEED_DICT:
-                ret = Z_DATA_ERROR; /* and fall through */
-            case Z_DATA_ERROR:
-            case Z_MEM_ERROR:
+            return ret;
+        case Z_BUF_ERROR:
+            if (strm.avail_in == 0) {
+                /* input exhausted before end of stream */
                 (void)inflateEnd(&strm);
-                return ret;
+                return Z_DATA_ERROR;
             }
-
-            have = DECOMP_CHUNK - strm.avail_out;
-
-            if (fwrite(out, 1, have, dest) != have || ferror(dest)) {
+            if (dest.size() == 0 || dest.size() > INT_MAX / 2) {
+                /* can't grow it any more */
                 (void)inflateEnd(&strm);
-                return Z_ERRNO;
+                return Z_MEM_ERROR;
             }
-        } while (strm.avail_out == 0);
-
-        /* done when inflate() says it's done */
+            dest.resize(2 * dest.size());
+            break;
+        }
     } while (ret != Z_STREAM_END);
 
+    dest.resize(int(strm.total_out));
+
     /* clean up and return */
     (void)inflateEnd(&strm);
-    return ret == Z_STREAM_END ? Z_OK : Z_DATA_ERROR;
+    return Z_OK;
 }
 
 /**************** PARSE QUICKTIME MOVIE ***********************/
@@ -299,9 +263,20 @@ QTVRDecoder::QTVRDecoder()
     m_imageRefTrackIndex = 0;
     m_panoType = 0;
     m_mainTrack = 0;
-    m_currTrackIsImageTrack = false;
+    m_currTrackId = 0;
+    m_level = -1;
+    gImagesAreTiled = false;
+    gNumTilesPerImage = 0;
+    gPanoChunkOffset = 0;
+    gPanoSampleSize = 0;
+    m_horizontalCyl = true;
     m_type = PANO_UNKNOWN;
     m_cmovZLib = false;
+    m_map = 0;
+    m_main.data = m_cmov.data = 0;
+    m_main.size = m_cmov.size = 0;
+    m_main.pos = m_cmov.pos = 0;
+    gFile = &m_main;
 
     // determine byteorder
     int testint = 0x01;
@@ -316,96 +291,115 @@ QTVRDecoder::QTVRDecoder()
 
 QTVRDecoder::~QTVRDecoder()
 {
-    if(gFile) {
-        fclose(gFile);
+    if(m_map) {
+        m_file.unmap(m_map);
     }
 }
 
 bool QTVRDecoder::parseHeaders(const char * theDataFilePath)
 {
     bool ok = true;
-    int32 atomSize;
-    gFile = fopen (theDataFilePath, "rb");
+    qint64 atomSize;
 
-    if  (!gFile)
+    m_file.setFileName( QString::fromUtf8( theDataFilePath ) );
+    if  (!m_file.open( QIODevice::ReadOnly ))
     {
-        m_error = "fopen() failed";
+        m_error = "open failed";
         return false;
     }
 
-    m_mainFile = gFile;
+    // view the whole file in memory; all reads below, including
+    // the JPEG decoders, work on slices of this view
+    m_main.size = m_file.size();
+    m_main.pos = 0;
+    m_map = m_file.map( 0, m_main.size );
+    if (m_map) {
+        m_main.data = m_map;
+    } else {
+        // can't map (e.g. address space) so read it in
+        m_fileData = m_file.readAll();
+        if (m_fileData.size() != m_main.size) {
+            m_error = "read failed";
+            return false;
+        }
+        m_main.data = (const uchar *)m_fileData.constData();
+    }
 
-    // get file size for EOF test
-    size_t filepos = ftell( gFile );
-    fseek( gFile, 0, SEEK_END );
-    size_t filesize = ftell( gFile );
-    fseek( gFile, filepos, SEEK_SET );
+    gFile = &m_main;
 
     // Recurse through atoms
     m_error = 0;
     do	{
         atomSize = ReadMovieAtom();
-    } while(atomSize > 0 && ftell( gFile ) < filesize );
+    } while(atomSize > 0 && tellData() < gFile->size );
 
     if (m_error != 0) {
         return false;
     }
 
+    // list the image tracks and select the best one
+    buildLevels();
+    if (m_levels.empty()) {
+        m_error = "no usable image track";
+        return false;
+    }
+
     //gMyInstances[instanceNum].drawDecodingBar = false;
 
     return(ok);
 }
 
-long QTVRDecoder::ReadQTMovieAtom(void)
+qint64 QTVRDecoder::ReadQTMovieAtom(void)
 {
-    int32   atomSize, atomType,  remainingSize;
+    int32   size32, atomType;
+    qint64  atomSize, remainingSize;
     int16   childCount;
-    size_t  filePos;
+    qint64  filePos;
     //char    *c = (char *)&atomType;
     //OSErr iErr;
 
-    filePos = ftell(gFile);
+    filePos = tellData();
 
     // read atom size
-    size_t sz = fread(&atomSize, 1, 4, gFile);
-    if (ferror(gFile) || sz != 4)
+    size_t sz = readData(&size32, 4);
+    if (sz != 4)
     {
-        m_error = "ReadQTMovieAtom:  fread() failed!";
+        m_error = "ReadQTMovieAtom:  read failed!";
         return(-1);
     }
 
     // read the atom type
-    sz = fread(&atomType, 1, 4, gFile);
-    if (ferror(gFile) || sz != 4)
+    sz = readData(&atomType, 4);
+    if (sz != 4)
     {
-        m_error = "ReadQTMovieAtom:  fread() failed!";
+        m_error = "ReadQTMovieAtom:  read failed!";
         return(-1);
     }
 
     // skip id and reserved
-    fseek(gFile, 6, SEEK_CUR);
+    skipData(6);
 
-    sz = fread(&childCount, 1, 2, gFile);
-    if (ferror(gFile) || sz != 2)
+    sz = readData(&childCount, 2);
+    if (sz != 2)
     {
-        m_error = "ReadQTMovieAtom:  fread() failed!";
+        m_error = "ReadQTMovieAtom:  read failed!";
         return(-1);
     }
 
     // skip reserved
-    fseek(gFile, 4, SEEK_CUR);
+    skipData(4);
 
     // convert BigEndian data to LittleEndian
-    Swizzle(&atomSize);
+    Swizzle(&size32);
     Swizzle(&atomType);
     Swizzle(&childCount);
+    atomSize = (uint32)size32;
 
-    // read extended data if needed
-
-    // if atom size == 1 then there's extended data in the header
-    if (atomSize == 1)
+    // QT atoms have a fixed 20 byte header, with no room for an
+    // extended size; they only live in the small 'pano' sample.
+    if (atomSize != 0 && atomSize < 20)
     {
-        m_error = "ReadQTMovieAtom: Extended size isn't supported";
+        m_error = "ReadQTMovieAtom: bad atom size";
         return(-1);
     }
 
@@ -422,14 +416,12 @@ long QTVRDecoder::ReadQTMovieAtom(void)
         // there are n bytes left in this atom to parse
         remainingSize = atomSize - 20 ;
 
-/*
-        do
-        {
-            remainingSize -= ReadMovieAtom();           // read atom and dec by its size
-        } while(remainingSize > 0);
-*/
-        for (int i=0; i < childCount; i++) {
-            remainingSize -= ReadQTMovieAtom();
+        for (int i=0; i < childCount && remainingSize > 0; i++) {
+            qint64 childSize = ReadQTMovieAtom();
+            if (childSize <= 0) {
+                break;
+            }
+            remainingSize -= childSize;
         }
 
         break;
@@ -453,55 +445,85 @@ long QTVRDecoder::ReadQTMovieAtom(void)
     {
         return(-1);
     } else {
-        int r = fseek(gFile, (long)filePos + atomSize, SEEK_SET);
-        //if (ferror(gFile) || r != 0)
-        //printf("ReadQTMovieAtom: fseek() failed, probably EOF?\n");
+        int r = seekData(filePos + atomSize);
+        //if (r != 0)
+        //printf("ReadQTMovieAtom: seek failed, probably EOF?\n");
     }
 
     return(atomSize);
 }
 
 /********************* READ MOVIE ATOM ************************/
-// INPUT:  parentAtomSize = size of the enclosing atom (or -1 if root).
-// This is used to determine when we've read all the child atoms from
-// the enclosing parent that we sub-recursed.
-// OUTPUT:	size of the atom
-long QTVRDecoder::ReadMovieAtom(void)
+// Reads the atom at the current position, recursing into the
+// container atoms we care about, and leaves the position at the
+// next atom.
+// OUTPUT:	size of the atom, including its header, or -1 at the end
+qint64 QTVRDecoder::ReadMovieAtom(void)
 {
-    int32	atomSize, atomType,  remainingSize;
-    size_t	filePos;
+    int32	size32, atomType;
+    qint64	atomSize, payloadSize;
+    qint64	filePos;
     //char	*c = (char *)&atomType;
     //OSErr	iErr;
 
-    filePos = ftell(gFile);
+    filePos = tellData();
 
     // read atom size
-    size_t sz = fread(&atomSize, 1, 4, gFile);
-    if (ferror(gFile) || sz != 4)
+    size_t sz = readData(&size32, 4);
+    if (sz != 4)
     {
-        m_error = "ReadMovieAtom:  fread() failed!";
+        m_error = "ReadMovieAtom:  read failed!";
         return(-1);
     }
 
     // read atom type
-    sz = fread(&atomType, 1, 4, gFile);
-    if (ferror(gFile) || sz != 4) {
-        m_error = "ReadMovieAtom:  fread() failed!";
+    sz = readData(&atomType, 4);
+    if (sz != 4) {
+        m_error = "ReadMovieAtom:  read failed!";
         return(-1);
     }
 
     // convert BigEndian data to LittleEndian
-    Swizzle(&atomSize);
+    Swizzle(&size32);
     Swizzle(&atomType);
+    atomSize = (uint32)size32;
 
     // read extended data
-    // if atom size == 1 then there's extended data in the header
+    // if atom size == 1 then a 64 bit size follows the type
     if (atomSize == 1)
     {
-        m_error = "ReadMovieAtom: Extended size isn't supported";
+        sz = readData(&atomSize, 8);
+        if (sz != 8)
+        {
+            m_error = "ReadMovieAtom:  read failed!";
+            return(-1);
+        }
+        Swizzle(&atomSize);
+        if (atomSize < 16)
+        {
+            m_error = "ReadMovieAtom:  bad extended atom size";
+            return(-1);
+        }
+    }
+    // size 0 means the atom runs to the end of the file
+    else if (atomSize == 0)
+    {
+        atomSize = gFile->size - filePos;
+    }
+    else if (atomSize < 8)
+    {
+        m_error = "ReadMovieAtom:  bad atom size";
         return(-1);
     }
 
+    // a truncated file: parse what we have
+    if (atomSize > gFile->size - filePos)
+    {
+        atomSize = gFile->size - filePos;
+    }
+
+    payloadSize = atomSize - (tellData() - filePos);
+
     /********************/
     /* HANDLE THIS ATOM */
     /********************/
@@ -511,89 +533,49 @@ long QTVRDecoder::ReadMovieAtom(void)
     // MOOV
     // This contains more sub-atoms, so just recurse
     case 'moov':
-        // there are n bytes left in this atom to parse
-        remainingSize = atomSize - 8;
-        do
-        {
-            // read atom and dec by its size
-            remainingSize -= ReadMovieAtom();
-        }
-        while(remainingSize > 0);
+        ReadChildAtoms(payloadSize);
         break;
     // CMOV
     // This contains more sub-atoms, so just recurse
     case    'cmov':
         //printf("  [Subrecursing 'cmov' atom]\n");
-
-        // there are n bytes left in this atom to parse
-        remainingSize = atomSize - 8;
-        do
-        {
-            // read atom and dec by its size
-            remainingSize -= ReadMovieAtom();
-        }
-
-        while(remainingSize > 0);
-
+        ReadChildAtoms(payloadSize);
         //printf("  [End subrecurse 'cmov' atom]\n");
-
         break;
     case 'dcom':
-        ReadAtom_DCOM(atomSize-8);
+        ReadAtom_DCOM(payloadSize);
         break;
     case 'cmvd':
-        ReadAtom_CMVD(atomSize-8);
+        ReadAtom_CMVD(payloadSize);
         break;
     // trak
     case 'trak':
         //printf("  [Subrecursing 'trak' atom]\n");
 
         // reset per track information
-        m_currTrackIsImageTrack = false;
+        m_currTrackId = 0;
         gCurrentTrackMedia = 0;
 
-        // there are n bytes left in this atom to parse
-        remainingSize = atomSize - 8;
-        do
-        {
-            // read atom and dec by its size
-            remainingSize -= ReadMovieAtom();
-        }
-        while(remainingSize > 0);
+        ReadChildAtoms(payloadSize);
 
         //printf("  [End subrecurse 'trak' atom]\n");
         break;
     case 'tkhd':
-        ReadAtom_TKHD(atomSize-8);
+        ReadAtom_TKHD(payloadSize);
         break;
     case 'tref':
-        ReadAtom_TREF(atomSize-8);
+        ReadAtom_TREF(payloadSize);
         break;
 
     case 'mdia':
         //printf("  [Subrecursing 'mdia' atom]\n");
-
-        remainingSize = atomSize - 8;
-        do
-        {
-            remainingSize -= ReadMovieAtom();
-        }
-        while(remainingSize > 0);
+        ReadChildAtoms(payloadSize);
         //printf("  [End subrecurse 'mdia' atom]\n");
         break;
     case 'minf':
-
         //printf("  [Subrecursing 'minf' atom]\n");
-
-        remainingSize = atomSize - 8;
-        do
-        {
-            remainingSize -= ReadMovieAtom();
-        }
-        while(remainingSize > 0);
-
+        ReadChildAtoms(payloadSize);
         //printf("  [End subrecurse 'minf' atom]\n");
-
         break;
     //DataInfoAID
     case 'dinf':
@@ -604,53 +586,55 @@ long QTVRDecoder::ReadMovieAtom(void)
     //SampleTableAID
     case 'stbl':
         //printf("  [Subrecursing 'stbl' atom]\n");
-        remainingSize = atomSize - 8;					// there are n bytes left in this atom to parse
-
-        do
-        {
-            remainingSize -= ReadMovieAtom();			// read atom and dec by its size
-        }
-        while(remainingSize > 0);
-
+        ReadChildAtoms(payloadSize);
         //printf("  [End subrecurse 'stbl' atom]\n");
         break;
-    // STChunkOffsetAID
+    // STChunkOffsetAID, 32 and 64 bit
     case 'stco':
-        ReadAtom_STCO(atomSize);
+        ReadAtom_STCO(payloadSize, false);
+        break;
+    case 'co64':
+        ReadAtom_STCO(payloadSize, true);
         break;
     //STSampleSizeAID
     case 'stsz':
-        ReadAtom_STSZ(atomSize);
+        ReadAtom_STSZ(payloadSize);
         break;
     case 'stsc':
-        ReadAtom_STSC(atomSize);
+        ReadAtom_STSC(payloadSize);
         break;
     // HandlerAID
     case 'hdlr':
-        ReadAtom_HDLR(atomSize);
+        ReadAtom_HDLR(payloadSize);
         break;
     }
 
     //if (iErr != noErr)
     //	return(-1);
 
-    // if last atom size was 0 then that was the end
-    if (atomSize == 0)
-    {
-        return(-1);
-    }
-    else
-    {
-        // set fpos to next atom
-        fseek(gFile, (long)filePos + atomSize, SEEK_SET);
-        //if (ferror(gFile))
-        //printf("ReadMovieAtom: fseek() failed, probably EOF?\n");
-    }
+    // set fpos to next atom
+    seekData(filePos + atomSize);
+    //if (r != 0)
+    //printf("ReadMovieAtom: seek failed, probably EOF?\n");
 
     return(atomSize);
 }
 
-void QTVRDecoder::ReadAtom_DCOM(long size)
+// read the sub-atoms filling size bytes of a container atom
+void QTVRDecoder::ReadChildAtoms(qint64 size)
+{
+    while (size > 0)
+    {
+        // read atom and dec by its size
+        qint64 atomSize = ReadMovieAtom();
+        if (atomSize <= 0) {
+            break;
+        }
+        size -= atomSize;
+    }
+}
+
+void QTVRDecoder::ReadAtom_DCOM(qint64 size)
 {
     char comp[5];
     comp[4] = 0;
@@ -659,10 +643,10 @@ void QTVRDecoder::ReadAtom_DCOM(long size)
     //PublicHandlerInfo *info;
     //int32 componentSubType;
 
-    size_t sz = fread(&comp,1 , 4, gFile);
-    if (ferror(gFile) || sz != 4)
+    size_t sz = readData(&comp, 4);
+    if (sz != 4)
     {
-        m_error = "ReadAtom_DCOM:  fread() failed!\n";
+        m_error = "ReadAtom_DCOM:  read failed!\n";
         return;
     }
 
@@ -676,326 +660,319 @@ void QTVRDecoder::ReadAtom_DCOM(long size)
 
 /********************** READ ATOM:  CMVD****************************/
 
-void QTVRDecoder::ReadAtom_CMVD(long size)
+void QTVRDecoder::ReadAtom_CMVD(qint64 size)
 {
     int32 uncomp_size;
 
-    size_t sz = fread(&uncomp_size,1 , 4, gFile);
-    if (ferror(gFile) || sz != 4)
+    size_t sz = readData(&uncomp_size, 4);
+    if (sz != 4)
     {
-        m_error = "ReadAtom_CMVD:  fread() failed!\n";
+        m_error = "ReadAtom_CMVD:  read failed!\n";
         return;
     }
     size -= (int)sz;
+    Swizzle(&uncomp_size);
 
     if (m_cmovZLib) {
-        // decompress compressed header
-        // create temporary file
-        FILE * decomp = tmpfile();
-        if (! decomp) {
-            // error
-            m_error = "Could not open temporary file for header decompression";
+        // decompress compressed header straight into memory
+        if (size <= 0 || size > gFile->size - gFile->pos) {
+            m_error = "ReadAtom_CMVD:  bad atom size";
             return;
         }
-
-        if (decompressZLIBFile(gFile, decomp) != Z_OK) {
+        if (uncomp_size <= 0 || uncomp_size > CMVD_MAX_SIZE
+            || uncomp_size / ZLIB_MAX_RATIO > size) {
+            m_error = "ReadAtom_CMVD:  bad uncompressed size";
+            return;
+        }
+        if (decompressZLIBBuffer(gFile->data + gFile->pos, size,
+                                 m_cmovData, uncomp_size) != Z_OK) {
             m_error = "zlib decompression failed";
-            fclose(decomp);
             return;
         }
 
         // restart parser on now decompressed header.
-        fseek(decomp,0,SEEK_SET);
-        m_mainFile = gFile;
-        m_cmovFile = decomp;
+        m_cmov.data = (const uchar *)m_cmovData.constData();
+        m_cmov.size = m_cmovData.size();
+        m_cmov.pos = 0;
 
-        gFile = m_cmovFile;
+        gFile = &m_cmov;
 
         // recurse through atoms
-        int atomSize;
+        qint64 atomSize;
         do
         {
             atomSize = ReadMovieAtom();
-        }while(atomSize > 0);
+        }while(atomSize > 0 && tellData() < gFile->size);
 
         // switch back to main file
-        gFile = m_mainFile;
+        gFile = &m_main;
 
-        // close header file
-        fclose(m_cmovFile);
+        // the sample tables have been copied out, so the
+        // header can go
+        m_cmovData = QByteArray();
+        m_cmov.data = 0;
+        m_cmov.size = 0;
     }
 }
 
-void QTVRDecoder::ReadAtom_STCO(long size)
+/*
+ * Read a table of count big-endian entries of 4 or 8 bytes
+   from the current atom, which has size bytes left.  Entries are
+   read one by one off the cursor, so the table can be as big as
+   the atom.  Returns false if the atom is too small or short.
+*/
+bool QTVRDecoder::readTable(std::vector<qint64> & table, qint64 count,
+                            int bytes, qint64 size)
 {
-    //int32 count;
-    int i;
-    ChunkOffsetAtom	*atom;
-    int numEntries;
+    table.clear();
+    if (count < 0 || count > size / bytes)
+    {
+        return false;
+    }
+    table.resize(size_t(count));
+    for (size_t i = 0; i < table.size(); i++)
+    {
+        if (bytes == 8) {
+            qint64 v;
+            if (readData(&v, 8) != 8) {
+                return false;
+            }
+            Swizzle(&v);
+            table[i] = v;
+        } else {
+            uint32 v;
+            if (readData(&v, 4) != 4) {
+                return false;
+            }
+            Swizzle(&v);
+            table[i] = v;
+        }
+    }
+    return true;
+}
 
-    fseek(gFile, -8, SEEK_CUR);
+// 'stco' has 32 bit chunk offsets, 'co64' 64 bit ones
+void QTVRDecoder::ReadAtom_STCO(qint64 size, bool co64)
+{
+    int32 numEntries;
+    std::vector<qint64> chunkOffsets;
 
-    // allocate memore for it
-    // This is a variable size structure, so we need to allocated based on the size of the atom that's passed in
-    atom = (ChunkOffsetAtom *) malloc(size);
-    if (atom == NULL)
+    // skip version and flags
+    if (skipData(4) != 0 || readData(&numEntries, 4) != 4)
     {
-        m_error = "ReadAtom_STCO:  malloc() failed!";
+        m_error = "ReadAtom_STCO:  read failed!";
         return;
     }
+    size -= 8;
 
-    // read the atom
-    fread(atom, size, 1, gFile);
-    if (ferror(gFile))
+    // convert BigEndian data to LittleEndian (if not Mac)
+    Swizzle(&numEntries);
+
+    // only the pano track and the video tracks matter
+    if (gCurrentTrackMedia != 'pano'
+        && !(gCurrentTrackMedia == 'vide' && !m_tracks.empty()))
     {
-        m_error = "ReadAtom_STCO:  fread() failed!";
-        free(atom);
         return;
     }
 
+    if (!readTable(chunkOffsets, (uint32)numEntries, co64 ? 8 : 4, size)
+        || chunkOffsets.empty())
+    {
+        m_error = "ReadAtom_STCO:  bad chunk offset table";
+        return;
+    }
 
-    // see what kind of track we've parsed into and get chunks based on taht
-    numEntries = atom->numEntries;
-
-    // convert BigEndian data to LittleEndian (if not Mac)
-    Swizzle(&numEntries);
-
+    // see what kind of track we've parsed into and get chunks based on that
     switch(gCurrentTrackMedia)
     {
     case 'pano':
     {
-        gPanoChunkOffset = atom->chunkOffsetTable[0];
-        Swizzle(&gPanoChunkOffset);
+        gPanoChunkOffset = chunkOffsets[0];
         //printf("        Chunk offset to 'pano' is : %d\n", gPanoChunkOffset);
         // TODO: parse the pano info atom here!
-        long fpos_saved = ftell(gFile);
+        qint64 fpos_saved = tellData();
 
-        bool switchChunk = (m_cmovFile == gFile);
+        bool switchChunk = (gFile == &m_cmov);
         // the pano chunk is always stored in the main file..
         if (switchChunk) {
-            gFile = m_mainFile;
+            gFile = &m_main;
         }
 
         // seek to panorama description. skip first 12 bytes
         // of new QT atom.
-        fseek(gFile, gPanoChunkOffset + 12, SEEK_SET);
+        seekData(gPanoChunkOffset + 12);
 
         //printf("  [Subrecursing pano 'stco' atom]\n");
 
         // there are n bytes left in this atom to parse
-        size_t remainingSize = gPanoSampleSize-12;
+        qint64 remainingSize = gPanoSampleSize-12;
         do
         {
             // read atom and dec by its size
-            remainingSize -= ReadQTMovieAtom();
+            qint64 atomSize = ReadQTMovieAtom();
+            if (atomSize <= 0) {
+                break;
+            }
+            remainingSize -= atomSize;
         }
         while(remainingSize > 0);
         //printf("  [End subrecurse pano 'stco' atom]\n");
 
         // switch back to compressed file, if needed
         if (switchChunk) {
-            gFile = m_cmovFile;
+            gFile = &m_cmov;
         }
 
-        fseek(gFile, fpos_saved, SEEK_SET);
+        seekData(fpos_saved);
         // reset this now
         gCurrentTrackMedia = 0;
     }
         break;
     case 'vide':
-        // if this is the main track, extract the images
-        if (m_currTrackIsImageTrack)
+    {
+        // a video track: work out the offset of every sample,
+        // considering the sample to chunk atom
+        if (m_sample2ChunkTable.empty())
         {
-        // extract the offsets to the images
-#if 0
-            for (i = 0; i < numEntries; i++)
-            {
-                ////		printf("       # Chunk Offset entries: %d\n", numEntries);
-
-                for (i = 0; i < numEntries; i++)
-                {
-                    gVideoChunkOffset[i] = atom->chunkOffsetTable[i];
-                    Swizzle(&gVideoChunkOffset[i]);							// convert BigEndian data to LittleEndian (if not Mac)
-                    ////			printf("       Chunk offset #%d = %d\n", i, gVideoChunkOffset[i] );
-                }
-                gCurrentTrackMedia = 0;											// reset this now!
-                break;
-            }
-#endif
-            // consider the sample to chunk atom when writing the offsets
-            m_sample2ChunkTable[0];
-            int sampleTableId = 0;
-            int chunkId = 0;
-            int32 sampleOffset = atom->chunkOffsetTable[0];
-            Swizzle(&sampleOffset);
-            // count sample in current chunk
-            int samplesInChunk=0;
-            for (i=0; i < gNumTilesPerImage*6; i++) {
-                // check if we have reached the end of the current Chunk
-                if (m_sample2ChunkTable[sampleTableId].samplesPerChunk == samplesInChunk) {
-                    // we have reached a new chunk
-                    chunkId++;
-                    samplesInChunk = 0;
-                    if (sampleTableId < ((int)m_sample2ChunkTable.size())-1) {
-                        // check if we have reached a sample to chunk table entry
-                        if (chunkId+1 == m_sample2ChunkTable[sampleTableId+1].startChunk) {
-                            // advance to next entry in sample table
-                            sampleTableId++;
-                        }
-                    } else {
-                        // we are in the last entry of the sample to chunktable, no need to check for a new entry
+            m_error = "ReadAtom_STCO:  no sample to chunk table";
+            return;
+        }
+        QTVRTrack & track = m_tracks.back();
+        size_t numSamples = track.sampleSize.size();
+        track.sampleOffset.resize(numSamples);
+        size_t sampleTableId = 0;
+        size_t chunkId = 0;
+        qint64 sampleOffset = chunkOffsets[0];
+        // count sample in current chunk
+        int samplesInChunk=0;
+        for (size_t i=0; i < numSamples; i++) {
+            // check if we have reached the end of the current Chunk
+            if (m_sample2ChunkTable[sampleTableId].samplesPerChunk == samplesInChunk) {
+                // we have reached a new chunk
+                chunkId++;
+                samplesInChunk = 0;
+                if (sampleTableId < m_sample2ChunkTable.size()-1) {
+                    // check if we have reached a sample to chunk table entry
+                    if (qint64(chunkId)+1 == m_sample2ChunkTable[sampleTableId+1].startChunk) {
+                        // advance to next entry in sample table
+                        sampleTableId++;
                     }
-                    // update chunk offset
-                    sampleOffset = atom->chunkOffsetTable[chunkId];
-                    Swizzle(&sampleOffset);
+                } else {
+                    // we are in the last entry of the sample to chunktable, no need to check for a new entry
                 }
-                gVideoChunkOffset[i] = sampleOffset;
-                // advance to next sample
-                sampleOffset += gVideoSampleSize[i];
-                samplesInChunk++;
+                if (chunkId >= chunkOffsets.size()) {
+                    m_error = "ReadAtom_STCO:  more samples than chunks";
+                    return;
+                }
+                // update chunk offset
+                sampleOffset = chunkOffsets[chunkId];
             }
-            gCurrentTrackMedia = 0;
+            track.sampleOffset[i] = sampleOffset;
+            // advance to next sample
+            sampleOffset += track.sampleSize[i];
+            samplesInChunk++;
         }
+        gCurrentTrackMedia = 0;
+    }
+        break;
     }
-
-    //bail:
-    free(atom);
 }
 
-void QTVRDecoder::ReadAtom_STSZ(long size)
+void QTVRDecoder::ReadAtom_STSZ(qint64 size)
 {
-    //int32	count;
-    SampleSizeAtom *atom;
-    int32 numEntries, i;
+    int32 sampleSize, numEntries;
 
-    fseek(gFile, -8, SEEK_CUR);
-
-    // This is a variable size structure, so we need to allocated based on the size of the atom that's passed in
-    atom = (SampleSizeAtom *) malloc(size);
-    if (atom == NULL)
-    {
-        m_error = "ReadAtom_STSZ:  malloc() failed!";
-        return;
-    }
-
-    fread(atom, size, 1, gFile);
-    if (ferror(gFile))
+    // skip version and flags
+    if (skipData(4) != 0
+        || readData(&sampleSize, 4) != 4
+        || readData(&numEntries, 4) != 4)
     {
-        m_error = "ReadAtom_STSZ:  fread() failed!";
-        free(atom);
+        m_error = "ReadAtom_STSZ:  read failed!";
         return;
     }
+    size -= 12;
 
-    // see what kind of track we've parsed into and get chunks based on that
-    numEntries = atom->numEntries;
+    Swizzle(&sampleSize);
     Swizzle(&numEntries);
 
+    // see what kind of track we've parsed into and get chunks based on that
     switch(gCurrentTrackMedia)
     {
     case 'pano':
-        gPanoSampleSize = atom->sampleSize;
-        Swizzle(&gPanoSampleSize);
+        gPanoSampleSize = (uint32)sampleSize;
+        if (gPanoSampleSize == 0 && numEntries > 0) {
+            // sizes are in the table
+            uint32 first;
+            if (readData(&first, 4) == 4) {
+                Swizzle(&first);
+                gPanoSampleSize = first;
+            }
+        }
         //printf("        'pano' sample size = : %d\n", gPanoSampleSize);
         break;
     case'vide':
         //printf("       # Sample Size entries: %d\n", numEntries);
 
-        if (m_currTrackIsImageTrack)
+        // keep the sizes of every video track, any of them may
+        // be a resolution level; buildLevels() sorts them out
+        if (!m_tracks.empty())
         {
-            if (m_type == PANO_CUBIC) {
-                // there MUST be at least 6 jpegs or this isn't a cube
-                if (numEntries < 6)
-                {
-                    m_error="cubic panorama with less than 6 images";
-                    free(atom);
+            QTVRTrack & track = m_tracks.back();
+            qint64 count = (uint32)numEntries;
+
+            // a nonzero sample size means all samples are that
+            // size, and there is no table.
+            if (sampleSize != 0) {
+                // can't be more samples than bytes in the file
+                if (count > m_main.size) {
+                    m_error = "ReadAtom_STSZ:  bad sample count";
                     return;
                 }
-
-                gFoundJPEGs = true;
-
-
-                /* ARE THE IMAGES TILED? */
-                gNumTilesPerImage = numEntries / 6;
-
-                if (gNumTilesPerImage > 1)
-                {
-                    //printf("_____ There are more than 6 entires in the 'vide' track, so this QTVR has tiled images!\n");
-                    gImagesAreTiled = true;
-                    // are there too many tiles?
-                    if (numEntries > MAX_IMAGE_OFFSETS)
-                    {
-                        m_error = "Too many tiles!";
-                        free(atom);
-                        return;
-                    }
-                }
-                else
-                {
-                    gImagesAreTiled = false;
-                }
-            } else {
-                // cylindrical pano
-                gFoundJPEGs = true;
-                gNumTilesPerImage = numEntries;
-                if (gNumTilesPerImage > 1)
-                {
-                    //printf("_____ There are more than 1 entires in the 'vide' track, so this QTVR has a tiled image!\n");
-                    gImagesAreTiled = true;
-                    // are there too many tiles?
-                    if (numEntries > MAX_IMAGE_OFFSETS)
-                    {
-                        m_error = "Too many tiles!";
-                        free(atom);
-                        return;
-                    }
-                }
-                else
-                {
-                    gImagesAreTiled = false;
-                }
-            }
-            for (i = 0; i < numEntries; i++)
-            {
-                gVideoSampleSize[i] = atom->sampleSizeTable[i];
-                Swizzle(&gVideoSampleSize[i]);
-                //printf("       sample size %d = %d\n", i, gVideoSampleSize[i] );
+                track.sampleSize.assign(size_t(count), (uint32)sampleSize);
+            } else if (!readTable(track.sampleSize, count, 4, size)) {
+                m_error = "ReadAtom_STSZ:  bad sample size table";
+                return;
             }
-            break;
         }
+        break;
     }
-    free(atom);
 }
 
-void QTVRDecoder::ReadAtom_STSC(long size)
+void QTVRDecoder::ReadAtom_STSC(qint64 size)
 {
     int32 numEntries;
 
     // skip version and flags
-    size_t sz = fread(&numEntries,1 , 4, gFile);
-    if (ferror(gFile) || sz != 4)
+    size_t sz = readData(&numEntries, 4);
+    if (sz != 4)
     {
-        m_error = "ReadAtom_STSC:  fread() failed!";
+        m_error = "ReadAtom_STSC:  read failed!";
         return;
     }
 
     // read number of entries
-    sz = fread(&numEntries,1 , 4, gFile);
-    if (ferror(gFile) || sz != 4)
+    sz = readData(&numEntries, 4);
+    if (sz != 4)
     {
-        m_error = "ReadAtom_STSC:  fread() failed!";
+        m_error = "ReadAtom_STSC:  read failed!";
         return;
     }
     Swizzle(&numEntries);
+    if (numEntries < 0 || numEntries > (size - 8) / 12)
+    {
+        m_error = "ReadAtom_STSC:  bad sample to chunk table";
+        return;
+    }
 
     // discart old sample table
     m_sample2ChunkTable.clear();
     for(int i=0; i < numEntries; i++)
     {
         SampleToChunkEntry tmp;
-        sz = fread(&tmp,1 , 12, gFile);
-        if (ferror(gFile) || sz != 12)
+        sz = readData(&tmp, 12);
+        if (sz != 12)
         {
-            m_error = "ReadAtom_STSC:  fread() failed!";
+            m_error = "ReadAtom_STSC:  read failed!";
             return;
         }
         Swizzle(&tmp.startChunk);
@@ -1005,38 +982,19 @@ void QTVRDecoder::ReadAtom_STSC(long size)
     }
 }
 
-void QTVRDecoder::ReadAtom_HDLR(int size)
+void QTVRDecoder::ReadAtom_HDLR(qint64 size)
 {
-    //int32	count;
-    HandlerAtom	*atom;
-    PublicHandlerInfo *info;
     int32 componentSubType;
 
-    fseek(gFile, -8, SEEK_CUR);
-
-    // This is a variable size structure, so we need to allocated based on the size of the atom that's passed in
-    atom = (HandlerAtom *) malloc(size);
-    if (atom == NULL)
+    // skip version, flags and component type
+    if (skipData(8) != 0 || readData(&componentSubType, 4) != 4)
     {
-        m_error = "ReadAtom_HDLR:  malloc() failed!";
+        m_error = "ReadAtom_HDLR:  read failed!";
         return;
     }
 
-    fread(atom, size, 1, gFile);
-    if (ferror(gFile))
-    {
-        m_error = "ReadAtom_HDLR:  fread() failed!";
-        free(atom);
-        return;
-    }
-
-    // point to handler info
-    info = &atom->hInfo;
-
     // get comp sub type
-    componentSubType = info->componentSubType;
     Swizzle(&componentSubType);
-    char * t = (char*) & componentSubType;
 
     if (componentSubType == 'pano')
     {
@@ -1048,119 +1006,110 @@ void QTVRDecoder::ReadAtom_HDLR(int size)
         {
             gCurrentTrackMedia = 'vide';
             //printf("ReadAtom_HDLR:  We found a 'vide' media!\n");
-#if 0
-            //		if (!gAlreadyGotVideoMedia)					// if we already got the 'vide' then this one is just the fast-start track, so ignore it!
-            {
-                gCurrentTrackMedia = 'vide';
-                //			gAlreadyGotVideoMedia = true;
-            }
-            else
-            //printf("Found an additional 'vide' media track, but we're going to ignore it since it's probably the fast-start track...\n");
-#endif
+            QTVRTrack track;
+            track.id = m_currTrackId;
+            m_tracks.push_back(track);
         }
-
-    free(atom);
 }
 
-void QTVRDecoder::ReadAtom_TKHD(long size)
+void QTVRDecoder::ReadAtom_TKHD(qint64 size)
 {
     int32 trackid;
 
-    int ret = fseek(gFile, 12, SEEK_CUR);
+    int ret = skipData(12);
     if ( ret != 0 )
     {
-        m_error = "ReadAtom_TKHD:  fseek() failed!";
+        m_error = "ReadAtom_TKHD:  seek failed!";
         return;
     }
 
-    size_t sz = fread(&trackid,1 , 4, gFile);
-    if (ferror(gFile) || sz != 4)
+    size_t sz = readData(&trackid, 4);
+    if (sz != 4)
     {
-        m_error = "ReadAtom_TKHD:  fread() failed!";
+        m_error = "ReadAtom_TKHD:  read failed!";
         return;
     }
     Swizzle(&trackid);
 
-    if (trackid == m_mainTrack) {
-        // this is the main pano track.
-        m_currTrackIsImageTrack = true;
-    }
+    m_currTrackId = trackid;
 }
 
-void QTVRDecoder::ReadAtom_TREF(long size)
+void QTVRDecoder::ReadAtom_TREF(qint64 size)
 {
     int32 subsize;
     int32 type;
     int32 track;
-    //int32 count;
-    //HandlerAtom *atom;
-    //PublicHandlerInfo *info;
-    //int32 componentSubType;
 
     // loop until everything has been read
-    while(size) {
-        size_t sz = fread(&subsize,1 , 4, gFile);
-        if (ferror(gFile) || sz != 4)
+    while(size > 0) {
+        size_t sz = readData(&subsize, 4);
+        if (sz != 4)
         {
-            m_error = "ReadAtom_TREF:  fread() failed!";
+            m_error = "ReadAtom_TREF:  read failed!";
             return;
         }
         Swizzle(&subsize);
         subsize -=sz;
         size -= sz;
-        sz = fread(&type,1 , 4, gFile);
-        if (ferror(gFile) || sz != 4)
+        sz = readData(&type, 4);
+        if (sz != 4)
         {
-            m_error = "ReadAtom_TREF:  fread() failed!";
+            m_error = "ReadAtom_TREF:  read failed!";
             return;
         }
         Swizzle(&type);
         subsize -=sz;
         size -= sz;
+        if (subsize < 0 || subsize > size)
+        {
+            m_error = "ReadAtom_TREF:  bad reference size";
+            return;
+        }
 
-        //int nRefs = (size)/4;
-
-        // only store tracks of type imgt, since these provide the image tracks.
-        int i=0;
+        // tracks of type imgt provide the image tracks; any
+        // others (hot spots etc.) are not resolution levels.
+        std::vector<int32> & refs = (type == 'imgt') ? m_panoTracks
+                                                     : m_otherTracks;
         if (type == 'imgt') {
-            while(subsize) {
-                sz = fread(&track,1 , 4, gFile);
-                if (ferror(gFile) || sz != 4)
-                {
-                    m_error = "ReadAtom_TREF:  fread() failed!";
-                    return;
-                }
-                subsize -= sz;
-                size -= sz;
-                Swizzle(&track);
-                if (i < MAX_REF_TRACKS)
-                    m_panoTracks[i++] = track;
-                else {
-                    m_error = "Too many reference tracks!";
-                }
-            }
-        } else {
-            // seek to next atom
-            int ret = fseek(gFile, subsize, SEEK_CUR);
-            if (ret != 0)
+            m_panoTracks.clear();
+        }
+        while(subsize >= 4) {
+            sz = readData(&track, 4);
+            if (sz != 4)
             {
-                m_error = "ReadAtom_TREF:  fread() failed!";
+                m_error = "ReadAtom_TREF:  read failed!";
                 return;
             }
-            size -= sz;
             subsize -= sz;
+            size -= sz;
+            Swizzle(&track);
+            refs.push_back(track);
         }
+        // seek to next atom
+        int ret = skipData(subsize);
+        if (ret != 0)
+        {
+            m_error = "ReadAtom_TREF:  read failed!";
+            return;
+        }
+        size -= subsize;
     }
 }
 
-void QTVRDecoder::ReadAtom_QTVR_PDAT(long size)
+void QTVRDecoder::ReadAtom_QTVR_PDAT(qint64 size)
 {
     //int32 count;
     VRPanoSampleAtom *atom;
     //int32 numEntries, i;
 
     // This is a variable size structure, so we need to allocated based on the size of the atom that's passed in
-    atom = (VRPanoSampleAtom *) malloc(size);
+    // (but never less than the fields we look at)
+    if (size < 0 || size > gFile->size - gFile->pos)
+    {
+        m_error = "ReadAtom_PDAT:  bad atom size";
+        return;
+    }
+    atom = (VRPanoSampleAtom *) calloc(1, qMax(size_t(size), sizeof(VRPanoSampleAtom)));
     if (atom == NULL)
     {
         m_error = "ReadAtom_QTVR_PDAT:  malloc() failed!";
@@ -1169,10 +1118,10 @@ void QTVRDecoder::ReadAtom_QTVR_PDAT(long size)
 
     /* READ IT */
 
-    size_t sz = fread(atom, size, 1, gFile);
-    if (ferror(gFile) || sz != 1)
+    size_t sz = readData(atom, size);
+    if (sz != (size_t)size)
     {
-        m_error = "ReadAtom_PDAT:  fread() failed!";
+        m_error = "ReadAtom_PDAT:  read failed!";
         free(atom);
         return;
     }
@@ -1203,12 +1152,18 @@ void QTVRDecoder::ReadAtom_QTVR_PDAT(long size)
     // get the track number of the real pano
     m_imageRefTrackIndex = atom->imageRefTrackIndex;
     Swizzle(&m_imageRefTrackIndex);
+    if (m_imageRefTrackIndex < 1
+        || m_imageRefTrackIndex > (int32)m_panoTracks.size()) {
+        m_error = "ReadAtom_PDAT:  bad image track reference";
+        free(atom);
+        return;
+    }
     m_mainTrack = m_panoTracks[m_imageRefTrackIndex -1];
 
     free(atom);
 }
 
-void QTVRDecoder::ReadAtom_QTVR_TREF(long size)
+void QTVRDecoder::ReadAtom_QTVR_TREF(qint64 size)
 {
     QTVRTrackRefEntry atom;
 
@@ -1216,9 +1171,9 @@ void QTVRDecoder::ReadAtom_QTVR_TREF(long size)
 
     for (int i=0; i < n; i++)
     {
-        fread(&(atom.trackRefType), 1,4, gFile);
-        fread(&atom.trackResolution, 1,2, gFile);
-        fread(&atom.trackRefIndex, 1,4, gFile);
+        readData(&(atom.trackRefType), 4);
+        readData(&atom.trackResolution, 2);
+        readData(&atom.trackRefIndex, 4);
         Swizzle(&(atom.trackRefType));
         Swizzle(&(atom.trackResolution));
         Swizzle(&(atom.trackRefIndex));
@@ -1229,220 +1184,258 @@ void QTVRDecoder::ReadAtom_QTVR_TREF(long size)
 
 // seek and extract images
 // get the image for cube face iim
-bool QTVRDecoder::extractCubeImage(int iim, QImage * &cubeface)
+bool QTVRDecoder::extractCubeImage(int iim, QImage &cubeface)
 {
     if (m_type != PANO_CUBIC) {
         m_error = "not a cubic panorama";
         return false;
     }
 
-    // see if we need to special-case tiled images
-    if (gImagesAreTiled)
-    {
-        return SeekAndExtractImage_Tiled(iim, cubeface);
-    }
-
     if (!gFoundJPEGs)
     {
         m_error = "Missing cubic images";
         return false;
     }
 
-    int i = iim;
-    // seek to the JPEG's data
-    fseek(gFile, gVideoChunkOffset[i], SEEK_SET);
-
-    cubeface = new QImage;
-    if (!decodeJPEG(gFile, *cubeface)) {
-        m_error = "JPEG decoding failed";
-        delete cubeface;
-        cubeface = 0;
-        return false;
-    }
-
-    return true;
+    return assembleImages(iim, 1, &cubeface);
 }
 
 // Seek and extract the image from a cylindrical pano
-bool QTVRDecoder::extractCylImage(QImage * &img)
+bool QTVRDecoder::extractCylImage(QImage &img)
 {
     if (m_type != PANO_CYLINDRICAL) {
         m_error = "not a cylindrical panorama";
         return false;
     }
 
-    if (gImagesAreTiled)
-    {
-        return SeekAndExtractImageCyl_Tiled(img);
-    }
-
     if (!gFoundJPEGs)
     {
         m_error = "No usable JPEG image found";
         return false;
     }
 
-    // seek to the JPEG's data
-    fseek(gFile, gVideoChunkOffset[0], SEEK_SET);
+    // rotated 90 CW, if required
+    return assembleImages(0, 1, &img);
+}
 
-    img = new QImage;
-    // decode jpeg, and rotate 90 CW, if required
-    if (!decodeJPEG( gFile, *img, (!m_horizontalCyl))) {
-        m_error = "JPEG decoding failed";
-        delete img;
-        img = 0;
-        return false;
+// copy a decoded tile into its slot in a bigger image
+static void copyTile( const QImage & tile, uchar * dst, int bpl )
+{
+    int n = tile.width() * tile.depth() / 8;
+    for (int y = 0; y < tile.height(); y++)
+    {
+        memcpy(dst, tile.constScanLine(y), n);
+        dst += bpl;
     }
-
-    return true;
 }
 
-// seek and extract images: tiled
-bool QTVRDecoder::SeekAndExtractImage_Tiled(int i, QImage * &cubeface)
+/*
+ * Decode JPEG sample i into a tile sized slot of a bigger image.
+   dst is the top left pixel of the slot and bpl is the line size
+   of the image.  Unless the tile has to be rotated, the decoder
+   writes straight into the slot.  If it won't (it picked another
+   size or pixel format) the tile is checked and copied in.
+   Returns 0 or an error message.
+   Safe to run on several threads at once for different slots.
+*/
+const char * QTVRDecoder::decodeTile( int i, uchar * dst, int bpl,
+                                      QSize size, QImage::Format fmt,
+                                      bool rot90 )
 {
-    int tileDimensions; //, compSize;
-    int faceSize;
+    QImage tile;
+    if (!rot90) {
+        // a view of the slot, not shared, so the decoder won't detach it
+        tile = QImage(dst, size.width(), size.height(), bpl, fmt);
+    }
 
-    //// TKS: this is really cheesy
-    tileDimensions = (int) sqrt((float)gNumTilesPerImage);
+    if (!decodeSample(i, tile, rot90)) {
+        return "JPEG decoding failed";
+    }
+    if (tile.size() != size || tile.format() != fmt) {
+        return "tiles of different sizes";
+    }
+    if (tile.constBits() != dst) {
+        copyTile(tile, dst, bpl);
+    }
+    return 0;
+}
 
-    int chunkNum = i * gNumTilesPerImage;
+/* decodes one tile on a pool thread */
+class QTVRTileJob : public QRunnable
+{
+public:
+    QTVRTileJob( QTVRDecoder * dec, int sample, uchar * dst, int bpl,
+                 QSize size, QImage::Format fmt, bool rot90,
+                 const char ** err )
+        : m_dec(dec), m_sample(sample), m_dst(dst), m_bpl(bpl),
+          m_size(size), m_fmt(fmt), m_rot90(rot90), m_err(err)
+    {}
+    void run()
+    {
+        *m_err = m_dec->decodeTile(m_sample, m_dst, m_bpl,
+                                   m_size, m_fmt, m_rot90);
+    }
+private:
+    QTVRDecoder * m_dec;
+    int m_sample;
+    uchar * m_dst;
+    int m_bpl;
+    QSize m_size;
+    QImage::Format m_fmt;
+    bool m_rot90;
+    const char ** m_err;
+};
 
-    // init tile assembly
-    cubeface = 0;
-    int tileSize = 0;
+/*
+ * Decode and assemble images first .. first+count-1 (cube faces,
+   or the single cylinder image) into pims[].
+   The first tile is decoded here to get the tile size and pixel
+   format.  Then the images are allocated, and all the other tiles
+   are decoded into place by a pool of threads, one per core.
+   Untiled images are treated as having one tile, so the faces of
+   an untiled cube still get decoded in parallel.
+   On failure sets m_error and returns false with pims[] all null.
+*/
+bool QTVRDecoder::assembleImages( int first, int count, QImage * pims )
+{
+    int ntiles = gImagesAreTiled ? gNumTilesPerImage : 1;
+    bool cube = (m_type == PANO_CUBIC);
+    bool rot90 = !cube && !m_horizontalCyl;
 
-    // load and assemble tiles.
-    for (int t = 0; t < gNumTilesPerImage; t++)
-    {
-        int cChunk = chunkNum + t;
-        fseek(gFile, gVideoChunkOffset[cChunk], SEEK_SET);
-        if (ferror(gFile))
-        {
-            m_error = "LoadTilesForFace:  fseek failed!";
-            return false;
-        }
-        QImage img;
-        // decode jpg
-        if (!decodeJPEG(gFile, img))
-        {
-            m_error = "JPEG decoding failed";
+    for (int k = 0; k < count; k++) {
+        pims[k] = QImage();
+    }
+
+    // cube faces are square arrays of tiles, cylinders a single row
+    int cols = ntiles, rows = 1;
+    if (cube) {
+        cols = rows = qRound(sqrt(double(ntiles)));
+        if (cols * rows != ntiles) {
+            m_error = "tiles don't make a square face";
             return false;
         }
+    }
 
-        if (tileSize == 0) {
-            // size cube face and create image
-            tileSize = img.size().width();
-            faceSize = tileSize * tileDimensions;
-            cubeface = new QImage(faceSize, faceSize, img.format());
-        }
+    QImage tile;
+    int sample0 = first * ntiles;
+    if (!decodeSample(sample0, tile, rot90)) {
+        m_error = "JPEG decoding failed";
+        return false;
+    }
+    QSize ts = tile.size();
+    QImage::Format fmt = tile.format();
+    if (cube && ts.width() != ts.height()) {
+        m_error = "non square tile";
+        return false;
+    }
 
-        if (img.size().height() != img.size().width()) {
-            m_error = "non square tile";
+    for (int k = 0; k < count; k++) {
+        pims[k] = QImage(cols * ts.width(), rows * ts.height(), fmt);
+        if (pims[k].isNull()) {
+            m_error = "not enough memory for image";
+            for (int j = 0; j < k; j++) {
+                pims[j] = QImage();
+            }
             return false;
         }
+        pims[k].setColorTable(tile.colorTable());
+    }
 
-        if (img.size().width() != tileSize) {
-            m_error = "tiles of different sizes";
-            return false;
+    std::vector<const char *> errs(count * ntiles, (const char *)0);
+    int bpp = tile.depth() / 8;
+    QThreadPool pool;
+
+    for (int k = 0; k < count; k++) {
+        uchar * base = pims[k].bits();
+        int bpl = pims[k].bytesPerLine();
+        for (int t = 0; t < ntiles; t++) {
+            // tile indices
+            int h = t % cols;
+            int v = t / cols;
+            // vertical cylinders are stored right-to-left
+            if (rot90) {
+                h = cols - 1 - t;
+            }
+            uchar * dst = base
+                    + bpl * ts.height() * v     // row
+                    + bpp * ts.width() * h;     // col
+
+            int sample = (first + k) * ntiles + t;
+            if (sample == sample0) {
+                copyTile(tile, dst, bpl);
+            } else {
+                pool.start(new QTVRTileJob(this, sample, dst, bpl,
+                                           ts, fmt, rot90,
+                                           &errs[k * ntiles + t]));
+            }
         }
+    }
+    pool.waitForDone();
 
-        // copy to cube face
-        // for QImage must use row strides...
-        int tilerowsize = img.bytesPerLine();
-        int facerowsize = cubeface->bytesPerLine();
-        // (and let's use the actual pixel size too)
-        int bpp = facerowsize / faceSize;
-        // tile indices
-        int h = t % tileDimensions;
-        int v = t / tileDimensions;
-        // byte addrs (incl alignment)
-        unsigned char * srcPtr = img.bits();
-        unsigned char * destPtr = cubeface->bits()			// raster
-                + facerowsize * tileSize * v	// row
-                + bpp * tileSize * h;			// col
-
-        // loop over rows
-        for (int y=0; y< tileSize; y++)
-        {
-            memcpy(destPtr, srcPtr, bpp*tileSize);
-            destPtr += facerowsize;
-            srcPtr += tilerowsize;
+    for (size_t j = 0; j < errs.size(); j++) {
+        if (errs[j]) {
+            m_error = errs[j];
+            for (int k = 0; k < count; k++) {
+                pims[k] = QImage();
+            }
+            return false;
         }
     }
 
     return true;
 }
 
-bool QTVRDecoder::SeekAndExtractImageCyl_Tiled(QImage * &image)
+/*
+ * Decode JPEG sample i straight from the mapped file.
+ * Only reads the mapping, so it is safe to call for
+ * different samples at the same time.
+ */
+bool QTVRDecoder::decodeSample(int i, QImage & img, bool rot90)
 {
-
-    // init tile assembly
-    if (image) {
-        delete image;
+    if (i < 0 || i >= (int)gVideoChunkOffset.size()
+        || i >= (int)gVideoSampleSize.size()) {
+        return false;
     }
-    image = 0;
-    QSize tileSize;
-
-    // load and assemble tiles.
-    for (int t = 0; t < gNumTilesPerImage; t++)
-    {
-        fseek(gFile, gVideoChunkOffset[t], SEEK_SET);
-        if (ferror(gFile))
-        {
-            m_error = "LoadTilesForFace:  fseek failed!";
-            return false;
-        }
-
-        QImage tile;
-        // decode jpg
-        if (!decodeJPEG(gFile, tile, (!m_horizontalCyl))) {
-            m_error = "JPEG decoding failed";
-            return false;
-        }
+    qint64 off = gVideoChunkOffset[i];
+    qint64 len = gVideoSampleSize[i];
+    if (off < 0 || len <= 0 || off + len > m_main.size) {
+        return false;
+    }
+    return decodeJPEG(m_main.data + off, size_t(len), img, rot90);
+}
 
-        // creat target image at first tile
-        int imgw, imgh, tw, th;
-        unsigned int bpp, imgbpl, tilebpl, tilebtc;
-        if (tileSize.isEmpty()) {
-            tileSize = tile.size();
-            tw = tileSize.width();
-            imgw = tw * gNumTilesPerImage;
-            th = tileSize.height();
-            imgh = th;
-            image = new QImage(imgw, imgh, tile.format());
-            imgbpl = image->bytesPerLine();
-            tilebpl = tile.bytesPerLine();
-            bpp = tilebpl / tw;	// bytes per pixel
-            tilebtc = tw * bpp;	// bytes to copy
-        }
-        if (tile.size().width() != tw || tile.size().height() != th ) {
-            // jpeg image size doesn't correspond to tile size
-            m_error = "Tiles with different size found";
-            return false;
-        }
+/*
+ * Read cursor over the current buffer (the mapped file or an
+ * inflated header).  These stand in for the stdio calls the
+ * parser was written around: readData() returns the number of
+ * bytes copied, seekData() and skipData() return 0 on success.
+ */
+size_t QTVRDecoder::readData(void * dst, size_t n)
+{
+    qint64 avail = gFile->size - gFile->pos;
+    if (avail <= 0) {
+        return 0;
+    }
+    if (qint64(n) > avail) {
+        n = size_t(avail);
+    }
+    memcpy(dst, gFile->data + gFile->pos, n);
+    gFile->pos += n;
+    return n;
+}
 
-        //add tile to image
-        //left-to right for horizontal fmt,
-        //right-to-left for vertical fmt.
-        int left=0;
-        int right=0;
-        if (m_horizontalCyl) {
-            left    = t * tw;
-            right   = left + tw;
-        } else {
-            left    = image->size().width() - (t+1) * tw;
-            right   = left + tw;
-        }
-        unsigned char * srcPtr = tile.bits();
-        unsigned char * destPtr = image->bits() + bpp * left;
-        for (int y = 0; y < th; y++ ){
-            memcpy(destPtr, srcPtr, tilebtc );
-            destPtr += imgbpl;
-            srcPtr += tilebpl;
-        }
+int QTVRDecoder::seekData(qint64 pos)
+{
+    if (pos < 0 || pos > gFile->size) {
+        return -1;
     }
-    return true;
+    gFile->pos = pos;
+    return 0;
+}
+
+int QTVRDecoder::skipData(qint64 n)
+{
+    return seekData(gFile->pos + n);
 }
 
 // Converts a 4-byte int to reverse the Big-Little Endian order of the bytes.
@@ -1474,6 +1467,22 @@ void QTVRDecoder::Swizzle(int32 *value)
     }
 }
 
+// 64 bit sizes and offsets
+void QTVRDecoder::Swizzle(qint64 *value)
+{
+    if (!m_HostBigEndian) {
+        char	*n, b;
+        n = (char *)value;
+
+        // reverse the 8 bytes
+        for (int i = 0; i < 4; i++) {
+            b = n[i];
+            n[i] = n[7 - i];
+            n[7 - i] = b;
+        }
+    }
+}
+
 // convert 16 bit values to native byteorder
 void QTVRDecoder::Swizzle(uint16 *value)
 {
@@ -1497,38 +1506,241 @@ void QTVRDecoder::Swizzle(int16 *value)
 }
 
 /*
- * Get a new QImage or a null pointer
+ * Get an image, or a null one
  */
-QImage * QTVRDecoder::getImage( int face )
+QImage QTVRDecoder::getImage( int face )
 {
-    QImage * pim = 0;
+    QImage im;
     m_error = 0;
     switch( m_type ){
     case PANO_CUBIC:
-        if( !extractCubeImage( face, pim ) ){
+        if( !extractCubeImage( face, im ) ){
             if(!m_error) {
                 m_error = "extractCubeImage() failed";
             }
-            if(pim) {
-                delete pim;
-            }
-            pim = 0;
+            im = QImage();
         }
         break;
     case PANO_CYLINDRICAL:
         if( face != 0 ||
-                !extractCylImage( pim ) ){
+                !extractCylImage( im ) ){
             if(!m_error) {
                 m_error = "extractCylImage() failed";
             }
-            if(pim) {
-                delete pim;
-            }
-            pim = 0;
+            im = QImage();
         }
         break;
     default:
         m_error = "No pano loaded";
     }
-    return pim;
+    return im;
+}
+
+int QTVRDecoder::getImages( QImage pims[6] )
+{
+    int n = 0;
+    m_error = 0;
+    switch( m_type ){
+    case PANO_CUBIC:
+        n = 6;
+        break;
+    case PANO_CYLINDRICAL:
+        n = 1;
+        break;
+    default:
+        m_error = "No pano loaded";
+        return 0;
+    }
+    if( !gFoundJPEGs ){
+        m_error = "No usable JPEG image found";
+        return 0;
+    }
+    if( !assembleImages( 0, n, pims ) ){
+        if(!m_error) {
+            m_error = "assembleImages() failed";
+        }
+        return 0;
+    }
+    return n;
+}
+
+/**************** RESOLUTION LEVELS ***********************/
+
+// pixel size of JPEG sample i of a track, from its header
+QSize QTVRDecoder::sampleDims( const QTVRTrack & track, size_t i )
+{
+    if (i >= track.sampleOffset.size() || i >= track.sampleSize.size()) {
+        return QSize();
+    }
+    qint64 off = track.sampleOffset[i];
+    qint64 len = track.sampleSize[i];
+    if (off < 0 || len <= 0 || off + len > m_main.size) {
+        return QSize();
+    }
+    QByteArray qb( QByteArray::fromRawData( (const char *)(m_main.data + off), int(len) ) );
+    QBuffer buf(&qb);
+    if( !buf.open( QIODevice::ReadOnly ) ) {
+        return QSize();
+    }
+    QImageReader ir( &buf, "JPEG" );
+    return ir.size();
+}
+
+static bool levelLess( const QTVRLevel & a, const QTVRLevel & b )
+{
+    qint64 pa = qint64(a.size.width()) * a.size.height(),
+           pb = qint64(b.size.width()) * b.size.height();
+    if (pa != pb) {
+        return pa < pb;
+    }
+    // referenced image tracks before previews of the same size
+    return a.isImage && !b.isImage;
+}
+
+/*
+ * List the resolution levels: every video track that holds a whole
+   panorama of the current type.  These are the image tracks the
+   pano track refers to, plus any unreferenced ones such as the
+   fast-start preview.  Tracks the pano refers to in other ways (hot
+   spots) are left out, and so are tracks that don't start with a
+   JPEG image.  Sorted lowest resolution first, one level per size.
+   Selects the highest level, so getImage() works as it always has.
+*/
+void QTVRDecoder::buildLevels()
+{
+    m_levels.clear();
+
+    for (size_t k = 0; k < m_tracks.size(); k++) {
+        const QTVRTrack & track = m_tracks[k];
+        if (std::find(m_otherTracks.begin(), m_otherTracks.end(), track.id)
+                != m_otherTracks.end()) {
+            continue;
+        }
+        size_t n = track.sampleSize.size();
+        if (n == 0 || track.sampleOffset.size() != n) {
+            continue;
+        }
+
+        QTVRLevel lev;
+        lev.track = int(k);
+        lev.isImage = std::find(m_panoTracks.begin(), m_panoTracks.end(),
+                                track.id) != m_panoTracks.end();
+        QSize ts = sampleDims(track, 0);
+        if (!ts.isValid()) {
+            continue;
+        }
+
+        if (m_type == PANO_CUBIC) {
+            // 6 faces, each a square array of square tiles
+            if (n < 6 || n % 6 != 0 || ts.width() != ts.height()) {
+                continue;
+            }
+            lev.tiles = int(n / 6);
+            int dim = qRound(sqrt(double(lev.tiles)));
+            if (dim * dim != lev.tiles) {
+                continue;
+            }
+            lev.size = ts * dim;
+        } else if (m_type == PANO_CYLINDRICAL) {
+            // a row of tiles, each rotated if the pano is vertical
+            lev.tiles = int(n);
+            if (!m_horizontalCyl) {
+                ts.transpose();
+            }
+            lev.size = QSize(ts.width() * lev.tiles, ts.height());
+        } else {
+            continue;
+        }
+        m_levels.push_back(lev);
+    }
+
+    std::stable_sort(m_levels.begin(), m_levels.end(), levelLess);
+    for (size_t j = 1; j < m_levels.size(); ) {
+        if (m_levels[j].size == m_levels[j - 1].size) {
+            m_levels.erase(m_levels.begin() + j);
+        } else {
+            j++;
+        }
+    }
+
+    if (!m_levels.empty()) {
+        selectLevel(int(m_levels.size()) - 1);
+    }
+}
+
+QSize QTVRDecoder::levelSize( int level )
+{
+    if (level < 0 || level >= levelCount()) {
+        return QSize();
+    }
+    return m_levels[level].size;
+}
+
+/*
+ * Make images come from a different resolution level.
+   The decoder isn't locked, so don't do this while another
+   thread is getting images.
+*/
+bool QTVRDecoder::selectLevel( int level )
+{
+    if (level < 0 || level >= levelCount()) {
+        return false;
+    }
+    const QTVRLevel & lev = m_levels[level];
+    const QTVRTrack & track = m_tracks[lev.track];
+    gVideoChunkOffset = track.sampleOffset;
+    gVideoSampleSize = track.sampleSize;
+    gNumTilesPerImage = lev.tiles;
+    gImagesAreTiled = (lev.tiles > 1);
+    gFoundJPEGs = true;
+    m_level = level;
+    return true;
+}
+
+/**************** BACKGROUND LEVEL LOADER ***********************/
+
+QTVRLoader::QTVRLoader( QTVRDecoder * dec, int firstLevel, int serial,
+                        QObject * parent )
+    : QThread( parent ), m_dec( dec ), m_first( firstLevel ),
+      m_serial( serial ), m_cancel( 0 )
+{
+    qRegisterMetaType< QList<QImage> >("QList<QImage>");
+}
+
+QTVRLoader::~QTVRLoader()
+{
+    cancel();
+    wait();
+    delete m_dec;
+}
+
+// stop after the level being decoded now
+void QTVRLoader::cancel()
+{
+    m_cancel.store( 1 );
+}
+
+void QTVRLoader::run()
+{
+    for( int l = m_first; l < m_dec->levelCount(); l++ ){
+        if( m_cancel.load() ) {
+            return;
+        }
+        if( !m_dec->selectLevel( l ) ) {
+            continue;
+        }
+        QImage pims[6];
+        int n = m_dec->getImages( pims );
+        if( n == 0 ){
+            qWarning("QTVR level %d: %s", l, m_dec->getError() );
+            continue;
+        }
+        QList<QImage> imgs;
+        for( int i = 0; i < n; i++ ){
+            imgs << pims[i];
+        }
+        if( !m_cancel.load() ) {
+            emit levelReady( m_serial, l, imgs );
+        }
+    }
 }
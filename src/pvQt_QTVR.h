@@ -31,6 +31,7 @@
 
 #include <vector>
 #include <QtCore>
+#include <QImage>
 
 /** possible QTVR panorama types  **/
 enum PanoType { PANO_UNKNOWN, PANO_CUBIC, PANO_CYLINDRICAL };
@@ -41,12 +42,31 @@ typedef int int32;
 typedef short int16;
 typedef unsigned short uint16;
 
-#define MAX_TILE_DIMENSIONS 10    // this is the maximum # of tiles x/y that we'll support
-#define MAX_TILES_PER_FACE  (MAX_TILE_DIMENSIONS * MAX_TILE_DIMENSIONS)
+/* a read cursor over a block of memory: the mapped .mov file,
+   or a movie header inflated from a 'cmov' atom */
+struct QTVRBuffer
+{
+    const uchar * data;
+    qint64 size;
+    qint64 pos;
+};
 
-#define MAX_IMAGE_OFFSETS   (MAX_TILES_PER_FACE*6)
+/* sample tables of one video track */
+struct QTVRTrack
+{
+    int32 id;
+    std::vector<qint64> sampleOffset;   // file offset of each sample
+    std::vector<qint64> sampleSize;
+};
 
-#define MAX_REF_TRACKS 10
+/* a video track holding the whole panorama at one resolution */
+struct QTVRLevel
+{
+    int track;      // index in m_tracks
+    int tiles;      // per image
+    QSize size;     // of a cube face, or of the cylinder image
+    bool isImage;   // referenced by the pano track (not a preview)
+};
 
 struct SampleToChunkEntry
 {
@@ -71,34 +91,56 @@ public:
     bool parseHeaders(const char * theDataFilePath);
     // get the type of pano it contains
     PanoType getType() { return m_type; }
-    // get one image (new QImage)
-    QImage * getImage( int face = 0 );
+    // get one image (null on error)
+    QImage getImage( int face = 0 );
+    // get all images at once (6 for cubic, 1 for cylindrical),
+    // decoding them in parallel; returns the number got, 0 on error
+    int getImages( QImage pims[6] );
+    /* resolution levels, lowest first.  After parseHeaders() the
+       highest is selected; getImage() etc. decode the selected one */
+    int levelCount(){ return int(m_levels.size()); }
+    QSize levelSize( int level );
+    int level(){ return m_level; }
+    bool selectLevel( int level );
     // get error message
     const char * getError(){ return m_error; }
 
 private:
-    long ReadMovieAtom(void);
-    long ReadQTMovieAtom(void);
-    void ReadAtom_DCOM(long size);
-    void ReadAtom_CMVD(long size);
-    void ReadAtom_STCO(long size);
-    void ReadAtom_HDLR(int size);
-    void ReadAtom_STSZ(long size);
-    void ReadAtom_STSC(long size);
-    void ReadAtom_TKHD(long size);
-    void ReadAtom_TREF(long size);
-    void ReadAtom_QTVR_PDAT(long size);
-    void ReadAtom_QTVR_TREF(long size);
-    void ReadAtom_QTVR_CUFA(long size);
-    bool extractCubeImage(int i, QImage * &img);
-    bool extractCylImage(QImage * &img);
-    bool SeekAndExtractImage_Tiled( int i, QImage * &img );
-    bool SeekAndExtractImageCyl_Tiled( QImage * &img );
+    friend class QTVRTileJob;
+    qint64 ReadMovieAtom(void);
+    qint64 ReadQTMovieAtom(void);
+    void ReadChildAtoms(qint64 size);
+    void ReadAtom_DCOM(qint64 size);
+    void ReadAtom_CMVD(qint64 size);
+    void ReadAtom_STCO(qint64 size, bool co64);
+    bool readTable(std::vector<qint64> & table, qint64 count,
+                   int bytes, qint64 size);
+    void ReadAtom_HDLR(qint64 size);
+    void ReadAtom_STSZ(qint64 size);
+    void ReadAtom_STSC(qint64 size);
+    void ReadAtom_TKHD(qint64 size);
+    void ReadAtom_TREF(qint64 size);
+    void ReadAtom_QTVR_PDAT(qint64 size);
+    void ReadAtom_QTVR_TREF(qint64 size);
+    void ReadAtom_QTVR_CUFA(qint64 size);
+    bool extractCubeImage(int i, QImage &img);
+    bool extractCylImage(QImage &img);
+    bool assembleImages( int first, int count, QImage * pims );
+    void buildLevels();
+    QSize sampleDims( const QTVRTrack & track, size_t i );
+    const char * decodeTile( int i, uchar * dst, int bpl,
+                             QSize size, QImage::Format fmt, bool rot90 );
+    bool decodeSample( int i, QImage & img, bool rot90 = false );
+    size_t readData( void * dst, size_t n );
+    int seekData( qint64 pos );
+    int skipData( qint64 n );
+    qint64 tellData(){ return gFile->pos; }
     void LoadTilesForFace(int chunkNum);
     void Swizzle(int32 *value);
     void Swizzle(uint32 *value);
     void Swizzle(int16 *value);
     void Swizzle(uint16 *value);
+    void Swizzle(qint64 *value);
     /*********************/
     /*    VARIABLES      */
     /*********************/
@@ -109,28 +151,36 @@ private:
     bool gImagesAreTiled;
     int  gNumTilesPerImage;
 
-    int32       gPanoChunkOffset;
-    int32       gPanoSampleSize;
-    int32       gVideoChunkOffset[MAX_IMAGE_OFFSETS];
-    int         gVideoSampleSize[MAX_IMAGE_OFFSETS];
-
-    int32       gTileSize[MAX_TILES_PER_FACE];
+    qint64      gPanoChunkOffset;
+    qint64      gPanoSampleSize;
+    // file offset and size of each JPEG sample of the image track
+    std::vector<qint64> gVideoChunkOffset;
+    std::vector<qint64> gVideoSampleSize;
 
-    FILE *gFile;
-    FILE * m_mainFile;
-    FILE * m_cmovFile;
+    QFile m_file;
+    uchar * m_map;          // mapped view of m_file
+    QByteArray m_fileData;  // used instead if mapping fails
+    QByteArray m_cmovData;  // inflated 'cmov' header
+    QTVRBuffer m_main;
+    QTVRBuffer m_cmov;
+    QTVRBuffer * gFile;     // buffer being parsed
 
     bool m_HostBigEndian;
 
     int32   m_imageRefTrackIndex;
     int32 m_panoType;
 
-    int32 m_panoTracks[MAX_REF_TRACKS];
+    std::vector<int32> m_panoTracks;
+    std::vector<int32> m_otherTracks;
     int32 m_mainTrack;
-    bool m_currTrackIsImageTrack;
+    int32 m_currTrackId;
+
+    std::vector<QTVRTrack> m_tracks;
+    std::vector<QTVRLevel> m_levels;
+    int m_level;
 
     std::vector<SampleToChunkEntry> m_sample2ChunkTable;
-    char * m_error;
+    const char * m_error;
 
     bool m_horizontalCyl;
     bool m_cmovZLib;
@@ -138,4 +188,31 @@ private:
     PanoType m_type;
 };
 
+/* Decodes the higher resolution levels of a QTVR on a worker thread,
+   starting with firstLevel, after the caller has shown a lower one.
+   Takes ownership of the decoder.  Deleting the loader cancels it
+   and waits for the level in progress.  Levels carry the serial
+   given to the constructor, so a receiver can tell a loader's
+   queued levels from those of the one before.
+*/
+class QTVRLoader : public QThread
+{
+    Q_OBJECT
+public:
+    QTVRLoader( QTVRDecoder * dec, int firstLevel, int serial,
+                QObject * parent = 0 );
+    ~QTVRLoader();
+    void cancel();
+signals:
+    // all images of one level: 6 cube faces or 1 cylinder
+    void levelReady( int serial, int level, QList<QImage> images );
+protected:
+    void run();
+private:
+    QTVRDecoder * m_dec;
+    int m_first;
+    int m_serial;
+    QAtomicInt m_cancel;
+};
+
 #endif //ndef QT_QTVR_H
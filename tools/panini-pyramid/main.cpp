@@ -0,0 +1,240 @@
+/* main.cpp for panini-pyramid
+ *
+ * This file is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this file; if not, write to Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+
+  Builds a tiled multiresolution pyramid (see pvQtPyramid.h) that
+  Panini can display, from one equirectangular image or six cube
+  face images.
+
+  usage: panini-pyramid [options] outdir image [image...]
+    one 2:1 equirectangular image, or 6 square cube faces in
+    Panini's face order: front right back left top bottom.
+  options:
+    -t size     tile size in pixels (512)
+    -f format   tile file format (jpg)
+    -q quality  tile quality 0:100 (90)
+    -j threads  worker threads (all cores)
+
+  Starting from full size, each level is cut into tiles and
+  halved to make the next one.  The tiles of a level are written,
+  and the next level computed, by parallel jobs on all cores.
+
+  Besides pyramid.ini and the tiles, outdir gets a resource
+  list, pyramid.qrc, so the whole pyramid can be packed into
+  one archive with
+      rcc -binary pyramid.qrc -o name.rcc
+  (run in outdir).
+*/
+
+#include <QCoreApplication>
+#include <QStringList>
+#include <QImage>
+#include <QImageReader>
+#include <QDir>
+#include <QFile>
+#include <QTextStream>
+#include <QThreadPool>
+#include <QRunnable>
+#include <QAtomicInt>
+#include <QThread>
+#include <cstdio>
+
+#include "pvQtPyramid.h"
+
+static QAtomicInt failures;
+
+/* cut one tile out of a level image and write it
+*/
+class TileJob : public QRunnable
+{
+public:
+    TileJob( const QImage & src, QRect rect, QString path, int quality )
+        : m_src( src ), m_rect( rect ), m_path( path ), m_quality( quality ) {}
+    void run(){
+        if( !m_src.copy( m_rect ).save( m_path, 0, m_quality ) ){
+            fprintf( stderr, "can't write %s\n", (const char *)m_path.toLocal8Bit() );
+            failures.ref();
+        }
+    }
+private:
+    QImage m_src;
+    QRect m_rect;
+    QString m_path;
+    int m_quality;
+};
+
+/* 2x2 box filter reduction of a band of rows, y0 <= y < y1
+   in the destination; odd last rows and columns are repeated.
+*/
+class HalveJob : public QRunnable
+{
+public:
+    HalveJob( const QImage & src, QImage & dst, int y0, int y1 )
+        : m_src( src ), m_dst( dst.bits() ), m_bpl( dst.bytesPerLine() ),
+          m_dw( dst.width() ), m_y0( y0 ), m_y1( y1 ) {}
+    void run(){
+        int sw = m_src.width(), sh = m_src.height();
+        for( int y = m_y0; y < m_y1; y++ ){
+            const QRgb * r0 = (const QRgb *)m_src.constScanLine( 2 * y );
+            const QRgb * r1 = (const QRgb *)m_src.constScanLine( qMin( 2 * y + 1, sh - 1 ) );
+            QRgb * d = (QRgb *)( m_dst + y * m_bpl );
+            for( int x = 0; x < m_dw; x++ ){
+                int x0 = 2 * x, x1 = qMin( 2 * x + 1, sw - 1 );
+                QRgb p[4] = { r0[x0], r0[x1], r1[x0], r1[x1] };
+                int a = 0, r = 0, g = 0, b = 0;
+                for( int i = 0; i < 4; i++ ){
+                    a += qAlpha( p[i] );
+                    r += qRed( p[i] );
+                    g += qGreen( p[i] );
+                    b += qBlue( p[i] );
+                }
+                d[x] = qRgba( (r + 2) / 4, (g + 2) / 4, (b + 2) / 4, (a + 2) / 4 );
+            }
+        }
+    }
+private:
+    QImage m_src;
+    uchar * m_dst;	// bits of the destination image
+    int m_bpl, m_dw;
+    int m_y0, m_y1;
+};
+
+static int usage()
+{
+    fprintf( stderr,
+             "usage: panini-pyramid [-t tilesize] [-f format] [-q quality] [-j threads]\n"
+             "                      outdir equirect_image | 6 cube face images\n" );
+    return 1;
+}
+
+int main( int argc, char ** argv )
+{
+    QCoreApplication app( argc, argv );
+    QStringList args = app.arguments();
+    args.removeFirst();
+
+    int tilesize = 512, quality = 90, threads = QThread::idealThreadCount();
+    QString format("jpg");
+    while( args.count() > 1 && args[0].startsWith("-") ){
+        QString opt = args.takeFirst(), val = args.takeFirst();
+        if( opt == "-t" ) tilesize = val.toInt();
+        else if( opt == "-f" ) format = val;
+        else if( opt == "-q" ) quality = val.toInt();
+        else if( opt == "-j" ) threads = val.toInt();
+        else return usage();
+    }
+    if( args.count() != 2 && args.count() != 7 ) return usage();
+
+    QString outdir = args.takeFirst();
+    bool cube = args.count() == 6;
+
+    // read the full size images
+    QList<QImage> faces;
+    foreach( QString name, args ){
+        QImageReader ir( name );
+        QImage img = ir.read();
+        if( img.isNull() ){
+            fprintf( stderr, "can't read %s: %s\n", (const char *)name.toLocal8Bit(),
+                     (const char *)ir.errorString().toLocal8Bit() );
+            return 2;
+        }
+        img = img.convertToFormat( img.hasAlphaChannel() ? QImage::Format_ARGB32
+                                                         : QImage::Format_RGB32 );
+        if( !faces.isEmpty() && img.size() != faces[0].size() ){
+            fprintf( stderr, "cube faces must all be the same size\n" );
+            return 2;
+        }
+        faces.append( img );
+    }
+    QSize dims = faces[0].size();
+    if( !cube && dims.width() != 2 * dims.height() ){
+        fprintf( stderr, "equirectangular image must be twice as wide as high\n" );
+        return 2;
+    }
+
+    pvQtPyramid pyr;
+    if( !pyr.setup( cube, dims, tilesize, format ) ){
+        fprintf( stderr, "%s\n", pyr.errMsg() );
+        return 2;
+    }
+
+    QDir out( outdir );
+    QStringList files;
+    QThreadPool pool;
+    if( threads > 0 ) pool.setMaxThreadCount( threads );
+
+    for( int level = pyr.levelCount() - 1; level >= 0; level-- ){
+        int rows = pyr.tileRows( level ), cols = pyr.tileCols( level );
+        printf( "level %d: %d x %d, %d tiles per face\n", level,
+                faces[0].width(), faces[0].height(), rows * cols );
+        fflush( stdout );
+
+        // write this level's tiles
+        for( int f = 0; f < faces.count(); f++ ){
+            QString fdir = QString("%1/%2").arg( level ).arg( f );
+            if( !out.mkpath( fdir ) ){
+                fprintf( stderr, "can't make %s\n", (const char *)out.filePath( fdir ).toLocal8Bit() );
+                return 3;
+            }
+            for( int r = 0; r < rows; r++ ){
+                for( int c = 0; c < cols; c++ ){
+                    QString name = pvQtPyramid::tileName( level, f, r, c, format );
+                    files += name;
+                    pool.start( new TileJob( faces[f], pyr.tileRect( level, r, c ),
+                                             out.filePath( name ), quality ) );
+                }
+            }
+        }
+
+        // meanwhile make the next coarser level
+        QList<QImage> next;
+        if( level > 0 ){
+            QSize ndims = pyr.levelSize( level - 1 );
+            int band = qMax( 16, ndims.height() / (4 * pool.maxThreadCount()) );
+            for( int f = 0; f < faces.count(); f++ ){
+                next.append( QImage( ndims, faces[f].format() ) );
+            }
+            for( int f = 0; f < faces.count(); f++ ){
+                for( int y = 0; y < ndims.height(); y += band ){
+                    pool.start( new HalveJob( faces[f], next[f], y,
+                                              qMin( y + band, ndims.height() ) ) );
+                }
+            }
+        }
+        pool.waitForDone();
+        if( failures.load() ) return 3;
+        faces = next;
+    }
+
+    if( !pyr.writeDescriptor( out.absolutePath() ) ){
+        fprintf( stderr, "%s\n", pyr.errMsg() );
+        return 3;
+    }
+
+    // resource list for packing the pyramid into an archive
+    QFile qrc( out.filePath("pyramid.qrc") );
+    if( qrc.open( QIODevice::WriteOnly | QIODevice::Text ) ){
+        QTextStream ts( &qrc );
+        ts << "<!DOCTYPE RCC><RCC version=\"1.0\">\n<qresource>\n";
+        ts << "<file>pyramid.ini</file>\n";
+        foreach( QString name, files ) ts << "<file>" << name << "</file>\n";
+        ts << "</qresource>\n</RCC>\n";
+    }
+
+    printf( "%d levels, %d tiles written to %s\n", pyr.levelCount(),
+            files.count(), (const char *)out.absolutePath().toLocal8Bit() );
+    return 0;
+}
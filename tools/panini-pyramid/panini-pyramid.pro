@@ -0,0 +1,23 @@
+## qmake project for panini-pyramid, the tiled pyramid builder ##
+TEMPLATE = app
+TARGET = panini-pyramid
+CONFIG += console
+CONFIG -= app_bundle
+QT = core gui
+
+## Directories ##
+OBJECTS_DIR = build
+MOC_DIR = build
+
+## Source Files ##
+INCLUDEPATH += ../../src
+HEADERS = ../../src/pvQtPyramid.h
+SOURCES = main.cpp \
+    ../../src/pvQtPyramid.cpp
+
+## Install Files ##
+isEmpty( PREFIX ) {
+    PREFIX = /usr
+}
+target.path = $$PREFIX$$/bin
+INSTALLS += target